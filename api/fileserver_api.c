@@ -15,10 +15,14 @@
 #include "utils/utilities.h"
 
 
-long        socket_fd  = -1;        // socket file descriptor
-char        *socket_path;           // saved socket path
-list_t      *opened_files;          // list of currently opened files
-char        result_buffer[2048];    // last request verbose result
+// Connection state is per thread, each thread may hold a connection of its own
+static __thread long     socket_fd  = -1;        // socket file descriptor
+static __thread char     *socket_path;           // saved socket path
+static __thread list_t   *opened_files;          // list of currently opened files
+static __thread char     result_buffer[2048];    // last request verbose result
+static __thread arena_t  *response_arena;        // responses of the current request, reset after each
+static __thread uint32_t wanted_capabilities = CAP_CHECKSUM;    // capabilities asked for by the next connection
+static __thread size_t   stream_chunk_size;      // files larger than this are streamed in frames of this size
 
 #define set_errno_save_result(err, opt_type, path, n_bytes) { \
         sprintf(result_buffer, "%-15s %-55s %-10ld %-20s", opt_type, path, n_bytes, strerror(err)); \
@@ -84,8 +88,10 @@ openConnection(const char *sockname, int msec, const struct timespec abstime)
         return -1; 
     }
 
-    // Sending handshake
-    if ( send_request(socket_fd, OPEN_CONNECTION, 0, NULL, 0, NULL) != 0 ) return -1;
+    // Sending handshake, with the capabilities wanted
+    set_capabilities(socket_fd, 0);
+    size_t caps_size = (wanted_capabilities != 0) ? sizeof(uint32_t) : 0;
+    if ( send_request(socket_fd, OPEN_CONNECTION, 0, NULL, caps_size, &wanted_capabilities) != 0 ) return -1;
 
     // Receiving handshake and checking result
     response_t *handshake = recv_response(socket_fd);
@@ -100,6 +106,14 @@ openConnection(const char *sockname, int msec, const struct timespec abstime)
 
             socket_path = calloc(1, strlen(sockname) + 1);
             strcpy(socket_path, sockname);
+
+            // responses are received in the arena when possible, on the heap otherwise
+            response_arena = arena_create(ARENA_DEFAULT_SIZE);
+
+            // servers that know no capabilities answer without a body
+            if ( handshake->body_size == sizeof(uint32_t) ) {
+                set_capabilities(socket_fd, *(uint32_t*)handshake->body & wanted_capabilities);
+            }
             result = 0;
             break;
         }
@@ -121,19 +135,36 @@ openConnection(const char *sockname, int msec, const struct timespec abstime)
     return result;
 }
 
+int
+setCompression(bool enable)
+{
+    if ( enable ) SET_FLAG(wanted_capabilities, CAP_COMPRESSION);
+    else CLR_FLAG(wanted_capabilities, CAP_COMPRESSION);
+    return 0;
+}
+
+int
+setStreaming(size_t chunk_size)
+{
+    stream_chunk_size = chunk_size;
+    if ( chunk_size > 0 ) SET_FLAG(wanted_capabilities, CAP_STREAMING);
+    else CLR_FLAG(wanted_capabilities, CAP_STREAMING);
+    return 0;
+}
+
 int 
 closeConnection(const char* sockname)
 {
-    // Validation of parameters
-    if ( strcmp(sockname, socket_path) != 0 ) {
-        set_errno_save_result(EINVAL, "closeConnection", sockname, 0);
-        return -1;
-    }
     // Verify if connection is opened
     if ( socket_fd == -1 ) {
         set_errno_save_result(ENOTCONN, "closeConnection", sockname, 0);
         return -1;
     }
+    // Validation of parameters
+    if ( sockname == NULL || strcmp(sockname, socket_path) != 0 ) {
+        set_errno_save_result(EINVAL, "closeConnection", sockname, 0);
+        return -1;
+    }
 
     // Iterate over list of openend files
     while (!list_is_empty(opened_files)) {
@@ -145,16 +176,20 @@ closeConnection(const char* sockname)
         free(pathname);
     }
     
-    if ( send_request(socket_fd, CLOSE_CONNECTION, 0, NULL, 0, NULL) != 0 ) {
-        close(socket_fd);
-        list_destroy(opened_files);
-        return -1;
-    }
-    
+    int result = send_request(socket_fd, CLOSE_CONNECTION, 0, NULL, 0, NULL);
+
+    // Thread can open a new connection
+    set_capabilities(socket_fd, 0);
     close(socket_fd);
+    socket_fd = -1;
     list_destroy(opened_files);
+    opened_files = NULL;
+    free(socket_path);
+    socket_path = NULL;
+    arena_destroy(response_arena);
+    response_arena = NULL;
 
-    return 0;
+    return (result != 0) ? -1 : 0;
 }
 
 int
@@ -176,7 +211,7 @@ openFile(const char* pathname, int flags)
     if ( send_request(socket_fd, OPEN_FILE, strlen(pathname) +1, pathname, sizeof(int), &flags) != 0 ) return -1;
 
     // Receiving response and checking result
-    response_t *response = recv_response(socket_fd);
+    response_t *response = recv_response_arena(socket_fd, response_arena);
     if ( response == NULL ) return -1;
 
     int result = 0;
@@ -224,6 +259,60 @@ openFile(const char* pathname, int flags)
     }
     
     if (response) free_response(response);
+    arena_reset(response_arena);
+    return result;
+}
+
+/**
+ * Receives a streamed body of size bytes into buffer
+ */
+static int
+recv_stream(void *buffer, size_t size)
+{
+    body_stream_t stream;
+    stream_open(&stream, socket_fd, size);
+
+    size_t received = 0;
+    ssize_t n;
+    while ( (n = stream_recv(&stream, (char*)buffer + received, size - received)) > 0 ) received += n;
+
+    return (n == 0) ? 0 : -1;
+}
+
+/**
+ * Sends the file_size bytes of file_ptr as the streamed body of a write
+ * request, read in frames of stream_chunk_size bytes. The body is aborted,
+ * and errno set to EIO, if the file cannot be read.
+ */
+static int
+send_stream(const char *path, FILE *file_ptr, size_t file_size)
+{
+    if ( send_request(socket_fd, WRITE_FILE, strlen(path) + 1, path, file_size | BODY_STREAMED, NULL) != 0 ) return -1;
+
+    body_stream_t stream;
+    stream_open(&stream, socket_fd, file_size);
+
+    void *frame = malloc(stream_chunk_size);
+    if ( frame == NULL ) {
+        stream_abort(&stream);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    int result = 0;
+    while ( result == 0 && stream.left > 0 ) {
+        size_t length = (stream.left < stream_chunk_size) ? stream.left : stream_chunk_size;
+        if ( fread(frame, 1, length, file_ptr) < length ) {
+            stream_abort(&stream);
+            errno = EIO;
+            result = -1;
+            break;
+        }
+        result = stream_send(&stream, frame, length);
+    }
+
+    if ( result == 0 ) result = stream_end(&stream);
+    free(frame);
     return result;
 }
 
@@ -255,7 +344,7 @@ readFile(const char* pathname, void** buf, size_t* size)
     if ( send_request(socket_fd, READ_FILE, strlen(absolute_path) + 1, absolute_path, 0, NULL) != 0 ) return -1;
 
     // Receiving response and checking result
-    response_t *response = recv_response(socket_fd);
+    response_t *response = recv_response_arena(socket_fd, response_arena);
     if ( response == NULL ) return -1;
 
     int result = 0;
@@ -272,7 +361,17 @@ readFile(const char* pathname, void** buf, size_t* size)
                 break;
             }
 
-            memcpy(tmp_buf, response->body, response->body_size);
+            // Streamed bodies are received frame by frame straight into the reading buffer
+            if ( response->streamed ) {
+                if ( recv_stream(tmp_buf, response->body_size) != 0 ) {
+                    free(tmp_buf);
+                    set_errno_save_result(errno, "readFile", absolute_path, 0);
+                    result = -1;
+                    break;
+                }
+            } else {
+                memcpy(tmp_buf, response->body, response->body_size);
+            }
             *buf = tmp_buf;
             *size = response->body_size;
             save_request_result("readFile", absolute_path, *size, response->status_phrase);
@@ -305,6 +404,101 @@ readFile(const char* pathname, void** buf, size_t* size)
     }
 
     if (response) free_response(response);
+    arena_reset(response_arena);
+    free(absolute_path);
+    return result;
+}
+
+int 
+readFileRange(const char* pathname, size_t offset, size_t length, void** buf, size_t* size)
+{
+    // Validation of parameters
+    if ( pathname == NULL ) {
+        set_errno_save_result(EINVAL, "readFileRange", pathname, 0);
+        return -1;
+    }
+
+    // Verify if connection is opened
+    if ( socket_fd == -1 ) {
+        set_errno_save_result(ENOTCONN, "readFileRange", pathname, 0);
+        return -1;
+    }
+
+    // Generating absolute path
+    char *absolute_path = realpath(pathname, NULL);
+    if ( absolute_path == NULL ) {
+        set_errno_save_result(ENOENT, "readFileRange", pathname, 0);
+        return -1;
+    }
+
+    // Checks if file has already been opened
+    if ( list_find(opened_files, absolute_path ) == -1 ) {
+        // File is not opened, perform openFile request
+        if ( openFile(absolute_path, O_NOFLAG) != 0 ) return -1;
+    }
+
+    // Sending read range request, offset and length make the body
+    uint64_t range[2] = { offset, length };
+    if ( send_request(socket_fd, READ_RANGE, strlen(absolute_path) + 1, absolute_path, sizeof(range), range) != 0 ) return -1;
+
+    // Receiving response and checking result
+    response_t *response = recv_response_arena(socket_fd, response_arena);
+    if ( response == NULL ) return -1;
+
+    int result = 0;
+    switch ( response->status ) {
+
+        case SUCCESS: {
+
+            // If successfull copies response body into reading buffer
+            void* tmp_buf;
+            tmp_buf = malloc((response->body_size > 0) ? response->body_size : 1);
+            if ( tmp_buf == NULL ) {
+                set_errno_save_result(ENOMEM, "readFileRange", absolute_path, 0);
+                result = -1;
+                break;
+            }
+
+            if ( response->body_size > 0 ) memcpy(tmp_buf, response->body, response->body_size);
+            *buf = tmp_buf;
+            *size = response->body_size;
+            save_request_result("readFileRange", absolute_path, *size, response->status_phrase);
+            break;
+        }
+
+        case INTERNAL_ERROR: {
+            set_errno_save_result(ECONNABORTED, "readFileRange", absolute_path, 0);
+            result = -1;
+            break;
+        }
+
+        case BAD_REQUEST: {
+            set_errno_save_result(EINVAL, "readFileRange", absolute_path, 0);
+            result = -1;
+            break;
+        }
+
+        case NOT_FOUND: {
+            set_errno_save_result(ENOENT, "readFileRange", absolute_path, 0);
+            result = -1;
+            break;
+        }
+
+        case UNAUTHORIZED: {
+            set_errno_save_result(EPERM, "readFileRange", absolute_path, 0);
+            result = -1;
+            break;
+        }
+
+        default: {
+            set_errno_save_result(EPROTONOSUPPORT, "readFileRange", absolute_path, 0);
+            result = -1;
+            break;
+        }
+    }
+
+    if (response) free_response(response);
+    arena_reset(response_arena);
     free(absolute_path);
     return result;
 }
@@ -328,7 +522,7 @@ readNFiles(int N, const char* dirname)
     if ( send_request(socket_fd, READ_N_FILES, 0, "", sizeof(int), (void*)&N) != 0 ) return -1;
     
     // Receiving response and checking result
-    response_t *response = recv_response(socket_fd);
+    response_t *response = recv_response_arena(socket_fd, response_arena);
     if ( response == NULL ) return -1;
 
     int result = 0;
@@ -351,7 +545,7 @@ readNFiles(int N, const char* dirname)
             int total_size_read = 0;
             while ( (how_many--) > 0) {
                 
-                response_t *received_file = recv_response(socket_fd);
+                response_t *received_file = recv_response_arena(socket_fd, response_arena);
                 if ( received_file == NULL ) break; // if recv fails keep on going to receive next file
 
                 total_size_read += received_file->body_size;
@@ -384,6 +578,7 @@ readNFiles(int N, const char* dirname)
     }
 
     if (response) free_response(response);
+    arena_reset(response_arena);
     return result;
 }
 
@@ -421,22 +616,27 @@ writeFile(const char* pathname, const char* dirname)
         return -1;
     }
         
-    // Reading file contents
-    void* file_data;
-    file_data = malloc(file_size);
-    if ( file_data == NULL ) {
-        fclose(file_ptr);
-        set_errno_save_result(ENOMEM, "writeFile", absolute_path, 0);
-        return -1;
-    }
+    // Large files are streamed as they are read, others read whole
+    bool streamed = CHK_FLAG(get_capabilities(socket_fd), CAP_STREAMING) && file_size > stream_chunk_size;
 
-    if ( fread(file_data, 1, file_size, file_ptr) < file_size ) {
-        if ( ferror(file_ptr) ) {
+    // Reading file contents
+    void* file_data = NULL;
+    if ( !streamed ) {
+        file_data = malloc(file_size);
+        if ( file_data == NULL ) {
             fclose(file_ptr);
-            if ( file_data != NULL ) free(file_data);
-            set_errno_save_result(EIO, "writeFile", absolute_path, 0);
+            set_errno_save_result(ENOMEM, "writeFile", absolute_path, 0);
             return -1;
         }
+
+        if ( fread(file_data, 1, file_size, file_ptr) < file_size ) {
+            if ( ferror(file_ptr) ) {
+                fclose(file_ptr);
+                if ( file_data != NULL ) free(file_data);
+                set_errno_save_result(EIO, "writeFile", absolute_path, 0);
+                return -1;
+            }
+        }
     }
 
     // Checks if file has already been opened
@@ -445,11 +645,17 @@ writeFile(const char* pathname, const char* dirname)
         if ( openFile(absolute_path, O_CREATE|O_LOCK ) != 0 ) return -1;
     }
 
-    // Sending write file request
-    if ( send_request(socket_fd, WRITE_FILE, strlen(absolute_path) + 1, absolute_path, file_size, file_data) != 0) return -1;
+    // Sending write file request, aborted streams are still answered
+    bool read_failed = false;
+    if ( streamed ) {
+        if ( send_stream(absolute_path, file_ptr, file_size) != 0 ) {
+            if ( errno != EIO ) return -1;
+            read_failed = true;
+        }
+    } else if ( send_request(socket_fd, WRITE_FILE, strlen(absolute_path) + 1, absolute_path, file_size, file_data) != 0) return -1;
 
     // Receiving response and checking result
-    response_t *response = recv_response(socket_fd);
+    response_t *response = recv_response_arena(socket_fd, response_arena);
     if ( response == NULL ) return -1;
 
     int result = 0;
@@ -476,7 +682,7 @@ writeFile(const char* pathname, const char* dirname)
             // Receiving expelled files
             while ( (how_many--) > 0) {
 
-                response_t *received_file = recv_response(socket_fd);
+                response_t *received_file = recv_response_arena(socket_fd, response_arena);
                 if ( received_file == NULL ) break; // if recv fails keep on going to receive next files
 
                 // Writes received file in directory
@@ -494,7 +700,7 @@ writeFile(const char* pathname, const char* dirname)
             }
 
             // Receiving final response
-            response_t *final_response = recv_response(socket_fd);
+            response_t *final_response = recv_response_arena(socket_fd, response_arena);
 
             switch ( final_response->status ) {
                 case SUCCESS: save_request_result("writeFile", absolute_path, file_size, final_response->status_phrase); break;
@@ -545,8 +751,14 @@ writeFile(const char* pathname, const char* dirname)
         }
     }
     
+    if ( read_failed ) {
+        set_errno_save_result(EIO, "writeFile", absolute_path, 0);
+        result = -1;
+    }
+
     fclose(file_ptr);
     if (response) free_response(response);
+    arena_reset(response_arena);
     if (file_data) free(file_data);
     free(absolute_path);
     return result;
@@ -580,7 +792,7 @@ appendToFile(const char* pathname, void* buf, size_t size, const char* dirname)
     if ( send_request(socket_fd, APPEND_TO_FILE, strlen(absolute_path) + 1, absolute_path, size, buf) != 0) return -1;
 
     // Receiving response and checking result
-    response_t *response = recv_response(socket_fd);
+    response_t *response = recv_response_arena(socket_fd, response_arena);
     if ( response == NULL ) return -1;
 
     int result = 0;
@@ -607,7 +819,7 @@ appendToFile(const char* pathname, void* buf, size_t size, const char* dirname)
             // Receiving expelled files
             while ( (how_many--) > 0) {
 
-                response_t *received_file = recv_response(socket_fd);
+                response_t *received_file = recv_response_arena(socket_fd, response_arena);
                 if ( received_file == NULL ) break; // if recv fails keep on going to receive next files
 
                 // Writes received file in directory
@@ -625,7 +837,7 @@ appendToFile(const char* pathname, void* buf, size_t size, const char* dirname)
             }
 
             // Receiving final response
-            response_t *final_response = recv_response(socket_fd);
+            response_t *final_response = recv_response_arena(socket_fd, response_arena);
 
             switch ( final_response->status ) {
                 case SUCCESS: save_request_result("appendToFile", absolute_path, size, final_response->status_phrase); break;
@@ -670,6 +882,7 @@ appendToFile(const char* pathname, void* buf, size_t size, const char* dirname)
     }
     
     if (response) free_response(response);
+    arena_reset(response_arena);
     free(absolute_path);
     return result;
 }
@@ -702,7 +915,7 @@ lockFile(const char* pathname)
     if ( send_request(socket_fd, LOCK_FILE, strlen(absolute_path) + 1, absolute_path, 0, NULL) != 0 ) return -1;
 
     // Receiving response and checking result
-    response_t *response = recv_response(socket_fd);
+    response_t *response = recv_response_arena(socket_fd, response_arena);
     if ( response == NULL) return -1;
 
     int result = 0;
@@ -739,6 +952,7 @@ lockFile(const char* pathname)
     }
     
     if (response) free_response(response);
+    arena_reset(response_arena);
     free(absolute_path);
     return result;
 }
@@ -771,7 +985,7 @@ unlockFile(const char* pathname)
     if ( send_request(socket_fd, UNLOCK_FILE, strlen(absolute_path) + 1, absolute_path, 0, NULL) != 0 ) return -1;
 
     // Receiving response and checking result
-    response_t *response = recv_response(socket_fd);
+    response_t *response = recv_response_arena(socket_fd, response_arena);
     if ( response == NULL) return -1;
 
     int result = 0;
@@ -815,6 +1029,7 @@ unlockFile(const char* pathname)
     }
     
     if (response) free_response(response);
+    arena_reset(response_arena);
     free(absolute_path);
     return result;
 }
@@ -847,7 +1062,7 @@ removeFile(const char* pathname)
     if ( send_request(socket_fd, REMOVE_FILE, strlen(absolute_path) + 1, absolute_path, 0, NULL) != 0 ) return -1;
 
     // Receiving response and checking result
-    response_t *response = recv_response(socket_fd);
+    response_t *response = recv_response_arena(socket_fd, response_arena);
     if ( response == NULL) return -1;
 
     int result = 0;
@@ -894,6 +1109,7 @@ removeFile(const char* pathname)
     }
     
     if (response) free_response(response);
+    arena_reset(response_arena);
     free(absolute_path);
     return result;
 }
@@ -926,7 +1142,7 @@ closeFile(const char* pathname)
     if ( send_request(socket_fd, CLOSE_FILE, strlen(absolute_path) + 1, absolute_path, 0, NULL) != 0 ) return -1;
 
     // Receiving response and checking result
-    response_t *response = recv_response(socket_fd);
+    response_t *response = recv_response_arena(socket_fd, response_arena);
     if ( response == NULL) return -1;
 
     int result = 0;
@@ -963,10 +1179,72 @@ closeFile(const char* pathname)
     }
     
     if (response) free_response(response);
+    arena_reset(response_arena);
     free(absolute_path);
     return result;
 }
 
+int
+getServerStats(char** buf, size_t* size)
+{
+    // Validation of parameters
+    if ( buf == NULL || size == NULL ) {
+        set_errno_save_result(EINVAL, "getServerStats", "", 0);
+        return -1;
+    }
+
+    // Verify if connection is opened
+    if ( socket_fd == -1 ) {
+        set_errno_save_result(ENOTCONN, "getServerStats", "", 0);
+        return -1;
+    }
+
+    // Sending stats request
+    if ( send_request(socket_fd, STATS, 0, "", 0, NULL) != 0 ) return -1;
+
+    // Receiving response and checking result
+    response_t *response = recv_response_arena(socket_fd, response_arena);
+    if ( response == NULL ) return -1;
+
+    int result = 0;
+    switch ( response->status ) {
+
+        case SUCCESS: {
+
+            // Stats are text, null terminated by the server
+            char *tmp_buf = malloc(response->body_size + 1);
+            if ( tmp_buf == NULL ) {
+                set_errno_save_result(ENOMEM, "getServerStats", "", 0);
+                result = -1;
+                break;
+            }
+
+            memcpy(tmp_buf, response->body, response->body_size);
+            tmp_buf[response->body_size] = '\0';
+            *buf = tmp_buf;
+            *size = strlen(tmp_buf);
+            save_request_result("getServerStats", "", *size, response->status_phrase);
+            break;
+        }
+
+        case INTERNAL_ERROR: {
+            set_errno_save_result(ECONNABORTED, "getServerStats", "", 0);
+            result = -1;
+            break;
+        }
+
+        default: {
+            set_errno_save_result(EPROTONOSUPPORT, "getServerStats", "", 0);
+            result = -1;
+            break;
+        }
+    }
+
+    if (response) free_response(response);
+    arena_reset(response_arena);
+    return result;
+}
+
 int
 write_file_in_directory(const char *dirname, char *filename, size_t size, void* contents)
 {
@@ -6,8 +6,11 @@
 
 /**
  * \brief Tries to open a connection to the socket file specified in the path variable socketname, 
- *        if the connection is not accepted immediatly tries again for msec millisecond until abstime
- * 
+ *        if the connection is not accepted immediatly tries again for msec millisecond until abstime.
+ *        The connection belongs to the calling thread, all other functions use the connection of
+ *        the thread calling them. Bodies carry CRC32C checksums if the server supports them, and
+ *        corrupted ones fail with EBADMSG.
+ *
  * \param sockname  path to the socket file to connect to
  * \param msec      interval in milliseconds between two attempts
  * \param abstime   absolute time availble for the connection attempt    
@@ -17,6 +20,31 @@
 int 
 openConnection(const char* sockname, int msec, const struct timespec abstime);
 
+/**
+ * \brief Asks for compression of large request and response bodies on the connections the
+ *        calling thread opens afterwards. The server may refuse it, in which case bodies are
+ *        sent as they are.
+ *
+ * \param enable    true to ask for compression, false to stop asking
+ *
+ * \return 0
+ */
+int
+setCompression(bool enable);
+
+/**
+ * \brief Asks for streaming of large files on the connections the calling thread opens
+ *        afterwards. Files larger than chunk_size bytes are written and read in frames of
+ *        chunk_size bytes, so a transfer never holds a second copy of a file. The server may
+ *        refuse it, in which case files are sent whole.
+ *
+ * \param chunk_size    bytes of each frame, 0 to stop asking
+ *
+ * \return 0
+ */
+int
+setStreaming(size_t chunk_size);
+
 /**
  * \brief Tries to close a connection to the socket file specified in the path variable socketname
  * 
@@ -51,6 +79,22 @@ openFile(const char* pathname, int flags);
 int 
 readFile(const char* pathname, void** buf, size_t* size);
 
+/**
+ * \brief Reads length bytes of the file specified in the path variable pathname, starting
+ *          at offset, without transferring the rest of it. The range is cut short at the
+ *          end of the file, a range past its end reads no bytes.
+ * 
+ * \param pathname  path to the file to read
+ * \param offset    first byte to read
+ * \param length    bytes to read
+ * \param buf       buffer used for saving the range
+ * \param size      bytes of the range actually read
+ * 
+ * \return 0 if the range is correctly read, -1 otherwise. ERRNO is correctly set
+ */
+int 
+readFileRange(const char* pathname, size_t offset, size_t length, void** buf, size_t* size);
+
 /**
  * \brief Tries to read N random files from the server. If N is 0 or greater than the actual
  *          number of files in the storage, it reads all file present in storage. If dirname is 
@@ -133,6 +177,19 @@ closeFile(const char* pathname);
 int 
 removeFile(const char* pathname);
 
+/**
+ * \brief Gets the current server metrics in Prometheus text exposition format. 
+ *          The text is saved in a newly allocated, null terminated buffer buf 
+ *          and its length in the variable size.
+ * 
+ * \param buf       buffer used for saving the metrics
+ * \param size      length of the text
+ * 
+ * \return 0 if the metrics are correctly read, -1 otherwise. ERRNO is correctly set
+ */
+int
+getServerStats(char** buf, size_t* size);
+
 int
 write_file_in_directory(const char *dirname, char *filename, size_t size, void* contents);
 
@@ -0,0 +1,782 @@
+#include "bench.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "api/fileserver_api.h"
+#include "utils/utilities.h"
+
+static const char *op_names[BENCH_OPS] = { "read", "write", "append" };
+
+static bench_config_t config = {
+    .threads = 4,
+    .duration = 10,
+    .mix = { 80, 15, 5 },
+    .sizes = { .kind = DIST_FIXED, .min = 4096, .max = 4096 },
+    .popularity = { .kind = DIST_ZIPF, .theta = 0.99 },
+    .n_keys = 100,
+    .seed = 1,
+};
+
+/* Sizes of the local files of all keys */
+static size_t *key_sizes = NULL;
+
+/* Contents of appends, read only once threads are started */
+static char *append_buffer = NULL;
+
+static uint64_t
+now_us()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/**
+ * xorshift64*, every thread has a state of its own
+ */
+static uint64_t
+next_random(uint64_t *state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ULL;
+}
+
+static double
+next_uniform(uint64_t *state)
+{
+    return (next_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+int
+parse_distribution(const char *arg, dist_t *dist)
+{
+    unsigned long min, max;
+    double theta;
+
+    if (sscanf(arg, "fixed:%lu", &min) == 1) {
+        dist->kind = DIST_FIXED;
+        dist->min = dist->max = min;
+        return 0;
+    }
+
+    if (sscanf(arg, "uniform:%lu:%lu", &min, &max) == 2 && min <= max) {
+        dist->kind = DIST_UNIFORM;
+        dist->min = min;
+        dist->max = max;
+        return 0;
+    }
+
+    if (sscanf(arg, "zipf:%lu:%lu:%lf", &min, &max, &theta) == 3 && min <= max && theta >= 0) {
+        dist->kind = DIST_ZIPF;
+        dist->min = min;
+        dist->max = max;
+        dist->theta = theta;
+        return 0;
+    }
+
+    errno = EINVAL;
+    return -1;
+}
+
+/**
+ * Parses key popularity, uniform or zipf:THETA
+ */
+static int
+parse_popularity(const char *arg, dist_t *dist)
+{
+    if (strcmp(arg, "uniform") == 0) {
+        dist->kind = DIST_UNIFORM;
+        return 0;
+    }
+
+    if (sscanf(arg, "zipf:%lf", &dist->theta) == 1 && dist->theta >= 0) {
+        dist->kind = DIST_ZIPF;
+        return 0;
+    }
+
+    errno = EINVAL;
+    return -1;
+}
+
+/**
+ * Builds the cumulative probabilities of Zipf ranks, at most 4096 of them
+ */
+static int
+dist_prepare(dist_t *dist)
+{
+    if (dist->kind != DIST_ZIPF) return 0;
+
+    dist->n = dist->max - dist->min + 1;
+    if (dist->n > 4096) dist->n = 4096;
+
+    dist->cdf = malloc(dist->n * sizeof(double));
+    if (dist->cdf == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    double sum = 0;
+    for (size_t i = 0; i < dist->n; i++) {
+        sum += 1.0 / pow(i + 1, dist->theta);
+        dist->cdf[i] = sum;
+    }
+    for (size_t i = 0; i < dist->n; i++) dist->cdf[i] /= sum;
+
+    return 0;
+}
+
+size_t
+dist_sample(const dist_t *dist, uint64_t *rng)
+{
+    switch (dist->kind) {
+        case DIST_FIXED:
+            return dist->min;
+
+        case DIST_UNIFORM:
+            return dist->min + next_random(rng) % (dist->max - dist->min + 1);
+
+        case DIST_ZIPF: {
+            // Lowest rank whose cumulative probability is above u
+            double u = next_uniform(rng);
+            size_t low = 0, high = dist->n - 1;
+            while (low < high) {
+                size_t mid = (low + high) / 2;
+                if (dist->cdf[mid] < u) low = mid + 1;
+                else high = mid;
+            }
+
+            // Ranks are spread evenly between min and max
+            if (dist->n == 1) return dist->min;
+            return dist->min + low * (dist->max - dist->min) / (dist->n - 1);
+        }
+    }
+
+    return dist->min;
+}
+
+static void
+key_path(const bench_config_t *config, size_t key, char *path)
+{
+    snprintf(path, MAX_PATH, "%s/key_%06lu", config->keys_dir, (unsigned long)key);
+}
+
+int
+create_keys(const bench_config_t *config)
+{
+    if (mkdir_p(config->keys_dir) == -1) return -1;
+
+    key_sizes = calloc(config->n_keys, sizeof(size_t));
+    char *contents = malloc(config->sizes.max + 1);
+    if (key_sizes == NULL || contents == NULL) {
+        free(contents);
+        errno = ENOMEM;
+        return -1;
+    }
+    memset(contents, 'x', config->sizes.max + 1);
+
+    uint64_t rng = config->seed;
+    for (size_t key = 0; key < config->n_keys; key++) {
+        char path[MAX_PATH];
+        key_path(config, key, path);
+
+        FILE *file = fopen(path, "wb");
+        if (file == NULL) {
+            free(contents);
+            return -1;
+        }
+
+        // Server refuses empty bodies
+        key_sizes[key] = dist_sample(&config->sizes, &rng);
+        if (key_sizes[key] == 0) key_sizes[key] = 1;
+
+        if (fwrite(contents, 1, key_sizes[key], file) != key_sizes[key]) {
+            fclose(file);
+            free(contents);
+            errno = EIO;
+            return -1;
+        }
+        fclose(file);
+    }
+
+    append_buffer = contents;
+    return 0;
+}
+
+int
+run_op(const bench_config_t *config, bench_op op, size_t key, uint64_t *rng, size_t *bytes)
+{
+    char path[MAX_PATH];
+    key_path(config, key, path);
+    *bytes = 0;
+
+    switch (op) {
+        case BENCH_READ: {
+            void *buf = NULL;
+            size_t size = 0;
+            if (readFile(path, &buf, &size) != 0) return -1;
+            free(buf);
+            *bytes = size;
+            return 0;
+        }
+
+        case BENCH_WRITE: {
+            // Files are only written once, an existing key is removed first
+            if (lockFile(path) == 0) {
+                if (removeFile(path) != 0) {
+                    int error = errno;
+                    unlockFile(path);
+                    errno = error;
+                    return -1;
+                }
+            } else if (errno != ENOENT) {
+                return -1;
+            }
+
+            if (writeFile(path, NULL) != 0) return -1;
+            closeFile(path);
+            *bytes = key_sizes[key];
+            return 0;
+        }
+
+        case BENCH_APPEND: {
+            size_t size = dist_sample(&config->sizes, rng);
+            if (size == 0) size = 1;
+
+            if (lockFile(path) != 0) return -1;
+            int result = appendToFile(path, append_buffer, size, NULL);
+            int error = errno;
+            unlockFile(path);
+            errno = error;
+
+            if (result == 0) *bytes = size;
+            return result;
+        }
+
+        default:
+            errno = EINVAL;
+            return -1;
+    }
+}
+
+static int
+add_latency(op_results_t *results, uint32_t latency_us)
+{
+    if (results->n_latencies == results->capacity) {
+        size_t capacity = (results->capacity == 0) ? 4096 : results->capacity * 2;
+        uint32_t *latencies = realloc(results->latencies, capacity * sizeof(uint32_t));
+        if (latencies == NULL) return -1;
+        results->latencies = latencies;
+        results->capacity = capacity;
+    }
+
+    results->latencies[results->n_latencies++] = latency_us;
+    return 0;
+}
+
+static bench_op
+pick_op(uint64_t *rng)
+{
+    unsigned total = 0;
+    for (int i = 0; i < BENCH_OPS; i++) total += config.mix[i];
+
+    unsigned pick = next_random(rng) % total;
+    for (int i = 0; i < BENCH_OPS; i++) {
+        if (pick < config.mix[i]) return i;
+        pick -= config.mix[i];
+    }
+    return BENCH_READ;
+}
+
+static int
+open_thread_connection()
+{
+    struct timespec abstime;
+    clock_gettime(CLOCK_REALTIME, &abstime);
+    abstime.tv_sec += 5;
+
+    return openConnection(config.socket_path, 100, abstime);
+}
+
+/**
+ * Sleeps until the monotonic clock reaches time_us
+ */
+static void
+sleep_until(uint64_t time_us)
+{
+    struct timespec at = { .tv_sec = time_us / 1000000, .tv_nsec = (time_us % 1000000) * 1000 };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &at, NULL) == EINTR);
+}
+
+/**
+ * In a closed loop every thread issues its next operation as soon as the
+ * last one completes. In an open loop operations arrive at thread->rate
+ * with exponential gaps, and latency is counted from the time an operation
+ * was due, so a server stall shows up in the latency of every operation
+ * that should have been sent meanwhile.
+ */
+static void*
+bench_thread(void *arg)
+{
+    bench_thread_t *thread = (bench_thread_t*)arg;
+
+    if (open_thread_connection() != 0) {
+        fprintf(stderr, "thread %d could not connect: %s\n", thread->id, strerror(errno));
+        return NULL;
+    }
+
+    uint64_t deadline = now_us() + (uint64_t)config.duration * 1000000;
+    uint64_t due = now_us();
+
+    while (true) {
+        uint64_t start;
+
+        if (thread->rate > 0) {
+            due += (uint64_t)(-log(1.0 - next_uniform(&thread->rng)) / thread->rate * 1e6);
+            if (due >= deadline) break;
+
+            // Behind schedule past the end, the remaining arrivals are lost
+            uint64_t now = now_us();
+            if (now >= deadline) {
+                thread->missed++;
+                continue;
+            }
+            if (now < due) sleep_until(due);
+            start = due;
+        } else {
+            start = now_us();
+            if (start >= deadline) break;
+        }
+
+        bench_op op = pick_op(&thread->rng);
+        size_t key = dist_sample(&config.popularity, &thread->rng);
+        size_t bytes;
+
+        op_results_t *results = &thread->results[op];
+        if (run_op(&config, op, key, &thread->rng, &bytes) != 0) {
+            results->errors++;
+        }
+        results->bytes += bytes;
+
+        if (add_latency(results, now_us() - start) != 0) break;
+    }
+
+    closeConnection(config.socket_path);
+    return NULL;
+}
+
+/**
+ * Writes every key once, so that reads find them
+ */
+static int
+preload_keys()
+{
+    if (open_thread_connection() != 0) return -1;
+
+    uint64_t rng = config.seed;
+    for (size_t key = 0; key < config.n_keys; key++) {
+        size_t bytes;
+        if (run_op(&config, BENCH_WRITE, key, &rng, &bytes) != 0) {
+            fprintf(stderr, "key %lu could not be written: %s\n", (unsigned long)key, strerror(errno));
+        }
+    }
+
+    return closeConnection(config.socket_path);
+}
+
+/**
+ * Reads the value of an unlabeled metric from the server stats
+ */
+static double
+stats_value(const char *stats, const char *name)
+{
+    size_t len = strlen(name);
+    for (const char *line = stats; line != NULL && *line != '\0'; line = strchr(line, '\n')) {
+        if (*line == '\n') line++;
+        if (strncmp(line, name, len) == 0 && line[len] == ' ') return strtod(line + len + 1, NULL);
+    }
+    return 0;
+}
+
+/**
+ * Prints the memory the server spends on each file besides its contents
+ */
+static int
+report_footprint()
+{
+    if (open_thread_connection() != 0) return -1;
+
+    char *stats;
+    size_t size;
+    if (getServerStats(&stats, &size) != 0) {
+        int err = errno;
+        closeConnection(config.socket_path);
+        errno = err;
+        return -1;
+    }
+    closeConnection(config.socket_path);
+
+    double files = stats_value(stats, "fss_storage_files");
+    double record_bytes = stats_value(stats, "fss_file_record_bytes");
+    double slab_bytes = stats_value(stats, "fss_file_record_slab_bytes");
+    free(stats);
+
+    printf("%.0f files in memory\n", files);
+    if (files > 0) {
+        printf("%10.1f bytes of file record per file\n", record_bytes / files);
+        printf("%10.1f bytes of slabs per file\n", slab_bytes / files);
+    }
+    return 0;
+}
+
+static int
+compare_latency(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Nearest rank percentile of sorted latencies
+ */
+static uint32_t
+percentile(const op_results_t *results, double p)
+{
+    size_t rank = (size_t)(p * results->n_latencies + 0.999999);
+    if (rank == 0) rank = 1;
+    if (rank > results->n_latencies) rank = results->n_latencies;
+    return results->latencies[rank - 1];
+}
+
+static int
+merge_results(op_results_t *to, const op_results_t *from)
+{
+    for (size_t i = 0; i < from->n_latencies; i++) {
+        if (add_latency(to, from->latencies[i]) != 0) return -1;
+    }
+    to->errors += from->errors;
+    to->bytes += from->bytes;
+    return 0;
+}
+
+static void
+print_report(op_results_t *results, double elapsed_s)
+{
+    printf("%-10s %10s %8s %12s %10s %10s %10s %10s %10s\n",
+        "OP", "COUNT", "ERRORS", "OPS/S", "MB/S", "P50 (us)", "P99 (us)", "P99.9 (us)", "MAX (us)");
+
+    size_t total = 0;
+    for (int op = 0; op < BENCH_OPS; op++) {
+        op_results_t *op_results = &results[op];
+        if (op_results->n_latencies == 0) continue;
+        total += op_results->n_latencies;
+
+        qsort(op_results->latencies, op_results->n_latencies, sizeof(uint32_t), compare_latency);
+        printf("%-10s %10lu %8lu %12.1f %10.2f %10u %10u %10u %10u\n", op_names[op],
+            (unsigned long)op_results->n_latencies, (unsigned long)op_results->errors,
+            op_results->n_latencies / elapsed_s, op_results->bytes / elapsed_s / 1e6,
+            percentile(op_results, 0.50), percentile(op_results, 0.99), percentile(op_results, 0.999),
+            op_results->latencies[op_results->n_latencies - 1]);
+    }
+
+    printf("\nTOTAL %lu operations in %.2f s, %.1f ops/s\n", (unsigned long)total, elapsed_s, total / elapsed_s);
+}
+
+static int
+parse_options(int argc, char * const argv[])
+{
+    int opt;
+    while ((opt = getopt(argc, argv, BENCH_OPTIONS)) != -1) {
+        switch (opt) {
+            case 'f': config.socket_path = optarg; break;
+            case 'w': config.keys_dir = optarg; break;
+            case 't': config.threads = atoi(optarg); break;
+            case 'd': config.duration = atoi(optarg); break;
+            case 'k': config.n_keys = strtoul(optarg, NULL, 10); break;
+            case 'r': config.seed = strtoull(optarg, NULL, 10); break;
+            case 'F': config.footprint = true; break;
+
+            case 'R': {
+                // A single rate, or a sweep FROM:TO:STEP
+                int n = sscanf(optarg, "%lf:%lf:%lf", &config.rate_from, &config.rate_to, &config.rate_step);
+                if (n == 1) {
+                    config.rate_to = config.rate_from;
+                    config.rate_step = 0;
+                }
+                if ((n != 1 && n != 3) || config.rate_from <= 0 || config.rate_to < config.rate_from
+                        || (n == 3 && config.rate_step <= 0)) {
+                    fprintf(stderr, "invalid rate %s\n", optarg);
+                    return -1;
+                }
+                break;
+            }
+
+            case 'm':
+                if (sscanf(optarg, "%u:%u:%u", &config.mix[BENCH_READ], &config.mix[BENCH_WRITE],
+                        &config.mix[BENCH_APPEND]) != 3) {
+                    fprintf(stderr, "invalid operation mix %s\n", optarg);
+                    return -1;
+                }
+                break;
+
+            case 's':
+                if (parse_distribution(optarg, &config.sizes) != 0) {
+                    fprintf(stderr, "invalid size distribution %s\n", optarg);
+                    return -1;
+                }
+                break;
+
+            case 'p':
+                if (parse_popularity(optarg, &config.popularity) != 0) {
+                    fprintf(stderr, "invalid key popularity %s\n", optarg);
+                    return -1;
+                }
+                break;
+
+            case 'h': return 1;
+            default: return -1;
+        }
+    }
+
+    if (config.threads <= 0 || config.duration <= 0 || config.n_keys == 0 || config.seed == 0
+            || config.mix[BENCH_READ] + config.mix[BENCH_WRITE] + config.mix[BENCH_APPEND] == 0) {
+        fprintf(stderr, "threads, duration, keys, seed and operation mix must be positive\n");
+        return -1;
+    }
+
+    if (config.socket_path == NULL) config.socket_path = DEFAULT_SOCKET_PATH;
+    if (config.keys_dir == NULL) config.keys_dir = DEFAULT_KEYS_DIR;
+
+    config.popularity.min = 0;
+    config.popularity.max = config.n_keys - 1;
+
+    return 0;
+}
+
+/**
+ * Runs all threads for the configured duration at rate operations per
+ * second, 0 for a closed loop, merging their results.
+ * Returns the elapsed seconds, -1 on failure, errno is set.
+ */
+static double
+run_phase(double rate, op_results_t *results, uint64_t *missed)
+{
+    bench_thread_t *threads = calloc(config.threads, sizeof(bench_thread_t));
+    pthread_t *tids = calloc(config.threads, sizeof(pthread_t));
+    if (threads == NULL || tids == NULL) {
+        free(threads);
+        free(tids);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    // Every phase draws different operations, with the same seed the same ones
+    static uint64_t phase = 0;
+    phase++;
+
+    uint64_t start = now_us();
+    int started = 0;
+    for (; started < config.threads; started++) {
+        threads[started].id = started;
+        threads[started].rng = config.seed + phase * config.threads + started;
+        threads[started].rate = rate / config.threads;
+        if (pthread_create(&tids[started], NULL, bench_thread, &threads[started]) != 0) break;
+    }
+
+    for (int i = 0; i < started; i++) pthread_join(tids[i], NULL);
+    double elapsed_s = (now_us() - start) / 1e6;
+
+    memset(results, 0, BENCH_OPS * sizeof(op_results_t));
+    *missed = 0;
+    int result = (started == config.threads) ? 0 : -1;
+    for (int i = 0; i < started; i++) {
+        for (int op = 0; op < BENCH_OPS; op++) {
+            if (result == 0 && merge_results(&results[op], &threads[i].results[op]) != 0) {
+                errno = ENOMEM;
+                result = -1;
+            }
+            free(threads[i].results[op].latencies);
+        }
+        *missed += threads[i].missed;
+    }
+
+    free(threads);
+    free(tids);
+    return (result == 0) ? elapsed_s : -1;
+}
+
+static void
+free_results(op_results_t *results)
+{
+    for (int op = 0; op < BENCH_OPS; op++) free(results[op].latencies);
+}
+
+/**
+ * Runs every rate of the sweep, and reports the highest rate the server
+ * sustained: served at least 95% of the offered rate, with a p99 latency
+ * within 10 times that of the lowest rate
+ */
+static int
+run_sweep()
+{
+    printf("%12s %12s %10s %8s %10s %10s %10s %10s\n", "TARGET/S", "ACHIEVED/S", "MISSED", "ERRORS",
+        "P50 (us)", "P99 (us)", "P99.9 (us)", "MAX (us)");
+
+    double knee = 0, base_p99 = 0;
+    bool saturated = false;
+
+    for (double rate = config.rate_from; rate <= config.rate_to + 1e-9; rate += config.rate_step) {
+
+        op_results_t results[BENCH_OPS], all;
+        uint64_t missed;
+        double elapsed_s = run_phase(rate, results, &missed);
+        if (elapsed_s < 0) return -1;
+
+        // Tail of all operations together
+        memset(&all, 0, sizeof(all));
+        for (int op = 0; op < BENCH_OPS; op++) {
+            if (merge_results(&all, &results[op]) != 0) {
+                free_results(results);
+                free(all.latencies);
+                errno = ENOMEM;
+                return -1;
+            }
+        }
+        free_results(results);
+
+        if (all.n_latencies == 0) {
+            printf("%12.0f %12s\n", rate, "no operations completed");
+            saturated = true;
+            break;
+        }
+
+        qsort(all.latencies, all.n_latencies, sizeof(uint32_t), compare_latency);
+        double achieved = all.n_latencies / elapsed_s;
+        uint32_t p99 = percentile(&all, 0.99);
+
+        printf("%12.0f %12.1f %10lu %8lu %10u %10u %10u %10u\n", rate, achieved, (unsigned long)missed,
+            (unsigned long)all.errors, percentile(&all, 0.50), p99, percentile(&all, 0.999),
+            all.latencies[all.n_latencies - 1]);
+        fflush(stdout);
+        free(all.latencies);
+
+        if (base_p99 == 0) base_p99 = (p99 > 0) ? p99 : 1;
+        if (achieved < 0.95 * rate || p99 > 10 * base_p99) {
+            saturated = true;
+            break;
+        }
+        knee = rate;
+
+        if (config.rate_step == 0) break;
+    }
+
+    if (!saturated) {
+        printf("\nServer was not saturated up to %.0f ops/s\n", knee);
+    } else if (knee == 0) {
+        printf("\nServer was saturated at the lowest rate\n");
+    } else {
+        printf("\nSaturation knee: %.0f ops/s, the highest rate sustained\n", knee);
+    }
+
+    return 0;
+}
+
+int
+main(int argc, char * const argv[])
+{
+    int res = parse_options(argc, argv);
+    if (res != 0) {
+        if (res == 1) print_help_msg();
+        exit((res == 1) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    if (dist_prepare(&config.sizes) != 0 || dist_prepare(&config.popularity) != 0) {
+        perror("dist_prepare()");
+        exit(EXIT_FAILURE);
+    }
+
+    if (create_keys(&config) != 0) {
+        fprintf(stderr, "could not create keys in %s: %s\n", config.keys_dir, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    if (preload_keys() != 0) {
+        fprintf(stderr, "could not preload keys: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    if (config.footprint) {
+        int result = report_footprint();
+        if (result != 0) perror("report_footprint()");
+
+        free(key_sizes);
+        free(append_buffer);
+        free(config.sizes.cdf);
+        free(config.popularity.cdf);
+        return (result == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    printf("%d threads, %lu keys, mix %u:%u:%u (read:write:append), %s loop\n\n", config.threads,
+        (unsigned long)config.n_keys, config.mix[BENCH_READ], config.mix[BENCH_WRITE], config.mix[BENCH_APPEND],
+        (config.rate_from > 0) ? "open" : "closed");
+
+    int result = 0;
+    if (config.rate_from > 0 && config.rate_step > 0) {
+        result = run_sweep();
+    } else {
+        op_results_t results[BENCH_OPS];
+        uint64_t missed;
+        double elapsed_s = run_phase(config.rate_from, results, &missed);
+        if (elapsed_s < 0) {
+            result = -1;
+        } else {
+            print_report(results, elapsed_s);
+            if (config.rate_from > 0) {
+                printf("Offered %.0f ops/s, %lu arrivals missed\n", config.rate_from, (unsigned long)missed);
+            }
+            free_results(results);
+        }
+    }
+
+    if (result != 0) perror("benchmark failed");
+
+    free(key_sizes);
+    free(append_buffer);
+    free(config.sizes.cdf);
+    free(config.popularity.cdf);
+    return (result == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+void
+print_help_msg()
+{
+    printf("usage: bench [options]\n\n"
+        "Load generator, every thread has a connection of its own. In a closed loop\n"
+        "threads issue their next operation as soon as the last one completes; with\n"
+        "-R operations arrive at a fixed rate, Poisson distributed, and latency is\n"
+        "measured from the time each one was due.\n\n"
+        "  -f SOCKET      socket of the server (default %s)\n"
+        "  -t THREADS     threads and connections (default 4)\n"
+        "  -d SECONDS     duration of the run (default 10)\n"
+        "  -m R:W:A       relative weights of reads, writes and appends (default 80:15:5)\n"
+        "  -s DIST        file and append sizes in bytes, fixed:SIZE, uniform:MIN:MAX\n"
+        "                 or zipf:MIN:MAX:THETA, smaller sizes more likely (default fixed:4096)\n"
+        "  -k KEYS        number of distinct files (default 100)\n"
+        "  -p POPULARITY  key popularity, uniform or zipf:THETA (default zipf:0.99)\n"
+        "  -w DIR         local directory for the key files (default %s)\n"
+        "  -r SEED        random seed (default 1)\n"
+        "  -R RATE        open loop at RATE ops/s, or FROM:TO:STEP to sweep rates, each\n"
+        "                 for the whole duration, until the server saturates\n"
+        "  -F             only writes the keys and prints the memory spent on each file\n"
+        "  -h             prints this message\n", DEFAULT_SOCKET_PATH, DEFAULT_KEYS_DIR);
+}
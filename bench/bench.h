@@ -0,0 +1,114 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define BENCH_OPTIONS           "f:t:d:m:s:k:p:w:r:R:Fh"
+#define DEFAULT_SOCKET_PATH     "/tmp/LSO_socket.sk"
+#define DEFAULT_KEYS_DIR        "/tmp/fss_bench"
+
+/**
+ * Operations issued by the benchmark
+ */
+typedef enum {
+    BENCH_READ      = 0,    /* readFile */
+    BENCH_WRITE     = 1,    /* removeFile if the key exists, then writeFile */
+    BENCH_APPEND    = 2,    /* lockFile, appendToFile, unlockFile */
+    BENCH_OPS       = 3,
+} bench_op;
+
+/**
+ * Distribution of file sizes, or of key ranks
+ */
+typedef enum {
+    DIST_FIXED,
+    DIST_UNIFORM,
+    DIST_ZIPF,
+} dist_kind;
+
+typedef struct {
+    dist_kind   kind;
+    size_t      min;
+    size_t      max;
+    double      theta;      /* Zipf exponent */
+    /* Cumulative probabilities of the Zipf ranks */
+    double      *cdf;
+    size_t      n;
+} dist_t;
+
+/**
+ * Benchmark parameters
+ */
+typedef struct {
+    char        *socket_path;
+    char        *keys_dir;
+    int         threads;
+    int         duration;           /* seconds */
+    unsigned    mix[BENCH_OPS];     /* relative weights */
+    dist_t      sizes;
+    dist_t      popularity;
+    size_t      n_keys;
+    uint64_t    seed;
+    /* Open loop rates in operations per second, 0 for a closed loop */
+    double      rate_from;
+    double      rate_to;
+    double      rate_step;
+    /* Only measures the memory the server spends on each file */
+    bool        footprint;
+} bench_config_t;
+
+/**
+ * Latencies of one operation, in microseconds
+ */
+typedef struct {
+    uint32_t    *latencies;
+    size_t      n_latencies;
+    size_t      capacity;
+    uint64_t    errors;
+    uint64_t    bytes;
+} op_results_t;
+
+/**
+ * State of a benchmark thread, it has a connection of its own
+ */
+typedef struct {
+    int             id;
+    uint64_t        rng;
+    double          rate;       /* operations per second of this thread, 0 for a closed loop */
+    uint64_t        missed;     /* arrivals due before the end that were never sent */
+    op_results_t    results[BENCH_OPS];
+} bench_thread_t;
+
+/**
+ * Parses a distribution, fixed:SIZE, uniform:MIN:MAX or zipf:MIN:MAX:THETA.
+ * Returns 0 on success, -1 on failure, errno is set.
+ */
+int
+parse_distribution(const char *arg, dist_t *dist);
+
+/**
+ * Draws a value from dist
+ */
+size_t
+dist_sample(const dist_t *dist, uint64_t *rng);
+
+/**
+ * Creates the local files of all keys, writeFile sends files from disk.
+ * Returns 0 on success, -1 on failure, errno is set.
+ */
+int
+create_keys(const bench_config_t *config);
+
+/**
+ * Performs op on key from the connection of the calling thread.
+ * Returns 0 on success, -1 on failure, errno is set.
+ */
+int
+run_op(const bench_config_t *config, bench_op op, size_t key, uint64_t *rng, size_t *bytes);
+
+void
+print_help_msg();
+
+#endif
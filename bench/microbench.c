@@ -0,0 +1,662 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "utils/hash_map.h"
+#include "utils/linked_list.h"
+#include "utils/protocol.h"
+#include "utils/utilities.h"
+#include "utils/lz.h"
+#include "utils/sha256.h"
+#include "utils/crc32c.h"
+
+/**
+ * Microbenchmarks of the utils libraries. Every benchmark runs ROUNDS
+ * times, the fastest and the median round are reported, as a table on
+ * stdout and as JSON in the file given as argument. Heap allocations of
+ * the timed operations are counted, malloc, calloc and realloc are
+ * wrapped at link time.
+ */
+
+#define ROUNDS              5
+#define HASH_MAP_BUCKETS    1024
+#define MAX_RESULTS         64
+#define DEFAULT_OUTPUT      "microbench.json"
+
+typedef struct {
+    char        name[32];
+    char        variant[32];
+    uint64_t    ops;            /* per round */
+    size_t      bytes_per_op;
+    double      ns_min;
+    double      ns_median;
+    double      allocs_per_op;  /* in the last round */
+} result_t;
+
+static result_t results[MAX_RESULTS];
+static int n_results = 0;
+
+/* Keys shaped like the paths the server stores */
+static char **keys = NULL;
+static size_t n_keys = 0;
+
+/* Heap allocations since the start, and in the last timed operations */
+static uint64_t allocations = 0;
+static uint64_t round_allocations = 0;
+static uint64_t start_allocations = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void*
+__wrap_malloc(size_t size)
+{
+    __atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+    return __real_malloc(size);
+}
+
+void*
+__wrap_calloc(size_t n, size_t size)
+{
+    __atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+    return __real_calloc(n, size);
+}
+
+void*
+__wrap_realloc(void *ptr, size_t size)
+{
+    __atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+    return __real_realloc(ptr, size);
+}
+
+static uint64_t
+now_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * Starts timing operations, returns the start time
+ */
+static uint64_t
+timer_start()
+{
+    start_allocations = __atomic_load_n(&allocations, __ATOMIC_RELAXED);
+    return now_ns();
+}
+
+/**
+ * Stops timing operations started at start, returns the nanoseconds elapsed
+ */
+static uint64_t
+timer_stop(uint64_t start)
+{
+    uint64_t elapsed = now_ns() - start;
+    round_allocations = __atomic_load_n(&allocations, __ATOMIC_RELAXED) - start_allocations;
+    return elapsed;
+}
+
+static int
+compare_double(const void *a, const void *b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Benchmark round: sets up state, times ops operations and returns
+ * the nanoseconds they took, or 0 on failure
+ */
+typedef uint64_t (*round_fun)(size_t n, uint64_t ops, size_t arg);
+
+static void
+run_benchmark(const char *name, const char *variant, round_fun round, size_t n, uint64_t ops, size_t arg)
+{
+    double ns_per_op[ROUNDS];
+
+    for (int r = 0; r < ROUNDS; r++) {
+        uint64_t elapsed = round(n, ops, arg);
+        if (elapsed == 0) {
+            fprintf(stderr, "%s/%s failed: %s\n", name, variant, strerror(errno));
+            return;
+        }
+        ns_per_op[r] = (double)elapsed / ops;
+    }
+    qsort(ns_per_op, ROUNDS, sizeof(double), compare_double);
+
+    if (n_results == MAX_RESULTS) return;
+    result_t *result = &results[n_results++];
+    snprintf(result->name, sizeof(result->name), "%s", name);
+    snprintf(result->variant, sizeof(result->variant), "%s", variant);
+    result->ops = ops;
+    result->bytes_per_op = (strncmp(name, "protocol", 8) == 0 || strncmp(name, "lz", 2) == 0
+        || strncmp(name, "sha256", 6) == 0 || strncmp(name, "crc32c", 6) == 0) ? arg : 0;
+    result->ns_min = ns_per_op[0];
+    result->ns_median = ns_per_op[ROUNDS / 2];
+    result->allocs_per_op = (double)round_allocations / ops;
+
+    printf("%-24s %-16s %10lu %14.1f %14.1f %10.3f\n", result->name, result->variant,
+        (unsigned long)ops, result->ns_min, result->ns_median, result->allocs_per_op);
+    fflush(stdout);
+}
+
+static int
+make_keys(size_t n)
+{
+    keys = malloc(n * sizeof(char*));
+    if (keys == NULL) return -1;
+
+    for (n_keys = 0; n_keys < n; n_keys++) {
+        keys[n_keys] = malloc(64);
+        if (keys[n_keys] == NULL) return -1;
+        snprintf(keys[n_keys], 64, "/home/user/files/dir_%03lu/file_%06lu.txt",
+            (unsigned long)(n_keys % 100), (unsigned long)n_keys);
+    }
+    return 0;
+}
+
+/* Hash map, n entries over HASH_MAP_BUCKETS buckets */
+
+static hash_map_t*
+filled_map(size_t n)
+{
+    hash_map_t *map = hash_map_create(HASH_MAP_BUCKETS, string_hash, string_compare, NULL, NULL);
+    if (map == NULL) return NULL;
+
+    for (size_t i = 0; i < n; i++) {
+        if (hash_map_insert(map, keys[i], keys[i]) != 0) {
+            hash_map_destroy(map);
+            return NULL;
+        }
+    }
+    return map;
+}
+
+static uint64_t
+hash_map_insert_round(size_t n, uint64_t ops, size_t arg)
+{
+    hash_map_t *map = hash_map_create(HASH_MAP_BUCKETS, string_hash, string_compare, NULL, NULL);
+    if (map == NULL) return 0;
+
+    uint64_t start = timer_start();
+    for (size_t i = 0; i < ops; i++) hash_map_insert(map, keys[i], keys[i]);
+    uint64_t elapsed = timer_stop(start);
+
+    hash_map_destroy(map);
+    return elapsed;
+}
+
+static uint64_t
+hash_map_get_round(size_t n, uint64_t ops, size_t hit)
+{
+    hash_map_t *map = filled_map(n);
+    if (map == NULL) return 0;
+
+    // Misses look up keys never inserted
+    size_t offset = (hit) ? 0 : n;
+    volatile void *sink = NULL;
+
+    uint64_t start = timer_start();
+    for (size_t i = 0; i < ops; i++) sink = hash_map_get(map, keys[offset + i % n]);
+    uint64_t elapsed = timer_stop(start);
+    (void)sink;
+
+    hash_map_destroy(map);
+    return elapsed;
+}
+
+static uint64_t
+hash_map_remove_round(size_t n, uint64_t ops, size_t arg)
+{
+    hash_map_t *map = filled_map(n);
+    if (map == NULL) return 0;
+
+    uint64_t start = timer_start();
+    for (size_t i = 0; i < ops; i++) hash_map_remove(map, keys[i]);
+    uint64_t elapsed = timer_stop(start);
+
+    hash_map_destroy(map);
+    return elapsed;
+}
+
+/* Linked list of n strings */
+
+static list_t*
+filled_list(size_t n)
+{
+    list_t *list = list_create(string_compare, NULL, NULL);
+    if (list == NULL) return NULL;
+
+    for (size_t i = 0; i < n; i++) {
+        if (list_insert_tail(list, keys[i]) != 0) {
+            list_destroy(list);
+            return NULL;
+        }
+    }
+    return list;
+}
+
+static uint64_t
+list_insert_round(size_t n, uint64_t ops, size_t at_head)
+{
+    list_t *list = list_create(string_compare, NULL, NULL);
+    if (list == NULL) return 0;
+
+    uint64_t start = timer_start();
+    for (size_t i = 0; i < ops; i++) {
+        if (at_head) list_insert_head(list, keys[i]);
+        else list_insert_tail(list, keys[i]);
+    }
+    uint64_t elapsed = timer_stop(start);
+
+    list_destroy(list);
+    return elapsed;
+}
+
+static uint64_t
+list_remove_head_round(size_t n, uint64_t ops, size_t arg)
+{
+    list_t *list = filled_list(ops);
+    if (list == NULL) return 0;
+
+    uint64_t start = timer_start();
+    for (size_t i = 0; i < ops; i++) list_remove_head(list);
+    uint64_t elapsed = timer_stop(start);
+
+    list_destroy(list);
+    return elapsed;
+}
+
+static uint64_t
+list_queue_round(size_t n, uint64_t ops, size_t arg)
+{
+    list_t *list = filled_list(n);
+    if (list == NULL) return 0;
+
+    // Every element taken from the head is queued again, as in the request queue
+    uint64_t start = timer_start();
+    for (size_t i = 0; i < ops; i++) list_insert_tail(list, list_remove_head(list));
+    uint64_t elapsed = timer_stop(start);
+
+    list_destroy(list);
+    return elapsed;
+}
+
+static uint64_t
+list_find_round(size_t n, uint64_t ops, size_t arg)
+{
+    list_t *list = filled_list(n);
+    if (list == NULL) return 0;
+
+    // Spread over the whole list, on average half of it is scanned
+    volatile int sink = 0;
+    uint64_t start = timer_start();
+    for (size_t i = 0; i < ops; i++) sink = list_find(list, keys[(i * 7919) % n]);
+    uint64_t elapsed = timer_stop(start);
+    (void)sink;
+
+    list_destroy(list);
+    return elapsed;
+}
+
+static uint64_t
+list_remove_element_round(size_t n, uint64_t ops, size_t arg)
+{
+    list_t *list = filled_list(n);
+    if (list == NULL) return 0;
+
+    // Every removed element is put back at the tail
+    uint64_t start = timer_start();
+    for (size_t i = 0; i < ops; i++) {
+        char *key = keys[(i * 7919) % n];
+        list_remove_element(list, key);
+        list_insert_tail(list, key);
+    }
+    uint64_t elapsed = timer_stop(start);
+
+    list_destroy(list);
+    return elapsed;
+}
+
+/* Protocol, requests over a socketpair */
+
+#define PROTOCOL_ARENA          1   /* requests are received in an arena */
+#define PROTOCOL_COMPRESSED     2   /* text bodies, compressed on the wire */
+
+static void* lz_data(size_t size, int random);
+
+typedef struct {
+    int         fd;
+    uint64_t    n;
+    arena_t     *arena;     /* requests are received in it, as the workers do, if not NULL */
+    int         failed;
+} receiver_arg_t;
+
+static void*
+receiver_thread(void *arg)
+{
+    receiver_arg_t *receiver = (receiver_arg_t*)arg;
+
+    for (uint64_t i = 0; i < receiver->n; i++) {
+        request_t *request = recv_request_arena(receiver->fd, receiver->arena);
+        if (request == NULL) {
+            // Unblocks the sender
+            receiver->failed = 1;
+            shutdown(receiver->fd, SHUT_RDWR);
+            return NULL;
+        }
+        free_request(request);
+        arena_reset(receiver->arena);
+    }
+    return NULL;
+}
+
+static uint64_t
+protocol_round(size_t mode, uint64_t ops, size_t body_size)
+{
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) return 0;
+
+    if (CHK_FLAG(mode, PROTOCOL_COMPRESSED)) {
+        set_capabilities(fds[0], CAP_COMPRESSION);
+        set_capabilities(fds[1], CAP_COMPRESSION);
+    }
+
+    void *body = NULL;
+    if (body_size > 0) body = (CHK_FLAG(mode, PROTOCOL_COMPRESSED)) ? lz_data(body_size, 0) : calloc(1, body_size);
+    if (body_size > 0 && body == NULL) {
+        close(fds[0]);
+        close(fds[1]);
+        return 0;
+    }
+
+    // Timed from the first send to the last request decoded
+    receiver_arg_t receiver = { fds[1], ops, NULL, 0 };
+    if (CHK_FLAG(mode, PROTOCOL_ARENA) && (receiver.arena = arena_create(ARENA_DEFAULT_SIZE)) == NULL) {
+        free(body);
+        close(fds[0]);
+        close(fds[1]);
+        return 0;
+    }
+    pthread_t tid;
+
+    uint64_t start = timer_start();
+    if (pthread_create(&tid, NULL, receiver_thread, &receiver) != 0) {
+        free(body);
+        close(fds[0]);
+        close(fds[1]);
+        return 0;
+    }
+
+    const char *path = keys[0];
+    int failed = 0;
+    for (uint64_t i = 0; i < ops && !failed; i++) {
+        failed = send_request(fds[0], WRITE_FILE, strlen(path) + 1, path, body_size, body) != 0;
+    }
+    if (failed) shutdown(fds[0], SHUT_RDWR);
+
+    pthread_join(tid, NULL);
+    uint64_t elapsed = timer_stop(start);
+
+    arena_destroy(receiver.arena);
+    free(body);
+    set_capabilities(fds[0], 0);
+    set_capabilities(fds[1], 0);
+    close(fds[0]);
+    close(fds[1]);
+    return (failed || receiver.failed) ? 0 : elapsed;
+}
+
+/* LZ codec, over text like the files clients store or over random bytes */
+
+static double lz_ratio = 0;
+
+static void*
+lz_data(size_t size, int random)
+{
+    static const char *words[] = {
+        "the", "of", "and", "a", "to", "in", "is", "garden", "forest", "which", "plants",
+        "layers", "with", "for", "as", "trees", "food", "system", "based", "on", "can", "be",
+        "grow", "production", "woodland", "fruit", "are", "that", "by", "this", "sustainable",
+    };
+    char *data = malloc(size);
+    if (data == NULL) return NULL;
+
+    uint32_t seed = 42;
+    for (size_t i = 0; i < size; ) {
+        seed = seed * 1103515245 + 12345;
+        if (random) {
+            data[i++] = (char)(seed >> 16);
+            continue;
+        }
+
+        const char *word = words[(seed >> 16) % (sizeof(words) / sizeof(words[0]))];
+        for (const char *c = word; *c && i < size; c++) data[i++] = *c;
+        if (i < size) data[i++] = ((seed >> 8) % 12 == 0) ? '\n' : ' ';
+    }
+    return data;
+}
+
+static uint64_t
+lz_compress_round(size_t random, uint64_t ops, size_t size)
+{
+    void *data = lz_data(size, random);
+    void *stream = malloc(lz_compress_bound(size));
+    if (data == NULL || stream == NULL) {
+        free(data);
+        free(stream);
+        return 0;
+    }
+
+    size_t stream_size = 0;
+    uint64_t start = timer_start();
+    for (uint64_t i = 0; i < ops; i++) stream_size = lz_compress(data, size, stream, lz_compress_bound(size));
+    uint64_t elapsed = timer_stop(start);
+
+    lz_ratio = (stream_size > 0) ? (double)size / stream_size : 0;
+    free(data);
+    free(stream);
+    return (stream_size > 0) ? elapsed : 0;
+}
+
+static uint64_t
+lz_decompress_round(size_t random, uint64_t ops, size_t size)
+{
+    void *data = lz_data(size, random);
+    void *stream = malloc(lz_compress_bound(size));
+    void *output = malloc(size);
+    size_t stream_size = (data && stream && output) ? lz_compress(data, size, stream, lz_compress_bound(size)) : 0;
+
+    // Every round checks the data survives the round trip
+    int failed = (stream_size == 0);
+    uint64_t start = timer_start();
+    for (uint64_t i = 0; i < ops && !failed; i++) failed = lz_decompress(stream, stream_size, output, size) != 0;
+    uint64_t elapsed = timer_stop(start);
+
+    if (!failed && memcmp(data, output, size) != 0) {
+        errno = EILSEQ;
+        failed = 1;
+    }
+
+    free(data);
+    free(stream);
+    free(output);
+    return failed ? 0 : elapsed;
+}
+
+/* SHA-256, hashing the chunks of deduplicated files */
+
+static uint64_t
+sha256_round(size_t unused, uint64_t ops, size_t size)
+{
+    void *data = lz_data(size, 0);
+    if (data == NULL) return 0;
+
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    uint64_t start = timer_start();
+    for (uint64_t i = 0; i < ops; i++) sha256(data, size, digest);
+    uint64_t elapsed = timer_stop(start);
+
+    free(data);
+    return elapsed;
+}
+
+/* CRC32C, checksumming bodies and file contents */
+
+static volatile uint32_t crc_sink;
+
+static uint64_t
+crc32c_round(size_t software, uint64_t ops, size_t size)
+{
+    void *data = lz_data(size, 1);
+    if (data == NULL) return 0;
+
+    // Checksums chain through the rounds and are kept, so none can be skipped
+    uint32_t crc = 0;
+    uint64_t start = timer_start();
+    for (uint64_t i = 0; i < ops; i++) crc = (software) ? crc32c_software(crc, data, size) : crc32c(crc, data, size);
+    uint64_t elapsed = timer_stop(start);
+
+    crc_sink = crc;
+    free(data);
+    return elapsed;
+}
+
+static int
+write_json(const char *path)
+{
+    FILE *out = fopen(path, "w");
+    if (out == NULL) return -1;
+
+    char timestamp[32];
+    time_t now = time(NULL);
+    strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+
+    fprintf(out, "{\n  \"suite\": \"utils\",\n  \"timestamp\": \"%s\",\n  \"rounds\": %d,\n  \"benchmarks\": [\n",
+        timestamp, ROUNDS);
+
+    for (int i = 0; i < n_results; i++) {
+        result_t *result = &results[i];
+        fprintf(out, "    {\"name\": \"%s\", \"variant\": \"%s\", \"ops\": %lu, \"bytes_per_op\": %lu, "
+            "\"ns_per_op_min\": %.1f, \"ns_per_op_median\": %.1f, \"allocs_per_op\": %.3f}%s\n",
+            result->name, result->variant, (unsigned long)result->ops, (unsigned long)result->bytes_per_op,
+            result->ns_min, result->ns_median, result->allocs_per_op, (i + 1 < n_results) ? "," : "");
+    }
+
+    fprintf(out, "  ]\n}\n");
+    return fclose(out);
+}
+
+int
+main(int argc, char const *argv[])
+{
+    const char *output = (argc > 1) ? argv[1] : DEFAULT_OUTPUT;
+
+    // Hash map loads up to 16 entries per bucket, misses need as many keys again
+    static const double loads[] = { 0.5, 1, 4, 16 };
+    size_t max_entries = 16 * HASH_MAP_BUCKETS;
+
+    if (make_keys(2 * max_entries) != 0) {
+        perror("make_keys()");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("%-24s %-16s %10s %14s %14s %10s\n", "BENCHMARK", "VARIANT", "OPS", "NS/OP MIN", "NS/OP MEDIAN", "ALLOCS/OP");
+
+    char variant[32];
+    for (int i = 0; i < sizeof(loads) / sizeof(loads[0]); i++) {
+        size_t n = loads[i] * HASH_MAP_BUCKETS;
+        snprintf(variant, sizeof(variant), "load=%g", loads[i]);
+
+        run_benchmark("hash_map_insert", variant, hash_map_insert_round, n, n, 0);
+        run_benchmark("hash_map_get_hit", variant, hash_map_get_round, n, 100000, 1);
+        run_benchmark("hash_map_get_miss", variant, hash_map_get_round, n, 100000, 0);
+        run_benchmark("hash_map_remove", variant, hash_map_remove_round, n, n, 0);
+    }
+
+    run_benchmark("list_insert_tail", "n=10000", list_insert_round, 0, 10000, 0);
+    run_benchmark("list_insert_head", "n=10000", list_insert_round, 0, 10000, 1);
+    run_benchmark("list_remove_head", "n=10000", list_remove_head_round, 0, 10000, 0);
+    run_benchmark("list_queue", "n=16", list_queue_round, 16, 1000000, 0);
+
+    static const size_t list_sizes[] = { 100, 1000, 10000 };
+    for (int i = 0; i < sizeof(list_sizes) / sizeof(list_sizes[0]); i++) {
+        size_t n = list_sizes[i];
+        snprintf(variant, sizeof(variant), "n=%lu", (unsigned long)n);
+
+        // Scans are linear, fewer of them on longer lists
+        uint64_t ops = 1000000 / n;
+        run_benchmark("list_find", variant, list_find_round, n, ops, 0);
+        run_benchmark("list_remove_element", variant, list_remove_element_round, n, ops, 0);
+    }
+
+    static const size_t body_sizes[] = { 0, 1024, 64 * 1024, 1024 * 1024 };
+    for (int i = 0; i < sizeof(body_sizes) / sizeof(body_sizes[0]); i++) {
+        size_t size = body_sizes[i];
+        snprintf(variant, sizeof(variant), "body=%lu", (unsigned long)size);
+
+        // About 64MB per round, at least 100 requests
+        uint64_t ops = (size > 0) ? (64 * 1024 * 1024) / size : 100000;
+        if (ops < 100) ops = 100;
+        if (ops > 100000) ops = 100000;
+        run_benchmark("protocol_request", variant, protocol_round, 0, ops, size);
+        run_benchmark("protocol_request_arena", variant, protocol_round, PROTOCOL_ARENA, ops, size);
+        run_benchmark("protocol_request_lz", variant, protocol_round, PROTOCOL_ARENA | PROTOCOL_COMPRESSED, ops, size);
+    }
+
+    static const char *lz_variants[] = { "text", "random" };
+    double lz_ratios[2];
+    for (int i = 0; i < 2; i++) {
+        snprintf(variant, sizeof(variant), "%s=%d", lz_variants[i], 64 * 1024);
+        run_benchmark("lz_compress", variant, lz_compress_round, i, 1000, 64 * 1024);
+        lz_ratios[i] = lz_ratio;
+        run_benchmark("lz_decompress", variant, lz_decompress_round, i, 1000, 64 * 1024);
+    }
+    printf("\nlz compression ratio: %.2f on text, %.2f on random bytes\n", lz_ratios[0], lz_ratios[1]);
+
+    snprintf(variant, sizeof(variant), "size=%d", 8192);
+    run_benchmark("sha256", variant, sha256_round, 0, 10000, 8192);
+
+    // Throughput of the median round, bytes per nanosecond are GB/s
+    static const size_t crc_sizes[] = { 4096, 64 * 1024, 1024 * 1024 };
+    double crc_gbps[2] = { 0, 0 };
+    for (int i = 0; i < sizeof(crc_sizes) / sizeof(crc_sizes[0]); i++) {
+        size_t size = crc_sizes[i];
+        snprintf(variant, sizeof(variant), "size=%lu", (unsigned long)size);
+        for (int software = 0; software < 2; software++) {
+            run_benchmark((software) ? "crc32c_software" : "crc32c", variant, crc32c_round, software,
+                (64 * 1024 * 1024) / size, size);
+            if (size == 64 * 1024) crc_gbps[software] = size / results[n_results - 1].ns_median;
+        }
+    }
+    printf("\ncrc32c throughput on 64KB: %.2f GB/s (%s), %.2f GB/s slicing by 8\n",
+        crc_gbps[0], (crc32c_hardware()) ? "SSE4.2" : "no SSE4.2, software", crc_gbps[1]);
+
+    for (size_t i = 0; i < n_keys; i++) free(keys[i]);
+    free(keys);
+
+    if (write_json(output) != 0) {
+        fprintf(stderr, "could not write %s: %s\n", output, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    printf("\nResults written to %s\n", output);
+
+    // Queues reuse the nodes of removed elements, in a steady state they never allocate
+    for (int i = 0; i < n_results; i++) {
+        if (strcmp(results[i].name, "list_queue") == 0 && results[i].allocs_per_op != 0) {
+            fprintf(stderr, "list_queue allocated %.3f times per operation\n", results[i].allocs_per_op);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    return 0;
+}
@@ -168,6 +168,21 @@ parse_options_in_list(int n_options, char * const option_vector[], list_t *actio
                 break;
             }
 
+            case 'z': {
+                setCompression(true);
+                break;
+            }
+
+            case 'b': {
+                long chunk_size;
+                if ( is_number(optarg, &chunk_size) != 0 || chunk_size <= 0 ) {
+                    fprintf(stderr, "option -b needs a size in bytes\n");
+                    break;
+                }
+                setStreaming(chunk_size);
+                break;
+            }
+
             case 't': {
                 // Modifies last action with specified wait time
                 action_t *prev_action = (action_t*)list_remove_tail(action_list);
@@ -317,6 +332,43 @@ parse_options_in_list(int n_options, char * const option_vector[], list_t *actio
                 break;
             }
 
+            case 'x': {
+                // Creating new read range request action
+                action_t    *new_action = calloc(1, sizeof(action_t));
+                if ( new_action == NULL ) {
+                    errno = ENOMEM;
+                    return -1;
+                }
+
+                new_action->code = READ_BYTES;
+
+                new_action->arguments = malloc(strlen(optarg) + 1);
+                if ( new_action->arguments == NULL ) {
+                    errno = ENOMEM;
+                    return -1;
+                }
+
+                strcpy(new_action->arguments, optarg);
+                if ( list_insert_tail(action_list, new_action) != 0 ) {
+                    fprintf(stderr, "Could not add read range request to list of actions\n");
+                }
+                break;
+            }
+
+            case 'S': {
+                action_t    *new_action = calloc(1, sizeof(action_t));
+                if ( new_action == NULL ) {
+                    errno = ENOMEM;
+                    return -1;
+                }
+
+                new_action->code = SERVER_STATS;
+                if ( list_insert_tail(action_list, new_action) != 0 ) {
+                    fprintf(stderr, "Could not add stats request to list of actions\n");
+                }
+                break;
+            }
+
             case 'R': {
                 action_t    *new_action = malloc(sizeof(action_t));
                 new_action->directory = NULL;
@@ -338,7 +390,7 @@ parse_options_in_list(int n_options, char * const option_vector[], list_t *actio
                 }
 
                 // Checking whether last action was a read
-                if ( (read_action->code == READ) || (read_action->code == READ_N) ) {
+                if ( (read_action->code == READ) || (read_action->code == READ_BYTES) || (read_action->code == READ_N) ) {
                     if ( read_action->directory == NULL ) {
                         read_action->directory = malloc(strlen(optarg) + 1);
                         if ( read_action->directory == NULL ) {
@@ -637,6 +689,33 @@ execute_action(action_t *action)
             break;
         }
 
+        case READ_BYTES: {
+
+            // Arguments are the file, the first byte and how many to read
+            const char *file_path = strtok(action->arguments, ",");
+            const char *offset = strtok(NULL, ",");
+            const char *length = strtok(NULL, ",");
+            if ( file_path == NULL || offset == NULL || length == NULL ) {
+                fprintf(stderr, "option -x needs file,offset,length\n");
+                break;
+            }
+
+            void *read_buffer = NULL;
+            size_t buffer_size = 0;
+
+            readFileRange(file_path, strtoul(offset, NULL, 10), strtoul(length, NULL, 10), &read_buffer, &buffer_size);
+            if (VERBOSE) display_request_result();
+
+            if (action->directory != NULL && read_buffer != NULL) {
+                write_file_in_directory(action->directory, (char*)file_path, buffer_size, read_buffer);
+            }
+
+            if (read_buffer != NULL) free(read_buffer);
+
+            if (action->wait_time != 0) msleep(action->wait_time);
+            break;
+        }
+
         case READ_N: {
 
             int N = atoi(action->arguments);
@@ -702,6 +781,21 @@ execute_action(action_t *action)
 
             break;
         }
+
+        case SERVER_STATS: {
+
+            char *stats = NULL;
+            size_t stats_size = 0;
+
+            if ( getServerStats(&stats, &stats_size) == 0 ) {
+                fwrite(stats, 1, stats_size, stdout);
+                free(stats);
+            }
+            if (VERBOSE) display_request_result();
+
+            if (action->wait_time != 0) msleep(action->wait_time);
+            break;
+        }
     }
 
     return 0;
@@ -725,6 +819,8 @@ print_help_msg()
                                         "    -h                        Prints this message\n" \
                                         "    -p                        Enables printing of infomation for each operation in the format:\n" \
                                         "                              OPT_TYPE      FILE      RESULT      N_BYTES\n" \
+                                        "    -z                        Asks File Storage Server to compress large files sent and received\n" \
+                                        "    -b bytes                  Asks File Storage Server to stream files larger than bytes in chunks of bytes\n" \
                                         "    -f sockname               Specifes the name of AF_UNIX socket to connect to\n" \
                                         "    -w dirname[,n_files]      Sends the contents of directory dirname to File Storage Server.\n" \
                                         "                              All subdirectories are visited recursively sending up to n_files.\n" \
@@ -734,13 +830,15 @@ print_help_msg()
                                         "                              in case of capacity misses. Option -D should be coupled with -w or -W, otherwise an error\n" \
                                         "                              message is print and all expelled files are trashed. If not specified all expelled files are trashed\n" \
                                         "    -r file1[,file2...]       Reads files specifed as arguments separated by commas from File Storage Server\n" \
+                                        "    -x file,offset,length     Reads length bytes of file starting at offset from File Storage Server\n" \
                                         "    -R [n_files]              Reads n_files files from File Storage Server. If n=0 or unspecified reads all files in File Storage Server\n" \
                                         "    -d dirname                Specifies the directory dirname where to write files read from File Strage Server.\n" \
-                                        "                              Option -d should be coupled with -r or -R, otherwise an error message is print and read files are not saved\n" \
+                                        "                              Option -d should be coupled with -r, -x or -R, otherwise an error message is print and read files are not saved\n" \
                                         "    -t time                   Times in milleseconds to wait in between requests to File Storage Server\n" \
                                         "    -l file1[,file2...]       List of files to acquire mutual exclusion on\n" \
                                         "    -u file1[,file2...]       List of files to release mutual exclusion on\n" \
-                                        "    -c file1[,file2...]       List of files to delete from File Storage Server\n");
+                                        "    -c file1[,file2...]       List of files to delete from File Storage Server\n" \
+                                        "    -S                        Prints the metrics of File Storage Server in Prometheus text format\n");
 }
 
 
@@ -3,7 +3,7 @@
 
 #include "utils/linked_list.h"
 
-#define CLIENT_OPTIONS      "a:w:W:r:R:l:u:c:f:d:D:t:ph"
+#define CLIENT_OPTIONS      "a:w:W:r:x:R:l:u:c:f:d:D:t:b:Sphz"
 #define DEFAULT_SOCKET_PATH "/tmp/LSO_socket.sk"
 
 /** 
@@ -13,11 +13,13 @@ typedef enum {
     APPEND,
     WRITE,
     READ,
+    READ_BYTES,
     WRITE_DIR,
     READ_N,
     LOCK,
     UNLOCK,
-    REMOVE
+    REMOVE,
+    SERVER_STATS
 } action_code;
 
 /**
@@ -0,0 +1,201 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "server/op_log.h"
+#include "utils/protocol.h"
+
+#define READ_BATCH  4096    /* records per read */
+
+/**
+ * Everything known about one kind of operation
+ */
+typedef struct {
+    const char      *name;
+    unsigned long   successes;
+    unsigned long   failures;
+    uint64_t        bytes;
+    /* Latencies of all requests, sorted before printing */
+    uint32_t        *latencies;
+    size_t          n_latencies;
+    size_t          capacity;
+} op_stats_t;
+
+static op_stats_t requests[] = {
+    [OPEN_CONNECTION - OPEN_CONNECTION]     = { .name = "openConn" },
+    [CLOSE_CONNECTION - OPEN_CONNECTION]    = { .name = "closeConn" },
+    [OPEN_FILE - OPEN_CONNECTION]           = { .name = "openFile" },
+    [CLOSE_FILE - OPEN_CONNECTION]          = { .name = "closeFile" },
+    [WRITE_FILE - OPEN_CONNECTION]          = { .name = "writeFile" },
+    [READ_FILE - OPEN_CONNECTION]           = { .name = "readFile" },
+    [READ_N_FILES - OPEN_CONNECTION]        = { .name = "readNFiles" },
+    [REMOVE_FILE - OPEN_CONNECTION]         = { .name = "removeFile" },
+    [LOCK_FILE - OPEN_CONNECTION]           = { .name = "lockFile" },
+    [UNLOCK_FILE - OPEN_CONNECTION]         = { .name = "unlockFile" },
+    [APPEND_TO_FILE - OPEN_CONNECTION]      = { .name = "appendToFile" },
+    [STATS - OPEN_CONNECTION]               = { .name = "stats" },
+    [READ_RANGE - OPEN_CONNECTION]          = { .name = "readRange" },
+};
+
+#define N_REQUESTS  (sizeof(requests) / sizeof(requests[0]))
+
+static unsigned long files_expelled = 0;
+static uint64_t max_connections = 0;
+
+static int
+add_latency(op_stats_t *stats, uint32_t latency_us)
+{
+    if (stats->n_latencies == stats->capacity) {
+        size_t capacity = (stats->capacity == 0) ? 1024 : stats->capacity * 2;
+        uint32_t *latencies = realloc(stats->latencies, capacity * sizeof(uint32_t));
+        if (latencies == NULL) return -1;
+        stats->latencies = latencies;
+        stats->capacity = capacity;
+    }
+
+    stats->latencies[stats->n_latencies++] = latency_us;
+    return 0;
+}
+
+static int
+account_record(const op_record_t *record)
+{
+    switch (record->op) {
+        case OP_FILE_EXPELLED:
+            files_expelled++;
+            return 0;
+
+        case OP_MAX_CONNECTIONS:
+            max_connections = record->bytes;
+            return 0;
+    }
+
+    if (record->op < OPEN_CONNECTION || record->op - OPEN_CONNECTION >= N_REQUESTS) {
+        fprintf(stderr, "unknown operation %u, skipped\n", record->op);
+        return 0;
+    }
+
+    op_stats_t *stats = &requests[record->op - OPEN_CONNECTION];
+    if (record->status == SUCCESS) {
+        stats->successes++;
+        stats->bytes += record->bytes;
+    } else {
+        stats->failures++;
+    }
+
+    // Locks granted by the lock manager did not wait on a worker
+    if (record->worker == OP_LOG_SERVER) return 0;
+    return add_latency(stats, record->latency_us);
+}
+
+static int
+read_op_log(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL) return -1;
+
+    op_log_header_t header;
+    if (fread(&header, sizeof(header), 1, file) != 1
+            || strncmp(header.magic, OP_LOG_MAGIC, sizeof(header.magic)) != 0
+            || header.version != OP_LOG_VERSION
+            || header.record_size != sizeof(op_record_t)) {
+        fclose(file);
+        errno = EINVAL;
+        return -1;
+    }
+
+    op_record_t *records = malloc(READ_BATCH * sizeof(op_record_t));
+    if (records == NULL) {
+        fclose(file);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    size_t n_read;
+    while ((n_read = fread(records, sizeof(op_record_t), READ_BATCH, file)) > 0) {
+        for (size_t i = 0; i < n_read; i++) {
+            if (account_record(&records[i]) != 0) {
+                free(records);
+                fclose(file);
+                errno = ENOMEM;
+                return -1;
+            }
+        }
+    }
+
+    free(records);
+    fclose(file);
+    return 0;
+}
+
+static int
+compare_latency(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Nearest rank percentile of sorted latencies
+ */
+static uint32_t
+percentile(const op_stats_t *stats, double p)
+{
+    size_t rank = (size_t)(p * stats->n_latencies + 0.999999);
+    if (rank == 0) rank = 1;
+    if (rank > stats->n_latencies) rank = stats->n_latencies;
+    return stats->latencies[rank - 1];
+}
+
+static void
+print_report()
+{
+    printf("NUMBER OF SUCCESSFULL OPEN CONNECTION: %lu\n", requests[OPEN_CONNECTION - OPEN_CONNECTION].successes);
+    printf("NUMBER OF SUCCESSFULL CLOSE CONNECTION: %lu\n", requests[CLOSE_CONNECTION - OPEN_CONNECTION].successes);
+    printf("NUMBER OF SUCCESSFULL OPEN: %lu\n", requests[OPEN_FILE - OPEN_CONNECTION].successes);
+    printf("NUMBER OF SUCCESSFULL CLOSE: %lu\n", requests[CLOSE_FILE - OPEN_CONNECTION].successes);
+    printf("NUMBER OF SUCCESSFULL WRITE: %lu\n", requests[WRITE_FILE - OPEN_CONNECTION].successes);
+    printf("NUMBER OF SUCCESSFULL APPEND: %lu\n", requests[APPEND_TO_FILE - OPEN_CONNECTION].successes);
+    printf("NUMBER OF SUCCESSFULL READ: %lu\n", requests[READ_FILE - OPEN_CONNECTION].successes);
+    printf("BYTES READ: %lu\n", (unsigned long)requests[READ_FILE - OPEN_CONNECTION].bytes);
+    printf("BYTES READ BY READ N FILES: %lu\n", (unsigned long)requests[READ_N_FILES - OPEN_CONNECTION].bytes);
+    printf("NUMBER OF SUCCESSFULL REMOVE: %lu\n", requests[REMOVE_FILE - OPEN_CONNECTION].successes);
+    printf("NUMBER OF SUCCESSFULL LOCK: %lu\n", requests[LOCK_FILE - OPEN_CONNECTION].successes);
+    printf("NUMBER OF SUCCESSFULL UNLOCK: %lu\n", requests[UNLOCK_FILE - OPEN_CONNECTION].successes);
+    printf("NUMBER OF FILES EXPELLED: %lu\n", files_expelled);
+    printf("MAX CONNECTION: %lu\n", (unsigned long)max_connections);
+
+    printf("\n%-12s %8s %8s %10s %10s %10s %10s %10s\n",
+        "LATENCY (us)", "OK", "FAILED", "P50", "P90", "P99", "P99.9", "MAX");
+
+    for (size_t i = 0; i < N_REQUESTS; i++) {
+        op_stats_t *stats = &requests[i];
+        if (stats->n_latencies == 0) continue;
+
+        qsort(stats->latencies, stats->n_latencies, sizeof(uint32_t), compare_latency);
+        printf("%-12s %8lu %8lu %10u %10u %10u %10u %10u\n", stats->name, stats->successes, stats->failures,
+            percentile(stats, 0.50), percentile(stats, 0.90), percentile(stats, 0.99),
+            percentile(stats, 0.999), stats->latencies[stats->n_latencies - 1]);
+    }
+}
+
+int
+main(int argc, char const *argv[])
+{
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s OP_LOG_FILE\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if (read_op_log(argv[1]) != 0) {
+        fprintf(stderr, "could not read operation log %s: %s\n", argv[1], strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    print_report();
+
+    for (size_t i = 0; i < N_REQUESTS; i++) free(requests[i].latencies);
+    return 0;
+}
@@ -0,0 +1,167 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#include "server/chunk_store.h"
+#include "server/payload.h"
+#include "utils/hash_map.h"
+
+/**
+ * Boundaries are where the top CHUNK_AVG_BITS bits of the gear hash of the
+ * last 64 bytes are zero
+ */
+#define CHUNK_AVG_BITS      13
+#define CHUNK_MASK          ((((uint64_t)1 << CHUNK_AVG_BITS) - 1) << (64 - CHUNK_AVG_BITS))
+#define CHUNK_BYTES(size)   (offsetof(chunk_t, data) + (size))
+
+static struct {
+    hash_map_t  *chunks;    /* by digest */
+    uint64_t    gear[256];  /* random value of each byte */
+    size_t      n_chunks;
+    size_t      stored_bytes;
+    size_t      referenced_bytes;
+} store;
+
+static size_t
+digest_hash(void *key)
+{
+    size_t hash;
+    memcpy(&hash, key, sizeof(hash));
+    return hash;
+}
+
+static bool
+digest_compare(void *a, void *b)
+{
+    return memcmp(a, b, SHA256_DIGEST_SIZE) == 0;
+}
+
+static void
+free_chunk(void *e)
+{
+    chunk_t *chunk = (chunk_t*)e;
+    payload_free(chunk, CHUNK_BYTES(chunk->size));
+}
+
+int
+chunk_store_init(size_t n_chunks)
+{
+    if (n_chunks < 1024) n_chunks = 1024;
+    if (n_chunks > (1 << 24)) n_chunks = 1 << 24;
+
+    store.chunks = hash_map_create(n_chunks, digest_hash, digest_compare, NULL, free_chunk);
+    if (store.chunks == NULL) return -1;
+
+    // Same values on every run, boundaries must not change across restarts
+    uint64_t seed = 0x9e3779b97f4a7c15;
+    for (int i = 0; i < 256; i++) {
+        uint64_t z = (seed += 0x9e3779b97f4a7c15);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+        store.gear[i] = z ^ (z >> 31);
+    }
+
+    store.n_chunks = store.stored_bytes = store.referenced_bytes = 0;
+    return 0;
+}
+
+void
+chunk_store_destroy()
+{
+    if (store.chunks == NULL) return;
+
+    hash_map_destroy(store.chunks);
+    store.chunks = NULL;
+}
+
+size_t
+chunk_boundary(const void *data, size_t size)
+{
+    if (size <= CHUNK_MIN_SIZE) return size;
+
+    const uint8_t *bytes = (const uint8_t*)data;
+    size_t limit = (size < CHUNK_MAX_SIZE) ? size : CHUNK_MAX_SIZE;
+    uint64_t hash = 0;
+
+    for (size_t i = CHUNK_MIN_SIZE; i < limit; i++) {
+        hash = (hash << 1) + store.gear[bytes[i]];
+        if ((hash & CHUNK_MASK) == 0) return i + 1;
+    }
+    return limit;
+}
+
+chunk_span_t*
+chunk_split(const void *data, size_t size, size_t *n_spans)
+{
+    // At most one chunk every CHUNK_MIN_SIZE bytes, but for the last one
+    size_t capacity = size / CHUNK_MIN_SIZE + 1;
+    chunk_span_t *spans = malloc(capacity * sizeof(chunk_span_t));
+    if (spans == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    const char *bytes = (const char*)data;
+    size_t n = 0;
+    for (size_t offset = 0; offset < size; n++) {
+        spans[n].offset = offset;
+        spans[n].size = chunk_boundary(bytes + offset, size - offset);
+        sha256(bytes + offset, spans[n].size, spans[n].digest);
+        offset += spans[n].size;
+    }
+
+    *n_spans = n;
+    return spans;
+}
+
+chunk_t*
+chunk_store_get(const uint8_t digest[SHA256_DIGEST_SIZE], const void *data, size_t size, size_t *created)
+{
+    *created = 0;
+
+    chunk_t *chunk = (chunk_t*)hash_map_get(store.chunks, (void*)digest);
+    if (chunk == NULL) {
+        chunk = payload_alloc(CHUNK_BYTES(size));
+        if (chunk == NULL) return NULL;
+
+        memcpy(chunk->digest, digest, SHA256_DIGEST_SIZE);
+        chunk->size = size;
+        chunk->refs = 0;
+        memcpy(chunk->data, data, size);
+
+        if (hash_map_insert(store.chunks, chunk->digest, chunk) != 0) {
+            free_chunk(chunk);
+            return NULL;
+        }
+
+        *created = size;
+        __atomic_fetch_add(&store.n_chunks, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&store.stored_bytes, size, __ATOMIC_RELAXED);
+    }
+
+    chunk->refs++;
+    __atomic_fetch_add(&store.referenced_bytes, chunk->size, __ATOMIC_RELAXED);
+    return chunk;
+}
+
+size_t
+chunk_store_put(chunk_t *chunk)
+{
+    size_t size = chunk->size;
+    __atomic_fetch_sub(&store.referenced_bytes, size, __ATOMIC_RELAXED);
+    if (--chunk->refs > 0) return 0;
+
+    __atomic_fetch_sub(&store.n_chunks, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&store.stored_bytes, size, __ATOMIC_RELAXED);
+    hash_map_remove(store.chunks, chunk->digest);
+    return size;
+}
+
+void
+chunk_store_get_stats(chunk_store_stats_t *stats)
+{
+    stats->chunks = __atomic_load_n(&store.n_chunks, __ATOMIC_RELAXED);
+    stats->stored_bytes = __atomic_load_n(&store.stored_bytes, __ATOMIC_RELAXED);
+    stats->referenced_bytes = __atomic_load_n(&store.referenced_bytes, __ATOMIC_RELAXED);
+}
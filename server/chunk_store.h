@@ -0,0 +1,100 @@
+#ifndef CHUNK_STORE_H
+#define CHUNK_STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "utils/sha256.h"
+
+/**
+ * Contents are cut into chunks where a rolling hash of the last bytes
+ * matches a mask, so insertions and deletions only move the boundaries
+ * around them and identical data gives identical chunks wherever it is.
+ * Chunks are between CHUNK_MIN_SIZE and CHUNK_MAX_SIZE bytes, about
+ * CHUNK_AVG_SIZE on average.
+ */
+#define CHUNK_MIN_SIZE      2048
+#define CHUNK_AVG_SIZE      8192
+#define CHUNK_MAX_SIZE      65536
+
+/**
+ * A chunk of contents shared by the files holding it, allocated from the
+ * arena of file contents together with its data
+ */
+typedef struct _chunk_t {
+    uint8_t     digest[SHA256_DIGEST_SIZE];
+    uint32_t    size;
+    uint32_t    refs;
+    char        data[];
+} chunk_t;
+
+/**
+ * Where a chunk of some data starts and what it holds
+ */
+typedef struct {
+    size_t      offset;
+    size_t      size;
+    uint8_t     digest[SHA256_DIGEST_SIZE];
+} chunk_span_t;
+
+/**
+ * Chunks stored and bytes of contents they stand for
+ */
+typedef struct {
+    size_t  chunks;
+    size_t  stored_bytes;       /* bytes of the chunks stored */
+    size_t  referenced_bytes;   /* bytes of the chunks times their references */
+} chunk_store_stats_t;
+
+/**
+ * Initializes the store of chunks, expecting about n_chunks of them.
+ * Returns 0 on success, -1 on failure, errno is set.
+ */
+int
+chunk_store_init(size_t n_chunks);
+
+/**
+ * Frees all chunks, files still holding them are left with invalid ones
+ */
+void
+chunk_store_destroy();
+
+/**
+ * Length of the chunk data starts with, size bytes long
+ */
+size_t
+chunk_boundary(const void *data, size_t size);
+
+/**
+ * Cuts size bytes of data into chunks and hashes them, needs no lock.
+ * Sets n_spans to the number of chunks.
+ * Returns the chunks on success, to be freed by the caller, NULL on failure,
+ * errno is set.
+ */
+chunk_span_t*
+chunk_split(const void *data, size_t size, size_t *n_spans);
+
+/**
+ * Takes a reference to the chunk with digest, storing a copy of size bytes
+ * of data as a new chunk if there is none. Callers hold the storage lock.
+ * Sets created to the bytes newly stored.
+ * Returns the chunk on success, NULL on failure, errno is set.
+ */
+chunk_t*
+chunk_store_get(const uint8_t digest[SHA256_DIGEST_SIZE], const void *data, size_t size, size_t *created);
+
+/**
+ * Drops a reference to chunk, freeing it with the last one. Callers hold
+ * the storage lock.
+ * Returns the bytes freed.
+ */
+size_t
+chunk_store_put(chunk_t *chunk);
+
+/**
+ * Reads the chunks stored
+ */
+void
+chunk_store_get_stats(chunk_store_stats_t *stats);
+
+#endif
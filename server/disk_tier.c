@@ -0,0 +1,528 @@
+#include "server/disk_tier.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "server/logger.h"
+#include "utils/hash_map.h"
+#include "utils/linked_list.h"
+#include "utils/utilities.h"
+#include "utils/crc32c.h"
+
+#define TIER_MAGIC          0x52454954  /* "TIER" */
+#define TIER_BUCKETS        4096
+#define TIER_COMPACT_MS     1000
+
+/**
+ * Record header, followed by path and data
+ */
+typedef struct {
+    uint32_t    magic;
+    uint32_t    path_len;   /* including terminator */
+    uint64_t    size;
+    uint32_t    checksum;   /* CRC32C of the data */
+} tier_record_t;
+
+/**
+ * A segment file
+ */
+typedef struct {
+    unsigned int    id;
+    int             fd;
+    size_t          size;       /* bytes written */
+    size_t          live;       /* bytes of files still indexed */
+} tier_segment_t;
+
+/**
+ * Where a file is stored
+ */
+typedef struct {
+    tier_segment_t  *segment;
+    off_t           offset;     /* of the record */
+    size_t          size;
+    uint32_t        checksum;
+} tier_entry_t;
+
+struct _disk_tier_t {
+    char                *dir;
+    size_t              max_size;
+    size_t              segment_size;
+    size_t              live_size;
+    size_t              disk_size;
+    hash_map_t          *index;         /* path -> tier_entry_t */
+    list_t              *segments;      /* oldest first, active one last */
+    tier_segment_t      *active;
+    unsigned int        next_id;
+    unsigned long       demoted;
+    unsigned long       promoted;
+    unsigned long       compactions;
+    bool                stop;
+    pthread_t           compactor;
+    pthread_mutex_t     mtx;
+    pthread_cond_t      compact_cond;
+};
+
+static char*
+segment_path(disk_tier_t *tier, unsigned int id)
+{
+    char *path = malloc(strlen(tier->dir) + 32);
+    if (path == NULL) return NULL;
+    sprintf(path, "%s/tier.%06u", tier->dir, id);
+    return path;
+}
+
+static tier_segment_t*
+open_segment(disk_tier_t *tier)
+{
+    tier_segment_t *segment = calloc(1, sizeof(tier_segment_t));
+    char *path = segment_path(tier, tier->next_id);
+    if (segment == NULL || path == NULL) {
+        free(segment);
+        free(path);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    segment->id = tier->next_id;
+    segment->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    free(path);
+    if (segment->fd == -1) {
+        free(segment);
+        return NULL;
+    }
+
+    if (list_insert_tail(tier->segments, segment) != 0) {
+        close(segment->fd);
+        free(segment);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    tier->next_id++;
+    tier->active = segment;
+    return segment;
+}
+
+static void
+close_segment(disk_tier_t *tier, tier_segment_t *segment)
+{
+    char *path = segment_path(tier, segment->id);
+    if (path) {
+        unlink(path);
+        free(path);
+    }
+    close(segment->fd);
+    tier->disk_size -= segment->size;
+}
+
+/**
+ * Appends a record to the active segment, tier->mtx must be held.
+ * Returns the offset of the record, -1 on failure.
+ */
+static off_t
+append_record(disk_tier_t *tier, const char *path, const void *data, size_t size, uint32_t checksum, tier_segment_t **segment)
+{
+    tier_record_t record;
+    memset(&record, 0, sizeof(record));
+    record.magic = TIER_MAGIC;
+    record.path_len = strlen(path) + 1;
+    record.size = size;
+    record.checksum = checksum;
+
+    size_t record_size = sizeof(record) + record.path_len + size;
+
+    // Sealing the active segment when full
+    if (tier->active->size > 0 && tier->active->size + record_size > tier->segment_size) {
+        if (open_segment(tier) == NULL) return -1;
+    }
+
+    tier_segment_t *active = tier->active;
+    off_t offset = active->size;
+
+    if (pwrite(active->fd, &record, sizeof(record), offset) != sizeof(record)
+        || pwrite(active->fd, path, record.path_len, offset + sizeof(record)) != record.path_len
+        || (size > 0 && pwrite(active->fd, data, size, offset + sizeof(record) + record.path_len) != size)) {
+        // Part of the record may be written, it is never indexed
+        active->size += record_size;
+        tier->disk_size += record_size;
+        if (errno == 0) errno = EIO;
+        return -1;
+    }
+
+    active->size += record_size;
+    tier->disk_size += record_size;
+    *segment = active;
+    return offset;
+}
+
+/**
+ * Removes path from the index, tier->mtx must be held
+ */
+static void
+drop_entry(disk_tier_t *tier, const char *path)
+{
+    tier_entry_t *entry = hash_map_get(tier->index, (void*)path);
+    if (entry == NULL) return;
+
+    entry->segment->live -= entry->size;
+    tier->live_size -= entry->size;
+
+    // Wakes the compactor when a segment gets mostly empty
+    if (entry->segment != tier->active && entry->segment->live * 2 < entry->segment->size) {
+        pthread_cond_signal(&tier->compact_cond);
+    }
+
+    hash_map_remove(tier->index, (void*)path);
+}
+
+/**
+ * Moves live files of segment to the active one and deletes it
+ */
+static void
+compact_segment(disk_tier_t *tier, tier_segment_t *segment)
+{
+    off_t offset = 0;
+    int moved = 0;
+
+    while (true) {
+        tier_record_t record;
+        char path[MAX_PATH];
+
+        // Segment is sealed, records are read without holding the lock
+        if (offset >= segment->size) break;
+        if (pread(segment->fd, &record, sizeof(record), offset) != sizeof(record)) break;
+        if (record.magic != TIER_MAGIC || record.path_len == 0 || record.path_len > MAX_PATH) break;
+        if (pread(segment->fd, path, record.path_len, offset + sizeof(record)) != record.path_len) break;
+        path[record.path_len - 1] = '\0';
+
+        off_t record_offset = offset;
+        offset += sizeof(record) + record.path_len + record.size;
+
+        pthread_mutex_lock(&tier->mtx);
+
+        tier_entry_t *entry = hash_map_get(tier->index, path);
+        if (entry == NULL || entry->segment != segment || entry->offset != record_offset) {
+            // Stale record
+            pthread_mutex_unlock(&tier->mtx);
+            continue;
+        }
+
+        void *data = malloc(record.size + 1);
+        if (data == NULL
+            || pread(segment->fd, data, record.size, record_offset + sizeof(record) + record.path_len) != record.size) {
+            free(data);
+            pthread_mutex_unlock(&tier->mtx);
+            log_error("Could not compact tier segment %u\n", segment->id);
+            return;
+        }
+
+        // Corrupted files are dropped rather than moved
+        if (crc32c(0, data, record.size) != record.checksum) {
+            free(data);
+            drop_entry(tier, path);
+            pthread_mutex_unlock(&tier->mtx);
+            log_error("File [%s] in tier segment %u is corrupted, dropped\n", path, segment->id);
+            continue;
+        }
+
+        tier_segment_t *new_segment;
+        off_t new_offset = append_record(tier, path, data, record.size, record.checksum, &new_segment);
+        free(data);
+
+        if (new_offset == -1) {
+            pthread_mutex_unlock(&tier->mtx);
+            log_error("Could not compact tier segment %u: %s\n", segment->id, strerror(errno));
+            return;
+        }
+
+        segment->live -= entry->size;
+        new_segment->live += entry->size;
+        entry->segment = new_segment;
+        entry->offset = new_offset;
+        moved++;
+
+        pthread_mutex_unlock(&tier->mtx);
+    }
+
+    pthread_mutex_lock(&tier->mtx);
+    if (segment->live == 0) {
+        // Segment is freed by the list
+        close_segment(tier, segment);
+        list_remove_element(tier->segments, segment);
+        tier->compactions++;
+    }
+    pthread_mutex_unlock(&tier->mtx);
+
+    log_debug("tier segment compacted, %d files moved\n", moved);
+}
+
+static void*
+compactor_thread(void *arg)
+{
+    disk_tier_t *tier = (disk_tier_t*)arg;
+
+    pthread_mutex_lock(&tier->mtx);
+
+    while (!tier->stop) {
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += TIER_COMPACT_MS / 1000;
+        pthread_cond_timedwait(&tier->compact_cond, &tier->mtx, &deadline);
+        if (tier->stop) break;
+
+        // Picking the emptiest sealed segment, if it is at most half full
+        tier_segment_t *victim = NULL;
+        for (node_t *curr = tier->segments->head; curr != NULL; curr = curr->next) {
+            tier_segment_t *segment = (tier_segment_t*)curr->data;
+            if (segment == tier->active || segment->live * 2 >= segment->size) continue;
+            if (victim == NULL || segment->live < victim->live) victim = segment;
+        }
+        if (victim == NULL) continue;
+
+        // Only this thread removes segments, victim stays valid while unlocked
+        pthread_mutex_unlock(&tier->mtx);
+        compact_segment(tier, victim);
+        pthread_mutex_lock(&tier->mtx);
+    }
+
+    pthread_mutex_unlock(&tier->mtx);
+    return NULL;
+}
+
+/**
+ * Deletes segments left by a previous run
+ */
+static void
+remove_stale_segments(const char *dir)
+{
+    DIR *d = opendir(dir);
+    if (d == NULL) return;
+
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (strncmp(entry->d_name, "tier.", 5) != 0) continue;
+
+        long id;
+        if (is_number(entry->d_name + 5, &id) != 0) continue;
+
+        char path[MAX_PATH];
+        if (snprintf(path, MAX_PATH, "%s/%s", dir, entry->d_name) >= MAX_PATH) continue;
+        unlink(path);
+    }
+
+    closedir(d);
+}
+
+disk_tier_t*
+disk_tier_create(const char *dir, size_t max_size, size_t segment_size)
+{
+    if (dir == NULL || max_size == 0 || segment_size == 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if (mkdir_p(dir) != 0) return NULL;
+    remove_stale_segments(dir);
+
+    disk_tier_t *tier = calloc(1, sizeof(disk_tier_t));
+    if (tier == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    tier->dir = strdup(dir);
+    tier->max_size = max_size;
+    tier->segment_size = segment_size;
+    tier->next_id = 1;
+    tier->index = hash_map_create(TIER_BUCKETS, string_hash, string_compare, free, free);
+    tier->segments = list_create(NULL, free, NULL);
+
+    if (tier->dir == NULL || tier->index == NULL || tier->segments == NULL) {
+        errno = ENOMEM;
+        goto _create_error;
+    }
+
+    if (open_segment(tier) == NULL) goto _create_error;
+
+    if (pthread_mutex_init(&tier->mtx, NULL) != 0
+        || pthread_cond_init(&tier->compact_cond, NULL) != 0
+        || pthread_create(&tier->compactor, NULL, compactor_thread, tier) != 0) {
+        close_segment(tier, tier->active);
+        goto _create_error;
+    }
+
+    return tier;
+
+_create_error:
+    {
+        int err = errno;
+        if (tier->index) hash_map_destroy(tier->index);
+        if (tier->segments) list_destroy(tier->segments);
+        free(tier->dir);
+        free(tier);
+        errno = err;
+    }
+    return NULL;
+}
+
+void
+disk_tier_destroy(disk_tier_t *tier)
+{
+    if (tier == NULL) return;
+
+    pthread_mutex_lock(&tier->mtx);
+    tier->stop = true;
+    pthread_cond_signal(&tier->compact_cond);
+    pthread_mutex_unlock(&tier->mtx);
+
+    pthread_join(tier->compactor, NULL);
+
+    for (node_t *curr = tier->segments->head; curr != NULL; curr = curr->next) {
+        close_segment(tier, (tier_segment_t*)curr->data);
+    }
+
+    list_destroy(tier->segments);
+    hash_map_destroy(tier->index);
+    pthread_mutex_destroy(&tier->mtx);
+    pthread_cond_destroy(&tier->compact_cond);
+    free(tier->dir);
+    free(tier);
+}
+
+int
+disk_tier_put(disk_tier_t *tier, const char *path, const void *data, size_t size)
+{
+    if (tier == NULL || path == NULL || (data == NULL && size > 0)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    tier_entry_t *entry = malloc(sizeof(tier_entry_t));
+    char *key = strdup(path);
+    if (entry == NULL || key == NULL) {
+        free(entry);
+        free(key);
+        errno = ENOMEM;
+        return -1;
+    }
+    entry->checksum = crc32c(0, data, size);
+
+    lock_return(&tier->mtx, -1);
+
+    drop_entry(tier, path);
+
+    if (tier->live_size + size > tier->max_size) {
+        unlock_return(&tier->mtx, -1);
+        free(entry);
+        free(key);
+        errno = ENOSPC;
+        return -1;
+    }
+
+    entry->size = size;
+    entry->offset = append_record(tier, path, data, size, entry->checksum, &entry->segment);
+    if (entry->offset == -1 || hash_map_insert(tier->index, key, entry) != 0) {
+        int err = errno;
+        unlock_return(&tier->mtx, -1);
+        free(entry);
+        free(key);
+        errno = err;
+        return -1;
+    }
+
+    entry->segment->live += size;
+    tier->live_size += size;
+    tier->demoted++;
+
+    unlock_return(&tier->mtx, -1);
+    return 0;
+}
+
+int
+disk_tier_take(disk_tier_t *tier, const char *path, void **data, size_t *size)
+{
+    if (tier == NULL || path == NULL || data == NULL || size == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    lock_return(&tier->mtx, -1);
+
+    tier_entry_t *entry = hash_map_get(tier->index, (void*)path);
+    if (entry == NULL) {
+        unlock_return(&tier->mtx, -1);
+        errno = ENOENT;
+        return -1;
+    }
+
+    // One more byte so that empty files get a valid buffer
+    void *buffer = malloc(entry->size + 1);
+    if (buffer == NULL) {
+        unlock_return(&tier->mtx, -1);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    off_t data_offset = entry->offset + sizeof(tier_record_t) + strlen(path) + 1;
+    if (pread(entry->segment->fd, buffer, entry->size, data_offset) != entry->size) {
+        int err = (errno) ? errno : EIO;
+        unlock_return(&tier->mtx, -1);
+        free(buffer);
+        errno = err;
+        return -1;
+    }
+
+    // The file is gone either way, corrupted contents are not handed out
+    bool corrupted = crc32c(0, buffer, entry->size) != entry->checksum;
+    *data = buffer;
+    *size = entry->size;
+
+    drop_entry(tier, path);
+    if (corrupted) {
+        unlock_return(&tier->mtx, -1);
+        free(buffer);
+        errno = EBADMSG;
+        return -1;
+    }
+    tier->promoted++;
+
+    unlock_return(&tier->mtx, -1);
+    return 0;
+}
+
+bool
+disk_tier_contains(disk_tier_t *tier, const char *path)
+{
+    if (tier == NULL || path == NULL) return false;
+
+    lock_return(&tier->mtx, false);
+    bool found = (hash_map_get(tier->index, (void*)path) != NULL);
+    unlock_return(&tier->mtx, false);
+
+    return found;
+}
+
+void
+disk_tier_get_stats(disk_tier_t *tier, disk_tier_stats_t *stats)
+{
+    memset(stats, 0, sizeof(disk_tier_stats_t));
+    if (tier == NULL) return;
+
+    pthread_mutex_lock(&tier->mtx);
+    stats->live_size = tier->live_size;
+    stats->disk_size = tier->disk_size;
+    stats->no_of_files = tier->index->n_entries;
+    stats->demoted = tier->demoted;
+    stats->promoted = tier->promoted;
+    stats->compactions = tier->compactions;
+    pthread_mutex_unlock(&tier->mtx);
+}
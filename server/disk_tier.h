@@ -0,0 +1,72 @@
+#ifndef DISK_TIER_H
+#define DISK_TIER_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/**
+ * On-disk second tier for files demoted from memory. Files are appended to
+ * log-structured segments (<dir>/tier.<id>) and found through an in-memory
+ * index, taking a file back out of the tier leaves a hole in its segment.
+ * A compaction thread rewrites the live files of mostly empty segments and
+ * deletes them. The tier is a cache: it starts empty at every run, so the
+ * server refuses it together with snapshots or the write-ahead log.
+ */
+typedef struct _disk_tier_t disk_tier_t;
+
+/**
+ * Tier counters
+ */
+typedef struct {
+    size_t          live_size;      /* bytes of files in the tier */
+    size_t          disk_size;      /* bytes of segments on disk */
+    int             no_of_files;
+    unsigned long   demoted;
+    unsigned long   promoted;
+    unsigned long   compactions;
+} disk_tier_stats_t;
+
+/**
+ * Creates a tier in directory dir, holding up to max_size bytes of files
+ * in segments of segment_size bytes. Stale segments in dir are deleted.
+ * Returns the tier on success, NULL on failure, errno is set.
+ */
+disk_tier_t*
+disk_tier_create(const char *dir, size_t max_size, size_t segment_size);
+
+/**
+ * Stops compaction, closes and deletes all segments
+ */
+void
+disk_tier_destroy(disk_tier_t *tier);
+
+/**
+ * Writes a copy of data to the tier under path, replacing any previous version.
+ * Returns 0 on success, -1 on failure, errno is set (ENOSPC if the tier is full).
+ */
+int
+disk_tier_put(disk_tier_t *tier, const char *path, const void *data, size_t size);
+
+/**
+ * Reads the file at path and removes it from the tier, contents are saved
+ * in a newly allocated buffer and checked against the checksum they were
+ * written with.
+ * Returns 0 on success, -1 on failure, errno is set (ENOENT if not in the
+ * tier, EBADMSG if its contents are corrupted, the file is dropped).
+ */
+int
+disk_tier_take(disk_tier_t *tier, const char *path, void **data, size_t *size);
+
+/**
+ * Whether the tier contains a file at path
+ */
+bool
+disk_tier_contains(disk_tier_t *tier, const char *path);
+
+/**
+ * Fills stats with the tier counters
+ */
+void
+disk_tier_get_stats(disk_tier_t *tier, disk_tier_stats_t *stats);
+
+#endif
@@ -0,0 +1,253 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "server/hot_keys.h"
+
+typedef struct {
+    uint64_t    hash;
+    hot_key_t   key;
+} hot_key_entry_t;
+
+/**
+ * Space-Saving sketch of a single thread, the mutex is only contended
+ * while merging
+ */
+typedef struct _hot_keys_shard_t {
+    hot_key_entry_t             entries[HOT_KEYS_TRACKED];
+    int                         n_entries;
+    pthread_mutex_t             mtx;
+    struct _hot_keys_shard_t    *next;
+} hot_keys_shard_t;
+
+/**
+ * A key of a shard while merging, with the lowest count of its shard
+ */
+typedef struct {
+    hot_key_entry_t     entry;
+    uint64_t            shard_min;
+} merged_entry_t;
+
+static struct {
+    hot_keys_shard_t    *shards;
+    pthread_mutex_t     shards_mtx;
+    pthread_key_t       shard_key;
+    bool                shard_key_created;
+} hot_keys = {
+    .shards_mtx = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static __thread hot_keys_shard_t *thread_shard = NULL;
+
+static uint64_t
+hash_path(const char *path)
+{
+    // FNV-1a, as in the operation log
+    uint64_t hash = 14695981039346656037ULL;
+    for (const char *p = path; *p != '\0'; p++) {
+        hash ^= (unsigned char)*p;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/**
+ * Destructor of the shard key, the sketch of an exiting thread goes with it
+ */
+static void
+free_thread_shard(void *arg)
+{
+    hot_keys_shard_t *shard = (hot_keys_shard_t*)arg;
+
+    pthread_mutex_lock(&hot_keys.shards_mtx);
+    hot_keys_shard_t **link = &hot_keys.shards;
+    while (*link != shard) link = &(*link)->next;
+    *link = shard->next;
+    pthread_mutex_unlock(&hot_keys.shards_mtx);
+
+    pthread_mutex_destroy(&shard->mtx);
+    free(shard);
+    thread_shard = NULL;
+}
+
+static hot_keys_shard_t*
+get_thread_shard()
+{
+    if (thread_shard != NULL) return thread_shard;
+
+    hot_keys_shard_t *shard = calloc(1, sizeof(hot_keys_shard_t));
+    if (shard == NULL) return NULL;
+    pthread_mutex_init(&shard->mtx, NULL);
+
+    // Registered once per thread, sketches live until it exits or they are destroyed
+    pthread_mutex_lock(&hot_keys.shards_mtx);
+    if (!hot_keys.shard_key_created) {
+        hot_keys.shard_key_created = (pthread_key_create(&hot_keys.shard_key, free_thread_shard) == 0);
+    }
+    if (hot_keys.shard_key_created) pthread_setspecific(hot_keys.shard_key, shard);
+    shard->next = hot_keys.shards;
+    hot_keys.shards = shard;
+    pthread_mutex_unlock(&hot_keys.shards_mtx);
+
+    thread_shard = shard;
+    return shard;
+}
+
+/**
+ * Gets the counter of hash, taking over the lowest one if path is not tracked
+ */
+static hot_key_entry_t*
+shard_counter(hot_keys_shard_t *shard, uint64_t hash, const char *path)
+{
+    hot_key_entry_t *min = NULL;
+
+    for (int i = 0; i < shard->n_entries; i++) {
+        hot_key_entry_t *entry = &shard->entries[i];
+        if (entry->hash == hash) return entry;
+        if (min == NULL || entry->key.count < min->key.count) min = entry;
+    }
+
+    hot_key_entry_t *entry;
+    if (shard->n_entries < HOT_KEYS_TRACKED) {
+        entry = &shard->entries[shard->n_entries++];
+        entry->key.count = 0;
+        entry->key.error = 0;
+    } else {
+        // Evicted path may have been requested as many times as it was counted
+        entry = min;
+        entry->key.error = entry->key.count;
+    }
+
+    entry->hash = hash;
+    strncpy(entry->key.path, path, MAX_PATH - 1);
+    entry->key.path[MAX_PATH - 1] = '\0';
+    entry->key.read_bytes = 0;
+    entry->key.write_bytes = 0;
+    return entry;
+}
+
+void
+hot_keys_record(const char *path, hot_key_op op, size_t bytes)
+{
+    if (path == NULL) return;
+
+    hot_keys_shard_t *shard = get_thread_shard();
+    if (shard == NULL) return;
+
+    uint64_t hash = hash_path(path);
+
+    pthread_mutex_lock(&shard->mtx);
+    hot_key_entry_t *entry = shard_counter(shard, hash, path);
+    entry->key.count++;
+    if (op == HOT_KEY_READ) {
+        entry->key.read_bytes += bytes;
+    } else {
+        entry->key.write_bytes += bytes;
+    }
+    pthread_mutex_unlock(&shard->mtx);
+}
+
+static int
+compare_hash(const void *a, const void *b)
+{
+    uint64_t x = ((const merged_entry_t*)a)->entry.hash, y = ((const merged_entry_t*)b)->entry.hash;
+    return (x > y) - (x < y);
+}
+
+static int
+compare_count(const void *a, const void *b)
+{
+    uint64_t x = ((const merged_entry_t*)a)->entry.key.count, y = ((const merged_entry_t*)b)->entry.key.count;
+    return (x < y) - (x > y);
+}
+
+int
+hot_keys_top(hot_key_t *keys, int max)
+{
+    pthread_mutex_lock(&hot_keys.shards_mtx);
+
+    int n_shards = 0;
+    for (hot_keys_shard_t *shard = hot_keys.shards; shard != NULL; shard = shard->next) n_shards++;
+
+    merged_entry_t *merged = malloc((n_shards * HOT_KEYS_TRACKED + 1) * sizeof(merged_entry_t));
+    if (merged == NULL) {
+        pthread_mutex_unlock(&hot_keys.shards_mtx);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    // A path missing from a full shard may have been counted there up to its lowest count
+    int n_merged = 0;
+    uint64_t total_min = 0;
+    for (hot_keys_shard_t *shard = hot_keys.shards; shard != NULL; shard = shard->next) {
+        pthread_mutex_lock(&shard->mtx);
+
+        uint64_t shard_min = 0;
+        if (shard->n_entries == HOT_KEYS_TRACKED) {
+            shard_min = shard->entries[0].key.count;
+            for (int i = 1; i < shard->n_entries; i++) {
+                if (shard->entries[i].key.count < shard_min) shard_min = shard->entries[i].key.count;
+            }
+        }
+        total_min += shard_min;
+
+        for (int i = 0; i < shard->n_entries; i++) {
+            merged[n_merged].entry = shard->entries[i];
+            merged[n_merged].shard_min = shard_min;
+            n_merged++;
+        }
+
+        pthread_mutex_unlock(&shard->mtx);
+    }
+    pthread_mutex_unlock(&hot_keys.shards_mtx);
+
+    // Summing counters of the same path
+    qsort(merged, n_merged, sizeof(merged_entry_t), compare_hash);
+
+    int n_keys = 0;
+    for (int i = 0; i < n_merged; ) {
+        merged_entry_t sum = merged[i];
+        uint64_t present_min = merged[i].shard_min;
+
+        int j = i + 1;
+        for (; j < n_merged && merged[j].entry.hash == sum.entry.hash; j++) {
+            sum.entry.key.count += merged[j].entry.key.count;
+            sum.entry.key.error += merged[j].entry.key.error;
+            sum.entry.key.read_bytes += merged[j].entry.key.read_bytes;
+            sum.entry.key.write_bytes += merged[j].entry.key.write_bytes;
+            present_min += merged[j].shard_min;
+        }
+
+        sum.entry.key.count += total_min - present_min;
+        sum.entry.key.error += total_min - present_min;
+        merged[n_keys++] = sum;
+        i = j;
+    }
+
+    qsort(merged, n_keys, sizeof(merged_entry_t), compare_count);
+
+    if (n_keys > max) n_keys = max;
+    for (int i = 0; i < n_keys; i++) keys[i] = merged[i].entry.key;
+
+    free(merged);
+    return n_keys;
+}
+
+void
+hot_keys_destroy()
+{
+    pthread_mutex_lock(&hot_keys.shards_mtx);
+    if (hot_keys.shard_key_created) {
+        pthread_key_delete(hot_keys.shard_key);
+        hot_keys.shard_key_created = false;
+    }
+    while (hot_keys.shards != NULL) {
+        hot_keys_shard_t *shard = hot_keys.shards;
+        hot_keys.shards = shard->next;
+        pthread_mutex_destroy(&shard->mtx);
+        free(shard);
+    }
+    pthread_mutex_unlock(&hot_keys.shards_mtx);
+    thread_shard = NULL;
+}
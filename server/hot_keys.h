@@ -0,0 +1,59 @@
+#ifndef HOT_KEYS_H
+#define HOT_KEYS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "utils/utilities.h"
+
+/**
+ * Hot key detection. Every thread keeps a Space-Saving sketch of the
+ * paths it served: HOT_KEYS_TRACKED counters, when all are taken a new
+ * path replaces the one with the lowest count and inherits it as error.
+ * Memory is constant, any path requested more than 1/HOT_KEYS_TRACKED
+ * of the times is guaranteed to be tracked. hot_keys_top merges the
+ * sketches of all threads.
+ */
+
+#define HOT_KEYS_TRACKED    64      /* counters per thread */
+#define HOT_KEYS_REPORTED   16      /* paths reported by stats */
+
+typedef enum {
+    HOT_KEY_READ    = 0,
+    HOT_KEY_WRITE   = 1,    /* writes and appends */
+} hot_key_op;
+
+/**
+ * Estimated traffic of a path. The path was requested between
+ * count - error and count times, bytes are only those seen since
+ * it was last tracked.
+ */
+typedef struct _hot_key_t {
+    char        path[MAX_PATH];
+    uint64_t    count;
+    uint64_t    error;
+    uint64_t    read_bytes;
+    uint64_t    write_bytes;
+} hot_key_t;
+
+/**
+ * Counts a request of the calling thread for path, moving bytes
+ */
+void
+hot_keys_record(const char *path, hot_key_op op, size_t bytes);
+
+/**
+ * Saves in keys the at most max paths with the highest count,
+ * highest first. Returns the number of paths saved, -1 on failure,
+ * errno is set.
+ */
+int
+hot_keys_top(hot_key_t *keys, int max);
+
+/**
+ * Frees all sketches, threads must not record anything afterwards
+ */
+void
+hot_keys_destroy();
+
+#endif
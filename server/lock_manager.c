@@ -1,3 +1,5 @@
+#include <stdlib.h>
+
 #include "lock_manager.h"
 
 void*
@@ -22,6 +24,12 @@ lock_manager_thread(void* args)
                 if ( tmp == NULL ) break;
             
                 int client_fd = *(int*)tmp;
+                free(tmp);
+
+                if (list_is_empty(file->waiting_on_lock)) {
+                    list_destroy(file->waiting_on_lock);
+                    file->waiting_on_lock = NULL;
+                }
 
                 log_debug("updating file [%s] lock\n", file->path);
 
@@ -35,6 +43,7 @@ lock_manager_thread(void* args)
                 send_response(client_fd, SUCCESS, get_status_message(SUCCESS), strlen(file->path) + 1, file->path, 0, NULL);
 
                 log_info("(LOCK MAN) [  %s  ]  %-21s : %s\n", "lockFile", get_status_message(SUCCESS), file->path);
+                log_op(OP_LOG_SERVER, LOCK_FILE, SUCCESS, file->path, 0, 0);
             }
 
             curr = curr->next;
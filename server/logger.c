@@ -1,28 +1,379 @@
 #include <string.h>
 #include <stdio.h>
-#include <stdarg.h> 
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdbool.h>
 #include <time.h>
-#include <sys/timeb.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
 
 #include "logger.h"
 #include "utils/utilities.h"
 
+#define LOG_RING_SIZE   (1 << 18)       /* bytes, per thread */
+#define LOG_LINE_MAX    4096
+#define LOG_BATCH_SIZE  (1 << 16)
+#define LOG_WRAP        UINT32_MAX      /* rest of the ring is unused */
+
+#define LOG_ALIGN(n)    (((n) + 15) & ~(size_t)15)
+
+typedef enum {
+    LOG_TEXT    = 0,
+    LOG_OP      = 1,
+} log_record_kind;
+
+/**
+ * A log line in a ring followed by its text,
+ * or an operation followed by its op_record_t
+ */
+typedef struct {
+    uint32_t    len;
+    uint32_t    kind;
+    uint64_t    ms;         /* timestamp, milliseconds since the epoch */
+    uint64_t    seq;        /* global order of records */
+    uint64_t    pad;
+} log_record_t;
+
+/**
+ * Output buffered by the writer thread
+ */
+typedef struct {
+    char        *data;
+    size_t      len;
+    int         fd;
+} log_batch_t;
+
+/**
+ * Ring of log records written by a single thread and read by the writer,
+ * head and tail only grow and are masked to get offsets
+ */
+typedef struct _log_ring_t {
+    char                *data;
+    size_t              head;       /* written by the writer thread */
+    size_t              tail;       /* written by the owner thread */
+    bool                orphaned;   /* owner exited, freed by the writer once drained */
+    struct _log_ring_t  *next;
+} log_ring_t;
+
 static loglevel log_level;
+static unsigned int log_sample_every = 1;
+
+/* Whether the request being served by this thread is logged */
+static __thread bool request_sampled = true;
+static __thread unsigned long requests_seen = 0;
+
+static struct {
+    bool                running;
+    bool                stop;
+    log_full_policy     policy;
+    int                 op_fd;      /* binary operation log, -1 if disabled */
+    uint64_t            now_ms;     /* cached clock, refreshed by the writer */
+    uint64_t            seq;        /* next record sequence number */
+    unsigned long       dropped;
+    log_ring_t          *rings;
+    pthread_mutex_t     rings_mtx;
+    pthread_key_t       ring_key;   /* orphans the ring of an exiting thread */
+    bool                ring_key_created;
+    pthread_t           writer;
+} logger = {
+    .op_fd = -1,
+    .rings_mtx = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static __thread log_ring_t *thread_ring = NULL;
 
-static char* 
-get_timestamp(char* buf) {
-    int bytes;
-    struct timeb start;
-    ftime(&start);
-    bytes = strftime(buf, 20, "%H:%M:%S", localtime(&start.time));
-    sprintf(&buf[bytes], ".%03u", start.millitm);
+static uint64_t
+clock_ms()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static char*
+format_timestamp(char* buf, uint64_t ms) {
+    // Broken down time is cached for the current second
+    static __thread time_t cached_sec = -1;
+    static __thread char cached_buf[20];
+
+    time_t sec = ms / 1000;
+    if (sec != cached_sec) {
+        struct tm tm;
+        localtime_r(&sec, &tm);
+        strftime(cached_buf, sizeof(cached_buf), "%H:%M:%S", &tm);
+        cached_sec = sec;
+    }
+
+    sprintf(buf, "%s.%03u", cached_buf, (unsigned int)(ms % 1000));
     return buf;
 }
 
-void 
-log_init(const char* path) 
+/**
+ * Writes a line straight to the log file, used when the writer is not running
+ */
+static void
+write_record_sync(log_record_kind kind, const char *data, size_t len)
+{
+    char tmp[50] = { 0 };
+
+    pthread_mutex_lock(&log_file_mtx);
+    if (kind == LOG_OP) {
+        if (logger.op_fd != -1) writen(logger.op_fd, (void*)data, len);
+    } else {
+        fprintf(log_file, "%s ", format_timestamp(tmp, clock_ms()));
+        fwrite(data, 1, len, log_file);
+        fflush(log_file);
+    }
+    pthread_mutex_unlock(&log_file_mtx);
+}
+
+/**
+ * Destructor of the ring key, the writer still has to drain the ring
+ */
+static void
+orphan_thread_ring(void *ring)
+{
+    __atomic_store_n(&((log_ring_t*)ring)->orphaned, true, __ATOMIC_RELEASE);
+    thread_ring = NULL;
+}
+
+static log_ring_t*
+get_thread_ring()
+{
+    if (thread_ring != NULL) return thread_ring;
+
+    log_ring_t *ring = calloc(1, sizeof(log_ring_t));
+    if (ring == NULL) return NULL;
+
+    ring->data = malloc(LOG_RING_SIZE);
+    if (ring->data == NULL) {
+        free(ring);
+        return NULL;
+    }
+
+    // Registered once per thread, rings live until the thread exits or the log is closed
+    pthread_mutex_lock(&logger.rings_mtx);
+    if (!logger.ring_key_created) {
+        logger.ring_key_created = (pthread_key_create(&logger.ring_key, orphan_thread_ring) == 0);
+    }
+    if (logger.ring_key_created) pthread_setspecific(logger.ring_key, ring);
+    ring->next = logger.rings;
+    logger.rings = ring;
+    pthread_mutex_unlock(&logger.rings_mtx);
+
+    thread_ring = ring;
+    return ring;
+}
+
+/**
+ * Copies a record in the calling thread ring, when the ring is full the record
+ * is dropped or the thread waits for the writer, according to the policy
+ */
+static void
+submit_record(log_record_kind kind, const char *data, size_t len, bool must_block)
+{
+    log_ring_t *ring = (__atomic_load_n(&logger.running, __ATOMIC_ACQUIRE)) ? get_thread_ring() : NULL;
+    if (ring == NULL) {
+        write_record_sync(kind, data, len);
+        return;
+    }
+
+    size_t need = LOG_ALIGN(sizeof(log_record_t) + len);
+    size_t tail = ring->tail;
+    size_t offset = tail & (LOG_RING_SIZE - 1);
+    size_t contiguous = LOG_RING_SIZE - offset;
+    size_t total = (contiguous < need) ? contiguous + need : need;
+
+    while (LOG_RING_SIZE - (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) < total) {
+        if (!must_block && logger.policy == LOG_DROP) {
+            __atomic_fetch_add(&logger.dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        if (!__atomic_load_n(&logger.running, __ATOMIC_ACQUIRE)) {
+            write_record_sync(kind, data, len);
+            return;
+        }
+        msleep(1);
+    }
+
+    // Records never wrap around, the end of the ring is skipped instead
+    if (contiguous < need) {
+        ((log_record_t*)(ring->data + offset))->len = LOG_WRAP;
+        tail += contiguous;
+        offset = 0;
+    }
+
+    log_record_t *record = (log_record_t*)(ring->data + offset);
+    record->len = len;
+    record->kind = kind;
+    record->ms = (kind == LOG_OP) ? ((op_record_t*)data)->ms : __atomic_load_n(&logger.now_ms, __ATOMIC_RELAXED);
+    record->seq = __atomic_fetch_add(&logger.seq, 1, __ATOMIC_RELAXED);
+    memcpy(ring->data + offset + sizeof(log_record_t), data, len);
+
+    __atomic_store_n(&ring->tail, tail + need, __ATOMIC_RELEASE);
+}
+
+/**
+ * Returns the next record of ring, NULL if it is empty
+ */
+static log_record_t*
+peek_record(log_ring_t *ring)
+{
+    size_t head = ring->head;
+    if (head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) return NULL;
+
+    log_record_t *record = (log_record_t*)(ring->data + (head & (LOG_RING_SIZE - 1)));
+    if (record->len == LOG_WRAP) {
+        head += LOG_RING_SIZE - (head & (LOG_RING_SIZE - 1));
+        __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+        if (head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) return NULL;
+        record = (log_record_t*)ring->data;
+    }
+
+    return record;
+}
+
+static void
+flush_batch(log_batch_t *batch)
+{
+    if (batch->len == 0) return;
+    if (batch->fd != -1) writen(batch->fd, batch->data, batch->len);
+    batch->len = 0;
+}
+
+/**
+ * Moves records from all rings to the log files, oldest first.
+ * Returns the number of records written.
+ */
+static int
+drain_rings(log_batch_t *text, log_batch_t *ops)
+{
+    int written = 0;
+
+    pthread_mutex_lock(&logger.rings_mtx);
+    log_ring_t *rings = logger.rings;
+    pthread_mutex_unlock(&logger.rings_mtx);
+
+    while (true) {
+        // Merging rings in submission order, the cached clock has ties
+        log_ring_t *oldest_ring = NULL;
+        log_record_t *oldest = NULL;
+        for (log_ring_t *ring = rings; ring != NULL; ring = ring->next) {
+            log_record_t *record = peek_record(ring);
+            if (record != NULL && (oldest == NULL || record->seq < oldest->seq)) {
+                oldest = record;
+                oldest_ring = ring;
+            }
+        }
+        if (oldest == NULL) break;
+
+        if (oldest->kind == LOG_OP) {
+            if (ops->len + oldest->len > LOG_BATCH_SIZE) flush_batch(ops);
+
+            memcpy(ops->data + ops->len, (char*)oldest + sizeof(log_record_t), oldest->len);
+            ops->len += oldest->len;
+        } else {
+            if (text->len + 32 + oldest->len > LOG_BATCH_SIZE) flush_batch(text);
+
+            char tmp[50];
+            int ts_len = sprintf(text->data + text->len, "%s ", format_timestamp(tmp, oldest->ms));
+            memcpy(text->data + text->len + ts_len, (char*)oldest + sizeof(log_record_t), oldest->len);
+            text->len += ts_len + oldest->len;
+        }
+
+        __atomic_store_n(&oldest_ring->head, oldest_ring->head + LOG_ALIGN(sizeof(log_record_t) + oldest->len), __ATOMIC_RELEASE);
+        written++;
+    }
+
+    return written;
+}
+
+/**
+ * Frees the rings of exited threads the writer has drained
+ */
+static void
+free_orphaned_rings()
+{
+    pthread_mutex_lock(&logger.rings_mtx);
+    log_ring_t **link = &logger.rings;
+    while (*link != NULL) {
+        log_ring_t *ring = *link;
+        if (__atomic_load_n(&ring->orphaned, __ATOMIC_ACQUIRE) && ring->head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) {
+            *link = ring->next;
+            free(ring->data);
+            free(ring);
+        } else {
+            link = &ring->next;
+        }
+    }
+    pthread_mutex_unlock(&logger.rings_mtx);
+}
+
+static void*
+log_writer_thread(void *arg)
+{
+    log_batch_t text = { malloc(LOG_BATCH_SIZE), 0, fileno(log_file) };
+    log_batch_t ops = { malloc(LOG_BATCH_SIZE), 0, logger.op_fd };
+    unsigned long reported_drops = 0;
+
+    while (true) {
+        __atomic_store_n(&logger.now_ms, clock_ms(), __ATOMIC_RELAXED);
+
+        bool stop = __atomic_load_n(&logger.stop, __ATOMIC_ACQUIRE);
+        int written = drain_rings(&text, &ops);
+
+        unsigned long dropped = __atomic_load_n(&logger.dropped, __ATOMIC_RELAXED);
+        if (dropped != reported_drops) {
+            char tmp[50];
+            if (text.len + 128 > LOG_BATCH_SIZE) flush_batch(&text);
+            text.len += sprintf(text.data + text.len, "%s [ WARNING ] %lu log records dropped, log ring full\n",
+                format_timestamp(tmp, logger.now_ms), dropped - reported_drops);
+            reported_drops = dropped;
+        }
+
+        flush_batch(&text);
+        flush_batch(&ops);
+        free_orphaned_rings();
+
+        // Last pass after stop was requested drains everything
+        if (stop) break;
+        if (written == 0) msleep(1);
+    }
+
+    free(text.data);
+    free(ops.data);
+    return NULL;
+}
+
+/**
+ * Opens the binary operation log and writes its header
+ */
+static int
+open_op_log(const char *op_path)
+{
+    int fd = open(op_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) return -1;
+
+    op_log_header_t header;
+    memset(&header, 0, sizeof(header));
+    strncpy(header.magic, OP_LOG_MAGIC, sizeof(header.magic));
+    header.version = OP_LOG_VERSION;
+    header.record_size = sizeof(op_record_t);
+
+    if (writen(fd, &header, sizeof(header)) != sizeof(header)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void
+log_init(const char* path, const char* op_path, log_full_policy policy)
 {
     log_level = LOG_INFO;
+    logger.policy = policy;
 
     if (path && *path != '\0') {
         log_file = fopen(path, "w+");
@@ -35,124 +386,232 @@ log_init(const char* path)
 
         log_file = stderr;
     }
+
+    if (op_path && *op_path != '\0') {
+        logger.op_fd = open_op_log(op_path);
+        if (logger.op_fd == -1) {
+            fprintf(log_file, "[ WARNING ] Could not open operation log %s: %s\n", op_path, strerror(errno));
+        }
+    }
+
+    logger.now_ms = clock_ms();
+    logger.stop = false;
+
+    // Writer must not receive signals meant for the signal handler thread
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    if (pthread_create(&logger.writer, NULL, log_writer_thread, NULL) == 0) {
+        __atomic_store_n(&logger.running, true, __ATOMIC_RELEASE);
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
 }
 
-void 
-set_log_level(loglevel level) 
+void
+set_log_level(loglevel level)
 {
     log_level = level;
 }
 
-int 
-logfatal(const char *file, const int line, const char* format, ...) 
+void
+set_log_sampling(unsigned int one_in)
 {
-    char tmp[50] = { 0 };
-    va_list args;
-    va_start (args, format);
+    log_sample_every = (one_in == 0) ? 1 : one_in;
+}
 
-    lock_return((&log_file_mtx), -1);
-    fprintf(log_file, "%s ", get_timestamp(tmp));
-    fprintf(log_file, "%s:%d: [ FATAL ERROR ] ", file, line);
-    vfprintf (log_file, format, args);
-    unlock_return((&log_file_mtx), -1);
+void
+log_sample_request()
+{
+    request_sampled = (requests_seen++ % log_sample_every) == 0;
+}
 
-    va_end (args);
-    fflush(log_file);
+/**
+ * Formats prefix and message in a single line and submits it
+ */
+static int
+log_line(bool must_block, const char *prefix, const char *format, va_list args)
+{
+    char line[LOG_LINE_MAX];
+
+    int len = snprintf(line, LOG_LINE_MAX, "%s", prefix);
+    if (len < 0) return -1;
+
+    int msg_len = vsnprintf(line + len, LOG_LINE_MAX - len, format, args);
+    if (msg_len < 0) return -1;
+
+    len += msg_len;
+    if (len >= LOG_LINE_MAX) {
+        // Truncated lines still end with a newline
+        len = LOG_LINE_MAX - 1;
+        line[len - 1] = '\n';
+    }
+
+    submit_record(LOG_TEXT, line, len, must_block);
     return 0;
 }
 
-int 
-logerror(const char *file, const int line, const char* format, ...) 
+int
+log_op(int worker, int op, int status, const char *path, size_t bytes, uint64_t latency_us)
+{
+    if (logger.op_fd == -1) return 0;
+
+    op_record_t record;
+    record.ms = (__atomic_load_n(&logger.running, __ATOMIC_ACQUIRE)) ? __atomic_load_n(&logger.now_ms, __ATOMIC_RELAXED) : clock_ms();
+    record.path_hash = 0;
+    record.bytes = bytes;
+    record.latency_us = (latency_us > UINT32_MAX) ? UINT32_MAX : latency_us;
+    record.worker = worker;
+    record.op = op;
+    record.status = status;
+
+    // FNV-1a
+    if (path != NULL && *path != '\0') {
+        record.path_hash = 14695981039346656037ULL;
+        for (const unsigned char *p = (const unsigned char*)path; *p != '\0'; p++) {
+            record.path_hash ^= *p;
+            record.path_hash *= 1099511628211ULL;
+        }
+    }
+
+    // Statistics are computed from the operation log, its records are never dropped
+    submit_record(LOG_OP, (char*)&record, sizeof(record), true);
+    return 0;
+}
+
+int
+logfatal(const char *file, const int line, const char* format, ...)
+{
+    char prefix[256];
+    snprintf(prefix, sizeof(prefix), "%s:%d: [ FATAL ERROR ] ", file, line);
+
+    va_list args;
+    va_start (args, format);
+    int res = log_line(true, prefix, format, args);
+    va_end (args);
+
+    return res;
+}
+
+int
+logerror(const char *file, const int line, const char* format, ...)
 {
     if (log_level >= LOG_ERROR) {
-        char tmp[50] = { 0 };
         va_list args;
         va_start (args, format);
-
-        lock_return((&log_file_mtx), -1);
-        fprintf(log_file, "%s ", get_timestamp(tmp));
-        fprintf(log_file, "[ ERROR ] ");
-        vfprintf (log_file, format, args);
-        unlock_return((&log_file_mtx), -1);
-
+        int res = log_line(false, "[ ERROR ] ", format, args);
         va_end (args);
-        fflush(log_file);
+        return res;
     }
     return 0;
 }
 
-int 
-loginfo(const char* format, ...) 
+int
+loginfo(const char* format, ...)
 {
     if (log_level >= LOG_INFO) {
-        char tmp[50] = { 0 };
         va_list args;
         va_start (args, format);
+        int res = log_line(false, "[ INFO ] ", format, args);
+        va_end (args);
+        return res;
+    }
 
-        lock_return((&log_file_mtx), -1);
-        fprintf(log_file, "%s ", get_timestamp(tmp));
-        fprintf(log_file, "[ INFO ] ");
-        vfprintf (log_file, format, args);
-        unlock_return((&log_file_mtx), -1);
+    return 0;
+}
 
+int
+logrequest(const char* format, ...)
+{
+    if (log_level >= LOG_INFO && request_sampled) {
+        va_list args;
+        va_start (args, format);
+        int res = log_line(false, "[ INFO ] ", format, args);
         va_end (args);
-        fflush(log_file);
+        return res;
     }
 
     return 0;
 }
 
-int 
-logwarning(const char *file, const int line, const char* format, ...) 
+int
+logwarning(const char *file, const int line, const char* format, ...)
 {
     if (log_level >= LOG_WARNING) {
-        char tmp[50] = { 0 };
+        char prefix[256];
+        snprintf(prefix, sizeof(prefix), "%s:%d: [ WARNING ] ", file, line);
+
         va_list args;
         va_start (args, format);
-
-        lock_return((&log_file_mtx), -1);
-        fprintf(log_file, "%s ", get_timestamp(tmp));
-        fprintf(log_file, "%s:%d: [ WARNING ] ", file, line);
-        vfprintf (log_file, format, args);
-        unlock_return((&log_file_mtx), -1);
-        
+        int res = log_line(false, prefix, format, args);
         va_end (args);
-        fflush(log_file);
+        return res;
     }
 
     return 0;
 }
 
-int 
-logdebug(const char *file, const int line, const char* format, ...) 
+int
+logdebug(const char *file, const int line, const char* format, ...)
 {
     if (log_level >= LOG_DEBUG) {
-        char tmp[50] = { 0 };
+        char prefix[256];
+        snprintf(prefix, sizeof(prefix), "%s:%d: ", file, line);
+
         va_list args;
         va_start (args, format);
-
-        lock_return((&log_file_mtx), -1);
-        fprintf(log_file, "%s ", get_timestamp(tmp));
-        fprintf(log_file, "%s:%d: ", file, line);
-        vfprintf (log_file, format, args);
-        unlock_return((&log_file_mtx), -1);
-        
+        int res = log_line(false, prefix, format, args);
         va_end (args);
-        fflush(log_file);
+        return res;
     }
 
     return 0;
 }
 
-void 
-flush_log() 
+void
+flush_log()
 {
+    // Waiting for the writer to drain all rings
+    if (__atomic_load_n(&logger.running, __ATOMIC_ACQUIRE)) {
+        pthread_mutex_lock(&logger.rings_mtx);
+        for (log_ring_t *ring = logger.rings; ring != NULL; ring = ring->next) {
+            while (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) != __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) {
+                msleep(1);
+            }
+        }
+        pthread_mutex_unlock(&logger.rings_mtx);
+    }
     fflush(log_file);
 }
 
-void 
-close_log() 
+void
+close_log()
 {
+    if (__atomic_load_n(&logger.running, __ATOMIC_ACQUIRE)) {
+        __atomic_store_n(&logger.stop, true, __ATOMIC_RELEASE);
+        pthread_join(logger.writer, NULL);
+        __atomic_store_n(&logger.running, false, __ATOMIC_RELEASE);
+
+        // Late lines from other threads are written synchronously
+        pthread_mutex_lock(&logger.rings_mtx);
+        if (logger.ring_key_created) {
+            pthread_key_delete(logger.ring_key);
+            logger.ring_key_created = false;
+        }
+        while (logger.rings != NULL) {
+            log_ring_t *ring = logger.rings;
+            logger.rings = ring->next;
+            free(ring->data);
+            free(ring);
+        }
+        pthread_mutex_unlock(&logger.rings_mtx);
+        thread_ring = NULL;
+    }
+
+    if (logger.op_fd != -1) {
+        close(logger.op_fd);
+        logger.op_fd = -1;
+    }
+
     if(log_file != stdout)
         fclose(log_file);
     log_file = NULL;
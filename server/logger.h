@@ -2,10 +2,21 @@
 #define LOGGER_H
 
 #include <stdio.h>
+#include <stdint.h>
 
 #include "server_config.h"
+#include "server/op_log.h"
 
 
+/**
+ * Most verbose level compiled in, as a loglevel value. Calls
+ * to more verbose levels expand to nothing. Override it with
+ * make LOG_MIN_LEVEL=4 to get debug lines back.
+ */
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL   2
+#endif
+
 typedef enum {
     LOG_FATAL   = 0,
     LOG_ERROR   = 1,
@@ -14,17 +25,41 @@ typedef enum {
     LOG_DEBUG   = 4,
 } loglevel;
 
+/**
+ * What to do when a thread logs faster than the
+ * writer thread can empty its ring buffer
+ */
+typedef enum {
+    LOG_DROP    = 0,
+    LOG_BLOCK   = 1,
+} log_full_policy;
+
 /* Configuration */
-void log_init(const char* path);
+void log_init(const char* path, const char* op_path, log_full_policy policy);
 void set_log_level(loglevel level);
+void set_log_sampling(unsigned int one_in);
+
+/**
+ * Starts a new request on the calling thread, deciding whether its
+ * log_request lines are written. One request in every one_in is.
+ */
+void log_sample_request();
 
 /* Logging Functions */
 int logfatal(const char *file, const int line, const char *fmt, ...);
 int logerror(const char *file, const int line, const char *fmt, ...);
 int loginfo(const char *fmt, ...);
+int logrequest(const char *fmt, ...);
 int logwarning(const char *file, const int line, const char *fmt, ...);
 int logdebug(const char *file, const int line, const char *fmt, ...); 
 
+/**
+ * Appends a record to the binary operation log, if there is one.
+ * Op is a request_code or an op_code, status a response_code. Records are
+ * never dropped, the caller waits for space in its ring instead.
+ */
+int log_op(int worker, int op, int status, const char *path, size_t bytes, uint64_t latency_us);
+
 /* Cleanup */
 void flush_log();
 void close_log();
@@ -32,9 +67,26 @@ void close_log();
 /* Wrappers */
 #define log_fatal(fmt, args...) logfatal(__FILE__, __LINE__, fmt, ##args); 
 #define log_error(fmt, args...) logerror(__FILE__, __LINE__, fmt, ##args); 
+
+#if LOG_MIN_LEVEL >= 2
 #define log_info(fmt, args...) loginfo(fmt, ##args); 
+#define log_request(fmt, args...) logrequest(fmt, ##args); 
+#else
+#define log_info(fmt, args...) ((void)0);
+#define log_request(fmt, args...) ((void)0);
+#endif
+
+#if LOG_MIN_LEVEL >= 3
 #define log_warning(fmt, args...) logwarning(__FILE__, __LINE__, fmt, ##args);
+#else
+#define log_warning(fmt, args...) ((void)0);
+#endif
+
+#if LOG_MIN_LEVEL >= 4
 #define log_debug(fmt, args...) logdebug(__FILE__, __LINE__, fmt, ##args); 
+#else
+#define log_debug(fmt, args...) ((void)0);
+#endif
 
 
 #endif
\ No newline at end of file
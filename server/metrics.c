@@ -0,0 +1,305 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "server/metrics.h"
+
+/**
+ * Metrics of a single thread, only written by its owner
+ */
+typedef struct _metrics_shard_t {
+    uint64_t                    counters[METRIC_COUNTERS];
+    uint64_t                    request_errors[METRICS_REQUEST_CODES];
+    histogram_t                 histograms[HISTOGRAMS];
+    int                         worker;     /* -1 if not a worker */
+    bool                        busy;
+    struct _metrics_shard_t     *next;
+} metrics_shard_t;
+
+static struct {
+    metrics_shard_t     *shards;
+    metrics_shard_t     retired;    /* sum of the shards of exited threads */
+    pthread_mutex_t     shards_mtx;
+    pthread_key_t       shard_key;
+    bool                shard_key_created;
+    size_t              peak_size;
+    size_t              peak_files;
+} metrics = {
+    .retired.worker = -1,
+    .shards_mtx = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static __thread metrics_shard_t *thread_shard = NULL;
+static __thread uint64_t lock_acquired_us = 0;
+
+uint64_t
+metrics_now_us()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/**
+ * Adds the counters and histograms of shard to the given totals
+ */
+static void
+add_shard(uint64_t *counters, uint64_t *request_errors, histogram_t *histograms, metrics_shard_t *shard)
+{
+    for (int i = 0; i < METRIC_COUNTERS; i++) {
+        counters[i] += __atomic_load_n(&shard->counters[i], __ATOMIC_RELAXED);
+    }
+
+    for (int i = 0; i < METRICS_REQUEST_CODES; i++) {
+        request_errors[i] += __atomic_load_n(&shard->request_errors[i], __ATOMIC_RELAXED);
+    }
+
+    for (int i = 0; i < HISTOGRAMS; i++) {
+        histogram_t *from = &shard->histograms[i], *into = &histograms[i];
+        if (__atomic_load_n(&from->count, __ATOMIC_RELAXED) == 0) continue;
+
+        for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+            into->buckets[b] += __atomic_load_n(&from->buckets[b], __ATOMIC_RELAXED);
+        }
+        into->count += __atomic_load_n(&from->count, __ATOMIC_RELAXED);
+        into->sum += __atomic_load_n(&from->sum, __ATOMIC_RELAXED);
+
+        uint64_t max = __atomic_load_n(&from->max, __ATOMIC_RELAXED);
+        if (max > into->max) into->max = max;
+    }
+}
+
+/**
+ * Destructor of the shard key, totals of the exiting thread are kept
+ */
+static void
+retire_thread_shard(void *arg)
+{
+    metrics_shard_t *shard = (metrics_shard_t*)arg;
+
+    pthread_mutex_lock(&metrics.shards_mtx);
+    add_shard(metrics.retired.counters, metrics.retired.request_errors, metrics.retired.histograms, shard);
+    metrics_shard_t **link = &metrics.shards;
+    while (*link != shard) link = &(*link)->next;
+    *link = shard->next;
+    pthread_mutex_unlock(&metrics.shards_mtx);
+
+    free(shard);
+    thread_shard = NULL;
+}
+
+static metrics_shard_t*
+get_thread_shard()
+{
+    if (thread_shard != NULL) return thread_shard;
+
+    metrics_shard_t *shard = calloc(1, sizeof(metrics_shard_t));
+    if (shard == NULL) return NULL;
+    shard->worker = -1;
+
+    // Registered once per thread, shards are retired when it exits
+    pthread_mutex_lock(&metrics.shards_mtx);
+    if (!metrics.shard_key_created) {
+        metrics.shard_key_created = (pthread_key_create(&metrics.shard_key, retire_thread_shard) == 0);
+    }
+    if (metrics.shard_key_created) pthread_setspecific(metrics.shard_key, shard);
+    shard->next = metrics.shards;
+    metrics.shards = shard;
+    pthread_mutex_unlock(&metrics.shards_mtx);
+
+    thread_shard = shard;
+    return shard;
+}
+
+/**
+ * Adds n to a value written only by the calling thread
+ */
+static inline void
+shard_add(uint64_t *value, uint64_t n)
+{
+    __atomic_store_n(value, *value + n, __ATOMIC_RELAXED);
+}
+
+static int
+bucket_of(uint64_t value)
+{
+    if (value >= (1ULL << HISTOGRAM_MAX_BITS)) value = (1ULL << HISTOGRAM_MAX_BITS) - 1;
+    if (value < (1 << HISTOGRAM_SUB_BITS)) return value;
+
+    int exponent = 63 - __builtin_clzll(value);
+    int sub_bucket = (value >> (exponent - HISTOGRAM_SUB_BITS)) & ((1 << HISTOGRAM_SUB_BITS) - 1);
+    return ((exponent - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS) + sub_bucket;
+}
+
+/**
+ * Highest value recorded in bucket
+ */
+static uint64_t
+bucket_value(int bucket)
+{
+    if (bucket < (1 << HISTOGRAM_SUB_BITS)) return bucket;
+
+    int exponent = (bucket >> HISTOGRAM_SUB_BITS) + HISTOGRAM_SUB_BITS - 1;
+    int sub_bucket = bucket & ((1 << HISTOGRAM_SUB_BITS) - 1);
+    uint64_t width = 1ULL << (exponent - HISTOGRAM_SUB_BITS);
+    return ((1ULL << HISTOGRAM_SUB_BITS) + sub_bucket) * width + width - 1;
+}
+
+void
+metrics_set_worker(int worker_id)
+{
+    metrics_shard_t *shard = get_thread_shard();
+    if (shard == NULL) return;
+
+    __atomic_store_n(&shard->worker, worker_id, __ATOMIC_RELAXED);
+}
+
+void
+metrics_set_busy(bool busy)
+{
+    metrics_shard_t *shard = get_thread_shard();
+    if (shard == NULL) return;
+
+    __atomic_store_n(&shard->busy, busy, __ATOMIC_RELAXED);
+}
+
+void
+metrics_count(metric_counter counter, uint64_t n)
+{
+    metrics_shard_t *shard = get_thread_shard();
+    if (shard == NULL) return;
+
+    shard_add(&shard->counters[counter], n);
+}
+
+static void
+histogram_add(histogram_t *histogram, uint64_t value)
+{
+    shard_add(&histogram->buckets[bucket_of(value)], 1);
+    shard_add(&histogram->count, 1);
+    shard_add(&histogram->sum, value);
+    if (value > histogram->max) __atomic_store_n(&histogram->max, value, __ATOMIC_RELAXED);
+}
+
+void
+metrics_record(metric_histogram histogram, uint64_t value_us)
+{
+    metrics_shard_t *shard = get_thread_shard();
+    if (shard == NULL) return;
+
+    histogram_add(&shard->histograms[histogram], value_us);
+}
+
+void
+metrics_request(request_code code, response_code status, uint64_t latency_us)
+{
+    metrics_shard_t *shard = get_thread_shard();
+    if (shard == NULL) return;
+
+    int index = code - OPEN_CONNECTION;
+    if (index < 0 || index >= METRICS_REQUEST_CODES) return;
+
+    shard_add(&shard->counters[METRIC_REQUESTS], 1);
+    histogram_add(&shard->histograms[HISTOGRAM_REQUESTS + index], latency_us);
+
+    if (status != SUCCESS && status != ACCEPTED) {
+        shard_add(&shard->counters[METRIC_ERRORS], 1);
+        shard_add(&shard->request_errors[index], 1);
+    }
+}
+
+/**
+ * Raises *peak to value, if lower
+ */
+static void
+atomic_max(size_t *peak, size_t value)
+{
+    size_t current = __atomic_load_n(peak, __ATOMIC_RELAXED);
+    while (value > current
+            && !__atomic_compare_exchange_n(peak, &current, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+void
+metrics_peak(size_t size, size_t files)
+{
+    atomic_max(&metrics.peak_size, size);
+    atomic_max(&metrics.peak_files, files);
+}
+
+void
+metrics_lock_acquired()
+{
+    lock_acquired_us = metrics_now_us();
+}
+
+void
+metrics_lock_released()
+{
+    if (lock_acquired_us == 0) return;
+    metrics_record(HISTOGRAM_LOCK_HOLD, metrics_now_us() - lock_acquired_us);
+    lock_acquired_us = 0;
+}
+
+void
+metrics_snapshot(metrics_snapshot_t *snapshot)
+{
+    memset(snapshot, 0, sizeof(metrics_snapshot_t));
+
+    pthread_mutex_lock(&metrics.shards_mtx);
+    add_shard(snapshot->counters, snapshot->request_errors, snapshot->histograms, &metrics.retired);
+    for (metrics_shard_t *shard = metrics.shards; shard != NULL; shard = shard->next) {
+        add_shard(snapshot->counters, snapshot->request_errors, snapshot->histograms, shard);
+
+        int worker = __atomic_load_n(&shard->worker, __ATOMIC_RELAXED);
+        if (worker >= 0 && worker < METRICS_MAX_WORKERS) {
+            snapshot->worker_requests[worker] = __atomic_load_n(&shard->counters[METRIC_REQUESTS], __ATOMIC_RELAXED);
+            snapshot->worker_busy[worker] = __atomic_load_n(&shard->busy, __ATOMIC_RELAXED);
+            if (worker >= snapshot->n_workers) snapshot->n_workers = worker + 1;
+        }
+    }
+    pthread_mutex_unlock(&metrics.shards_mtx);
+
+    snapshot->peak_size = __atomic_load_n(&metrics.peak_size, __ATOMIC_RELAXED);
+    snapshot->peak_files = __atomic_load_n(&metrics.peak_files, __ATOMIC_RELAXED);
+}
+
+uint64_t
+histogram_percentile(const histogram_t *histogram, double p)
+{
+    // Buckets may be read while being updated, their sum is the count
+    uint64_t total = 0;
+    for (int b = 0; b < HISTOGRAM_BUCKETS; b++) total += histogram->buckets[b];
+    if (total == 0) return 0;
+
+    uint64_t rank = (uint64_t)(p * total + 0.999999);
+    if (rank == 0) rank = 1;
+    if (rank > total) rank = total;
+
+    uint64_t seen = 0;
+    for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+        seen += histogram->buckets[b];
+        if (seen >= rank) {
+            uint64_t value = bucket_value(b);
+            return (value > histogram->max) ? histogram->max : value;
+        }
+    }
+
+    return histogram->max;
+}
+
+void
+metrics_destroy()
+{
+    pthread_mutex_lock(&metrics.shards_mtx);
+    if (metrics.shard_key_created) {
+        pthread_key_delete(metrics.shard_key);
+        metrics.shard_key_created = false;
+    }
+    while (metrics.shards != NULL) {
+        metrics_shard_t *shard = metrics.shards;
+        metrics.shards = shard->next;
+        free(shard);
+    }
+    pthread_mutex_unlock(&metrics.shards_mtx);
+    thread_shard = NULL;
+}
@@ -0,0 +1,144 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "utils/protocol.h"
+#include "utils/utilities.h"
+#include "server/trace.h"
+
+/**
+ * Server metrics. Every thread updates its own shard of counters and
+ * histograms with plain relaxed stores, readers sum all shards into a
+ * snapshot. The hot path never takes a lock, a mutex is only taken the
+ * first time a thread records something and while taking a snapshot.
+ */
+
+/* Request codes with a histogram of their own, starting at OPEN_CONNECTION */
+#define METRICS_REQUEST_CODES   16
+
+/* Workers reported one by one, others only count in the totals */
+#define METRICS_MAX_WORKERS     64
+
+/**
+ * HDR style histogram of microseconds: values below 2^SUB_BITS have a
+ * bucket each, above that every power of two is split in 2^SUB_BITS
+ * buckets, so values are recorded with a relative error below 1/16
+ */
+#define HISTOGRAM_SUB_BITS      4
+#define HISTOGRAM_MAX_BITS      36
+#define HISTOGRAM_BUCKETS       ((HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS)
+
+typedef struct _histogram_t {
+    uint64_t    buckets[HISTOGRAM_BUCKETS];
+    uint64_t    count;
+    uint64_t    sum;
+    uint64_t    max;
+} histogram_t;
+
+typedef enum {
+    METRIC_REQUESTS     = 0,
+    METRIC_ERRORS       = 1,
+    METRIC_BYTES_IN     = 2,    /* request bodies */
+    METRIC_BYTES_OUT    = 3,    /* files sent to clients */
+    METRIC_EVICTIONS    = 4,    /* files demoted or expelled */
+    METRIC_COUNTERS     = 5,
+} metric_counter;
+
+typedef enum {
+    HISTOGRAM_QUEUE_WAIT    = 0,    /* request_queue, enqueue to dequeue */
+    HISTOGRAM_LOCK_HOLD     = 1,    /* storage->access */
+    HISTOGRAM_REQUESTS      = 2,    /* first request code histogram */
+    HISTOGRAMS              = HISTOGRAM_REQUESTS + METRICS_REQUEST_CODES,
+} metric_histogram;
+
+/**
+ * Sum of all shards
+ */
+typedef struct _metrics_snapshot_t {
+    uint64_t        counters[METRIC_COUNTERS];
+    uint64_t        request_errors[METRICS_REQUEST_CODES];
+    histogram_t     histograms[HISTOGRAMS];
+    size_t          peak_size;
+    size_t          peak_files;
+    /* Per worker, up to the highest worker id seen */
+    int             n_workers;
+    uint64_t        worker_requests[METRICS_MAX_WORKERS];
+    bool            worker_busy[METRICS_MAX_WORKERS];
+} metrics_snapshot_t;
+
+/**
+ * Monotonic clock in microseconds
+ */
+uint64_t
+metrics_now_us();
+
+/**
+ * Tags the metrics of the calling thread as those of a worker
+ */
+void
+metrics_set_worker(int worker_id);
+
+/**
+ * Marks the calling worker as serving a request or idle
+ */
+void
+metrics_set_busy(bool busy);
+
+void
+metrics_count(metric_counter counter, uint64_t n);
+
+void
+metrics_record(metric_histogram histogram, uint64_t value_us);
+
+/**
+ * Records a request served by a worker, latency goes in the histogram of
+ * its request code, statuses other than SUCCESS and ACCEPTED are errors
+ */
+void
+metrics_request(request_code code, response_code status, uint64_t latency_us);
+
+/**
+ * Records storage occupancy, to be called with storage locked after it grows
+ */
+void
+metrics_peak(size_t size, size_t files);
+
+/**
+ * Marks the storage lock as taken or released by the calling thread,
+ * the time in between goes in HISTOGRAM_LOCK_HOLD
+ */
+void
+metrics_lock_acquired();
+
+void
+metrics_lock_released();
+
+#define timed_lock_return(mtx, ret) { \
+            lock_return(mtx, ret); metrics_lock_acquired(); trace_mark(TRACE_LOCKED); }
+
+#define timed_unlock_return(mtx, ret) { \
+            metrics_lock_released(); unlock_return(mtx, ret); }
+
+/**
+ * Sums all shards in snapshot
+ */
+void
+metrics_snapshot(metrics_snapshot_t *snapshot);
+
+/**
+ * Gets the value below which a fraction p of the values of histogram are,
+ * as the highest value of its bucket. Returns 0 if the histogram is empty.
+ */
+uint64_t
+histogram_percentile(const histogram_t *histogram, double p);
+
+/**
+ * Frees all shards, threads must not record anything afterwards
+ */
+void
+metrics_destroy();
+
+#endif
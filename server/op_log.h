@@ -0,0 +1,52 @@
+#ifndef OP_LOG_H
+#define OP_LOG_H
+
+#include <stdint.h>
+
+/**
+ * Binary operation log, written by the server logger and read back
+ * offline by the decoder. The file starts with an op_log_header_t and
+ * is followed by op_record_t records, in the byte order of the server.
+ */
+
+#define OP_LOG_MAGIC        "FSOPLOG"
+#define OP_LOG_VERSION      1
+
+/* Worker id of records logged by the main server thread */
+#define OP_LOG_SERVER       UINT16_MAX
+
+/**
+ * Operation codes of records that are not requests,
+ * requests are logged with their request_code
+ */
+typedef enum {
+    OP_FILE_EXPELLED    = 200,
+    OP_MAX_CONNECTIONS  = 201,
+} op_code;
+
+typedef struct _op_log_header_t {
+    char        magic[8];
+    uint32_t    version;
+    uint32_t    record_size;
+} op_log_header_t;
+
+/**
+ * One operation performed by the server
+ */
+typedef struct _op_record_t {
+    /* Milliseconds since the epoch */
+    uint64_t    ms;
+    /* FNV-1a hash of the file path, 0 if there is none */
+    uint64_t    path_hash;
+    /* Bytes read or written, or the value of server records */
+    uint64_t    bytes;
+    /* Time from request received to response sent */
+    uint32_t    latency_us;
+    uint16_t    worker;
+    /* request_code or op_code */
+    uint8_t     op;
+    /* response_code */
+    uint8_t     status;
+} op_record_t;
+
+#endif
@@ -0,0 +1,175 @@
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "server/payload.h"
+#include "server/slab.h"
+
+/**
+ * Sizes classes are 16, 32, 48 and 64 bytes, then four for each power of
+ * two up to PAYLOAD_MAX_CLASS, no class wastes more than a fifth of it
+ */
+#define PAYLOAD_CLASSES     48
+
+static struct {
+    slab_cache_t    classes[PAYLOAD_CLASSES];
+    size_t          page_size;
+    bool            huge_pages;
+    bool            initialized;
+    size_t          requested_bytes;
+    size_t          large_bytes;
+} arena;
+
+static int
+size_class(size_t size)
+{
+    if (size <= 64) return (size + 15) / 16 - 1;
+
+    // size is in (2^shift, 2^(shift + 1)], split in four classes
+    int shift = 63 - __builtin_clzl(size - 1);
+    return 4 + (shift - 6) * 4 + ((size - 1) >> (shift - 2)) - 4;
+}
+
+static size_t
+class_size(int class)
+{
+    if (class < 4) return 16 * (class + 1);
+
+    int shift = 6 + (class - 4) / 4;
+    return ((size_t)1 << shift) + ((class - 4) % 4 + 1) * ((size_t)1 << (shift - 2));
+}
+
+static size_t
+large_size(size_t size)
+{
+    return (size + arena.page_size - 1) / arena.page_size * arena.page_size;
+}
+
+static void*
+large_alloc(size_t size)
+{
+    size_t mapped = large_size(size);
+    void *contents = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (contents == MAP_FAILED) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    if (arena.huge_pages && mapped >= SLAB_HUGE_SIZE) madvise(contents, mapped, MADV_HUGEPAGE);
+    __atomic_fetch_add(&arena.large_bytes, mapped, __ATOMIC_RELAXED);
+    return contents;
+}
+
+static void
+large_free(void *contents, size_t size)
+{
+    size_t mapped = large_size(size);
+    munmap(contents, mapped);
+    __atomic_fetch_sub(&arena.large_bytes, mapped, __ATOMIC_RELAXED);
+}
+
+int
+payload_arena_init(bool huge_pages)
+{
+    arena.page_size = sysconf(_SC_PAGESIZE);
+    arena.huge_pages = huge_pages;
+    arena.requested_bytes = 0;
+    arena.large_bytes = 0;
+
+    for (int i = 0; i < PAYLOAD_CLASSES; i++) {
+        if (slab_cache_init(&arena.classes[i], class_size(i), huge_pages) != 0) {
+            while (--i >= 0) slab_cache_destroy(&arena.classes[i]);
+            return -1;
+        }
+    }
+
+    arena.initialized = true;
+    return 0;
+}
+
+void
+payload_arena_destroy()
+{
+    if (!arena.initialized) return;
+
+    for (int i = 0; i < PAYLOAD_CLASSES; i++) slab_cache_destroy(&arena.classes[i]);
+    arena.initialized = false;
+}
+
+void*
+payload_alloc(size_t size)
+{
+    if (size == 0) return NULL;
+
+    void *contents = (size <= PAYLOAD_MAX_CLASS) ? slab_alloc(&arena.classes[size_class(size)]) : large_alloc(size);
+    if (contents != NULL) __atomic_fetch_add(&arena.requested_bytes, size, __ATOMIC_RELAXED);
+    return contents;
+}
+
+void
+payload_free(void *contents, size_t size)
+{
+    if (contents == NULL || size == 0) return;
+
+    if (size <= PAYLOAD_MAX_CLASS) {
+        slab_free(&arena.classes[size_class(size)], contents);
+    } else {
+        large_free(contents, size);
+    }
+    __atomic_fetch_sub(&arena.requested_bytes, size, __ATOMIC_RELAXED);
+}
+
+void*
+payload_realloc(void *contents, size_t old_size, size_t new_size)
+{
+    if (contents == NULL || old_size == 0) return payload_alloc(new_size);
+    if (new_size == 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    bool old_large = old_size > PAYLOAD_MAX_CLASS, new_large = new_size > PAYLOAD_MAX_CLASS;
+    void *resized = NULL;
+
+    if (!old_large && !new_large && size_class(old_size) == size_class(new_size)) {
+        resized = contents;
+    } else if (old_large && new_large) {
+        // Pages are moved by the kernel, not copied
+        size_t old_mapped = large_size(old_size), new_mapped = large_size(new_size);
+        resized = mremap(contents, old_mapped, new_mapped, MREMAP_MAYMOVE);
+        if (resized == MAP_FAILED) {
+            errno = ENOMEM;
+            return NULL;
+        }
+        if (arena.huge_pages && new_mapped >= SLAB_HUGE_SIZE) madvise(resized, new_mapped, MADV_HUGEPAGE);
+        __atomic_fetch_add(&arena.large_bytes, new_mapped - old_mapped, __ATOMIC_RELAXED);
+    } else {
+        resized = payload_alloc(new_size);
+        if (resized == NULL) return NULL;
+        memcpy(resized, contents, (old_size < new_size) ? old_size : new_size);
+        payload_free(contents, old_size);
+        return resized;
+    }
+
+    __atomic_fetch_add(&arena.requested_bytes, new_size - old_size, __ATOMIC_RELAXED);
+    return resized;
+}
+
+void
+payload_get_stats(payload_stats_t *stats)
+{
+    stats->requested_bytes = __atomic_load_n(&arena.requested_bytes, __ATOMIC_RELAXED);
+    stats->large_bytes = __atomic_load_n(&arena.large_bytes, __ATOMIC_RELAXED);
+    stats->allocated_bytes = stats->large_bytes;
+    stats->resident_bytes = stats->large_bytes;
+
+    if (!arena.initialized) return;
+
+    for (int i = 0; i < PAYLOAD_CLASSES; i++) {
+        slab_stats_t class;
+        slab_get_stats(&arena.classes[i], &class);
+        stats->allocated_bytes += class.object_bytes;
+        stats->resident_bytes += class.slab_bytes;
+    }
+}
@@ -0,0 +1,66 @@
+#ifndef PAYLOAD_H
+#define PAYLOAD_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/**
+ * Largest contents served from slabs, larger ones get a mapping of their own
+ */
+#define PAYLOAD_MAX_CLASS       (128 * 1024)
+
+/**
+ * Memory held by the contents of files
+ */
+typedef struct {
+    size_t  requested_bytes;    /* bytes of contents */
+    size_t  allocated_bytes;    /* bytes of the size classes and mappings they got */
+    size_t  resident_bytes;     /* bytes of slabs and mappings */
+    size_t  large_bytes;        /* bytes of mappings of large contents */
+} payload_stats_t;
+
+/**
+ * Initializes the arena of file contents. Contents up to PAYLOAD_MAX_CLASS
+ * bytes come from slabs of size classes, four for each power of two, larger
+ * ones are mapped on their own. With huge_pages slabs and large mappings are
+ * backed by transparent huge pages when the kernel allows it.
+ * Returns 0 on success, -1 on failure, errno is set.
+ */
+int
+payload_arena_init(bool huge_pages);
+
+/**
+ * Unmaps all memory of the arena, contents still allocated become invalid
+ */
+void
+payload_arena_destroy();
+
+/**
+ * Allocates contents of size bytes, NULL for 0 bytes.
+ * Returns the contents on success, NULL on failure, errno is set.
+ */
+void*
+payload_alloc(size_t size);
+
+/**
+ * Resizes contents of old_size bytes to new_size, they are moved only if
+ * the size class changes.
+ * Returns the contents on success, NULL on failure, errno is set and
+ * contents are left as they are.
+ */
+void*
+payload_realloc(void *contents, size_t old_size, size_t new_size);
+
+/**
+ * Frees contents of size bytes
+ */
+void
+payload_free(void *contents, size_t size);
+
+/**
+ * Reads the memory held by the arena
+ */
+void
+payload_get_stats(payload_stats_t *stats);
+
+#endif
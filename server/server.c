@@ -18,6 +18,10 @@
 #include "server/server_config.h"
 #include "server/lock_manager.h"
 #include "server/signal_handler.h"
+#include "server/snapshot.h"
+#include "server/wal.h"
+#include "server/hot_keys.h"
+#include "server/payload.h"
 #include "server/worker.h"
 
 #define LOG_LVL      LOG_INFO
@@ -33,6 +37,7 @@ pthread_mutex_t         server_status_mtx = PTHREAD_MUTEX_INITIALIZER;
 list_t                  *request_queue;
 pthread_mutex_t         request_queue_mtx = PTHREAD_MUTEX_INITIALIZER;
 pthread_cond_t          request_queue_notempty = PTHREAD_COND_INITIALIZER;
+list_t                  *request_pool;
 
 FILE                    *storage_file;
 FILE                    *log_file;
@@ -94,11 +99,106 @@ parse_configuration_file(const char *file_name)
          strcpy(server_config.log_file, log_path);
       }
 
+      if (strcmp(parameter, "OP_LOG_FILE") == 0) {
+         char *op_log_path = strtok(NULL, "\n");
+         server_config.op_log_file = calloc(1, strlen(op_log_path) + 1);
+         strcpy(server_config.op_log_file, op_log_path);
+      }
+
+      if (strcmp(parameter, "LOG_POLICY") == 0) {
+         char *log_policy = strtok(NULL, "\n");
+         server_config.log_policy = (strcmp(log_policy, "block") == 0) ? LOG_BLOCK : LOG_DROP;
+      }
+
+      if (strcmp(parameter, "LOG_SAMPLE") == 0) {
+         char *tmp_str = strtok(NULL, "\n");
+         int log_sample = atoi(tmp_str);
+         server_config.log_sample = log_sample;
+      }
+
+      if (strcmp(parameter, "TRACE_FILE") == 0) {
+         char *trace_file = strtok(NULL, "\n");
+         server_config.trace_file = calloc(1, strlen(trace_file) + 1);
+         strcpy(server_config.trace_file, trace_file);
+      }
+
+      if (strcmp(parameter, "TRACE_SAMPLE") == 0) {
+         char *tmp_str = strtok(NULL, "\n");
+         int trace_sample = atoi(tmp_str);
+         server_config.trace_sample = trace_sample;
+      }
+
       if (strcmp(parameter, "STORAGE_FILE") == 0) {
          char *storage_file = strtok(NULL, "\n");
          server_config.storage_file = calloc(1, strlen(storage_file) + 1);
          strcpy(server_config.storage_file, storage_file);
       }
+
+      if (strcmp(parameter, "WAL_FILE") == 0) {
+         char *wal_file = strtok(NULL, "\n");
+         server_config.wal_file = calloc(1, strlen(wal_file) + 1);
+         strcpy(server_config.wal_file, wal_file);
+      }
+
+      if (strcmp(parameter, "WAL_SYNC") == 0) {
+         char *tmp_str = strtok(NULL, "\n");
+         int wal_sync = atoi(tmp_str);
+         server_config.wal_sync = wal_sync;
+      }
+
+      if (strcmp(parameter, "TIER_DIR") == 0) {
+         char *tier_dir = strtok(NULL, "\n");
+         server_config.tier_dir = calloc(1, strlen(tier_dir) + 1);
+         strcpy(server_config.tier_dir, tier_dir);
+      }
+
+      if (strcmp(parameter, "TIER_MAX_SIZE") == 0) {
+         char *tmp_str = strtok(NULL, "\n");
+         long tier_max_size = atol(tmp_str);
+         server_config.tier_max_size = tier_max_size;
+      }
+
+      if (strcmp(parameter, "TIER_SEGMENT_SIZE") == 0) {
+         char *tmp_str = strtok(NULL, "\n");
+         long tier_segment_size = atol(tmp_str);
+         server_config.tier_segment_size = tier_segment_size;
+      }
+
+      if (strcmp(parameter, "ARENA_HUGE_PAGES") == 0) {
+         char *tmp_str = strtok(NULL, "\n");
+         int arena_huge_pages = atoi(tmp_str);
+         server_config.arena_huge_pages = arena_huge_pages;
+      }
+
+      if (strcmp(parameter, "COMPRESS_THRESHOLD") == 0) {
+         char *tmp_str = strtok(NULL, "\n");
+         int compress_threshold = atoi(tmp_str);
+         server_config.compress_threshold = compress_threshold;
+      }
+
+      if (strcmp(parameter, "DEDUP") == 0) {
+         char *tmp_str = strtok(NULL, "\n");
+         int dedup = atoi(tmp_str);
+         server_config.dedup = dedup;
+      }
+
+      if (strcmp(parameter, "WIRE_COMPRESSION") == 0) {
+         char *tmp_str = strtok(NULL, "\n");
+         int wire_compression = atoi(tmp_str);
+         server_config.wire_compression = wire_compression;
+      }
+
+      if (strcmp(parameter, "STREAM_CHUNK_SIZE") == 0) {
+         char *tmp_str = strtok(NULL, "\n");
+         long stream_chunk_size = atol(tmp_str);
+         server_config.stream_chunk_size = stream_chunk_size;
+      }
+
+      if (strcmp(parameter, "WAL_COMMIT_INTERVAL") == 0) {
+         char *tmp_str = strtok(NULL, "\n");
+         int wal_commit_interval = atoi(tmp_str);
+         server_config.wal_commit_interval = wal_commit_interval;
+      }
    }
 
    free(line);
@@ -134,14 +234,26 @@ main(int argc, char const *argv[])
    server_status->max_size_reached = 0;
 
    
-   /* Initialize log file */
+   /* Initialize log file, operations go next to it unless told otherwise */
+   if (server_config.log_file != NULL && server_config.op_log_file == NULL) {
+      server_config.op_log_file = calloc(1, strlen(server_config.log_file) + strlen(".ops") + 1);
+      sprintf(server_config.op_log_file, "%s.ops", server_config.log_file);
+   }
+
    if (server_config.log_file != NULL) {
-      log_init(server_config.log_file);
+      log_init(server_config.log_file, server_config.op_log_file, server_config.log_policy);
    } else {
-      log_init(NULL);
+      log_init(NULL, server_config.op_log_file, server_config.log_policy);
    }
 
    set_log_level(LOG_LVL);
+   set_log_sampling(server_config.log_sample);
+
+   /* Requests are only traced if there is somewhere to dump them */
+   if (server_config.trace_file != NULL && server_config.trace_sample == 0) {
+      server_config.trace_sample = 100;
+   }
+   trace_init((server_config.trace_file != NULL) ? server_config.trace_sample : 0);
 
 
    /* Max fd for select */
@@ -171,12 +283,20 @@ main(int argc, char const *argv[])
 
    /* Initialize request queue */
    request_queue = list_create(int_compare, NULL, print_int); // ugly af
-   if ( request_queue == NULL ) {
+   request_pool = list_create(NULL, free, NULL);
+   if ( request_queue == NULL || request_pool == NULL ) {
       log_fatal("Could not initialize request queue: %s\n", strerror(errno));
       free(signal_pipe);
       return -1;
    }
 
+   /* Initialize arena of file contents */
+   if ( payload_arena_init(server_config.arena_huge_pages != 0) != 0 ) {
+      log_error("Could not initialize arena of file contents: %s\n", strerror(errno));
+      ret = -1;
+      goto _server_exit1;
+   }
+
    /* Initialize storage*/
    storage = storage_create(server_config.max_size, server_config.max_files);
    if ( storage == NULL ) {
@@ -184,6 +304,64 @@ main(int argc, char const *argv[])
       ret = -1;
       goto _server_exit1;
    }
+   storage->compress_threshold = server_config.compress_threshold;
+
+   /* Initialize store of chunks shared by files */
+   if ( server_config.dedup ) {
+      if ( chunk_store_init(server_config.max_size / CHUNK_AVG_SIZE) != 0 ) {
+         log_error("Could not initialize chunk store: %s\n", strerror(errno));
+         ret = -1;
+         goto _server_exit1;
+      }
+      storage->dedup = true;
+   }
+
+   /* Restores storage from last snapshot */
+   uint64_t snapshot_lsn = 0;
+   if ( server_config.storage_file != NULL ) {
+      int loaded = snapshot_load(storage, server_config.storage_file, &snapshot_lsn);
+      if ( loaded == -1 && errno != ENOENT ) {
+         log_error("Could not load snapshot %s: %s\n", server_config.storage_file, strerror(errno));
+      } else if ( loaded > 0 ) {
+         log_info("(SERVER) Loaded %d files from snapshot %s\n", loaded, server_config.storage_file);
+      }
+   }
+
+   /* Replays operations logged after the snapshot */
+   if ( server_config.wal_file != NULL ) {
+      if ( wal_open(server_config.wal_file, server_config.wal_sync, server_config.wal_commit_interval) != 0 ) {
+         log_error("Could not open write-ahead log %s: %s\n", server_config.wal_file, strerror(errno));
+         ret = -1;
+         goto _server_exit1;
+      }
+
+      int replayed = wal_replay(storage, snapshot_lsn);
+      if ( replayed == -1 ) {
+         log_error("Could not replay write-ahead log %s: %s\n", server_config.wal_file, strerror(errno));
+      } else if ( replayed > 0 ) {
+         log_info("(SERVER) Replayed %d operations from write-ahead log %s\n", replayed, server_config.wal_file);
+      }
+   }
+
+   /* Opens disk tier, evicted files are demoted there from now on */
+   if ( server_config.tier_dir != NULL ) {
+      // Neither snapshots nor the log keep demoted files, a restart would lose them
+      if ( server_config.storage_file != NULL || server_config.wal_file != NULL ) {
+         log_error("Disk tier %s cannot be used with STORAGE_FILE or WAL_FILE, demoted files would not survive a restart\n", server_config.tier_dir);
+         ret = -1;
+         goto _server_exit1;
+      }
+
+      if ( server_config.tier_max_size == 0 ) server_config.tier_max_size = 8 * (size_t)server_config.max_size;
+      if ( server_config.tier_segment_size == 0 ) server_config.tier_segment_size = 64 * 1024 * 1024;
+
+      storage->tier = disk_tier_create(server_config.tier_dir, server_config.tier_max_size, server_config.tier_segment_size);
+      if ( storage->tier == NULL ) {
+         log_error("Could not open disk tier %s: %s\n", server_config.tier_dir, strerror(errno));
+         ret = -1;
+         goto _server_exit1;
+      }
+   }
 
    /* Starts lock manager */
    int lock_manager_pipe[2];
@@ -317,6 +495,7 @@ main(int argc, char const *argv[])
                   continue;
                }
 
+               trace_accept(client_fd);
                FD_SET(client_fd, &set);
 
                if (client_fd > fd_max) fd_max = client_fd;
@@ -330,12 +509,19 @@ main(int argc, char const *argv[])
 
             } else { // new request from already connected client
 
-               int *tmp_fd = malloc(sizeof(int));
-               *tmp_fd = fd;
-      
                lock_return((&request_queue_mtx), -1);
-               if ( list_insert_tail(request_queue, (void*)tmp_fd) != 0 ) {
+
+               // Entries freed by workers are reused
+               queued_client_t *queued = (queued_client_t*)list_remove_head(request_pool);
+               if ( queued == NULL ) queued = malloc(sizeof(queued_client_t));
+               if ( queued != NULL ) {
+                  queued->client_fd = fd;
+                  queued->enqueued_us = metrics_now_us();
+               }
+
+               if ( queued == NULL || list_insert_tail(request_queue, (void*)queued) != 0 ) {
                   log_error("Could not enqueue new client request\n");
+                  free(queued);
                }
 
                cond_signal_return(&(request_queue_notempty), -1);
@@ -349,7 +535,8 @@ main(int argc, char const *argv[])
             }
          }
 
-         if ( FD_ISSET(fd, &rdset) && FD_ISSET(mw_pipe[0], &rdset) ) {
+         // Only one descriptor per read, the pipe stays ready if workers returned more
+         if ( (fd == mw_pipe[0]) && FD_ISSET(fd, &rdset) ) {
             
             int new_fd;
 
@@ -378,6 +565,9 @@ main(int argc, char const *argv[])
    }
 
    log_info("(SERVER) Maximum number of connections: %d\n", server_status->max_connections);
+   log_op(OP_LOG_SERVER, OP_MAX_CONNECTIONS, SUCCESS, NULL, server_status->max_connections, 0);
+   log_info("(SERVER) Lookups answered by filter: %lu/%lu, false positive rate: %.4f\n", 
+      storage->filter->negatives, storage->filter->lookups, bloom_filter_fp_rate(storage->filter));
 
 
    /* Joining threads */
@@ -385,6 +575,33 @@ main(int argc, char const *argv[])
       ret = -1;
    }
 
+   /* Final metrics */
+   metrics_snapshot_t *metrics = malloc(sizeof(metrics_snapshot_t));
+   if ( metrics != NULL ) {
+      metrics_snapshot(metrics);
+      server_status->max_size_reached = metrics->peak_size;
+      server_status->max_no_files_reached = metrics->peak_files;
+
+      log_info("(SERVER) Maximum size reached: %d bytes, maximum number of files reached: %d\n", 
+         server_status->max_size_reached, server_status->max_no_files_reached);
+      log_info("(SERVER) Requests: %lu, errors: %lu, bytes in: %lu, bytes out: %lu, evictions: %lu\n",
+         metrics->counters[METRIC_REQUESTS], metrics->counters[METRIC_ERRORS], metrics->counters[METRIC_BYTES_IN],
+         metrics->counters[METRIC_BYTES_OUT], metrics->counters[METRIC_EVICTIONS]);
+      log_info("(SERVER) Queue wait p99: %lu us, storage lock hold p99: %lu us\n",
+         histogram_percentile(&metrics->histograms[HISTOGRAM_QUEUE_WAIT], 0.99),
+         histogram_percentile(&metrics->histograms[HISTOGRAM_LOCK_HOLD], 0.99));
+      free(metrics);
+   }
+
+   /* Saving storage snapshot */
+   if ( server_config.storage_file != NULL ) {
+      if ( snapshot_checkpoint(storage, server_config.storage_file) != 0 ) {
+         log_error("Could not save snapshot %s: %s\n", server_config.storage_file, strerror(errno));
+      } else {
+         log_info("(SERVER) Snapshot saved to %s\n", server_config.storage_file);
+      }
+   }
+
 _server_exit2:
    close(socket_fd);
    unlink(server_config.socket_path);
@@ -397,11 +614,24 @@ _server_exit1:
    free(server_status);
    close(signal_pipe[0]); 
    free(signal_pipe);
+   wal_close();
+   if ( storage ) disk_tier_destroy(storage->tier);
    storage_destroy(storage);
+   chunk_store_destroy();
+   payload_arena_destroy();
    free(server_config.log_file);
+   free(server_config.op_log_file);
    free(server_config.socket_path);
+   free(server_config.storage_file);
+   free(server_config.wal_file);
+   free(server_config.tier_dir);
+   free(server_config.trace_file);
+   metrics_destroy();
+   trace_destroy();
+   hot_keys_destroy();
    close_log();
    list_destroy(request_queue); 
+   list_destroy(request_pool);
    
    return ret;
 }
@@ -446,8 +676,8 @@ shutdown_all_threads()
 
    for (int i = 0; i < server_config.no_of_workers; i++) {
       
-      int *terminate = malloc(sizeof(int));
-      *terminate = -1;
+      queued_client_t *terminate = calloc(1, sizeof(queued_client_t));
+      terminate->client_fd = -1;
       
       lock_return((&request_queue_mtx), -1);
       if ( list_insert_tail(request_queue, (void*)terminate) != 0 ) {
@@ -33,7 +33,23 @@ typedef struct {
     unsigned int max_files;
     char *socket_path;
     char *log_file;
+    char *op_log_file;
+    int log_policy;
+    unsigned int log_sample;
+    char *trace_file;
+    unsigned int trace_sample;
     char *storage_file;
+    char *wal_file;
+    unsigned int wal_sync;
+    unsigned int wal_commit_interval;
+    char *tier_dir;
+    size_t tier_max_size;
+    size_t tier_segment_size;
+    unsigned int arena_huge_pages;
+    unsigned int compress_threshold;
+    unsigned int dedup;
+    unsigned int wire_compression;
+    size_t stream_chunk_size;
 } server_config_t;
 
 
@@ -47,6 +63,8 @@ EXTERN pthread_mutex_t          server_status_mtx;
 EXTERN list_t                   *request_queue;
 EXTERN pthread_mutex_t          request_queue_mtx;
 EXTERN pthread_cond_t           request_queue_notempty;
+/* Entries of request_queue for reuse, guarded by request_queue_mtx */
+EXTERN list_t                   *request_pool;
 
 EXTERN FILE                     *log_file;
 EXTERN pthread_mutex_t          log_file_mtx;
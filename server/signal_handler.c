@@ -7,6 +7,8 @@
 #include <stdlib.h>
 
 #include "server/logger.h"
+#include "server/snapshot.h"
+#include "server/trace.h"
 
 // funzione eseguita dal signal handler thread
 void* 
@@ -46,6 +48,29 @@ sig_handler_thread(void *arg) {
                 free(set);
                 return NULL;
 
+	        case SIGUSR2:
+	            log_info("(SIGNAL HANDLER) Received snapshot signal\n");
+                if ( server_config.storage_file == NULL ) break;
+
+                // The child writes the snapshot, storage is locked only while forking
+                if ( snapshot_bgsave(storage, server_config.storage_file) != 0 ) {
+                    log_error("Could not start snapshot %s: %s\n", server_config.storage_file, strerror(errno));
+                }
+                break;
+
+	        case SIGUSR1: {
+	            log_info("(SIGNAL HANDLER) Received trace signal\n");
+                if ( server_config.trace_file == NULL ) break;
+
+                int traced = trace_dump(server_config.trace_file);
+                if ( traced == -1 ) {
+                    log_error("Could not dump traces to %s: %s\n", server_config.trace_file, strerror(errno));
+                } else {
+                    log_info("(SIGNAL HANDLER) Dumped %d traced requests to %s\n", traced, server_config.trace_file);
+                }
+                break;
+            }
+
 	        default:  ; 
 	    }
     }
@@ -70,6 +95,8 @@ install_signal_handler(int *signal_pipe, pthread_t *sig_handler_id)
     sigaddset(mask, SIGINT); 
     sigaddset(mask, SIGQUIT);
     sigaddset(mask, SIGHUP);
+    sigaddset(mask, SIGUSR1);
+    sigaddset(mask, SIGUSR2);
 
     if (pthread_sigmask(SIG_BLOCK, mask, NULL) != 0) {
 	   log_fatal("could not set signal mask\n");
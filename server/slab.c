@@ -0,0 +1,196 @@
+#include <errno.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+#include "server/slab.h"
+
+/**
+ * Start of each slab
+ */
+typedef struct _slab_t {
+    struct _slab_t  *prev;
+    struct _slab_t  *next;
+    void            *free_objects;  /* each links the next with its first word */
+    char            *unused;        /* objects never allocated, handed out in order */
+    char            *end;
+    size_t          in_use;
+} slab_t;
+
+#define SLAB_HEADER     ((sizeof(slab_t) + 15) & ~(size_t)15)
+
+/**
+ * Bytes of each slab of cache, a power of two
+ */
+static size_t
+slab_size(const slab_cache_t *cache)
+{
+    size_t size = (cache->huge_pages) ? SLAB_HUGE_SIZE : SLAB_SIZE;
+    while ((size - SLAB_HEADER) / cache->object_size < SLAB_MIN_OBJECTS) size *= 2;
+    return size;
+}
+
+static void
+list_unlink(slab_t **list, slab_t *slab)
+{
+    if (slab->prev) slab->prev->next = slab->next;
+    else *list = slab->next;
+    if (slab->next) slab->next->prev = slab->prev;
+    slab->prev = slab->next = NULL;
+}
+
+static void
+list_push(slab_t **list, slab_t *slab)
+{
+    slab->prev = NULL;
+    slab->next = *list;
+    if (*list) (*list)->prev = slab;
+    *list = slab;
+}
+
+/**
+ * Maps a slab aligned to its size
+ */
+static slab_t*
+slab_map(slab_cache_t *cache)
+{
+    size_t size = slab_size(cache);
+
+    // Twice the size is mapped, the unaligned ends are given back
+    char *area = mmap(NULL, 2 * size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (area == MAP_FAILED) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    char *aligned = (char*)(((uintptr_t)area + size - 1) & ~(uintptr_t)(size - 1));
+    if (aligned > area) munmap(area, aligned - area);
+    if (aligned + size < area + 2 * size) munmap(aligned + size, area + 2 * size - (aligned + size));
+
+    if (cache->huge_pages) madvise(aligned, size, MADV_HUGEPAGE);
+
+    slab_t *slab = (slab_t*)aligned;
+    slab->prev = slab->next = NULL;
+    slab->free_objects = NULL;
+    slab->unused = aligned + SLAB_HEADER;
+    slab->end = slab->unused + (size - SLAB_HEADER) / cache->object_size * cache->object_size;
+    slab->in_use = 0;
+    return slab;
+}
+
+int
+slab_cache_init(slab_cache_t *cache, size_t size, bool huge_pages)
+{
+    if (cache == NULL || size == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    cache->object_size = SLAB_OBJECT_SIZE(size);
+    cache->huge_pages = huge_pages;
+    cache->partial = cache->full = NULL;
+    cache->n_slabs = 0;
+    cache->n_empty = 0;
+    cache->in_use = 0;
+    if (pthread_mutex_init(&cache->mtx, NULL) != 0) return -1;
+    return 0;
+}
+
+void
+slab_cache_destroy(slab_cache_t *cache)
+{
+    size_t size = slab_size(cache);
+
+    pthread_mutex_lock(&cache->mtx);
+    slab_t *lists[] = { cache->partial, cache->full };
+    for (int i = 0; i < 2; i++) {
+        while (lists[i] != NULL) {
+            slab_t *slab = lists[i];
+            lists[i] = slab->next;
+            munmap(slab, size);
+        }
+    }
+    cache->partial = cache->full = NULL;
+    cache->n_slabs = 0;
+    cache->n_empty = 0;
+    cache->in_use = 0;
+    pthread_mutex_unlock(&cache->mtx);
+}
+
+void*
+slab_alloc(slab_cache_t *cache)
+{
+    pthread_mutex_lock(&cache->mtx);
+
+    slab_t *slab = cache->partial;
+    if (slab == NULL) {
+        slab = slab_map(cache);
+        if (slab == NULL) {
+            pthread_mutex_unlock(&cache->mtx);
+            return NULL;
+        }
+        list_push(&cache->partial, slab);
+        cache->n_slabs++;
+        cache->n_empty++;
+    }
+
+    // Freed objects are reused first, pages of a new slab are touched as they are needed
+    void *object = slab->free_objects;
+    if (object != NULL) {
+        slab->free_objects = *(void**)object;
+    } else {
+        object = slab->unused;
+        slab->unused += cache->object_size;
+    }
+
+    if (slab->in_use++ == 0) cache->n_empty--;
+    if (slab->free_objects == NULL && slab->unused == slab->end) {
+        list_unlink(&cache->partial, slab);
+        list_push(&cache->full, slab);
+    }
+
+    cache->in_use++;
+    pthread_mutex_unlock(&cache->mtx);
+    return object;
+}
+
+void
+slab_free(slab_cache_t *cache, void *object)
+{
+    if (object == NULL) return;
+
+    size_t size = slab_size(cache);
+    slab_t *slab = (slab_t*)((uintptr_t)object & ~(uintptr_t)(size - 1));
+
+    pthread_mutex_lock(&cache->mtx);
+
+    if (slab->free_objects == NULL && slab->unused == slab->end) {
+        list_unlink(&cache->full, slab);
+        list_push(&cache->partial, slab);
+    }
+
+    *(void**)object = slab->free_objects;
+    slab->free_objects = object;
+    cache->in_use--;
+
+    if (--slab->in_use == 0) {
+        if (cache->n_empty > 0) {
+            list_unlink(&cache->partial, slab);
+            munmap(slab, size);
+            cache->n_slabs--;
+        } else {
+            cache->n_empty++;
+        }
+    }
+
+    pthread_mutex_unlock(&cache->mtx);
+}
+
+void
+slab_get_stats(slab_cache_t *cache, slab_stats_t *stats)
+{
+    pthread_mutex_lock(&cache->mtx);
+    stats->objects = cache->in_use;
+    stats->object_bytes = cache->in_use * cache->object_size;
+    stats->slab_bytes = cache->n_slabs * slab_size(cache);
+    pthread_mutex_unlock(&cache->mtx);
+}
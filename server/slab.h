@@ -0,0 +1,85 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#define SLAB_SIZE           (64 * 1024)
+#define SLAB_HUGE_SIZE      (2 * 1024 * 1024)
+#define SLAB_MIN_OBJECTS    4
+
+/**
+ * Cache of objects of a single size, carved from slabs of SLAB_SIZE bytes
+ * mapped from the system, or larger ones holding at least SLAB_MIN_OBJECTS
+ * objects. Slabs are aligned to their size, so freeing an object finds its
+ * slab from the address. A slab left empty is unmapped, unless it is the
+ * only empty one, kept for the next allocations.
+ */
+typedef struct _slab_cache_t {
+    size_t              object_size;
+    bool                huge_pages;     /* slabs are backed by transparent huge pages */
+    struct _slab_t      *partial;       /* slabs with free objects */
+    struct _slab_t      *full;
+    size_t              n_slabs;
+    size_t              n_empty;
+    size_t              in_use;
+    pthread_mutex_t     mtx;
+} slab_cache_t;
+
+/**
+ * Initializer of a cache of objects of size bytes, usable for static caches
+ */
+#define SLAB_CACHE_INITIALIZER(size) \
+    { .object_size = SLAB_OBJECT_SIZE(size), .mtx = PTHREAD_MUTEX_INITIALIZER }
+
+/**
+ * Objects are aligned as pointers and can hold the free list link
+ */
+#define SLAB_OBJECT_SIZE(size) \
+    (((size) < sizeof(void*)) ? sizeof(void*) : ((size) + sizeof(void*) - 1) & ~(sizeof(void*) - 1))
+
+/**
+ * Memory held by a cache
+ */
+typedef struct {
+    size_t  objects;        /* objects allocated */
+    size_t  object_bytes;   /* bytes of the objects allocated */
+    size_t  slab_bytes;     /* bytes mapped for slabs */
+} slab_stats_t;
+
+/**
+ * Initializes cache for objects of size bytes, if huge_pages slabs are at
+ * least SLAB_HUGE_SIZE bytes and the kernel is advised to back them with
+ * huge pages.
+ * Returns 0 on success, -1 on failure, errno is set.
+ */
+int
+slab_cache_init(slab_cache_t *cache, size_t size, bool huge_pages);
+
+/**
+ * Unmaps all slabs of cache, objects still allocated become invalid
+ */
+void
+slab_cache_destroy(slab_cache_t *cache);
+
+/**
+ * Allocates an object, its contents are undefined.
+ * Returns the object on success, NULL on failure, errno is set.
+ */
+void*
+slab_alloc(slab_cache_t *cache);
+
+/**
+ * Gives object back to cache
+ */
+void
+slab_free(slab_cache_t *cache, void *object);
+
+/**
+ * Reads the memory held by cache
+ */
+void
+slab_get_stats(slab_cache_t *cache, slab_stats_t *stats);
+
+#endif
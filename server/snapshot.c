@@ -0,0 +1,464 @@
+#include "server/snapshot.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "server/logger.h"
+#include "server/wal.h"
+#include "utils/crc32c.h"
+
+#define SNAPSHOT_ALIGN(n, a)    (((n) + ((a) - 1)) & ~((uint64_t)(a) - 1))
+#define SNAPSHOT_PAGE           4096
+
+/**
+ * Snapshot header
+ */
+typedef struct {
+    char        magic[8];
+    uint32_t    version;
+    uint32_t    no_of_files;
+    uint64_t    lsn;        /* last log record covered */
+    uint64_t    index_size;
+    uint64_t    data_offset;
+    uint64_t    data_size;
+} snapshot_header_t;
+
+/**
+ * Index entry, followed by the file path padded to 8 bytes
+ */
+typedef struct {
+    uint64_t    offset;     /* relative to the data region */
+    uint64_t    size;
+    uint32_t    path_len;   /* including terminator */
+    uint32_t    flags;
+    uint32_t    checksum;       /* CRC32C of the contents as clients wrote them */
+    uint32_t    data_checksum;  /* CRC32C of the bytes in the data region */
+} snapshot_entry_t;
+
+/* Entries of snapshots before version 4 end with the flags */
+#define SNAPSHOT_V3_ENTRY_SIZE      offsetof(snapshot_entry_t, checksum)
+
+#define SNAPSHOT_ENTRY_COMPRESSED   0x1     /* contents are stored compressed */
+
+/**
+ * Background snapshot in progress
+ */
+static struct {
+    bool            running;
+    pid_t           pid;
+    unsigned int    seq;        /* log segment started for it */
+    char            *path;
+    pthread_mutex_t mtx;
+    pthread_cond_t  done;
+} bgsave = {
+    .mtx = PTHREAD_MUTEX_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER,
+};
+
+static int
+write_padding(FILE *stream, uint64_t how_many)
+{
+    static const char zeros[SNAPSHOT_PAGE] = { 0 };
+    while (how_many > 0) {
+        uint64_t chunk = (how_many > SNAPSHOT_PAGE) ? SNAPSHOT_PAGE : how_many;
+        if (fwrite(zeros, 1, chunk, stream) != chunk) return -1;
+        how_many -= chunk;
+    }
+    return 0;
+}
+
+/**
+ * Bytes of the contents of file in the snapshot, chunked files are saved
+ * as a whole
+ */
+static size_t
+entry_size(file_t *file)
+{
+    return (file->chunked) ? storage_contents_size(file) : file->size;
+}
+
+/**
+ * File of path if it goes in the snapshot, mapped contents are verified
+ * first so that corrupted ones are left out and missing checksums computed
+ */
+static file_t*
+saved_file(storage_t *storage, char *path)
+{
+    file_t *file = storage_get_file(storage, path);
+    if (file == NULL || storage_verify_contents(file) != 0) return NULL;
+    return file;
+}
+
+static int
+write_contents(FILE *stream, file_t *file)
+{
+    if (!file->chunked) {
+        return (file->size > 0 && fwrite(file->contents, 1, file->size, stream) != file->size) ? -1 : 0;
+    }
+
+    size_t size = storage_contents_size(file);
+    void *contents = malloc(size);
+    if (contents == NULL) return -1;
+
+    int result = (storage_read_contents(file, contents) != 0 || fwrite(contents, 1, size, stream) != size) ? -1 : 0;
+    free(contents);
+    return result;
+}
+
+int
+snapshot_save(storage_t *storage, const char *path, uint64_t lsn)
+{
+    if (storage == NULL || path == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    char *tmp_path = malloc(strlen(path) + 5);
+    if (tmp_path == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    sprintf(tmp_path, "%s.tmp", path);
+
+    FILE *stream = fopen(tmp_path, "wb");
+    if (stream == NULL) {
+        free(tmp_path);
+        return -1;
+    }
+
+    // First pass computes index and data region sizes
+    snapshot_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.lsn = lsn;
+
+    for (node_t *curr = storage->fifo_queue->head; curr != NULL; curr = curr->next) {
+        file_t *file = saved_file(storage, (char*)curr->data);
+        if (file == NULL) continue;
+
+        header.no_of_files++;
+        header.index_size += sizeof(snapshot_entry_t) + SNAPSHOT_ALIGN(strlen(file->path) + 1, 8);
+        header.data_size += SNAPSHOT_ALIGN(entry_size(file), 8);
+    }
+
+    header.data_offset = SNAPSHOT_ALIGN(sizeof(header) + header.index_size, SNAPSHOT_PAGE);
+
+    if (fwrite(&header, sizeof(header), 1, stream) != 1) goto _save_error;
+
+    // Second pass writes the index
+    uint64_t offset = 0;
+    for (node_t *curr = storage->fifo_queue->head; curr != NULL; curr = curr->next) {
+        file_t *file = saved_file(storage, (char*)curr->data);
+        if (file == NULL) continue;
+
+        snapshot_entry_t entry;
+        entry.offset = offset;
+        entry.size = entry_size(file);
+        entry.path_len = strlen(file->path) + 1;
+        entry.flags = (file->compressed) ? SNAPSHOT_ENTRY_COMPRESSED : 0;
+        entry.checksum = file->checksum;
+        entry.data_checksum = (file->compressed) ? crc32c(0, file->contents, file->size) : file->checksum;
+
+        if (fwrite(&entry, sizeof(entry), 1, stream) != 1) goto _save_error;
+        if (fwrite(file->path, 1, entry.path_len, stream) != entry.path_len) goto _save_error;
+        if (write_padding(stream, SNAPSHOT_ALIGN(entry.path_len, 8) - entry.path_len) != 0) goto _save_error;
+
+        offset += SNAPSHOT_ALIGN(entry.size, 8);
+    }
+
+    if (write_padding(stream, header.data_offset - sizeof(header) - header.index_size) != 0) goto _save_error;
+
+    // Third pass writes the data region
+    for (node_t *curr = storage->fifo_queue->head; curr != NULL; curr = curr->next) {
+        file_t *file = saved_file(storage, (char*)curr->data);
+        if (file == NULL) continue;
+
+        size_t size = entry_size(file);
+        if (write_contents(stream, file) != 0) goto _save_error;
+        if (write_padding(stream, SNAPSHOT_ALIGN(size, 8) - size) != 0) goto _save_error;
+    }
+
+    if (fflush(stream) != 0 || fsync(fileno(stream)) != 0) goto _save_error;
+    if (fclose(stream) != 0) {
+        stream = NULL;
+        goto _save_error;
+    }
+    stream = NULL;
+
+    // Old snapshot stays valid (and mapped) until it is replaced
+    if (rename(tmp_path, path) != 0) goto _save_error;
+
+    free(tmp_path);
+    return 0;
+
+_save_error:
+    {
+        int err = errno;
+        if (stream) fclose(stream);
+        unlink(tmp_path);
+        free(tmp_path);
+        errno = err;
+    }
+    return -1;
+}
+
+/**
+ * Waits for the background snapshot, if any, to finish
+ */
+static void
+bgsave_wait()
+{
+    pthread_mutex_lock(&bgsave.mtx);
+    while (bgsave.running) pthread_cond_wait(&bgsave.done, &bgsave.mtx);
+    pthread_mutex_unlock(&bgsave.mtx);
+}
+
+static void*
+bgsave_waiter_thread(void *arg)
+{
+    int status;
+    while (waitpid(bgsave.pid, &status, 0) == -1 && errno == EINTR);
+
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+        wal_checkpoint(bgsave.seq);
+        log_info("(SNAPSHOT) Background snapshot saved to %s\n", bgsave.path);
+    } else {
+        log_error("Background snapshot %s failed\n", bgsave.path);
+    }
+
+    pthread_mutex_lock(&bgsave.mtx);
+    free(bgsave.path);
+    bgsave.path = NULL;
+    bgsave.running = false;
+    pthread_cond_broadcast(&bgsave.done);
+    pthread_mutex_unlock(&bgsave.mtx);
+
+    return NULL;
+}
+
+int
+snapshot_bgsave(storage_t *storage, const char *path)
+{
+    if (storage == NULL || path == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    lock_return(&bgsave.mtx, -1);
+    if (bgsave.running) {
+        unlock_return(&bgsave.mtx, -1);
+        errno = EBUSY;
+        return -1;
+    }
+
+    bgsave.path = strdup(path);
+    if (bgsave.path == NULL) {
+        unlock_return(&bgsave.mtx, -1);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    // Records logged from now on go to the new segment, workers keep serving while it is rotated
+    bgsave.seq = wal_rotate(NULL);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // Storage is locked only while forking, records logged since the rotation
+    // are in the snapshot too and replay skips them by their LSN
+    lock_return(&(storage->access), -1);
+    uint64_t lsn = wal_last_lsn();
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        // Child only touches its copy of storage, no locks and no logging
+        _exit((snapshot_save(storage, path, lsn) == 0) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    unlock_return(&(storage->access), -1);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (pid == -1) {
+        int err = errno;
+        free(bgsave.path);
+        bgsave.path = NULL;
+        unlock_return(&bgsave.mtx, -1);
+        errno = err;
+        return -1;
+    }
+
+    bgsave.pid = pid;
+    bgsave.running = true;
+
+    pthread_t waiter;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&waiter, &attr, bgsave_waiter_thread, NULL) != 0) {
+        // Nobody reaps the child, waiting for it here
+        pthread_attr_destroy(&attr);
+        unlock_return(&bgsave.mtx, -1);
+        bgsave_waiter_thread(NULL);
+        return 0;
+    }
+    pthread_attr_destroy(&attr);
+
+    unlock_return(&bgsave.mtx, -1);
+
+    log_info("(SNAPSHOT) Forked background snapshot %d in %ld us\n", pid,
+        (end.tv_sec - start.tv_sec) * 1000000L + (end.tv_nsec - start.tv_nsec) / 1000);
+
+    return 0;
+}
+
+int
+snapshot_checkpoint(storage_t *storage, const char *path)
+{
+    // Both would write the same temporary file
+    bgsave_wait();
+
+    // Records logged from now on go to the new segment
+    uint64_t lsn;
+    unsigned int seq = wal_rotate(&lsn);
+
+    if (snapshot_save(storage, path, lsn) != 0) return -1;
+
+    wal_checkpoint(seq);
+    return 0;
+}
+
+int
+snapshot_load(storage_t *storage, const char *path, uint64_t *lsn)
+{
+    if (storage == NULL || path == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    if (st.st_size < sizeof(snapshot_header_t)) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+
+    // Validating header
+    snapshot_header_t *header = (snapshot_header_t*)map;
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0
+        || header->version < SNAPSHOT_MIN_VERSION || header->version > SNAPSHOT_VERSION
+        || sizeof(snapshot_header_t) + header->index_size > header->data_offset
+        || header->data_offset + header->data_size > st.st_size) {
+
+        munmap(map, st.st_size);
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (lsn) *lsn = header->lsn;
+
+    char *index = (char*)map + sizeof(snapshot_header_t);
+    char *index_end = index + header->index_size;
+    char *data = (char*)map + header->data_offset;
+    int loaded = 0, mapped = 0;
+    bool checked = header->version >= 4;
+    size_t index_entry_size = (checked) ? sizeof(snapshot_entry_t) : SNAPSHOT_V3_ENTRY_SIZE;
+
+    for (uint32_t i = 0; i < header->no_of_files; i++) {
+
+        if (index + index_entry_size > index_end) break;
+
+        snapshot_entry_t *entry = (snapshot_entry_t*)index;
+        char *file_path = index + index_entry_size;
+        index += index_entry_size + SNAPSHOT_ALIGN(entry->path_len, 8);
+
+        // Skipping malformed entries
+        if (index > index_end || entry->path_len == 0 || entry->path_len > MAX_PATH
+            || file_path[entry->path_len - 1] != '\0'
+            || entry->offset + entry->size > header->data_size) {
+            log_error("Skipping malformed snapshot entry %u\n", i);
+            continue;
+        }
+
+        // With dedup contents are chunked again, chunks shared by files are charged once
+        bool compressed = CHK_FLAG(entry->flags, SNAPSHOT_ENTRY_COMPRESSED);
+        bool chunked = storage->dedup && !compressed && entry->size >= CHUNK_MIN_SIZE;
+
+        // Stops when storage capacity is reached
+        if (storage->no_of_files + 1 > storage->max_files
+            || (!chunked && storage->current_size + entry->size > storage->max_size)) {
+            log_error("Storage is full, %u snapshot files were not loaded\n", header->no_of_files - i);
+            break;
+        }
+
+        if (storage_get_file(storage, file_path) != NULL) continue;
+
+        file_t *file = storage_create_file(file_path);
+        if (file == NULL) break;
+
+        CLR_FLAG(file->flags, O_CREATE);
+
+        if (storage_add_file(storage, file) != 0) {
+            free_file(file);
+            break;
+        }
+
+        // Chunked contents are read anyway, mapped ones are only verified when first used
+        if (chunked) {
+            if (storage_set_contents(storage, file, data + entry->offset, entry->size) != 0
+                || storage->current_size > storage->max_size) {
+                log_error("Storage is full, %u snapshot files were not loaded\n", header->no_of_files - i);
+                storage_remove_file(storage, file_path);
+                break;
+            }
+            if (checked && file->checksum != entry->checksum) {
+                log_error("Skipping corrupted snapshot entry %u\n", i);
+                storage_remove_file(storage, file->path);
+                continue;
+            }
+        } else if (storage_map_contents(storage, file, data + entry->offset, entry->size, compressed,
+                    checked, (checked) ? entry->checksum : 0) != 0) {
+            log_error("Skipping malformed snapshot entry %u\n", i);
+            storage_remove_file(storage, file->path);
+            continue;
+        } else {
+            mapped++;
+        }
+
+        list_insert_tail(storage->fifo_queue, file->path);
+        loaded++;
+    }
+
+    // Chunked files hold copies of their contents
+    if (mapped == 0) {
+        munmap(map, st.st_size);
+        return loaded;
+    }
+
+    storage->snapshot_map = map;
+    storage->snapshot_map_size = st.st_size;
+    return loaded;
+}
@@ -0,0 +1,56 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+
+#include "server/storage.h"
+
+/**
+ * Snapshot file layout: a header, an index with one entry per file
+ * (in FIFO order) and a page aligned, contiguous data region
+ */
+#define SNAPSHOT_MAGIC      "FSSNAP01"
+#define SNAPSHOT_VERSION    4
+/*
+ * Version 2 snapshots have no compressed entries and load as they are,
+ * entries before version 4 have no checksums
+ */
+#define SNAPSHOT_MIN_VERSION    2
+
+/**
+ * Writes a snapshot of storage to path, storage must be locked by the caller.
+ * The snapshot is written to a temporary file and renamed over path,
+ * lsn is the last write-ahead log record it covers.
+ * Returns 0 on success, -1 on failure, errno is set.
+ */
+int
+snapshot_save(storage_t *storage, const char *path, uint64_t lsn);
+
+/**
+ * Starts a new write-ahead log segment, saves a snapshot to path and deletes
+ * the log segments it covers, storage must be locked by the caller.
+ * Returns 0 on success, -1 on failure, errno is set.
+ */
+int
+snapshot_checkpoint(storage_t *storage, const char *path);
+
+/**
+ * Like snapshot_checkpoint, but the snapshot is written by a forked child
+ * which sees a copy-on-write image of storage. Storage must not be locked
+ * by the caller, it is only locked for the fork. Old log segments are
+ * deleted once the child succeeds. Returns 0 if the child was started, -1
+ * on failure, errno is set (EBUSY if a background snapshot is already running).
+ */
+int
+snapshot_bgsave(storage_t *storage, const char *path);
+
+/**
+ * Maps the snapshot found at path and adds its files to storage, file
+ * contents are not read but served straight from the mapping. The last
+ * write-ahead log record covered by the snapshot is saved in lsn.
+ * Returns the number of files loaded, -1 on failure, errno is set.
+ */
+int
+snapshot_load(storage_t *storage, const char *path, uint64_t *lsn);
+
+#endif
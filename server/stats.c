@@ -0,0 +1,277 @@
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "server/stats.h"
+#include "server/metrics.h"
+#include "server/hot_keys.h"
+#include "server/payload.h"
+
+#define STATS_INITIAL_SIZE  8192
+
+/**
+ * Growing text buffer
+ */
+typedef struct {
+    char    *data;
+    size_t  len;
+    size_t  capacity;
+    bool    failed;
+} text_t;
+
+static void
+append(text_t *text, const char *format, ...)
+{
+    if (text->failed) return;
+
+    while (true) {
+        va_list args;
+        va_start(args, format);
+        int n = vsnprintf(text->data + text->len, text->capacity - text->len, format, args);
+        va_end(args);
+
+        if (n < 0) {
+            text->failed = true;
+            return;
+        }
+
+        if (text->len + n < text->capacity) {
+            text->len += n;
+            return;
+        }
+
+        char *data = realloc(text->data, text->capacity * 2);
+        if (data == NULL) {
+            text->failed = true;
+            return;
+        }
+        text->data = data;
+        text->capacity *= 2;
+    }
+}
+
+static void
+append_metric(text_t *text, const char *name, const char *type, const char *help, uint64_t value)
+{
+    append(text, "# HELP fss_%s %s\n# TYPE fss_%s %s\nfss_%s %lu\n", name, help, name, type, name, value);
+}
+
+/**
+ * Appends value as a label value, escaping backslashes, quotes and newlines
+ */
+static void
+append_label_value(text_t *text, const char *value)
+{
+    for (const char *c = value; *c != '\0'; c++) {
+        switch (*c) {
+            case '\\': append(text, "\\\\"); break;
+            case '"':  append(text, "\\\""); break;
+            case '\n': append(text, "\\n"); break;
+            default:   append(text, "%c", *c);
+        }
+    }
+}
+
+/**
+ * Appends the paths with most traffic, one sample of name per path
+ */
+static void
+append_hot_keys(text_t *text, const hot_key_t *keys, int n_keys, const char *name, const char *type,
+    const char *help, size_t field)
+{
+    append(text, "# HELP fss_%s %s\n# TYPE fss_%s %s\n", name, help, name, type);
+    for (int i = 0; i < n_keys; i++) {
+        append(text, "fss_%s{path=\"", name);
+        append_label_value(text, keys[i].path);
+        append(text, "\"} %lu\n", *(const uint64_t*)((const char*)&keys[i] + field));
+    }
+}
+
+/**
+ * Appends a histogram as a Prometheus summary, labels may be NULL
+ */
+static void
+append_summary(text_t *text, const char *name, const char *labels, const histogram_t *histogram)
+{
+    static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+    for (int i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++) {
+        append(text, "fss_%s{%s%squantile=\"%g\"} %lu\n", name, (labels) ? labels : "", (labels) ? "," : "",
+            quantiles[i], histogram_percentile(histogram, quantiles[i]));
+    }
+
+    append(text, "fss_%s_sum%s%s%s %lu\n", name, (labels) ? "{" : "", (labels) ? labels : "", (labels) ? "}" : "", histogram->sum);
+    append(text, "fss_%s_count%s%s%s %lu\n", name, (labels) ? "{" : "", (labels) ? labels : "", (labels) ? "}" : "", histogram->count);
+}
+
+int
+stats_render(char **result, size_t *size)
+{
+    // State shared with other threads is read first, under its locks
+    lock_return(&(storage->access), -1);
+    size_t current_size = storage->current_size, max_size = storage->max_size;
+    int no_of_files = storage->no_of_files, max_files = storage->max_files;
+    unlock_return(&(storage->access), -1);
+
+    lock_return(&server_status_mtx, -1);
+    int current_connections = server_status->current_connections, max_connections = server_status->max_connections;
+    unlock_return(&server_status_mtx, -1);
+
+    lock_return(&request_queue_mtx, -1);
+    int queue_depth = request_queue->length;
+    unlock_return(&request_queue_mtx, -1);
+
+    metrics_snapshot_t *metrics = malloc(sizeof(metrics_snapshot_t));
+    if (metrics == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    metrics_snapshot(metrics);
+
+    text_t text = { malloc(STATS_INITIAL_SIZE), 0, STATS_INITIAL_SIZE, false };
+    if (text.data == NULL) {
+        free(metrics);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    // Request counters and latencies
+    append_metric(&text, "requests_total", "counter", "Requests served", metrics->counters[METRIC_REQUESTS]);
+    append_metric(&text, "request_errors_total", "counter", "Requests that did not succeed", metrics->counters[METRIC_ERRORS]);
+    append_metric(&text, "bytes_in_total", "counter", "Bytes of request bodies received", metrics->counters[METRIC_BYTES_IN]);
+    append_metric(&text, "bytes_out_total", "counter", "Bytes of files sent to clients", metrics->counters[METRIC_BYTES_OUT]);
+    append_metric(&text, "evictions_total", "counter", "Files demoted to the disk tier or expelled", metrics->counters[METRIC_EVICTIONS]);
+
+    append(&text, "# HELP fss_request_latency_us Time from request received to response sent\n"
+                  "# TYPE fss_request_latency_us summary\n");
+    for (int i = 0; i < METRICS_REQUEST_CODES; i++) {
+        const char *name = get_request_name(OPEN_CONNECTION + i);
+        if (name == NULL || metrics->histograms[HISTOGRAM_REQUESTS + i].count == 0) continue;
+
+        char labels[64];
+        snprintf(labels, sizeof(labels), "request=\"%s\"", name);
+        append_summary(&text, "request_latency_us", labels, &metrics->histograms[HISTOGRAM_REQUESTS + i]);
+    }
+
+    append(&text, "# HELP fss_request_errors_by_request_total Requests that did not succeed, by request\n"
+                  "# TYPE fss_request_errors_by_request_total counter\n");
+    for (int i = 0; i < METRICS_REQUEST_CODES; i++) {
+        const char *name = get_request_name(OPEN_CONNECTION + i);
+        if (name == NULL || metrics->histograms[HISTOGRAM_REQUESTS + i].count == 0) continue;
+        append(&text, "fss_request_errors_by_request_total{request=\"%s\"} %lu\n", name, metrics->request_errors[i]);
+    }
+
+    append(&text, "# HELP fss_queue_wait_us Time requests wait in the request queue\n"
+                  "# TYPE fss_queue_wait_us summary\n");
+    append_summary(&text, "queue_wait_us", NULL, &metrics->histograms[HISTOGRAM_QUEUE_WAIT]);
+
+    append(&text, "# HELP fss_storage_lock_hold_us Time the storage lock is held\n"
+                  "# TYPE fss_storage_lock_hold_us summary\n");
+    append_summary(&text, "storage_lock_hold_us", NULL, &metrics->histograms[HISTOGRAM_LOCK_HOLD]);
+
+    // Storage occupancy
+    append_metric(&text, "storage_bytes", "gauge", "Bytes of files in memory", current_size);
+    append_metric(&text, "storage_max_bytes", "gauge", "Capacity of storage in bytes", max_size);
+    append_metric(&text, "storage_peak_bytes", "gauge", "Highest number of bytes in memory", metrics->peak_size);
+    append_metric(&text, "storage_files", "gauge", "Files in memory", no_of_files);
+    append_metric(&text, "storage_max_files", "gauge", "Capacity of storage in files", max_files);
+    append_metric(&text, "storage_peak_files", "gauge", "Highest number of files in memory", metrics->peak_files);
+
+    // File records, paths included
+    slab_stats_t records;
+    storage_get_file_stats(&records);
+    append_metric(&text, "file_record_bytes", "gauge", "Bytes of file records in use", records.object_bytes);
+    append_metric(&text, "file_record_slab_bytes", "gauge", "Bytes of slabs mapped for file records", records.slab_bytes);
+
+    // File contents
+    payload_stats_t payload;
+    payload_get_stats(&payload);
+    append_metric(&text, "payload_bytes", "gauge", "Bytes of file contents in the arena", payload.requested_bytes);
+    append_metric(&text, "payload_allocated_bytes", "gauge", "Bytes of the size classes and mappings of file contents", payload.allocated_bytes);
+    append_metric(&text, "payload_resident_bytes", "gauge", "Bytes of slabs and mappings holding file contents", payload.resident_bytes);
+    append_metric(&text, "payload_large_bytes", "gauge", "Bytes of file contents mapped on their own", payload.large_bytes);
+    append(&text, "# HELP fss_payload_fragmentation Fraction of the memory of file contents not holding contents\n"
+                  "# TYPE fss_payload_fragmentation gauge\nfss_payload_fragmentation %.6f\n",
+                  (payload.resident_bytes > 0) ? 1.0 - (double)payload.requested_bytes / payload.resident_bytes : 0.0);
+
+    // Compressed contents
+    size_t compressed_files, compressed_raw_bytes, compressed_stored_bytes;
+    storage_get_compression_stats(&compressed_files, &compressed_raw_bytes, &compressed_stored_bytes);
+    append_metric(&text, "compressed_files", "gauge", "Files stored compressed", compressed_files);
+    append_metric(&text, "compressed_raw_bytes", "gauge", "Bytes compressed files were written with", compressed_raw_bytes);
+    append_metric(&text, "compressed_stored_bytes", "gauge", "Bytes compressed files take in storage", compressed_stored_bytes);
+
+    // Deduplicated contents
+    chunk_store_stats_t chunks;
+    chunk_store_get_stats(&chunks);
+    append_metric(&text, "dedup_chunks", "gauge", "Chunks shared by deduplicated files", chunks.chunks);
+    append_metric(&text, "dedup_stored_bytes", "gauge", "Bytes of the chunks stored", chunks.stored_bytes);
+    append_metric(&text, "dedup_referenced_bytes", "gauge", "Bytes of deduplicated files, as written", chunks.referenced_bytes);
+    append(&text, "# HELP fss_dedup_ratio Bytes of deduplicated files over bytes of the chunks stored\n"
+                  "# TYPE fss_dedup_ratio gauge\nfss_dedup_ratio %.6f\n",
+                  (chunks.stored_bytes > 0) ? (double)chunks.referenced_bytes / chunks.stored_bytes : 1.0);
+
+    // Connections and workers
+    append_metric(&text, "connections", "gauge", "Open client connections", current_connections);
+    append_metric(&text, "connections_max", "gauge", "Highest number of open client connections", max_connections);
+    append_metric(&text, "request_queue_depth", "gauge", "Requests waiting for a worker", queue_depth);
+
+    append(&text, "# HELP fss_worker_busy Whether a worker is serving a request\n# TYPE fss_worker_busy gauge\n");
+    for (int i = 0; i < metrics->n_workers; i++) {
+        append(&text, "fss_worker_busy{worker=\"%d\"} %d\n", i, metrics->worker_busy[i]);
+    }
+    append(&text, "# HELP fss_worker_requests_total Requests served by a worker\n# TYPE fss_worker_requests_total counter\n");
+    for (int i = 0; i < metrics->n_workers; i++) {
+        append(&text, "fss_worker_requests_total{worker=\"%d\"} %lu\n", i, metrics->worker_requests[i]);
+    }
+
+    // Hot paths
+    hot_key_t *keys = malloc(HOT_KEYS_REPORTED * sizeof(hot_key_t));
+    int n_keys = (keys != NULL) ? hot_keys_top(keys, HOT_KEYS_REPORTED) : -1;
+    if (n_keys == -1) {
+        text.failed = true;
+    } else {
+        append_hot_keys(&text, keys, n_keys, "hot_key_requests", "gauge",
+            "Estimated reads and writes of the most requested paths", offsetof(hot_key_t, count));
+        append_hot_keys(&text, keys, n_keys, "hot_key_requests_error", "gauge",
+            "Highest overestimate of fss_hot_key_requests", offsetof(hot_key_t, error));
+        append_hot_keys(&text, keys, n_keys, "hot_key_read_bytes", "gauge",
+            "Bytes read from the most requested paths since they are tracked", offsetof(hot_key_t, read_bytes));
+        append_hot_keys(&text, keys, n_keys, "hot_key_write_bytes", "gauge",
+            "Bytes written to the most requested paths since they are tracked", offsetof(hot_key_t, write_bytes));
+    }
+    free(keys);
+
+    // Bloom filter
+    append_metric(&text, "filter_lookups_total", "counter", "Lookups in the Bloom filter", __atomic_load_n(&storage->filter->lookups, __ATOMIC_RELAXED));
+    append_metric(&text, "filter_negatives_total", "counter", "Lookups answered by the Bloom filter", __atomic_load_n(&storage->filter->negatives, __ATOMIC_RELAXED));
+    append(&text, "# HELP fss_filter_false_positive_rate Fraction of lookups for absent files not ruled out\n"
+                  "# TYPE fss_filter_false_positive_rate gauge\nfss_filter_false_positive_rate %.6f\n",
+                  bloom_filter_fp_rate(storage->filter));
+
+    // Disk tier
+    if (storage->tier != NULL) {
+        disk_tier_stats_t tier;
+        disk_tier_get_stats(storage->tier, &tier);
+
+        append_metric(&text, "tier_bytes", "gauge", "Bytes of files in the disk tier", tier.live_size);
+        append_metric(&text, "tier_disk_bytes", "gauge", "Bytes of disk tier segments", tier.disk_size);
+        append_metric(&text, "tier_files", "gauge", "Files in the disk tier", tier.no_of_files);
+        append_metric(&text, "tier_demoted_total", "counter", "Files demoted to the disk tier", tier.demoted);
+        append_metric(&text, "tier_promoted_total", "counter", "Files promoted from the disk tier", tier.promoted);
+        append_metric(&text, "tier_compactions_total", "counter", "Disk tier segments compacted", tier.compactions);
+    }
+
+    free(metrics);
+
+    if (text.failed) {
+        free(text.data);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    *result = text.data;
+    *size = text.len + 1;
+    return 0;
+}
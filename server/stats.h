@@ -0,0 +1,17 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+
+#include "server_config.h"
+
+/**
+ * Renders the current server metrics, storage occupancy, worker state,
+ * Bloom filter and disk tier counters in Prometheus text exposition format.
+ * Text is saved in a newly allocated, null terminated buffer.
+ * Returns 0 on success, -1 on failure, errno is set.
+ */
+int
+stats_render(char **text, size_t *size);
+
+#endif
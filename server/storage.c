@@ -1,8 +1,56 @@
 #include <errno.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/mman.h>
 #include "server/storage.h"
 #include "utils/utilities.h"
 #include "server/logger.h"
+#include "server/metrics.h"
+#include "server/payload.h"
+#include "utils/protocol.h"
+#include "utils/lz.h"
+#include "utils/crc32c.h"
+
+/**
+ * Files are kept in the slab of the shortest path capacity holding their path
+ */
+#define FILE_SIZE(path_capacity)    (offsetof(file_t, path) + (path_capacity))
+#define FILE_CLASSES                (sizeof(file_path_classes) / sizeof(file_path_classes[0]))
+
+static const size_t file_path_classes[] = { 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, MAX_PATH };
+
+/**
+ * Compressed contents start with the size they decompress to, laid out as
+ * compressed message bodies so they can be sent as they are
+ */
+#define COMPRESSED_HEADER           COMPRESSED_BODY_HEADER
+
+static struct {
+    size_t  files;
+    size_t  raw_bytes;
+    size_t  stored_bytes;
+} compression;
+
+/**
+ * Contents of a chunked file, its chunks in order
+ */
+typedef struct {
+    uint64_t    raw_size;
+    uint64_t    n_chunks;
+    chunk_t     *chunks[];
+} chunk_list_t;
+
+#define CHUNK_LIST_BYTES(n)         (offsetof(chunk_list_t, chunks) + (n) * sizeof(chunk_t*))
+
+static slab_cache_t file_slabs[] = {
+    SLAB_CACHE_INITIALIZER(FILE_SIZE(32)),  SLAB_CACHE_INITIALIZER(FILE_SIZE(48)),
+    SLAB_CACHE_INITIALIZER(FILE_SIZE(64)),  SLAB_CACHE_INITIALIZER(FILE_SIZE(96)),
+    SLAB_CACHE_INITIALIZER(FILE_SIZE(128)), SLAB_CACHE_INITIALIZER(FILE_SIZE(192)),
+    SLAB_CACHE_INITIALIZER(FILE_SIZE(256)), SLAB_CACHE_INITIALIZER(FILE_SIZE(384)),
+    SLAB_CACHE_INITIALIZER(FILE_SIZE(512)), SLAB_CACHE_INITIALIZER(FILE_SIZE(768)),
+    SLAB_CACHE_INITIALIZER(FILE_SIZE(MAX_PATH)),
+};
 
 storage_t*
 storage_create(size_t max_size, size_t max_files)
@@ -27,9 +75,20 @@ storage_create(size_t max_size, size_t max_files)
         return NULL;
     }
 
-    storage->fifo_queue = list_create(string_compare, free_string, string_print);
+    // Negative lookups are answered by the filter without locking
+    storage->filter = bloom_filter_create(max_files);
+    if (storage->filter == NULL) {
+        hash_map_destroy(storage->files);
+        free(storage);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    // FIFO queue borrows paths from the files in the hashmap
+    storage->fifo_queue = list_create(string_compare, NULL, string_print);
     if (storage->fifo_queue == NULL) {
         hash_map_destroy(storage->files);
+        bloom_filter_destroy(storage->filter);
         free(storage);
         errno = ENOMEM;
         return NULL;
@@ -45,28 +104,40 @@ storage_create(size_t max_size, size_t max_files)
 int
 storage_destroy(storage_t *storage)
 {
+    if (storage == NULL) return 0;
+
     hash_map_destroy(storage->files);
     list_destroy(storage->fifo_queue);
+    bloom_filter_destroy(storage->filter);
+    if (storage->snapshot_map) munmap(storage->snapshot_map, storage->snapshot_map_size);
     free(storage);
+
+    for (int i = 0; i < FILE_CLASSES; i++) slab_cache_destroy(&file_slabs[i]);
     return 0;
 }
 
 file_t*
 storage_create_file(char *file_name)
 {  
-    // Allocating file
-    file_t *new_file = calloc(1, sizeof(file_t));
-    if (new_file == NULL) {
-        errno = ENOMEM;
+    size_t path_len = strlen(file_name) + 1;
+
+    int path_class = 0;
+    while (path_class < FILE_CLASSES && file_path_classes[path_class] < path_len) path_class++;
+    if (path_class == FILE_CLASSES) {
+        errno = ENAMETOOLONG;
         return NULL;
     }
 
+    // Allocating file
+    file_t *new_file = slab_alloc(&file_slabs[path_class]);
+    if (new_file == NULL) return NULL;
+
     // Setting initial file fileds
-    strcpy(new_file->path, file_name);
-    new_file->size = 0;
+    memset(new_file, 0, offsetof(file_t, path));
+    memcpy(new_file->path, file_name, path_len);
+    new_file->path_class = path_class;
     new_file->locked_by = -1;
     SET_FLAG(new_file->flags, O_CREATE);
-    new_file->waiting_on_lock = list_create(NULL, NULL, NULL);
     
     return new_file;
 }
@@ -77,7 +148,9 @@ storage_add_file(storage_t *storage, file_t *file)
     // Adds the file to storage data structures
     if ( hash_map_insert(storage->files, file->path, file) != 0 ) return -1;
     // if ( list_insert_tail(storage->fifo_queue, file->path) != 0 ) return -1;
+    bloom_filter_add(storage->filter, file->path);
     storage->no_of_files++;
+    metrics_peak(storage->current_size, storage->no_of_files);
     return 0;
 }
 
@@ -87,6 +160,458 @@ storage_update_file(storage_t *storage, file_t *file)
     return hash_map_insert(storage->files, file->path, file);
 }
 
+static size_t
+compressed_raw_size(const void *contents)
+{
+    uint64_t raw_size;
+    memcpy(&raw_size, contents, sizeof(raw_size));
+    return raw_size;
+}
+
+/**
+ * Counts compressed contents of file as they are set (sign 1) or released (sign -1)
+ */
+static void
+count_compressed(file_t *file, int sign)
+{
+    if (!file->compressed || file->contents == NULL) return;
+
+    size_t raw_size = compressed_raw_size(file->contents);
+    if (sign > 0) {
+        __atomic_fetch_add(&compression.files, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&compression.raw_bytes, raw_size, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&compression.stored_bytes, file->size, __ATOMIC_RELAXED);
+    } else {
+        __atomic_fetch_sub(&compression.files, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_sub(&compression.raw_bytes, raw_size, __ATOMIC_RELAXED);
+        __atomic_fetch_sub(&compression.stored_bytes, file->size, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * Compresses data into the arena if it saves at least an eighth of its size.
+ * Returns the contents, NULL if data does not compress well enough or on failure.
+ */
+static void*
+compress_contents(const void *data, size_t size, size_t *stored_size)
+{
+    if (size / 8 <= COMPRESSED_HEADER) return NULL;
+
+    // Streams not fitting in capacity are given up early
+    size_t capacity = size - size / 8 - COMPRESSED_HEADER;
+    char *buffer = malloc(COMPRESSED_HEADER + capacity);
+    if (buffer == NULL) return NULL;
+
+    void *contents = NULL;
+    size_t stream_size = lz_compress(data, size, buffer + COMPRESSED_HEADER, capacity);
+    if (stream_size > 0) {
+        uint64_t raw_size = size;
+        memcpy(buffer, &raw_size, sizeof(raw_size));
+
+        *stored_size = COMPRESSED_HEADER + stream_size;
+        contents = payload_alloc(*stored_size);
+        if (contents != NULL) memcpy(contents, buffer, *stored_size);
+    }
+
+    free(buffer);
+    return contents;
+}
+
+/**
+ * Drops the references of a list of chunks and frees it.
+ * Returns the bytes of the chunks freed.
+ */
+static size_t
+release_chunks(chunk_list_t *list)
+{
+    size_t freed = 0;
+    for (size_t i = 0; i < list->n_chunks; i++) freed += chunk_store_put(list->chunks[i]);
+    payload_free(list, CHUNK_LIST_BYTES(list->n_chunks));
+    return freed;
+}
+
+/**
+ * Frees file contents, storage is no longer charged for them if not NULL
+ */
+static void
+release_contents(storage_t *storage, file_t *file)
+{
+    count_compressed(file, -1);
+
+    size_t freed = file->size;
+    if (file->chunked && file->contents) {
+        freed += release_chunks(file->contents);
+    } else if (file->contents && !file->mapped) {
+        payload_free(file->contents, file->size);
+    }
+    if (storage) storage->current_size -= freed;
+
+    file->contents = NULL;
+    file->size = 0;
+    file->checksum = 0;
+    file->mapped = file->compressed = file->chunked = false;
+    file->unverified = file->unchecksummed = false;
+}
+
+int
+storage_prepare_contents(storage_t *storage, void *data, size_t size, contents_t *contents)
+{
+    memset(contents, 0, sizeof(contents_t));
+    contents->size = size;
+    contents->checksum = crc32c(0, data, size);
+
+    if (storage->dedup && size >= CHUNK_MIN_SIZE) {
+        contents->spans = chunk_split(data, size, &contents->n_spans);
+        if (contents->spans == NULL) return -1;
+
+        // Until chunks are stored contents are charged as if none was shared
+        contents->source = data;
+        contents->chunked = true;
+        contents->size = CHUNK_LIST_BYTES(contents->n_spans) + size;
+        return 0;
+    }
+
+    if (storage->compress_threshold > 0 && size >= storage->compress_threshold) {
+        contents->data = compress_contents(data, size, &contents->size);
+        contents->compressed = (contents->data != NULL);
+    }
+    if (contents->compressed) return 0;
+
+    contents->size = size;
+    if (size == 0) return 0;
+
+    contents->data = payload_alloc(size);
+    if (contents->data == NULL) return -1;
+    memcpy(contents->data, data, size);
+    return 0;
+}
+
+int
+storage_adopt_contents(storage_t *storage, void *data, size_t size, contents_t *contents)
+{
+    if ((storage->dedup && size >= CHUNK_MIN_SIZE)
+        || (storage->compress_threshold > 0 && size >= storage->compress_threshold)) {
+        return storage_prepare_contents(storage, data, size, contents);
+    }
+
+    memset(contents, 0, sizeof(contents_t));
+    contents->data = data;
+    contents->size = size;
+    contents->checksum = crc32c(0, data, size);
+    return 0;
+}
+
+int
+storage_store_chunks(storage_t *storage, contents_t *contents)
+{
+    if (contents->spans == NULL) return 0;
+
+    chunk_list_t *list = payload_alloc(CHUNK_LIST_BYTES(contents->n_spans));
+    if (list == NULL) return -1;
+
+    list->raw_size = 0;
+    for (list->n_chunks = 0; list->n_chunks < contents->n_spans; list->n_chunks++) {
+        chunk_span_t *span = &contents->spans[list->n_chunks];
+
+        size_t created;
+        chunk_t *chunk = chunk_store_get(span->digest, contents->source + span->offset, span->size, &created);
+        if (chunk == NULL) {
+            for (size_t i = 0; i < list->n_chunks; i++) storage->current_size -= chunk_store_put(list->chunks[i]);
+            payload_free(list, CHUNK_LIST_BYTES(contents->n_spans));
+            return -1;
+        }
+
+        storage->current_size += created;
+        list->chunks[list->n_chunks] = chunk;
+        list->raw_size += span->size;
+    }
+
+    free(contents->spans);
+    contents->spans = NULL;
+    contents->source = NULL;
+    contents->data = list;
+    contents->size = CHUNK_LIST_BYTES(list->n_chunks);
+    return 0;
+}
+
+int
+storage_attach_contents(storage_t *storage, file_t *file, contents_t *contents)
+{
+    // New chunks are stored first, those shared with previous contents stay
+    if (storage_store_chunks(storage, contents) != 0) return -1;
+
+    release_contents(storage, file);
+    storage->current_size += contents->size;
+
+    file->contents = contents->data;
+    file->size = contents->size;
+    file->compressed = contents->compressed;
+    file->chunked = contents->chunked;
+    file->checksum = contents->checksum;
+    count_compressed(file, 1);
+    metrics_peak(storage->current_size, storage->no_of_files);
+
+    contents->data = NULL;
+    contents->size = 0;
+    return 0;
+}
+
+void
+storage_discard_contents(storage_t *storage, contents_t *contents)
+{
+    free(contents->spans);
+    contents->spans = NULL;
+
+    if (contents->chunked && contents->data) {
+        storage->current_size -= release_chunks(contents->data);
+    } else {
+        payload_free(contents->data, contents->size);
+    }
+    contents->data = NULL;
+    contents->size = 0;
+}
+
+int
+storage_set_contents(storage_t *storage, file_t *file, void *data, size_t size)
+{
+    contents_t contents;
+    if (storage_prepare_contents(storage, data, size, &contents) != 0) return -1;
+
+    if (storage_attach_contents(storage, file, &contents) != 0) {
+        storage_discard_contents(storage, &contents);
+        return -1;
+    }
+    return 0;
+}
+
+int
+storage_append_contents(storage_t *storage, file_t *file, void *data, size_t size)
+{
+    if (size == 0) return 0;
+
+    // Checksum of mapped contents is extended, it has to hold first
+    if (storage_verify_contents(file) != 0) return -1;
+
+    // Compressed and chunked contents are read, appended to and set again
+    if (file->compressed || file->chunked) {
+        size_t raw_size = storage_contents_size(file);
+        char *buffer = malloc(raw_size + size);
+        if (buffer == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+
+        if (storage_read_contents(file, buffer) != 0) {
+            free(buffer);
+            return -1;
+        }
+        memcpy(buffer + raw_size, data, size);
+
+        int result = storage_set_contents(storage, file, buffer, raw_size + size);
+        free(buffer);
+        return result;
+    }
+
+    size_t new_size = file->size + size;
+    void *new_contents;
+
+    if (file->mapped) {
+        // Mapped contents are read only, they get copied on first append
+        new_contents = payload_alloc(new_size);
+        if (new_contents != NULL && file->size > 0) memcpy(new_contents, file->contents, file->size);
+    } else {
+        new_contents = payload_realloc(file->contents, file->size, new_size);
+    }
+
+    if (new_contents == NULL) return -1;
+
+    memcpy((char*)new_contents + file->size, data, size);
+    file->contents = new_contents;
+    file->size = new_size;
+    file->checksum = crc32c(file->checksum, data, size);
+    file->mapped = false;
+    storage->current_size += size;
+    metrics_peak(storage->current_size, storage->no_of_files);
+    return 0;
+}
+
+int
+storage_map_contents(storage_t *storage, file_t *file, void *data, size_t size, bool compressed, bool checked, uint32_t checksum)
+{
+    if (compressed && size < COMPRESSED_HEADER) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    file->contents = data;
+    file->size = size;
+    file->mapped = true;
+    file->compressed = compressed;
+    file->checksum = (checked) ? checksum : 0;
+    file->unverified = true;
+    file->unchecksummed = !checked;
+    count_compressed(file, 1);
+
+    storage->current_size += size;
+    metrics_peak(storage->current_size, storage->no_of_files);
+    return 0;
+}
+
+size_t
+storage_contents_size(file_t *file)
+{
+    if (file->chunked) return ((chunk_list_t*)file->contents)->raw_size;
+    return (file->compressed) ? compressed_raw_size(file->contents) : file->size;
+}
+
+/**
+ * Copies file contents as clients wrote them into buffer, decompressing or
+ * joining them without checking them
+ */
+static int
+decode_contents(file_t *file, void *buffer)
+{
+    if (file->chunked) {
+        chunk_list_t *list = (chunk_list_t*)file->contents;
+        char *next = buffer;
+        for (size_t i = 0; i < list->n_chunks; i++) {
+            memcpy(next, list->chunks[i]->data, list->chunks[i]->size);
+            next += list->chunks[i]->size;
+        }
+        return 0;
+    }
+
+    if (!file->compressed) {
+        if (file->size > 0) memcpy(buffer, file->contents, file->size);
+        return 0;
+    }
+
+    return lz_decompress((char*)file->contents + COMPRESSED_HEADER, file->size - COMPRESSED_HEADER,
+        buffer, compressed_raw_size(file->contents));
+}
+
+int
+storage_read_contents(file_t *file, void *buffer)
+{
+    if (decode_contents(file, buffer) != 0) return -1;
+
+    // Raw contents are checked by whoever receives them
+    if ((file->compressed || file->chunked) && crc32c(0, buffer, storage_contents_size(file)) != file->checksum) {
+        errno = EBADMSG;
+        return -1;
+    }
+    return 0;
+}
+
+int
+storage_read_range(file_t *file, void *buffer, size_t offset, size_t length)
+{
+    if (length == 0) return 0;
+
+    if (file->chunked) {
+        // Only the chunks overlapping the range are copied
+        chunk_list_t *list = (chunk_list_t*)file->contents;
+        char *next = buffer;
+        size_t start = 0, end = offset + length;
+        for (size_t i = 0; i < list->n_chunks && start < end; i++) {
+            size_t chunk_end = start + list->chunks[i]->size;
+            if (chunk_end > offset) {
+                size_t from = (start < offset) ? offset - start : 0;
+                size_t to = (chunk_end < end) ? list->chunks[i]->size : end - start;
+                memcpy(next, list->chunks[i]->data + from, to - from);
+                next += to - from;
+            }
+            start = chunk_end;
+        }
+        return 0;
+    }
+
+    if (!file->compressed) {
+        memcpy(buffer, (char*)file->contents + offset, length);
+        return 0;
+    }
+
+    // Sequences after the range are never decoded, the ones before it are
+    const void *stream = (char*)file->contents + COMPRESSED_HEADER;
+    size_t stream_size = file->size - COMPRESSED_HEADER;
+    if (offset == 0) return lz_decompress_prefix(stream, stream_size, buffer, length);
+
+    char *prefix = malloc(offset + length);
+    if (prefix == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    int result = lz_decompress_prefix(stream, stream_size, prefix, offset + length);
+    if (result == 0) memcpy(buffer, prefix + offset, length);
+    free(prefix);
+    return result;
+}
+
+int
+storage_checksum_contents(file_t *file)
+{
+    if (!file->compressed && !file->chunked) {
+        file->checksum = crc32c(0, file->contents, file->size);
+        return 0;
+    }
+
+    size_t raw_size = storage_contents_size(file);
+    void *buffer = malloc((raw_size > 0) ? raw_size : 1);
+    if (buffer == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    int result = decode_contents(file, buffer);
+    if (result == 0) file->checksum = crc32c(0, buffer, raw_size);
+    free(buffer);
+    return result;
+}
+
+int
+storage_verify_contents(file_t *file)
+{
+    if (!file->unverified) return 0;
+
+    if (file->unchecksummed) {
+        if (storage_checksum_contents(file) != 0) return -1;
+    } else if (file->compressed) {
+        size_t raw_size = storage_contents_size(file);
+        void *buffer = malloc((raw_size > 0) ? raw_size : 1);
+        if (buffer == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+
+        int result = storage_read_contents(file, buffer);
+        free(buffer);
+        if (result != 0) return -1;
+    } else if (crc32c(0, file->contents, file->size) != file->checksum) {
+        errno = EBADMSG;
+        return -1;
+    }
+
+    file->unverified = file->unchecksummed = false;
+    return 0;
+}
+
+/**
+ * Answers clients still waiting for the lock of a file that is going away,
+ * the lock manager would never grant it
+ */
+static void
+release_lock_waiters(file_t *file)
+{
+    if (file->waiting_on_lock == NULL) return;
+
+    int *client_fd;
+    while ((client_fd = (int*)list_remove_head(file->waiting_on_lock)) != NULL) {
+        send_response(*client_fd, NOT_FOUND, get_status_message(NOT_FOUND), strlen(file->path) + 1, file->path, 0, NULL);
+        free(client_fd);
+    }
+}
+
 int
 storage_remove_file(storage_t *storage, char *file_name)
 {
@@ -96,25 +621,151 @@ storage_remove_file(storage_t *storage, char *file_name)
     
     // Update storage fields and data structures
     storage->no_of_files--;
-    storage->current_size = storage->current_size - to_remove->size;
+    release_contents(storage, to_remove);
     /* char *filename1 = malloc(strlen(file_name) + 1);
     strcpy(filename1, file_name);
     char *filename2 = malloc(strlen(file_name) + 1);
     strcpy(filename2, file_name); */
-    if ( list_remove_element(storage->fifo_queue, file_name) != 0 ) return -1;
+    // Files created but never written are not queued
+    list_remove_element(storage->fifo_queue, file_name);
+    bloom_filter_remove(storage->filter, file_name);
+    release_lock_waiters(to_remove);
     if ( hash_map_remove(storage->files, file_name) != 0 ) return -1;
     return 0;
 }
 
+int
+storage_demote_file(storage_t *storage, char *file_name)
+{
+    if (storage->tier == NULL) {
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    file_t *file = (file_t*)hash_map_get(storage->files, file_name);
+    if (file == NULL) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    if (storage_verify_contents(file) != 0) return -1;
+
+    // The tier keeps contents as clients wrote them
+    if (file->compressed || file->chunked) {
+        size_t raw_size = storage_contents_size(file);
+        void *raw = malloc(raw_size);
+        if (raw == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+
+        int result = storage_read_contents(file, raw);
+        if (result == 0) result = disk_tier_put(storage->tier, file->path, raw, raw_size);
+        free(raw);
+        if (result != 0) return -1;
+    } else if (disk_tier_put(storage->tier, file->path, file->contents, file->size) != 0) {
+        return -1;
+    }
+
+    log_debug("file [%s] demoted to disk tier\n", file->path);
+    metrics_count(METRIC_EVICTIONS, 1);
+
+    // Path stays in the filter for the copy in the tier
+    bloom_filter_add(storage->filter, file->path);
+
+    return storage_remove_file(storage, file->path);
+}
+
+/**
+ * Brings a file back from the disk tier, demoting others to make space
+ */
+static file_t*
+promote_file(storage_t *storage, char *file_name)
+{
+    void *contents;
+    size_t size;
+    if (disk_tier_take(storage->tier, file_name, &contents, &size) != 0) {
+        if (errno == EBADMSG) log_error("File [%s] in the disk tier is corrupted, dropped\n", file_name);
+        return NULL;
+    }
+
+    while (storage->no_of_files + 1 > storage->max_files
+            || storage->current_size + size > storage->max_size) {
+
+        char *to_demote = (storage->fifo_queue->head) ? (char*)storage->fifo_queue->head->data : NULL;
+        if (to_demote == NULL || storage_demote_file(storage, to_demote) != 0) {
+            // No space in either tier, file goes back to disk
+            int err = errno;
+            disk_tier_put(storage->tier, file_name, contents, size);
+            free(contents);
+            errno = err;
+            return NULL;
+        }
+    }
+
+    file_t *file = storage_create_file(file_name);
+    if (file == NULL || storage_add_file(storage, file) != 0) {
+        if (file) free_file(file);
+        disk_tier_put(storage->tier, file_name, contents, size);
+        free(contents);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    // Contents are copied into the arena
+    if (storage_set_contents(storage, file, contents, size) != 0) {
+        int err = errno;
+        storage_remove_file(storage, file_name);
+        disk_tier_put(storage->tier, file_name, contents, size);
+        free(contents);
+        errno = err;
+        return NULL;
+    }
+    free(contents);
+
+    CLR_FLAG(file->flags, O_CREATE);
+    list_insert_tail(storage->fifo_queue, file->path);
+
+    // Copy in the tier is gone
+    bloom_filter_remove(storage->filter, file->path);
+
+    log_debug("file [%s] promoted from disk tier\n", file->path);
+    return file;
+}
+
 file_t*
 storage_get_file(storage_t *storage, char *file_name)
 {
     // Finds the file in hashtable
-    file_t *file = (file_t*)hash_map_get(storage->files, (void*)file_name);
-    if (file == NULL) return NULL;
+    return (file_t*)hash_map_get(storage->files, (void*)file_name);
+}
+
+file_t*
+storage_fetch_file(storage_t *storage, char *file_name)
+{
+    file_t *file = storage_get_file(storage, file_name);
+    if (file == NULL && storage->tier != NULL) file = promote_file(storage, file_name);
     return file;
 }
 
+bool
+storage_contains_file(storage_t *storage, char *file_name)
+{
+    return storage_get_file(storage, file_name) != NULL || disk_tier_contains(storage->tier, file_name);
+}
+
+bool
+storage_may_contain(storage_t *storage, const char *file_name)
+{
+    return bloom_filter_may_contain(storage->filter, file_name);
+}
+
+void
+storage_false_positive(storage_t *storage)
+{
+    bloom_filter_false_positive(storage->filter);
+}
+
 int
 storage_FIFO_replace(storage_t *storage, int how_many, size_t required_size, list_t *replaced_files)
 {
@@ -125,25 +776,61 @@ storage_FIFO_replace(storage_t *storage, int how_many, size_t required_size, lis
 
     while ( storage->current_size + required_size > storage->max_size ) {
         
+        if (storage->fifo_queue->head == NULL) break;
+
+        // Demoted files stay available from the disk tier
+        removed_file_path = (char*)storage->fifo_queue->head->data;
+        if (storage->tier != NULL && storage_demote_file(storage, removed_file_path) == 0) continue;
+
         // Dequeue filename from FIFO queue
         removed_file_path = (char*)list_remove_head(storage->fifo_queue);
-        to_remove = storage_get_file(storage, removed_file_path);
+        to_remove = (file_t*)hash_map_get(storage->files, removed_file_path);
 
+        // Corrupted snapshot contents are dropped instead of being sent back
+        file_t *copy = NULL;
+        if (storage_verify_contents(to_remove) != 0) {
+            log_error("File [%s] in the snapshot is corrupted, dropped\n", to_remove->path);
+            release_contents(storage, to_remove);
+            goto _replace_remove;
+        }
 
-        // Copies file contents
-        file_t *copy = calloc(1, sizeof(file_t));
-        strcpy(copy->path, to_remove->path);
-        copy->size = to_remove->size;
-        copy->contents = malloc(copy->size);
-        memcpy(copy->contents, to_remove->contents, copy->size);
+        // Contents move to a copy of the file
+        copy = storage_create_file(to_remove->path);
+        if (copy == NULL) {
+            list_insert_head(storage->fifo_queue, removed_file_path);
+            break;
+        }
+        copy->checksum = to_remove->checksum;
+        if (to_remove->chunked) {
+            // Chunks may be shared, the copy gets contents of its own
+            copy->size = storage_contents_size(to_remove);
+            copy->contents = payload_alloc(copy->size);
+            if (copy->contents == NULL) {
+                free_file(copy);
+                list_insert_head(storage->fifo_queue, removed_file_path);
+                break;
+            }
+            storage_read_contents(to_remove, copy->contents);
+            release_contents(storage, to_remove);
+        } else {
+            copy->size = to_remove->size;
+            copy->contents = to_remove->contents;
+            copy->mapped = to_remove->mapped;
+            copy->compressed = to_remove->compressed;
+            to_remove->contents = NULL;
+            storage->current_size = storage->current_size - to_remove->size;
+        }
 
+_replace_remove:
         // Removes file from storage
-        storage->current_size = storage->current_size - to_remove->size;
         storage->no_of_files--;
+        bloom_filter_remove(storage->filter, to_remove->path);
+        release_lock_waiters(to_remove);
         hash_map_remove(storage->files, to_remove->path);
 
         // Adds file to list of expelled files
-        list_insert_tail(replaced_files, copy);
+        if (copy != NULL) list_insert_tail(replaced_files, copy);
+        metrics_count(METRIC_EVICTIONS, 1);
         files_removed++;
     }
 
@@ -151,6 +838,28 @@ storage_FIFO_replace(storage_t *storage, int how_many, size_t required_size, lis
     
 }
 
+void
+storage_get_file_stats(slab_stats_t *stats)
+{
+    stats->objects = stats->object_bytes = stats->slab_bytes = 0;
+
+    for (int i = 0; i < FILE_CLASSES; i++) {
+        slab_stats_t class;
+        slab_get_stats(&file_slabs[i], &class);
+        stats->objects += class.objects;
+        stats->object_bytes += class.object_bytes;
+        stats->slab_bytes += class.slab_bytes;
+    }
+}
+
+void
+storage_get_compression_stats(size_t *files, size_t *raw_bytes, size_t *stored_bytes)
+{
+    *files = __atomic_load_n(&compression.files, __ATOMIC_RELAXED);
+    *raw_bytes = __atomic_load_n(&compression.raw_bytes, __ATOMIC_RELAXED);
+    *stored_bytes = __atomic_load_n(&compression.stored_bytes, __ATOMIC_RELAXED);
+}
+
 void
 storage_dump(storage_t *storage, FILE *stream)
 {
@@ -175,9 +884,9 @@ void
 free_file(void *e) 
 {
     file_t *f = (file_t*)e;
-    if (f->contents) free(f->contents);
-    list_destroy(f->waiting_on_lock);
-    free(f);
+    release_contents(NULL, f);
+    if (f->waiting_on_lock) list_destroy(f->waiting_on_lock);
+    slab_free(&file_slabs[f->path_class], f);
 }
 
 void
@@ -187,7 +896,7 @@ print_file(void *e, FILE *stream)
     fprintf(stream, " %lu (bytes)", f->size);
     fprintf(stream, " locked by (%d)\n", f->locked_by);
     fprintf(stream, "Clients waiting for lock: ");
-    list_dump(f->waiting_on_lock, stream);
+    if (f->waiting_on_lock) list_dump(f->waiting_on_lock, stream);
     fprintf(stream, "\n");
     fprintf(stream, "\n------------------------------------------------------\n\n");
 }
\ No newline at end of file
@@ -7,19 +7,44 @@
 #include "utils/hash_map.h"
 #include "utils/linked_list.h"
 #include "utils/utilities.h"
+#include "utils/bloom_filter.h"
+#include "server/disk_tier.h"
+#include "server/slab.h"
+#include "server/chunk_store.h"
 
 /**
- * A file in storage
+ * A file in storage, allocated from the slab of its path length
  */
 typedef struct _file_t {
-    char    path[MAX_PATH];
-    int     flags;
-    size_t  size;
-    void*   contents;   
-    int     locked_by;
-    list_t  *waiting_on_lock;
+    size_t          size;
+    void*           contents;   
+    list_t          *waiting_on_lock;   /* created when the first client waits */
+    int             flags;
+    int             locked_by;
+    bool            mapped;     /* contents live in the snapshot mapping */
+    bool            compressed; /* contents are their raw size followed by an LZ stream */
+    bool            chunked;    /* contents are a list of chunks shared with other files */
+    bool            unverified; /* mapped contents not checked against the checksum yet */
+    bool            unchecksummed; /* mapped contents came without a checksum */
+    uint32_t        checksum;   /* CRC32C of the contents as clients wrote them */
+    unsigned char   path_class;
+    char            path[];
 } file_t;
 
+/**
+ * Contents copied into the arena and not yet set in a file
+ */
+typedef struct {
+    void            *data;
+    size_t          size;       /* bytes stored */
+    bool            compressed;
+    bool            chunked;
+    uint32_t        checksum;   /* of the data prepared */
+    const char      *source;    /* data being chunked, until its chunks are stored */
+    chunk_span_t    *spans;     /* chunks of source */
+    size_t          n_spans;
+} contents_t;
+
 /**
  * The storage
  */
@@ -29,7 +54,13 @@ typedef struct _storage_t {
     int             max_files;
     int             no_of_files;
     hash_map_t      *files;
+    bloom_filter_t  *filter;    /* paths in memory or in the disk tier */
     list_t          *fifo_queue;
+    void            *snapshot_map;
+    size_t          snapshot_map_size;
+    disk_tier_t     *tier;      /* where evicted files are demoted, if any */
+    size_t          compress_threshold; /* contents at least this big are compressed, 0 never */
+    bool            dedup;      /* contents of at least CHUNK_MIN_SIZE bytes are chunked */
     pthread_mutex_t access;
 } storage_t;
 
@@ -48,7 +79,8 @@ int
 storage_destroy(storage_t *storage);
 
 /**
- * Creates a new file
+ * Creates a new file, paths longer than MAX_PATH are refused.
+ * Returns the file on success, NULL on failure, errno is set.
  */
 file_t*
 storage_create_file(char *file_name);
@@ -65,6 +97,114 @@ storage_add_file(storage_t *storage, file_t *file);
 int
 storage_update_file(storage_t *storage, file_t *file);
 
+/**
+ * Prepares data to become file contents and computes its checksum, storage
+ * needs not be locked.
+ * With dedup, data of at least CHUNK_MIN_SIZE bytes is cut into chunks,
+ * stored later, and data stays in use until then. Otherwise it is copied
+ * into the arena, compressed if it is at least compress_threshold bytes and
+ * compression saves an eighth of them.
+ * Returns 0 on success, -1 on failure, errno is set.
+ */
+int
+storage_prepare_contents(storage_t *storage, void *data, size_t size, contents_t *contents);
+
+/**
+ * Prepares size bytes of data allocated with payload_alloc as by
+ * storage_prepare_contents, taking data itself as the contents when it is
+ * neither chunked nor compressed instead of copying it. Contents hold data
+ * if it was taken, otherwise the caller still frees it.
+ * Returns 0 on success, -1 on failure, errno is set.
+ */
+int
+storage_adopt_contents(storage_t *storage, void *data, size_t size, contents_t *contents);
+
+/**
+ * Stores the chunks of prepared contents that are not in storage yet,
+ * charging storage for their bytes, and takes references to the others.
+ * Size of contents becomes the bytes of their list of chunks.
+ * Returns 0 on success, -1 on failure, errno is set.
+ */
+int
+storage_store_chunks(storage_t *storage, contents_t *contents);
+
+/**
+ * Replaces file contents with prepared contents, which are taken by the file.
+ * Returns 0 on success, -1 if chunks could not be stored, errno is set.
+ */
+int
+storage_attach_contents(storage_t *storage, file_t *file, contents_t *contents);
+
+/**
+ * Frees prepared contents never attached to a file, storage must be locked
+ * if their chunks were stored
+ */
+void
+storage_discard_contents(storage_t *storage, contents_t *contents);
+
+/**
+ * Replaces file contents with a copy of data, prepared as by storage_prepare_contents
+ */
+int
+storage_set_contents(storage_t *storage, file_t *file, void *data, size_t size);
+
+/**
+ * Appends a copy of data to file contents, compressed and chunked contents
+ * are read and set again
+ */
+int
+storage_append_contents(storage_t *storage, file_t *file, void *data, size_t size);
+
+/**
+ * Makes contents in the snapshot mapping the contents of file, checksum is
+ * the CRC32C of the contents as clients wrote them, if checked. Contents are
+ * not read, they are verified the first time they are used.
+ * Returns 0 on success, -1 if compressed contents are too short, errno is set.
+ */
+int
+storage_map_contents(storage_t *storage, file_t *file, void *data, size_t size, bool compressed, bool checked, uint32_t checksum);
+
+/**
+ * Size of file contents as clients wrote them
+ */
+size_t
+storage_contents_size(file_t *file);
+
+/**
+ * Copies file contents as clients wrote them into buffer, which holds
+ * storage_contents_size bytes. Decompressed and joined contents are checked
+ * against the checksum of the file.
+ * Returns 0 on success, -1 if contents are corrupted, errno is set.
+ */
+int
+storage_read_contents(file_t *file, void *buffer);
+
+/**
+ * Copies length bytes of file contents as clients wrote them, starting at
+ * offset, into buffer. The range lies within storage_contents_size bytes.
+ * Compressed contents are decoded up to the end of the range only, so the
+ * range is not checked against the checksum of the file.
+ * Returns 0 on success, -1 if contents are corrupted, errno is set.
+ */
+int
+storage_read_range(file_t *file, void *buffer, size_t offset, size_t length);
+
+/**
+ * Computes the checksum of file contents, for contents that came without one.
+ * Returns 0 on success, -1 if compressed contents are corrupted, errno is set.
+ */
+int
+storage_checksum_contents(file_t *file);
+
+/**
+ * Checks mapped contents against the checksum of the file the first time
+ * they are used, or computes it if they came without one. Contents that
+ * already passed or were never mapped are not read.
+ * Returns 0 on success, -1 if contents are corrupted, errno is set.
+ */
+int
+storage_verify_contents(file_t *file);
+
 /**
  * Remove file from storage
  */
@@ -72,17 +212,63 @@ int
 storage_remove_file(storage_t *storage, char *file_name);
 
 /**
- * Find a file in storage
+ * Moves a file to the disk tier, freeing its memory
+ */
+int
+storage_demote_file(storage_t *storage, char *file_name);
+
+/**
+ * Find a file in memory, files in the disk tier are not looked up
  */
 file_t*
 storage_get_file(storage_t *storage, char *file_name);
 
 /**
- * Replace files up to how_many or until there is enough space
+ * Find a file in storage to use its contents or lock it, files in the
+ * disk tier are promoted back to memory
+ */
+file_t*
+storage_fetch_file(storage_t *storage, char *file_name);
+
+/**
+ * Whether a file is in memory or in the disk tier
+ */
+bool
+storage_contains_file(storage_t *storage, char *file_name);
+
+/**
+ * Checks without locking whether a file may be in storage, if false
+ * the file is surely not there
+ */
+bool
+storage_may_contain(storage_t *storage, const char *file_name);
+
+/**
+ * Records that a file storage_may_contain was true for was not found
+ */
+void
+storage_false_positive(storage_t *storage);
+
+/**
+ * Replace files up to how_many or until there is enough space, files are
+ * demoted to the disk tier or, if that fails, added to replaced_files
  */
 int
 storage_FIFO_replace(storage_t *storage, int how_many, size_t required_size, list_t *replaced_files);
 
+/**
+ * Reads the memory held by the slabs of files
+ */
+void
+storage_get_file_stats(slab_stats_t *stats);
+
+/**
+ * Reads the number of files stored compressed, the bytes they were written
+ * with and the bytes they take
+ */
+void
+storage_get_compression_stats(size_t *files, size_t *raw_bytes, size_t *stored_bytes);
+
 /**
  * Prints storage 
  */
@@ -0,0 +1,283 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "server/trace.h"
+#include "server/metrics.h"
+#include "utils/protocol.h"
+
+#define TRACE_RING_SIZE     4096    /* requests kept per thread */
+#define TRACE_MAIN_TID      0
+
+/**
+ * A traced request, stage timestamps are from metrics_now_us
+ */
+typedef struct {
+    uint64_t    stages[TRACE_STAGES];
+    int         worker;
+    int         client_fd;
+    int         request;
+    int         status;
+} trace_t;
+
+/**
+ * Last traces of a thread, the mutex is only contended while dumping
+ */
+typedef struct _trace_ring_t {
+    trace_t                 traces[TRACE_RING_SIZE];
+    unsigned long           written;
+    pthread_mutex_t         mtx;
+    struct _trace_ring_t    *next;
+} trace_ring_t;
+
+/**
+ * Connections accepted by the main thread
+ */
+typedef struct {
+    uint64_t    ts;
+    int         client_fd;
+} trace_accept_t;
+
+static struct {
+    unsigned int        sample_every;
+    trace_ring_t        *rings;
+    pthread_mutex_t     rings_mtx;
+    pthread_key_t       ring_key;
+    bool                ring_key_created;
+    trace_accept_t      accepts[TRACE_RING_SIZE];
+    unsigned long       accepted;
+    pthread_mutex_t     accepts_mtx;
+} tracer = {
+    .rings_mtx = PTHREAD_MUTEX_INITIALIZER,
+    .accepts_mtx = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static __thread trace_ring_t *thread_ring = NULL;
+static __thread trace_t current;
+static __thread bool tracing = false;
+static __thread unsigned long requests_seen = 0;
+
+void
+trace_init(unsigned int sample_every)
+{
+    tracer.sample_every = sample_every;
+}
+
+/**
+ * Decides whether the next event of the calling thread is traced
+ */
+static bool
+sampled()
+{
+    if (tracer.sample_every == 0) return false;
+    return (requests_seen++ % tracer.sample_every) == 0;
+}
+
+/**
+ * Destructor of the ring key, traces of exited threads are dropped
+ */
+static void
+free_thread_ring(void *arg)
+{
+    trace_ring_t *ring = (trace_ring_t*)arg;
+
+    pthread_mutex_lock(&tracer.rings_mtx);
+    trace_ring_t **link = &tracer.rings;
+    while (*link != ring) link = &(*link)->next;
+    *link = ring->next;
+    pthread_mutex_unlock(&tracer.rings_mtx);
+
+    pthread_mutex_destroy(&ring->mtx);
+    free(ring);
+    thread_ring = NULL;
+}
+
+static trace_ring_t*
+get_thread_ring()
+{
+    if (thread_ring != NULL) return thread_ring;
+
+    trace_ring_t *ring = calloc(1, sizeof(trace_ring_t));
+    if (ring == NULL) return NULL;
+    pthread_mutex_init(&ring->mtx, NULL);
+
+    // Registered once per thread, rings live until it exits or tracing is destroyed
+    pthread_mutex_lock(&tracer.rings_mtx);
+    if (!tracer.ring_key_created) {
+        tracer.ring_key_created = (pthread_key_create(&tracer.ring_key, free_thread_ring) == 0);
+    }
+    if (tracer.ring_key_created) pthread_setspecific(tracer.ring_key, ring);
+    ring->next = tracer.rings;
+    tracer.rings = ring;
+    pthread_mutex_unlock(&tracer.rings_mtx);
+
+    thread_ring = ring;
+    return ring;
+}
+
+void
+trace_accept(int client_fd)
+{
+    if (!sampled()) return;
+
+    pthread_mutex_lock(&tracer.accepts_mtx);
+    trace_accept_t *accept = &tracer.accepts[tracer.accepted % TRACE_RING_SIZE];
+    accept->ts = metrics_now_us();
+    accept->client_fd = client_fd;
+    tracer.accepted++;
+    pthread_mutex_unlock(&tracer.accepts_mtx);
+}
+
+void
+trace_begin(int worker_id, int client_fd, uint64_t enqueued_us, uint64_t dequeued_us)
+{
+    tracing = sampled();
+    if (!tracing) return;
+
+    memset(&current, 0, sizeof(trace_t));
+    current.worker = worker_id;
+    current.client_fd = client_fd;
+    current.stages[TRACE_ENQUEUED] = enqueued_us;
+    current.stages[TRACE_DEQUEUED] = dequeued_us;
+}
+
+void
+trace_mark(trace_stage stage)
+{
+    if (!tracing) return;
+
+    // Only the first time the storage lock is taken counts
+    if (stage == TRACE_LOCKED && current.stages[TRACE_LOCKED] != 0) return;
+    current.stages[stage] = metrics_now_us();
+}
+
+void
+trace_end(int request_code, int status)
+{
+    if (!tracing) return;
+    tracing = false;
+
+    trace_ring_t *ring = get_thread_ring();
+    if (ring == NULL) return;
+
+    // Requests without a handler were handled when the response was sent
+    if (current.stages[TRACE_SENT] == 0) current.stages[TRACE_SENT] = metrics_now_us();
+    if (current.stages[TRACE_HANDLED] == 0) current.stages[TRACE_HANDLED] = current.stages[TRACE_SENT];
+    if (current.stages[TRACE_RECEIVED] == 0) current.stages[TRACE_RECEIVED] = current.stages[TRACE_HANDLED];
+    current.request = request_code;
+    current.status = status;
+
+    pthread_mutex_lock(&ring->mtx);
+    ring->traces[ring->written % TRACE_RING_SIZE] = current;
+    ring->written++;
+    pthread_mutex_unlock(&ring->mtx);
+}
+
+/**
+ * Writes a complete event, from start to end, on the thread of a worker
+ */
+static void
+write_span(FILE *out, bool *first, const char *name, const char *category, int worker, uint64_t start, uint64_t end)
+{
+    if (end < start) end = start;
+
+    fprintf(out, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%lu,\"dur\":%lu,\"pid\":1,\"tid\":%d}",
+        (*first) ? "" : ",\n", name, category, start, end - start, worker + 1);
+    *first = false;
+}
+
+static void
+write_trace(FILE *out, bool *first, const trace_t *trace)
+{
+    const uint64_t *at = trace->stages;
+    const char *name = get_request_name(trace->request);
+    const char *status = get_status_message(trace->status);
+
+    fprintf(out, "%s{\"name\":\"%s\",\"cat\":\"request\",\"ph\":\"X\",\"ts\":%lu,\"dur\":%lu,\"pid\":1,\"tid\":%d,"
+        "\"args\":{\"client_fd\":%d,\"status\":\"%s\"}}",
+        (*first) ? "" : ",\n", (name) ? name : "unknown", at[TRACE_ENQUEUED], at[TRACE_SENT] - at[TRACE_ENQUEUED],
+        trace->worker + 1, trace->client_fd, (status) ? status : "unknown");
+    *first = false;
+
+    write_span(out, first, "queue", "stage", trace->worker, at[TRACE_ENQUEUED], at[TRACE_DEQUEUED]);
+    write_span(out, first, "recv", "stage", trace->worker, at[TRACE_DEQUEUED], at[TRACE_RECEIVED]);
+
+    uint64_t handler_start = at[TRACE_RECEIVED];
+    if (at[TRACE_LOCKED] != 0) {
+        write_span(out, first, "lock wait", "stage", trace->worker, at[TRACE_RECEIVED], at[TRACE_LOCKED]);
+        handler_start = at[TRACE_LOCKED];
+    }
+
+    write_span(out, first, "handler", "stage", trace->worker, handler_start, at[TRACE_HANDLED]);
+    write_span(out, first, "send", "stage", trace->worker, at[TRACE_HANDLED], at[TRACE_SENT]);
+}
+
+int
+trace_dump(const char *path)
+{
+    FILE *out = fopen(path, "w");
+    if (out == NULL) return -1;
+
+    int written = 0;
+    bool first = true;
+    int max_worker = -1;
+
+    fprintf(out, "{\"traceEvents\":[\n");
+
+    pthread_mutex_lock(&tracer.accepts_mtx);
+    unsigned long n_accepts = (tracer.accepted < TRACE_RING_SIZE) ? tracer.accepted : TRACE_RING_SIZE;
+    for (unsigned long i = tracer.accepted - n_accepts; i < tracer.accepted; i++) {
+        trace_accept_t *accept = &tracer.accepts[i % TRACE_RING_SIZE];
+        fprintf(out, "%s{\"name\":\"accept\",\"cat\":\"connection\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%lu,\"pid\":1,\"tid\":%d,"
+            "\"args\":{\"client_fd\":%d}}", (first) ? "" : ",\n", accept->ts, TRACE_MAIN_TID, accept->client_fd);
+        first = false;
+    }
+    pthread_mutex_unlock(&tracer.accepts_mtx);
+
+    pthread_mutex_lock(&tracer.rings_mtx);
+    for (trace_ring_t *ring = tracer.rings; ring != NULL; ring = ring->next) {
+
+        pthread_mutex_lock(&ring->mtx);
+        unsigned long n_traces = (ring->written < TRACE_RING_SIZE) ? ring->written : TRACE_RING_SIZE;
+        for (unsigned long i = ring->written - n_traces; i < ring->written; i++) {
+            trace_t *trace = &ring->traces[i % TRACE_RING_SIZE];
+            write_trace(out, &first, trace);
+            if (trace->worker > max_worker) max_worker = trace->worker;
+            written++;
+        }
+        pthread_mutex_unlock(&ring->mtx);
+    }
+    pthread_mutex_unlock(&tracer.rings_mtx);
+
+    // Thread names
+    fprintf(out, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"main\"}}",
+        (first) ? "" : ",\n", TRACE_MAIN_TID);
+    for (int i = 0; i <= max_worker; i++) {
+        fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"worker %d\"}}", i + 1, i);
+    }
+
+    fprintf(out, "\n]}\n");
+
+    if (fclose(out) != 0) return -1;
+    return written;
+}
+
+void
+trace_destroy()
+{
+    pthread_mutex_lock(&tracer.rings_mtx);
+    if (tracer.ring_key_created) {
+        pthread_key_delete(tracer.ring_key);
+        tracer.ring_key_created = false;
+    }
+    while (tracer.rings != NULL) {
+        trace_ring_t *ring = tracer.rings;
+        tracer.rings = ring->next;
+        pthread_mutex_destroy(&ring->mtx);
+        free(ring);
+    }
+    pthread_mutex_unlock(&tracer.rings_mtx);
+    thread_ring = NULL;
+}
@@ -0,0 +1,71 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Per request tracing. One request in every sample_every is traced:
+ * the worker serving it records when each stage of the request ended,
+ * and the finished trace goes in a ring of the worker's own, where
+ * older traces are overwritten. trace_dump writes all rings as a
+ * Chrome trace-event JSON file (chrome://tracing, ui.perfetto.dev).
+ */
+
+/**
+ * Stages of a request, in order
+ */
+typedef enum {
+    TRACE_ENQUEUED      = 0,    /* main thread queued the client */
+    TRACE_DEQUEUED      = 1,    /* a worker took it from the queue */
+    TRACE_RECEIVED      = 2,    /* request read from the socket */
+    TRACE_LOCKED        = 3,    /* storage lock acquired, if ever */
+    TRACE_HANDLED       = 4,    /* handler returned */
+    TRACE_SENT          = 5,    /* response written */
+    TRACE_STAGES        = 6,
+} trace_stage;
+
+/**
+ * Enables tracing of one request in every sample_every, 0 disables it
+ */
+void
+trace_init(unsigned int sample_every);
+
+/**
+ * Records that the main thread accepted a connection
+ */
+void
+trace_accept(int client_fd);
+
+/**
+ * Starts a request on the calling worker, deciding whether it is traced
+ */
+void
+trace_begin(int worker_id, int client_fd, uint64_t enqueued_us, uint64_t dequeued_us);
+
+/**
+ * Records the end of a stage of the current request, if it is traced
+ */
+void
+trace_mark(trace_stage stage);
+
+/**
+ * Ends the current request
+ */
+void
+trace_end(int request_code, int status);
+
+/**
+ * Writes all traces recorded so far to path.
+ * Returns the number of requests written, -1 on failure, errno is set.
+ */
+int
+trace_dump(const char *path);
+
+/**
+ * Frees all rings, threads must not trace anything afterwards
+ */
+void
+trace_destroy();
+
+#endif
@@ -0,0 +1,576 @@
+#include "server/wal.h"
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <libgen.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "server/logger.h"
+#include "utils/utilities.h"
+
+#define WAL_MAGIC       0x314c4157  /* "WAL1" */
+#define WAL_BUFFER_SIZE (1 << 16)
+
+/**
+ * Record header, followed by path and data
+ */
+typedef struct {
+    uint32_t    magic;
+    uint32_t    checksum;   /* over the rest of the record */
+    uint64_t    lsn;
+    uint32_t    op;
+    uint32_t    path_len;   /* including terminator */
+    uint64_t    data_size;
+} wal_record_t;
+
+/**
+ * Growable buffer of records waiting to be written
+ */
+typedef struct {
+    char        *data;
+    size_t      len;
+    size_t      cap;
+} wal_buffer_t;
+
+/**
+ * Log state
+ */
+static struct {
+    bool            enabled;
+    char            *path;
+    wal_sync_level  sync_level;
+    unsigned int    interval_ms;
+    int             fd;
+    unsigned int    seq;            /* current segment */
+    uint64_t        next_lsn;
+    uint64_t        last_lsn;       /* last record buffered */
+    uint64_t        durable_lsn;    /* last record written (and synced) */
+    bool            flushing;
+    bool            stop;
+    int             error;
+    wal_buffer_t    pending;
+    wal_buffer_t    spare;
+    pthread_t       flusher;
+    pthread_mutex_t mtx;
+    pthread_cond_t  pending_cond;
+    pthread_cond_t  durable_cond;
+} wal = {
+    .fd = -1,
+    .next_lsn = 1,
+    .mtx = PTHREAD_MUTEX_INITIALIZER,
+    .pending_cond = PTHREAD_COND_INITIALIZER,
+    .durable_cond = PTHREAD_COND_INITIALIZER,
+};
+
+static uint32_t
+wal_checksum(uint32_t hash, const void *data, size_t size)
+{
+    // FNV-1a
+    const unsigned char *p = data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= p[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static uint32_t
+record_checksum(const wal_record_t *record, const char *path, const void *data)
+{
+    uint32_t hash = 2166136261u;
+    hash = wal_checksum(hash, &record->lsn, sizeof(wal_record_t) - offsetof(wal_record_t, lsn));
+    hash = wal_checksum(hash, path, record->path_len);
+    if (record->data_size > 0) hash = wal_checksum(hash, data, record->data_size);
+    return hash;
+}
+
+static int
+buffer_append(wal_buffer_t *buffer, const void *data, size_t size)
+{
+    if (buffer->len + size > buffer->cap) {
+        size_t new_cap = (buffer->cap == 0) ? WAL_BUFFER_SIZE : buffer->cap;
+        while (new_cap < buffer->len + size) new_cap *= 2;
+
+        char *new_data = realloc(buffer->data, new_cap);
+        if (new_data == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+        buffer->data = new_data;
+        buffer->cap = new_cap;
+    }
+
+    memcpy(buffer->data + buffer->len, data, size);
+    buffer->len += size;
+    return 0;
+}
+
+static char*
+segment_path(unsigned int seq)
+{
+    char *path = malloc(strlen(wal.path) + 16);
+    if (path == NULL) return NULL;
+    sprintf(path, "%s.%06u", wal.path, seq);
+    return path;
+}
+
+/**
+ * Calls fun on the sequence number of every segment of the log
+ */
+static int
+for_each_segment(void (*fun)(unsigned int, void*), void *arg)
+{
+    char *dir_copy = strdup(wal.path);
+    char *base_copy = strdup(wal.path);
+    if (dir_copy == NULL || base_copy == NULL) {
+        free(dir_copy);
+        free(base_copy);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    char *dir_name = dirname(dir_copy);
+    char *base_name = basename(base_copy);
+    size_t base_len = strlen(base_name);
+
+    DIR *dir = opendir(dir_name);
+    if (dir == NULL) {
+        free(dir_copy);
+        free(base_copy);
+        return -1;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, base_name, base_len) != 0) continue;
+        if (entry->d_name[base_len] != '.') continue;
+
+        long seq;
+        if (is_number(entry->d_name + base_len + 1, &seq) != 0 || seq <= 0) continue;
+        fun((unsigned int)seq, arg);
+    }
+
+    closedir(dir);
+    free(dir_copy);
+    free(base_copy);
+    return 0;
+}
+
+static void
+find_last_segment(unsigned int seq, void *arg)
+{
+    unsigned int *last = arg;
+    if (seq > *last) *last = seq;
+}
+
+static int
+open_segment(unsigned int seq)
+{
+    char *path = segment_path(seq);
+    if (path == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0600);
+    free(path);
+    if (fd == -1) return -1;
+
+    wal.fd = fd;
+    wal.seq = seq;
+    return 0;
+}
+
+static void*
+wal_flusher_thread(void *arg)
+{
+    pthread_mutex_lock(&wal.mtx);
+
+    while (true) {
+
+        while (wal.pending.len == 0 && !wal.stop) {
+            pthread_cond_wait(&wal.pending_cond, &wal.mtx);
+        }
+        if (wal.pending.len == 0 && wal.stop) break;
+
+        // Gathers more records before committing
+        if (wal.interval_ms > 0 && !wal.stop) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += wal.interval_ms / 1000;
+            deadline.tv_nsec += (wal.interval_ms % 1000) * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            while (!wal.stop && pthread_cond_timedwait(&wal.pending_cond, &wal.mtx, &deadline) != ETIMEDOUT);
+        }
+
+        // Swapping buffers so that records can be logged during the commit
+        wal_buffer_t batch = wal.pending;
+        wal.pending = wal.spare;
+        wal.pending.len = 0;
+        uint64_t batch_lsn = wal.last_lsn;
+        int fd = wal.fd;
+        wal.flushing = true;
+
+        pthread_mutex_unlock(&wal.mtx);
+
+        int error = 0;
+        if (writen(fd, batch.data, batch.len) != batch.len) error = (errno) ? errno : EIO;
+        if (error == 0 && wal.sync_level != WAL_SYNC_NONE && fdatasync(fd) != 0) error = errno;
+
+        pthread_mutex_lock(&wal.mtx);
+
+        if (error != 0) {
+            wal.error = error;
+            log_error("Write-ahead log commit failed: %s\n", strerror(error));
+        }
+
+        batch.len = 0;
+        wal.spare = batch;
+        wal.durable_lsn = batch_lsn;
+        wal.flushing = false;
+        pthread_cond_broadcast(&wal.durable_cond);
+    }
+
+    pthread_mutex_unlock(&wal.mtx);
+    return NULL;
+}
+
+int
+wal_open(const char *path, wal_sync_level sync_level, unsigned int interval_ms)
+{
+    if (path == NULL || wal.enabled) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    wal.path = strdup(path);
+    if (wal.path == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    wal.sync_level = sync_level;
+    wal.interval_ms = interval_ms;
+
+    // New segment goes after the existing ones
+    unsigned int last_seq = 0;
+    if (for_each_segment(find_last_segment, &last_seq) != 0
+        || open_segment(last_seq + 1) != 0) {
+        free(wal.path);
+        wal.path = NULL;
+        return -1;
+    }
+
+    if (pthread_create(&wal.flusher, NULL, wal_flusher_thread, NULL) != 0) {
+        close(wal.fd);
+        free(wal.path);
+        wal.path = NULL;
+        return -1;
+    }
+
+    wal.enabled = true;
+    return 0;
+}
+
+static void
+collect_segment(unsigned int seq, void *arg)
+{
+    list_t *segments = arg;
+    if (seq >= wal.seq) return;
+
+    unsigned int *tmp = malloc(sizeof(unsigned int));
+    if (tmp == NULL) return;
+    *tmp = seq;
+
+    // Keeping segments sorted
+    int index = 0;
+    for (node_t *curr = segments->head; curr != NULL; curr = curr->next, index++) {
+        if (*(unsigned int*)curr->data > seq) break;
+    }
+    list_insert_at_index(segments, tmp, index);
+}
+
+static int
+make_space(storage_t *storage, size_t required_size)
+{
+    while (storage->no_of_files + 1 > storage->max_files
+            || storage->current_size + required_size > storage->max_size) {
+
+        if (storage->fifo_queue->head == NULL) return -1;
+        if (storage_remove_file(storage, (char*)storage->fifo_queue->head->data) != 0) return -1;
+    }
+    return 0;
+}
+
+static void
+apply_record(storage_t *storage, wal_record_t *record, char *path, void *data)
+{
+    file_t *file = storage_get_file(storage, path);
+
+    switch (record->op) {
+
+        case WAL_WRITE: {
+            if (file != NULL) storage_remove_file(storage, path);
+
+            if (record->data_size > storage->max_size) break;
+            if (make_space(storage, record->data_size) != 0) break;
+
+            file = storage_create_file(path);
+            if (file == NULL) break;
+
+            CLR_FLAG(file->flags, O_CREATE);
+            storage_add_file(storage, file);
+            storage_set_contents(storage, file, data, record->data_size);
+            list_insert_tail(storage->fifo_queue, file->path);
+            break;
+        }
+
+        case WAL_APPEND: {
+            if (file == NULL) break;
+            storage_append_contents(storage, file, data, record->data_size);
+            break;
+        }
+
+        case WAL_REMOVE: {
+            if (file == NULL) break;
+            storage_remove_file(storage, path);
+            break;
+        }
+    }
+}
+
+static int
+replay_segment(storage_t *storage, unsigned int seq, uint64_t from_lsn)
+{
+    char *path = segment_path(seq);
+    if (path == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        log_error("Could not open log segment %s: %s\n", path, strerror(errno));
+        free(path);
+        return -1;
+    }
+
+    int applied = 0;
+    wal_record_t record;
+    char record_path[MAX_PATH];
+
+    while (readn(fd, &record, sizeof(record)) == sizeof(record)) {
+
+        if (record.magic != WAL_MAGIC || record.path_len == 0 || record.path_len > MAX_PATH) break;
+        if (readn(fd, record_path, record.path_len) != record.path_len) break;
+
+        void *data = NULL;
+        if (record.data_size > 0) {
+            data = malloc(record.data_size);
+            if (data == NULL) break;
+            if (readn(fd, data, record.data_size) != record.data_size) {
+                free(data);
+                break;
+            }
+        }
+
+        // Torn or corrupted records end the segment
+        if (record_checksum(&record, record_path, data) != record.checksum
+            || record_path[record.path_len - 1] != '\0') {
+            log_error("Log segment %s is truncated at record %lu\n", path, record.lsn);
+            free(data);
+            break;
+        }
+
+        if (record.lsn > from_lsn) {
+            apply_record(storage, &record, record_path, data);
+            applied++;
+        }
+        if (record.lsn >= wal.next_lsn) wal.next_lsn = record.lsn + 1;
+
+        free(data);
+    }
+
+    close(fd);
+    free(path);
+    return applied;
+}
+
+int
+wal_replay(storage_t *storage, uint64_t from_lsn)
+{
+    if (!wal.enabled) return 0;
+
+    if (from_lsn >= wal.next_lsn) wal.next_lsn = from_lsn + 1;
+
+    list_t *segments = list_create(int_compare, free, NULL);
+    if (segments == NULL) return -1;
+
+    if (for_each_segment(collect_segment, segments) != 0) {
+        list_destroy(segments);
+        return -1;
+    }
+
+    int applied = 0;
+    for (node_t *curr = segments->head; curr != NULL; curr = curr->next) {
+        int res = replay_segment(storage, *(unsigned int*)curr->data, from_lsn);
+        if (res > 0) applied += res;
+    }
+
+    wal.last_lsn = wal.durable_lsn = wal.next_lsn - 1;
+
+    list_destroy(segments);
+    return applied;
+}
+
+uint64_t
+wal_log(wal_op op, const char *path, const void *data, size_t size)
+{
+    if (!wal.enabled) return 0;
+
+    wal_record_t record;
+    record.magic = WAL_MAGIC;
+    record.op = op;
+    record.path_len = strlen(path) + 1;
+    record.data_size = size;
+
+    lock_return(&wal.mtx, 0);
+
+    record.lsn = wal.next_lsn;
+    record.checksum = record_checksum(&record, path, data);
+
+    size_t old_len = wal.pending.len;
+    if (buffer_append(&wal.pending, &record, sizeof(record)) != 0
+        || buffer_append(&wal.pending, path, record.path_len) != 0
+        || (size > 0 && buffer_append(&wal.pending, data, size) != 0)) {
+
+        wal.pending.len = old_len;
+        unlock_return(&wal.mtx, 0);
+        log_error("Could not log operation on %s: %s\n", path, strerror(errno));
+        return 0;
+    }
+
+    wal.next_lsn++;
+    wal.last_lsn = record.lsn;
+    pthread_cond_signal(&wal.pending_cond);
+
+    unlock_return(&wal.mtx, 0);
+    return record.lsn;
+}
+
+int
+wal_commit(uint64_t lsn)
+{
+    if (!wal.enabled || lsn == 0 || wal.sync_level != WAL_SYNC_COMMIT) return 0;
+
+    lock_return(&wal.mtx, -1);
+    while (wal.durable_lsn < lsn && wal.error == 0) {
+        cond_wait_return(&wal.durable_cond, &wal.mtx, -1);
+    }
+    int res = (wal.error == 0) ? 0 : -1;
+    unlock_return(&wal.mtx, -1);
+
+    return res;
+}
+
+/**
+ * Waits until every buffered record has been written, wal.mtx must be held
+ */
+static void
+wait_flushed()
+{
+    while ((wal.pending.len > 0 || wal.flushing) && wal.error == 0) {
+        pthread_cond_signal(&wal.pending_cond);
+        pthread_cond_wait(&wal.durable_cond, &wal.mtx);
+    }
+}
+
+unsigned int
+wal_rotate(uint64_t *lsn)
+{
+    if (lsn) *lsn = 0;
+    if (!wal.enabled) return 0;
+
+    lock_return(&wal.mtx, 0);
+
+    wait_flushed();
+    if (lsn) *lsn = wal.last_lsn;
+
+    int old_fd = wal.fd;
+    unsigned int old_seq = wal.seq;
+    if (open_segment(old_seq + 1) != 0) {
+        log_error("Could not start a new log segment: %s\n", strerror(errno));
+        unlock_return(&wal.mtx, 0);
+        return 0;
+    }
+
+    unsigned int seq = wal.seq;
+    unlock_return(&wal.mtx, 0);
+
+    // Records are already going to the new segment
+    fdatasync(old_fd);
+    close(old_fd);
+    return seq;
+}
+
+uint64_t
+wal_last_lsn()
+{
+    if (!wal.enabled) return 0;
+
+    lock_return(&wal.mtx, 0);
+    uint64_t lsn = wal.last_lsn;
+    unlock_return(&wal.mtx, 0);
+    return lsn;
+}
+
+static void
+remove_segment(unsigned int seq, void *arg)
+{
+    unsigned int before = *(unsigned int*)arg;
+    if (seq >= before) return;
+
+    char *path = segment_path(seq);
+    if (path == NULL) return;
+    if (unlink(path) != 0) log_error("Could not remove log segment %s: %s\n", path, strerror(errno));
+    free(path);
+}
+
+void
+wal_checkpoint(unsigned int seq)
+{
+    if (!wal.enabled || seq == 0) return;
+    for_each_segment(remove_segment, &seq);
+}
+
+void
+wal_close()
+{
+    if (!wal.enabled) return;
+
+    pthread_mutex_lock(&wal.mtx);
+    wait_flushed();
+    wal.stop = true;
+    pthread_cond_signal(&wal.pending_cond);
+    pthread_mutex_unlock(&wal.mtx);
+
+    pthread_join(wal.flusher, NULL);
+
+    if (wal.sync_level != WAL_SYNC_NONE) fdatasync(wal.fd);
+    close(wal.fd);
+
+    free(wal.pending.data);
+    free(wal.spare.data);
+    free(wal.path);
+    wal.enabled = false;
+}
@@ -0,0 +1,94 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include <stdint.h>
+
+#include "server/storage.h"
+
+/**
+ * Write-ahead log of mutating operations. Records are appended to an
+ * in-memory buffer under the storage lock and written by a flusher thread,
+ * which batches all records logged during one write + fdatasync (group commit).
+ *
+ * The log is split in segments named <path>.<seq>, a checkpoint starts a new
+ * segment so the older ones can be deleted once a snapshot covers them.
+ */
+
+/**
+ * Durability levels
+ */
+typedef enum {
+    WAL_SYNC_NONE       = 0,    /* records are written, never synced */
+    WAL_SYNC_PERIODIC   = 1,    /* records are synced in background */
+    WAL_SYNC_COMMIT     = 2,    /* requests wait for their records to be synced */
+} wal_sync_level;
+
+/**
+ * Logged operations
+ */
+typedef enum {
+    WAL_WRITE   = 1,
+    WAL_APPEND  = 2,
+    WAL_REMOVE  = 3,
+} wal_op;
+
+/**
+ * Opens the log at path, a new segment is started after the existing ones.
+ * interval_ms is how long the flusher waits to gather records before a commit.
+ * Returns 0 on success, -1 on failure, errno is set.
+ */
+int
+wal_open(const char *path, wal_sync_level sync_level, unsigned int interval_ms);
+
+/**
+ * Replays existing segments over storage, records up to from_lsn are skipped
+ * since the snapshot already contains them. Must be called before any logging.
+ * Returns the number of records applied, -1 on failure, errno is set.
+ */
+int
+wal_replay(storage_t *storage, uint64_t from_lsn);
+
+/**
+ * Appends a record to the log, must be called with storage locked so that
+ * records follow the order in which operations are applied.
+ * Returns the record LSN, 0 if the log is disabled or on failure.
+ */
+uint64_t
+wal_log(wal_op op, const char *path, const void *data, size_t size);
+
+/**
+ * Waits until the record with the given LSN is durable, according to the
+ * configured durability level. Returns 0 on success, -1 on failure.
+ */
+int
+wal_commit(uint64_t lsn);
+
+/**
+ * Flushes the current segment and starts a new one, the old segment is
+ * synced once writers can log again. The LSN of the last record logged so
+ * far is saved in lsn, it covers storage only if storage is locked.
+ * Returns the sequence number of the new segment, 0 if the log is disabled.
+ */
+unsigned int
+wal_rotate(uint64_t *lsn);
+
+/**
+ * Returns the LSN of the last record logged, 0 if the log is disabled
+ */
+uint64_t
+wal_last_lsn();
+
+/**
+ * Deletes all segments older than segment seq, once a snapshot made at
+ * the time of the corresponding rotation has been saved.
+ */
+void
+wal_checkpoint(unsigned int seq);
+
+/**
+ * Flushes pending records, stops the flusher and closes the log
+ */
+void
+wal_close();
+
+#endif
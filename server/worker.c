@@ -7,6 +7,187 @@
 #include <assert.h>
 
 #include "server/server_config.h"
+#include "server/wal.h"
+#include "server/stats.h"
+#include "server/hot_keys.h"
+#include "server/payload.h"
+
+/**
+ * A file read out of storage, to be sent once storage is unlocked
+ */
+typedef struct {
+    char        *path;
+    void        *contents;
+    size_t      size;       /* with BODY_COMPRESSED set if contents are compressed */
+    uint32_t    checksum;   /* of the contents as clients wrote them */
+} file_copy_t;
+
+static void
+free_file_copy(void *e)
+{
+    file_copy_t *copy = (file_copy_t*)e;
+    free(copy->path);
+    free(copy->contents);
+    free(copy);
+}
+
+/**
+ * Copies the contents of file into a buffer of its own, decompressed unless
+ * the client takes them compressed, in which case BODY_COMPRESSED is set in
+ * size. Storage must be locked.
+ * Returns 0 on success, -1 on failure, errno is set.
+ */
+static int
+copy_contents(int client_fd, file_t *file, void **buffer, size_t *size)
+{
+    // Contents mapped from a snapshot are checked the first time they are read
+    if ( storage_verify_contents(file) != 0 ) {
+        log_error("File [%s] is corrupted: %s\n", file->path, strerror(errno));
+        return -1;
+    }
+
+    bool pass_through = file->compressed && CHK_FLAG(get_capabilities(client_fd), CAP_COMPRESSION);
+
+    *size = (pass_through) ? file->size : storage_contents_size(file);
+    *buffer = malloc((*size > 0) ? *size : 1);
+    if ( *buffer == NULL ) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    if ( pass_through ) {
+        memcpy(*buffer, file->contents, file->size);
+        SET_FLAG(*size, BODY_COMPRESSED);
+    } else if ( storage_read_contents(file, *buffer) != 0 ) {
+        log_error("Could not decompress file [%s]: %s\n", file->path, strerror(errno));
+        free(*buffer);
+        *buffer = NULL;
+        *size = 0;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Closes a connection whose requests can no longer be read, like a
+ * closeConnection the client did not send
+ */
+static void
+drop_connection(int *client_fd)
+{
+    set_capabilities(*client_fd, 0);
+    close(*client_fd);
+    *client_fd = -1;
+
+    pthread_mutex_lock(&server_status_mtx);
+    server_status->current_connections--;
+    pthread_mutex_unlock(&server_status_mtx);
+}
+
+/**
+ * Receives and drops the streamed body of request
+ */
+static int
+drain_stream(int client_fd, request_t *request)
+{
+    // Frames are taken in pieces, draining needs no memory that could be missing
+    char frame[BUFSIZ];
+
+    body_stream_t stream;
+    stream_open(&stream, client_fd, request->body_size);
+
+    ssize_t received;
+    while ((received = stream_recv(&stream, frame, sizeof(frame))) > 0);
+
+    return (received == 0) ? 0 : -1;
+}
+
+/**
+ * Receives the streamed body of request frame by frame straight into the
+ * arena of file contents, where it becomes the body of request.
+ * Returns 0 on success, -1 on failure, errno is set (ENOMEM if the body
+ * was dropped, ECANCELED if the client aborted it).
+ */
+static int
+receive_stream(int client_fd, request_t *request)
+{
+    char *body = payload_alloc(request->body_size);
+    if (body == NULL) {
+        // Connection goes on if the body could be dropped
+        if (drain_stream(client_fd, request) == 0 || errno == ECANCELED) errno = ENOMEM;
+        return -1;
+    }
+
+    body_stream_t stream;
+    stream_open(&stream, client_fd, request->body_size);
+
+    size_t size = 0;
+    ssize_t received;
+    while ((received = stream_recv(&stream, body + size, request->body_size - size)) > 0) size += received;
+
+    if (received != 0) {
+        int err = errno;
+        payload_free(body, request->body_size);
+        errno = err;
+        return -1;
+    }
+
+    request->body = body;
+    return 0;
+}
+
+/**
+ * Sends the size bytes of the file of request in frames of stream_chunk_size
+ * bytes, each copied out of storage while holding the lock only for it.
+ * The body is aborted if the file changes in between.
+ */
+static int
+stream_file(int client_fd, request_t *request, size_t size, uint32_t checksum)
+{
+    if ( send_response(client_fd, SUCCESS, get_status_message(SUCCESS), request->path_len, request->file_path, size | BODY_STREAMED, NULL) != 0 ) return -1;
+
+    body_stream_t stream;
+    stream_open(&stream, client_fd, size);
+
+    char *frame = malloc(server_config.stream_chunk_size);
+    if (frame == NULL) {
+        stream_abort(&stream);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    int result = 0;
+    for (size_t offset = 0; result == 0 && offset < size; offset += server_config.stream_chunk_size) {
+        size_t length = (size - offset < server_config.stream_chunk_size) ? size - offset : server_config.stream_chunk_size;
+
+        if (pthread_mutex_lock(&(storage->access)) != 0) {
+            stream_abort(&stream);
+            result = -1;
+            break;
+        }
+        metrics_lock_acquired();
+
+        file_t *file = storage_get_file(storage, request->file_path);
+        bool changed = file == NULL || file->checksum != checksum || file->compressed || storage_contents_size(file) != size;
+        if (!changed) result = storage_read_range(file, frame, offset, length);
+
+        metrics_lock_released();
+        if (pthread_mutex_unlock(&(storage->access)) != 0) result = -1;
+
+        if (changed || result != 0) {
+            stream_abort(&stream);
+            if (changed) errno = ECANCELED;
+            result = -1;
+            break;
+        }
+
+        result = stream_send(&stream, frame, length);
+    }
+
+    if (result == 0) result = stream_end(&stream);
+    free(frame);
+    return result;
+}
 
 void*
 worker_thread(void* args)
@@ -19,6 +200,12 @@ worker_thread(void* args)
 
     free(args);
 
+    metrics_set_worker(worker_id);
+
+    // Requests are received in an arena reset after each of them, without it they go to the heap
+    arena_t *arena = arena_create(ARENA_DEFAULT_SIZE);
+    if (arena == NULL) log_error("(WORKER %d) Could not create request arena: %s\n", worker_id, strerror(errno));
+
     // Main worker loop
     do {
 
@@ -31,39 +218,85 @@ worker_thread(void* args)
             cond_wait_return((&request_queue_notempty), (&request_queue_mtx), NULL);
         }
 
-        int *tmp_ptr = (int*)list_remove_head(request_queue);
+        queued_client_t *queued = (queued_client_t*)list_remove_head(request_queue);
+        int client_fd = queued->client_fd;
+        uint64_t enqueued_us = queued->enqueued_us;
+        if ( list_insert_head(request_pool, queued) != 0 ) free(queued);
 
         unlock_return(&(request_queue_mtx), NULL);
         
-        int client_fd = *tmp_ptr;
-        free(tmp_ptr);
-        
         if ( client_fd == -1 ) break;     // Server signal to worker for termination
+
+        uint64_t start_us = metrics_now_us();
+        metrics_record(HISTOGRAM_QUEUE_WAIT, start_us - enqueued_us);
+        metrics_set_busy(true);
+        trace_begin(worker_id, client_fd, enqueued_us, start_us);
         
         // Receiving request from client
-        request_t *request = recv_request(client_fd);
+        request_t *request = recv_request_arena(client_fd, arena);
         if (request == NULL) {
             log_error("Request could not be received: %s\n", strerror(errno));
-            close(client_fd);
-            client_fd = -1;
+            drop_connection(&client_fd);
             write(pipe_fd, &client_fd, sizeof(int));
-            free_request(request);
+            arena_reset(arena);
+            trace_end(0, BAD_REQUEST);
+            metrics_set_busy(false);
+            continue;
         }
 
-        switch (request->type) {
+        trace_mark(TRACE_RECEIVED);
+        log_sample_request();
+
+        // Outcome of the request, for the operation log
+        int op_status = SUCCESS;
+        size_t op_bytes = 0;
+
+        // Only writes take streamed bodies, others are dropped and refused without handling the request
+        bool refused = request->streamed && request->type != WRITE_FILE;
+        if ( refused ) {
+            int drained = drain_stream(client_fd, request);
+            trace_mark(TRACE_HANDLED);
+            if ( drained != 0 && errno != ECANCELED ) {
+                // Frames were lost, the next request cannot be found
+                log_error("Streamed body could not be received: %s\n", strerror(errno));
+                drop_connection(&client_fd);
+            } else {
+                send_response(client_fd, BAD_REQUEST, get_status_message(BAD_REQUEST), request->path_len, request->file_path, 0, NULL);
+            }
+            op_status = BAD_REQUEST;
+        }
+
+        if ( !refused ) switch (request->type) {
 
             case OPEN_CONNECTION: {     
                 int status = 0;
                 if ( shutdown_now ) status = INTERNAL_ERROR;  // shouldn't happen
                 if ( accept_connection == 0 ) status = NO_MORE_CON;
-                send_response(client_fd, status, get_status_message(status), 0, "", 0, NULL);
 
-                log_info("(WORKER %d) [  %s  ]  %-21s\n", worker_id, "openConn",  get_status_message(status));
+                // Capabilities asked for are answered with those accepted, the connection starts with none
+                uint32_t capabilities = 0;
+                size_t caps_size = 0;
+                if ( request->body_size == sizeof(uint32_t) ) {
+                    capabilities = *(uint32_t*)request->body;
+                    if ( !server_config.wire_compression ) CLR_FLAG(capabilities, CAP_COMPRESSION);
+                    if ( server_config.stream_chunk_size == 0 ) CLR_FLAG(capabilities, CAP_STREAMING);
+                    capabilities &= CAP_COMPRESSION | CAP_CHECKSUM | CAP_STREAMING;
+                    caps_size = sizeof(uint32_t);
+                }
+                if ( status != SUCCESS ) capabilities = 0;
+
+                set_capabilities(client_fd, 0);
+                send_response(client_fd, status, get_status_message(status), 0, "", caps_size, &capabilities);
+                set_capabilities(client_fd, capabilities);
+
+                log_request("(WORKER %d) [  %s  ]  %-21s\n", worker_id, "openConn",  get_status_message(status));
+                op_status = status;
                 break;
             }
     
             case CLOSE_CONNECTION: {     
                 int status = 0;
+                set_capabilities(client_fd, 0);
                 close(client_fd);
                 client_fd = -1;
                 
@@ -72,20 +305,24 @@ worker_thread(void* args)
                 server_status->current_connections--;
                 unlock_return((&server_status_mtx), NULL);
 
-                log_info("(WORKER %d) [ %s  ]  %-21s\n", worker_id, "closeConn", get_status_message(status));
-                
+                log_request("(WORKER %d) [ %s  ]  %-21s\n", worker_id, "closeConn", get_status_message(status));
+                op_status = status;
                 break;
             }
             
             case OPEN_FILE: {    
                 int status = open_file_handler(worker_id, client_fd, request);
+                trace_mark(TRACE_HANDLED);
                 send_response(client_fd, status, get_status_message(status), request->path_len, request->file_path, 0, NULL);
+                op_status = status;
                 break;
             }
             
             case CLOSE_FILE: {
                 int status = close_file_handler(worker_id, client_fd, request);
+                trace_mark(TRACE_HANDLED);
                 send_response(client_fd, status, get_status_message(status), request->path_len, request->file_path, 0, NULL);
+                op_status = status;
                 break;
 
             }
@@ -93,65 +330,136 @@ worker_thread(void* args)
             case WRITE_FILE: {
                 list_t *expelled_files = list_create(NULL, free_file, NULL);
                 int status = write_file_handler(worker_id, client_fd, request, expelled_files);
-                send_response(client_fd, status, get_status_message(status), request->path_len, request->file_path, 0, NULL);
+                trace_mark(TRACE_HANDLED);
+                if ( status == -1 ) {
+                    // Streamed body was cut short, the next request cannot be found
+                    drop_connection(&client_fd);
+                    status = BAD_REQUEST;
+                } else {
+                    send_response(client_fd, status, get_status_message(status), request->path_len, request->file_path, 0, NULL);
+                }
                 list_destroy(expelled_files);
+                op_status = status;
+                op_bytes = request->body_size;
                 break;
             }
 
             case APPEND_TO_FILE: {
                 list_t *expelled_files = list_create(NULL, free_file, NULL);
                 int status = append_to_file_handler(worker_id, client_fd, request, expelled_files);
+                trace_mark(TRACE_HANDLED);
                 send_response(client_fd, status, get_status_message(status), request->path_len, request->file_path, 0, NULL);
                 list_destroy(expelled_files);
+                op_status = status;
+                op_bytes = request->body_size;
+                break;
             }
 
             case READ_FILE: {
                 void *read_buffer = NULL;
                 size_t buffer_size = 0;
-                int status = read_file_handler(worker_id, client_fd, request, &read_buffer, &buffer_size);
-                send_response(client_fd, status, get_status_message(status), request->path_len, request->file_path, buffer_size, read_buffer);
+                uint32_t checksum = 0;
+                bool streamed = false;
+                int status = read_file_handler(worker_id, client_fd, request, &read_buffer, &buffer_size, &checksum, &streamed);
+                trace_mark(TRACE_HANDLED);
+                if ( streamed ) {
+                    if ( stream_file(client_fd, request, buffer_size, checksum) != 0 ) {
+                        log_error("File [%s] could not be streamed: %s\n", request->file_path, strerror(errno));
+                    }
+                } else {
+                    send_response_checksum(client_fd, status, get_status_message(status), request->path_len, request->file_path, buffer_size, read_buffer, checksum);
+                }
                 if (read_buffer) free(read_buffer);
+                op_status = status;
+                op_bytes = buffer_size & ~BODY_COMPRESSED;
+                metrics_count(METRIC_BYTES_OUT, op_bytes);
                 break;
             }
 
             case READ_N_FILES: {
-                list_t *files_list = list_create(NULL, free_file, NULL);
-                int status = read_n_files_handler(worker_id, client_fd, request, files_list);
+                list_t *files_list = list_create(NULL, free_file_copy, NULL);
+                int status = read_n_files_handler(worker_id, client_fd, request, files_list, &op_bytes);
+                trace_mark(TRACE_HANDLED);
                 send_response(client_fd, status, get_status_message(status), 0, "", 0, NULL);
                 list_destroy(files_list);
+                op_status = status;
+                metrics_count(METRIC_BYTES_OUT, op_bytes);
                 break;
             }
 
             case REMOVE_FILE: { 
                 int status = remove_file_handler(worker_id, client_fd, request);
+                trace_mark(TRACE_HANDLED);
                 send_response(client_fd, status, get_status_message(status), request->path_len, request->file_path, 0, NULL);
+                op_status = status;
                 break;
             }
 
             case LOCK_FILE: {
                 int status = lock_file_handler(worker_id, client_fd, request);
+                trace_mark(TRACE_HANDLED);
                 if (status != AWAITING) {
                     send_response(client_fd, status, get_status_message(status), request->path_len, request->file_path, 0, NULL);
                 }
+                op_status = status;
                 break;
             }
 
             case UNLOCK_FILE: {
                 int status = unlock_file_handler(worker_id, client_fd, request);
+                trace_mark(TRACE_HANDLED);
                 send_response(client_fd, status, get_status_message(status), request->path_len, request->file_path, 0, NULL);
+                op_status = status;
+                break;
+            }
+
+            case READ_RANGE: {
+                void *read_buffer = NULL;
+                size_t buffer_size = 0;
+                int status = read_range_handler(worker_id, client_fd, request, &read_buffer, &buffer_size);
+                trace_mark(TRACE_HANDLED);
+                send_response(client_fd, status, get_status_message(status), request->path_len, request->file_path, buffer_size, read_buffer);
+                if (read_buffer) free(read_buffer);
+                op_status = status;
+                op_bytes = buffer_size;
+                metrics_count(METRIC_BYTES_OUT, op_bytes);
+                break;
+            }
+
+            case STATS: {
+                char *stats = NULL;
+                size_t stats_size = 0;
+                int status = stats_handler(worker_id, client_fd, request, &stats, &stats_size);
+                trace_mark(TRACE_HANDLED);
+                send_response(client_fd, status, get_status_message(status), 0, "", stats_size, stats);
+                if (stats) free(stats);
+                op_status = status;
+                op_bytes = stats_size;
+                metrics_count(METRIC_BYTES_OUT, stats_size);
                 break;
             }
         } 
 
+        trace_mark(TRACE_SENT);
+        trace_end(request->type, op_status);
+
+        uint64_t latency_us = metrics_now_us() - start_us;
+        metrics_request(request->type, op_status, latency_us);
+        metrics_count(METRIC_BYTES_IN, request->body_size);
+        log_op(worker_id, request->type, op_status, request->file_path, op_bytes, latency_us);
+        metrics_set_busy(false);
+
         if ( write(pipe_fd, &client_fd, sizeof(int)) == -1 ) {
             log_fatal("(WORKER %d) write on pipe failed: %s\n", strerror(errno));
             return NULL;
         }
 
         if ( request ) free_request(request);
+        arena_reset(arena);
 
     } while (shutdown_now == 0);
 
+    arena_destroy(arena);
     return NULL;
 }
 
@@ -170,26 +478,34 @@ open_file_handler(int worker_no, int client_fd, request_t *request)
     
         log_debug("creating file [%s]\n", request->file_path);
 
+        // Files that are surely new are allocated before taking the lock
+        bool may_exist = storage_may_contain(storage, request->file_path);
+        file_t *new_file = (may_exist) ? NULL : storage_create_file(request->file_path);
+
         // Checking whether file already exists
-        lock_return(&(storage->access), INTERNAL_ERROR);
+        timed_lock_return(&(storage->access), INTERNAL_ERROR);
 
-        if (storage_get_file(storage, request->file_path) != NULL) {
+        if (storage_contains_file(storage, request->file_path)) {
             // File exists, log and return status
-            unlock_return(&(storage->access), INTERNAL_ERROR);
+            timed_unlock_return(&(storage->access), INTERNAL_ERROR);
+            if (new_file) free_file(new_file);
 
-            log_info("(WORKER %d) [  %s  ]  %-21s : %s\n", 
+            log_request("(WORKER %d) [  %s  ]  %-21s : %s\n", 
                 worker_no, "openFile", get_status_message(FILE_EXISTS), request->file_path);
 
             return FILE_EXISTS;
         }
 
         // Creating the file
-        file_t *new_file = storage_create_file(request->file_path);
+        if (may_exist) {
+            storage_false_positive(storage);
+            new_file = storage_create_file(request->file_path);
+        }
         if (new_file == NULL) {
             // Fatal error
-            unlock_return(&(storage->access), INTERNAL_ERROR);
+            timed_unlock_return(&(storage->access), INTERNAL_ERROR);
 
-            log_info("(WORKER %d) [  %s  ]  %-21s : %s\n", 
+            log_request("(WORKER %d) [  %s  ]  %-21s : %s\n", 
                 worker_no, "openFile", get_status_message(INTERNAL_ERROR), request->file_path);
 
             return INTERNAL_ERROR;
@@ -198,22 +514,28 @@ open_file_handler(int worker_no, int client_fd, request_t *request)
         // Makes space for the new file if necessary
         if (storage->no_of_files + 1 > storage->max_files) {
 
-            char *to_remove_path = (char*)list_remove_head(storage->fifo_queue);
+            // Path is borrowed from the file, it stays queued until the file is removed
+            char *to_remove_path = (storage->fifo_queue->head) ? (char*)storage->fifo_queue->head->data : NULL;
             if (to_remove_path == NULL) {
                 // Fatal error
-                unlock_return(&(storage->access), INTERNAL_ERROR);
+                timed_unlock_return(&(storage->access), INTERNAL_ERROR);
 
-                log_info("(WORKER %d) [  %s  ]  %-21s : %s\n", 
+                log_request("(WORKER %d) [  %s  ]  %-21s : %s\n", 
                     worker_no, "openFile", get_status_message(INTERNAL_ERROR), request->file_path);
 
                 return INTERNAL_ERROR;
             }
 
             
-            // Removing file
-            log_info("(WORKER %d) [%s]  %-21s : %s\n", 
+            // Demoting file to the disk tier, or removing it
+            log_request("(WORKER %d) [%s]  %-21s : %s\n", 
                 worker_no, "FIFO replace", get_status_message(FILES_EXPELLED), to_remove_path);
-            storage_remove_file(storage, to_remove_path);
+            log_op(worker_no, OP_FILE_EXPELLED, FILES_EXPELLED, to_remove_path, 0, 0);
+            if (storage->tier == NULL || storage_demote_file(storage, to_remove_path) != 0) {
+                wal_log(WAL_REMOVE, to_remove_path, NULL, 0);
+                storage_remove_file(storage, to_remove_path);
+                metrics_count(METRIC_EVICTIONS, 1);
+            }
 
         }
         
@@ -221,7 +543,7 @@ open_file_handler(int worker_no, int client_fd, request_t *request)
         // Adding empty file to storage
         storage_add_file(storage, new_file);
 
-        unlock_return(&(storage->access), INTERNAL_ERROR);
+        timed_unlock_return(&(storage->access), INTERNAL_ERROR);
 
         log_debug("file [%s] added\n", request->file_path);
     }
@@ -230,15 +552,21 @@ open_file_handler(int worker_no, int client_fd, request_t *request)
 
         log_debug("locking file [%s]\n", request->file_path);
 
-        // Checking whether file already exists
-        lock_return(&(storage->access), INTERNAL_ERROR);
+        // Checking whether file already exists, misses don't need the lock
+        file_t *file = NULL;
+        if (storage_may_contain(storage, request->file_path)) {
+            timed_lock_return(&(storage->access), INTERNAL_ERROR);
+            file = storage_fetch_file(storage, request->file_path);
+            if (file == NULL) {
+                storage_false_positive(storage);
+                timed_unlock_return(&(storage->access), INTERNAL_ERROR);
+            }
+        }
 
-        file_t *file = storage_get_file(storage, request->file_path);
         if (file == NULL) {
             // File doesn't exists, log and return
-            unlock_return(&(storage->access), INTERNAL_ERROR);
 
-            log_info("(WORKER %d) [  %s  ]  %-21s : %s\n", 
+            log_request("(WORKER %d) [  %s  ]  %-21s : %s\n", 
                 worker_no, "openFile", get_status_message(NOT_FOUND), request->file_path);
 
             return NOT_FOUND;
@@ -247,9 +575,9 @@ open_file_handler(int worker_no, int client_fd, request_t *request)
         // Checking whether file is already locked
         if (CHK_FLAG(file->flags, O_LOCK) && (file->locked_by == client_fd)) {
             
-            unlock_return(&(storage->access), INTERNAL_ERROR);
+            timed_unlock_return(&(storage->access), INTERNAL_ERROR);
 
-            log_info("(WORKER %d) [  %s  ]  %-21s : %s\n", 
+            log_request("(WORKER %d) [  %s  ]  %-21s : %s\n", 
                 worker_no, "openFile", get_status_message(UNAUTHORIZED), request->file_path);
 
             return UNAUTHORIZED; 
@@ -261,28 +589,34 @@ open_file_handler(int worker_no, int client_fd, request_t *request)
 
         storage_update_file(storage, file);
 
-        unlock_return(&(storage->access), INTERNAL_ERROR);
+        timed_unlock_return(&(storage->access), INTERNAL_ERROR);
  
         log_debug("file [%s] locked\n", request->file_path);
     }
 
     if (CHK_FLAG(flags, O_NOFLAG)) { // flag is O_NOFLAG, checking whether file exists
         
-        // Checking whether file already exists
-        lock_return(&(storage->access), INTERNAL_ERROR);
+        // Checking whether file already exists, misses don't need the lock
+        bool found = false;
+        if (storage_may_contain(storage, request->file_path)) {
+            timed_lock_return(&(storage->access), INTERNAL_ERROR);
+            found = storage_contains_file(storage, request->file_path);
+            if (!found) {
+                storage_false_positive(storage);
+                timed_unlock_return(&(storage->access), INTERNAL_ERROR);
+            }
+        }
 
-        file_t *file = storage_get_file(storage, request->file_path);
-        if (file == NULL) {
+        if (!found) {
             // File doesn't exists, log and return
-            unlock_return(&(storage->access), INTERNAL_ERROR);
 
-            log_info("(WORKER %d) [  %s  ]  %-21s : %s\n", 
+            log_request("(WORKER %d) [  %s  ]  %-21s : %s\n", 
                 worker_no, "openFile", get_status_message(NOT_FOUND), request->file_path);
 
             return NOT_FOUND;
         }
 
-        unlock_return(&(storage->access), INTERNAL_ERROR);
+        timed_unlock_return(&(storage->access), INTERNAL_ERROR);
     }
 
     // Printing found flags
@@ -292,7 +626,7 @@ open_file_handler(int worker_no, int client_fd, request_t *request)
     if (CHK_FLAG(flags, O_NOFLAG)) strcat(print_flags, "(O_NOFLAG)");
     
     
-    log_info("(WORKER %d) [  %s  ]  %-21s : %s : %s\n", 
+    log_request("(WORKER %d) [  %s  ]  %-21s : %s : %s\n", 
         worker_no, "openFile", get_status_message(status), request->file_path, print_flags);
 
     return status;
@@ -305,22 +639,22 @@ close_file_handler(int worker_no, int client_fd, request_t *request)
 
     int status = 0; // will be the final response status
 
-    lock_return(&(storage->access), INTERNAL_ERROR);
+    timed_lock_return(&(storage->access), INTERNAL_ERROR);
 
     // Checking whether file exists
     file_t *file = storage_get_file(storage, request->file_path);
-    if (file == NULL) {
+    if (file == NULL && !storage_contains_file(storage, request->file_path)) {
         // File doesn't exists, log and return
-        unlock_return(&(storage->access), INTERNAL_ERROR);
+        timed_unlock_return(&(storage->access), INTERNAL_ERROR);
 
-        log_info("(WORKER %d) [ %s  ]  %-21s : %s\n", 
+        log_request("(WORKER %d) [ %s  ]  %-21s : %s\n", 
             worker_no, "closeFile", get_status_message(NOT_FOUND), request->file_path);
         
         return NOT_FOUND;
     }
 
-    // Checking whether file was locked by this client
-    if (CHK_FLAG(file->flags, O_LOCK) && (file->locked_by == client_fd)) {
+    // Checking whether file was locked by this client, files in the disk tier lost their lock
+    if (file != NULL && CHK_FLAG(file->flags, O_LOCK) && (file->locked_by == client_fd)) {
         
         // Unlocking file
         CLR_FLAG(file->flags, O_LOCK);
@@ -331,41 +665,70 @@ close_file_handler(int worker_no, int client_fd, request_t *request)
         log_debug("unlocked file [%s] before closing it\n", request->file_path);
     }
 
-    unlock_return(&(storage->access), INTERNAL_ERROR);
+    timed_unlock_return(&(storage->access), INTERNAL_ERROR);
 
 
-    log_info("(WORKER %d) [ %s  ]  %-21s : %s\n", 
+    log_request("(WORKER %d) [ %s  ]  %-21s : %s\n", 
         worker_no, "closeFile", get_status_message(status), request->file_path);
 
     return status;
 }
 
-int
-write_file_handler(int worker_no, int client_fd, request_t *request, list_t *expelled_files)
+/**
+ * Sends a file to the client with the contents it was written with,
+ * decompressing them or joining their chunks if needed. Compressed contents
+ * go out as they are to clients that negotiated compression.
+ * Sets sent to the bytes of contents sent.
+ */
+static int
+send_file(int client_fd, int status, file_t *file, size_t *sent)
 {
-    log_debug("writing file [%s]\n", request->file_path);
+    void *contents = file->contents;
+    size_t size = storage_contents_size(file);
+
+    if (file->compressed && CHK_FLAG(get_capabilities(client_fd), CAP_COMPRESSION)) {
+        int result = send_response_checksum(client_fd, status, get_status_message(status),
+            strlen(file->path) + 1, file->path, file->size | BODY_COMPRESSED, file->contents, file->checksum);
+        if (result == 0) *sent = file->size;
+        return result;
+    }
 
-    int status = 0; // will be the final response status
+    if (file->compressed || file->chunked) {
+        contents = malloc(size);
+        if (contents == NULL) return -1;
+        if (storage_read_contents(file, contents) != 0) {
+            log_error("Could not decompress file [%s]: %s\n", file->path, strerror(errno));
+            free(contents);
+            return -1;
+        }
+    }
 
-    // Checking if request contains any content
-    if (request->body_size == 0 || request->body == NULL) {
-        
-        log_info("(WORKER %d) [ %s  ]  %-21s : %s : %lu bytes\n", 
-            worker_no, "writeFile", get_status_message(BAD_REQUEST), request->file_path, request->body_size);
+    int result = send_response_checksum(client_fd, status, get_status_message(status),
+        strlen(file->path) + 1, file->path, size, contents, file->checksum);
+    if (result == 0) *sent = size;
 
-        return BAD_REQUEST;
-    }
+    if (contents != file->contents) free(contents);
+    return result;
+}
 
+/**
+ * Writes prepared contents to the file of request, expelling files to make
+ * space for the bytes they take. Contents are taken by the file on success.
+ */
+static int
+store_file(int worker_no, int client_fd, request_t *request, contents_t *contents, list_t *expelled_files)
+{
+    int status = 0; // will be the final response status
 
     // Checking whether file exists
-    lock_return(&(storage->access), INTERNAL_ERROR);
+    timed_lock_return(&(storage->access), INTERNAL_ERROR);
     
-    file_t *file = storage_get_file(storage, request->file_path);
+    file_t *file = storage_fetch_file(storage, request->file_path);
     if (file == NULL) {
         // File doesn't exists, log and return
-        unlock_return(&(storage->access), INTERNAL_ERROR);
+        timed_unlock_return(&(storage->access), INTERNAL_ERROR);
 
-        log_info("(WORKER %d) [ %s  ]  %-21s : %s : %lu bytes\n", 
+        log_request("(WORKER %d) [ %s  ]  %-21s : %s : %lu bytes\n", 
             worker_no, "writeFile", get_status_message(NOT_FOUND), request->file_path, request->body_size);
 
         return NOT_FOUND;
@@ -374,21 +737,21 @@ write_file_handler(int worker_no, int client_fd, request_t *request, list_t *exp
     // Checking whether file is locked by this client
     if ( (file->locked_by != client_fd) ) {
         // Client doesn't have permission, log and return
-        unlock_return(&(storage->access), INTERNAL_ERROR);
+        timed_unlock_return(&(storage->access), INTERNAL_ERROR);
 
-        log_info("(WORKER %d) [ %s  ]  %-21s : %s : %lu bytes\n", 
+        log_request("(WORKER %d) [ %s  ]  %-21s : %s : %lu bytes\n", 
             worker_no, "writeFile", get_status_message(UNAUTHORIZED), request->file_path, request->body_size);
 
         return UNAUTHORIZED;
     }
 
     // Checking if file is too big
-    if (request->body_size > storage->max_size) {
+    if (contents->size > storage->max_size) {
         // File is too big, removing empty file previuosly created, log and return
-        unlock_return(&(storage->access), INTERNAL_ERROR);
         storage_remove_file(storage, request->file_path);
+        timed_unlock_return(&(storage->access), INTERNAL_ERROR);
         
-        log_info("(WORKER %d) [ %s  ]  %-21s : %s : %lu bytes\n", 
+        log_request("(WORKER %d) [ %s  ]  %-21s : %s : %lu bytes\n", 
             worker_no, "writeFile", get_status_message(FILE_TOO_BIG), request->file_path, request->body_size);
         
         return FILE_TOO_BIG; 
@@ -397,29 +760,37 @@ write_file_handler(int worker_no, int client_fd, request_t *request, list_t *exp
     // Checking if file was freshly created, otherwise it cannot be overwritten
     if (!CHK_FLAG(file->flags, O_CREATE)) {
        
-        unlock_return(&(storage->access), INTERNAL_ERROR);
+        timed_unlock_return(&(storage->access), INTERNAL_ERROR);
 
-        log_info("(WORKER %d) [ %s  ]  %-21s : %s : %lu bytes\n", 
+        log_request("(WORKER %d) [ %s  ]  %-21s : %s : %lu bytes\n", 
             worker_no, "writeFile", get_status_message(FILE_EXISTS), request->file_path, request->body_size);
 
         return FILE_EXISTS;
     }
 
+    // Chunks already in storage are shared and cannot be expelled to make space for themselves
+    if ( storage_store_chunks(storage, contents) != 0 ) {
+        timed_unlock_return(&(storage->access), INTERNAL_ERROR);
+        return INTERNAL_ERROR;
+    }
+
     // Checking if some files show be expelled to make space 
-    if (storage->current_size + request->body_size > storage->max_size) {
+    if (storage->current_size + contents->size > storage->max_size) {
         
         log_debug("about to expell some files\n");
 
-        int how_many = storage_FIFO_replace(storage, 0, request->body_size, expelled_files);
+        int how_many = storage_FIFO_replace(storage, 0, contents->size, expelled_files);
         
         if ( how_many != list_length(expelled_files) ) { // shouldn't happen
-            unlock_return(&(storage->access), INTERNAL_ERROR);
+            storage_discard_contents(storage, contents);
+            timed_unlock_return(&(storage->access), INTERNAL_ERROR);
             return INTERNAL_ERROR;
         }
 
-        // Sending response to client with number of files expelled
-        if ( send_response(client_fd, FILES_EXPELLED, get_status_message(FILES_EXPELLED), 0, "", sizeof(int), (void*)&how_many) != 0 ) {
-            unlock_return(&(storage->access), INTERNAL_ERROR);
+        // Sending response to client with number of files expelled, if any were not demoted
+        if ( how_many > 0 && send_response(client_fd, FILES_EXPELLED, get_status_message(FILES_EXPELLED), 0, "", sizeof(int), (void*)&how_many) != 0 ) {
+            storage_discard_contents(storage, contents);
+            timed_unlock_return(&(storage->access), INTERNAL_ERROR);
             return INTERNAL_ERROR;
         }
 
@@ -429,44 +800,146 @@ write_file_handler(int worker_no, int client_fd, request_t *request, list_t *exp
             file_t *to_send = (file_t*)list_remove_head(expelled_files);
 
             // Sending current expelled file to client
-            send_response(client_fd, FILES_EXPELLED, get_status_message(FILES_EXPELLED), 
-                strlen(to_send->path) + 1, to_send->path, to_send->size, to_send->contents);
+            size_t sent = 0;
+            send_file(client_fd, FILES_EXPELLED, to_send, &sent);
 
            
-            log_info("(WORKER %d) [%s]  %-21s : %s\n", 
+            log_request("(WORKER %d) [%s]  %-21s : %s\n", 
                 worker_no, "FIFO replace", get_status_message(FILES_EXPELLED), to_send->path);
+            log_op(worker_no, OP_FILE_EXPELLED, FILES_EXPELLED, to_send->path, sent, 0);
+            metrics_count(METRIC_BYTES_OUT, sent);
+
+            wal_log(WAL_REMOVE, to_send->path, NULL, 0);
+            free_file(to_send);
         }
     }
 
     // Updating file contents
+    if ( storage_attach_contents(storage, file, contents) != 0 ) {
+        timed_unlock_return(&(storage->access), INTERNAL_ERROR);
+        return INTERNAL_ERROR;
+    }
     CLR_FLAG(file->flags, O_CREATE);
-    file->size = request->body_size;
-    file->contents = calloc(1, file->size);
-    memcpy(file->contents, request->body, file->size);
     storage_update_file(storage, file);
     list_insert_tail(storage->fifo_queue, file->path);
-    storage->current_size += file->size;
 
-    unlock_return(&(storage->access), INTERNAL_ERROR);
+    uint64_t lsn = wal_log(WAL_WRITE, file->path, request->body, request->body_size);
 
-    log_info("(WORKER %d) [ %s  ]  %-21s : %s : %lu bytes\n", 
+    timed_unlock_return(&(storage->access), INTERNAL_ERROR);
+
+    // Waiting for the write to be durable
+    if ( wal_commit(lsn) != 0 ) status = INTERNAL_ERROR;
+
+    log_request("(WORKER %d) [ %s  ]  %-21s : %s : %lu bytes\n", 
         worker_no, "writeFile", get_status_message(status), request->file_path, request->body_size);
 
     return status;
             
 }
 
+/**
+ * Writes the file of a request whose body is streamed, received into the
+ * arena of file contents and kept there as the contents when they need no
+ * compression or chunking. Returns -1 if frames of the body were lost and
+ * the connection must be closed.
+ */
+static int
+write_stream(int worker_no, int client_fd, request_t *request, list_t *expelled_files)
+{
+    // Bodies too big for storage are dropped as they come, store_file refuses them by their size alone
+    if (request->body_size > storage->max_size || request->body_size == 0) {
+        if (drain_stream(client_fd, request) != 0 && errno != ECANCELED) return -1;
+
+        contents_t too_big;
+        memset(&too_big, 0, sizeof(contents_t));
+        too_big.size = request->body_size;
+        if (request->body_size > 0) return store_file(worker_no, client_fd, request, &too_big, expelled_files);
+
+        log_request("(WORKER %d) [ %s  ]  %-21s : %s : %lu bytes\n", 
+            worker_no, "writeFile", get_status_message(BAD_REQUEST), request->file_path, request->body_size);
+
+        return BAD_REQUEST;
+    }
+
+    if ( receive_stream(client_fd, request) != 0 ) {
+        if (errno != ECANCELED && errno != ENOMEM) {
+            log_error("Streamed body of [%s] could not be received: %s\n", request->file_path, strerror(errno));
+            return -1;
+        }
+
+        log_request("(WORKER %d) [ %s  ]  %-21s : %s : %lu bytes\n", 
+            worker_no, "writeFile", get_status_message(BAD_REQUEST), request->file_path, request->body_size);
+
+        return BAD_REQUEST;
+    }
+
+    contents_t contents;
+    if ( storage_adopt_contents(storage, request->body, request->body_size, &contents) != 0 ) {
+        payload_free(request->body, request->body_size);
+        request->body = NULL;
+
+        log_request("(WORKER %d) [ %s  ]  %-21s : %s : %lu bytes\n", 
+            worker_no, "writeFile", get_status_message(INTERNAL_ERROR), request->file_path, request->body_size);
+
+        return INTERNAL_ERROR;
+    }
+    bool taken = (contents.data == request->body);
+
+    int status = store_file(worker_no, client_fd, request, &contents, expelled_files);
+    storage_discard_contents(storage, &contents);
+
+    // Body comes from the arena of file contents, not from the request one
+    if (!taken) payload_free(request->body, request->body_size);
+    request->body = NULL;
+    return status;
+}
+
+int
+write_file_handler(int worker_no, int client_fd, request_t *request, list_t *expelled_files)
+{
+    log_debug("writing file [%s]\n", request->file_path);
+    hot_keys_record(request->file_path, HOT_KEY_WRITE, request->body_size);
+
+    if (request->streamed) return write_stream(worker_no, client_fd, request, expelled_files);
+
+    // Checking if request contains any content
+    if (request->body_size == 0 || request->body == NULL) {
+        
+        log_request("(WORKER %d) [ %s  ]  %-21s : %s : %lu bytes\n", 
+            worker_no, "writeFile", get_status_message(BAD_REQUEST), request->file_path, request->body_size);
+
+        return BAD_REQUEST;
+    }
+
+    // Contents are copied, and compressed, before locking storage
+    contents_t contents;
+    if ( storage_prepare_contents(storage, request->body, request->body_size, &contents) != 0 ) {
+
+        log_request("(WORKER %d) [ %s  ]  %-21s : %s : %lu bytes\n", 
+            worker_no, "writeFile", get_status_message(INTERNAL_ERROR), request->file_path, request->body_size);
+
+        return INTERNAL_ERROR;
+    }
+
+    int status = store_file(worker_no, client_fd, request, &contents, expelled_files);
+
+    // Contents are left to free if the file was not written, their chunks were never stored
+    storage_discard_contents(storage, &contents);
+    return status;
+}
+
 int
 append_to_file_handler(int worker_no, int client_fd, request_t *request, list_t *expelled_files)
 {
     log_debug("appending to file [%s]\n", request->file_path);
+    hot_keys_record(request->file_path, HOT_KEY_WRITE, request->body_size);
 
     int status = 0; // will be the final response status
 
     // Checking whether request contains any content
     if (request->body_size == 0 || request->body == NULL) {
         
-        log_info("(WORKER %d) [%s]  %-21s : %s : %lu bytes\n", 
+        log_request("(WORKER %d) [%s]  %-21s : %s : %lu bytes\n", 
             worker_no, "appendToFile", get_status_message(BAD_REQUEST), request->file_path, request->body_size);
 
         return BAD_REQUEST;
@@ -475,21 +948,21 @@ append_to_file_handler(int worker_no, int client_fd, request_t *request, list_t
     // Checking if file is too big for storage
     if (request->body_size > storage->max_size) {
         
-        log_info("(WORKER %d) [%s]  %-21s : %s : %lu bytes\n", 
+        log_request("(WORKER %d) [%s]  %-21s : %s : %lu bytes\n", 
             worker_no, "appendToFile", get_status_message(FILE_TOO_BIG), request->file_path, request->body_size);
         
         return FILE_TOO_BIG; 
     }
 
     // Checking whether file exists
-    lock_return(&(storage->access), INTERNAL_ERROR);
+    timed_lock_return(&(storage->access), INTERNAL_ERROR);
     
-    file_t *file = storage_get_file(storage, request->file_path);
+    file_t *file = storage_fetch_file(storage, request->file_path);
     if (file == NULL) {
         // File doesn't exists, log and return
-        unlock_return(&(storage->access), INTERNAL_ERROR);
+        timed_unlock_return(&(storage->access), INTERNAL_ERROR);
 
-        log_info("(WORKER %d) [%s]  %-21s : %s : %lu bytes\n", 
+        log_request("(WORKER %d) [%s]  %-21s : %s : %lu bytes\n", 
             worker_no, "appendToFile", get_status_message(NOT_FOUND), request->file_path, request->body_size);
 
         return NOT_FOUND;
@@ -498,9 +971,9 @@ append_to_file_handler(int worker_no, int client_fd, request_t *request, list_t
     // Checking whether client has locked the file
     if ( (file->locked_by != client_fd) ) {
         // Client doesn't have permission to append, log and return
-        unlock_return(&(storage->access), INTERNAL_ERROR);
+        timed_unlock_return(&(storage->access), INTERNAL_ERROR);
         
-        log_info("(WORKER %d) [%s]  %-21s : %s : %lu bytes\n", 
+        log_request("(WORKER %d) [%s]  %-21s : %s : %lu bytes\n", 
             worker_no, "appendToFile", get_status_message(UNAUTHORIZED), request->file_path, request->body_size);
         
         return UNAUTHORIZED;
@@ -511,23 +984,20 @@ append_to_file_handler(int worker_no, int client_fd, request_t *request, list_t
 
 
     // Updating file contents
-    size_t new_size = file->size + request->body_size;
-    file->contents = realloc(file->contents, new_size);
-    if (file->contents == NULL) {
-        errno = ENOMEM;
-        unlock_return(&(storage->access), INTERNAL_ERROR);
+    if ( storage_append_contents(storage, file, request->body, request->body_size) != 0 ) {
+        timed_unlock_return(&(storage->access), INTERNAL_ERROR);
         return INTERNAL_ERROR;
     }
-
-    memcpy((file->contents + file->size), request->body, request->body_size);
-    file->size = new_size;
     storage_update_file(storage, file);
-    storage->current_size += request->body_size;
 
-    unlock_return(&(storage->access), INTERNAL_ERROR);
+    uint64_t lsn = wal_log(WAL_APPEND, file->path, request->body, request->body_size);
+
+    timed_unlock_return(&(storage->access), INTERNAL_ERROR);
 
+    // Waiting for the append to be durable
+    if ( wal_commit(lsn) != 0 ) status = INTERNAL_ERROR;
 
-    log_info("(WORKER %d) [%s]  %-21s : %s : %lu bytes\n", 
+    log_request("(WORKER %d) [%s]  %-21s : %s : %lu bytes\n", 
         worker_no, "appendToFile", get_status_message(status), request->file_path, request->body_size);
 
     return status;
@@ -535,45 +1005,150 @@ append_to_file_handler(int worker_no, int client_fd, request_t *request, list_t
 }
 
 int
-read_file_handler(int worker_no, int client_fd, request_t *request, void** read_buffer, size_t *size)
+read_file_handler(int worker_no, int client_fd, request_t *request, void** read_buffer, size_t *size, uint32_t *checksum, bool *streamed)
 {
     log_debug("reading file [%s]\n", request->file_path);
 
     int status = 0; // will be the final response status
 
+    // Misses are answered without locking storage
+    if (!storage_may_contain(storage, request->file_path)) {
+        log_request("(WORKER %d) [  %s  ]  %-21s : %s\n", 
+                            worker_no, "readFile", get_status_message(NOT_FOUND), request->file_path);
+        
+        return NOT_FOUND;
+    }
+
     // Checking whether file exists
-    lock_return(&(storage->access), INTERNAL_ERROR);
+    timed_lock_return(&(storage->access), INTERNAL_ERROR);
 
-    file_t *file = storage_get_file(storage, request->file_path);
+    file_t *file = storage_fetch_file(storage, request->file_path);
     if (file == NULL) {
         // File doesn't exists, log and return
-        log_info("(WORKER %d) [  %s  ]  %-21s : %s\n", 
+        storage_false_positive(storage);
+        timed_unlock_return(&(storage->access), INTERNAL_ERROR);
+
+        log_request("(WORKER %d) [  %s  ]  %-21s : %s\n", 
                             worker_no, "readFile", get_status_message(NOT_FOUND), request->file_path);
         
         return NOT_FOUND;
     }
 
-    // Copying file contents into reading buffer
-    *read_buffer = calloc(1, file->size);
+    // Mapped contents are checked before their checksum is taken, it may have to be computed
+    if ( storage_verify_contents(file) != 0 ) {
+        log_error("File [%s] is corrupted: %s\n", file->path, strerror(errno));
+        timed_unlock_return(&(storage->access), INTERNAL_ERROR);
+        return INTERNAL_ERROR;
+    }
+
+    // Copying file contents into reading buffer, decompressed unless the client takes them compressed
+    size_t raw_size = storage_contents_size(file);
+
+    // Large files are streamed later a frame at a time, compressed ones would have to be decoded whole
+    *streamed = !file->compressed && CHK_FLAG(get_capabilities(client_fd), CAP_STREAMING) && raw_size > server_config.stream_chunk_size;
+    if ( *streamed ) {
+        *size = raw_size;
+        *checksum = file->checksum;
+        timed_unlock_return(&(storage->access), INTERNAL_ERROR);
+
+        hot_keys_record(request->file_path, HOT_KEY_READ, raw_size);
+
+        log_request("(WORKER %d) [  %s  ]  %-21s : %s : %lu bytes\n", 
+            worker_no, "readFile", get_status_message(status), request->file_path, raw_size);
+
+        return status;
+    }
+
+    // Stored checksum goes with the contents, clients check them against it
+    *checksum = file->checksum;
+
+    if ( copy_contents(client_fd, file, read_buffer, size) != 0 ) {
+        timed_unlock_return(&(storage->access), INTERNAL_ERROR);
+        return INTERNAL_ERROR;
+    }
+
+    timed_unlock_return(&(storage->access), INTERNAL_ERROR);
+
+    // Only reads of files in storage count, misses never hold the lock for long
+    hot_keys_record(request->file_path, HOT_KEY_READ, raw_size);
+    
+    log_request("(WORKER %d) [  %s  ]  %-21s : %s : %lu bytes\n", 
+        worker_no, "readFile", get_status_message(status), request->file_path, raw_size);
+    
+    return status;
+}
+
+int
+read_range_handler(int worker_no, int client_fd, request_t *request, void** read_buffer, size_t *size)
+{
+    log_debug("reading range of file [%s]\n", request->file_path);
+
+    // Body holds offset and length of the range
+    uint64_t range[2];
+    if (request->body_size != sizeof(range) || request->body == NULL) {
+        log_request("(WORKER %d) [  %s  ]  %-21s : %s : %lu bytes\n", 
+            worker_no, "readRange", get_status_message(BAD_REQUEST), request->file_path, request->body_size);
+
+        return BAD_REQUEST;
+    }
+    memcpy(range, request->body, sizeof(range));
+
+    // Misses are answered without locking storage
+    if (!storage_may_contain(storage, request->file_path)) {
+        log_request("(WORKER %d) [  %s  ]  %-21s : %s\n", 
+                            worker_no, "readRange", get_status_message(NOT_FOUND), request->file_path);
+        
+        return NOT_FOUND;
+    }
+
+    timed_lock_return(&(storage->access), INTERNAL_ERROR);
+
+    file_t *file = storage_fetch_file(storage, request->file_path);
+    if (file == NULL) {
+        storage_false_positive(storage);
+        timed_unlock_return(&(storage->access), INTERNAL_ERROR);
+
+        log_request("(WORKER %d) [  %s  ]  %-21s : %s\n", 
+                            worker_no, "readRange", get_status_message(NOT_FOUND), request->file_path);
+        
+        return NOT_FOUND;
+    }
+
+    // Ranges past the end are cut short, down to no bytes at all
+    size_t raw_size = storage_contents_size(file);
+    size_t offset = (range[0] < raw_size) ? range[0] : raw_size;
+    size_t length = (range[1] < raw_size - offset) ? range[1] : raw_size - offset;
+
+    // Only the range is copied while holding the lock
+    *size = length;
+    *read_buffer = malloc((length > 0) ? length : 1);
     if ( *read_buffer == NULL ) {
+        timed_unlock_return(&(storage->access), INTERNAL_ERROR);
         errno = ENOMEM;
         return INTERNAL_ERROR;
     }
 
-    *size = file->size;
-    memcpy(*read_buffer, file->contents, file->size);
+    if ( storage_read_range(file, *read_buffer, offset, length) != 0 ) {
+        timed_unlock_return(&(storage->access), INTERNAL_ERROR);
+        log_error("Could not decompress file [%s]: %s\n", file->path, strerror(errno));
+        free(*read_buffer);
+        *read_buffer = NULL;
+        *size = 0;
+        return INTERNAL_ERROR;
+    }
 
-    unlock_return(&(storage->access), INTERNAL_ERROR);
+    timed_unlock_return(&(storage->access), INTERNAL_ERROR);
 
+    hot_keys_record(request->file_path, HOT_KEY_READ, length);
     
-    log_info("(WORKER %d) [  %s  ]  %-21s : %s : %lu bytes\n", 
-        worker_no, "readFile", get_status_message(status), request->file_path, *size);
+    log_request("(WORKER %d) [  %s  ]  %-21s : %s : %lu bytes\n", 
+        worker_no, "readRange", get_status_message(SUCCESS), request->file_path, length);
     
-    return status;
+    return SUCCESS;
 }
 
 int
-read_n_files_handler(int worker_no, int client_fd, request_t *request, list_t *files_list)
+read_n_files_handler(int worker_no, int client_fd, request_t *request, list_t *files_list, size_t *bytes_read)
 {
     // Checking how many files to read
     int how_many = *(int*)request->body;
@@ -581,7 +1156,7 @@ read_n_files_handler(int worker_no, int client_fd, request_t *request, list_t *f
         how_many = storage->max_size;
     }
 
-    lock_return(&(storage->access), INTERNAL_ERROR);
+    timed_lock_return(&(storage->access), INTERNAL_ERROR);
 
     node_t *iter = storage->fifo_queue->head;
 
@@ -589,9 +1164,9 @@ read_n_files_handler(int worker_no, int client_fd, request_t *request, list_t *f
 
         char *path = (char*)iter->data;
         if (path == NULL) { 
-            unlock_return(&(storage->access), INTERNAL_ERROR); 
+            timed_unlock_return(&(storage->access), INTERNAL_ERROR); 
 
-            log_info("(WORKER %d) [ %s  ]  %-21s : %s : %lu bytes\n", 
+            log_request("(WORKER %d) [ %s  ]  %-21s : %s : %lu bytes\n", 
                 worker_no, "readNFiles", get_status_message(INTERNAL_ERROR), "", 0);
 
             return INTERNAL_ERROR; 
@@ -599,19 +1174,34 @@ read_n_files_handler(int worker_no, int client_fd, request_t *request, list_t *f
 
         file_t *file = storage_get_file(storage, path);
         if (file == NULL) { 
-            unlock_return(&(storage->access), INTERNAL_ERROR); 
+            timed_unlock_return(&(storage->access), INTERNAL_ERROR); 
 
-            log_info("(WORKER %d) [ %s  ]  %-21s : %s : %lu bytes\n", 
+            log_request("(WORKER %d) [ %s  ]  %-21s : %s : %lu bytes\n", 
                 worker_no, "readNFiles", get_status_message(INTERNAL_ERROR), "", 0);
 
             return INTERNAL_ERROR; 
         }
 
-        list_insert_tail(files_list, file);
+        // Files are copied while storage is locked, they may be gone by the time they are sent
+        file_copy_t *copy = calloc(1, sizeof(file_copy_t));
+        if (copy != NULL) copy->path = malloc(strlen(file->path) + 1);
+        if (copy == NULL || copy->path == NULL || copy_contents(client_fd, file, &copy->contents, &copy->size) != 0) {
+            if (copy) free_file_copy(copy);
+            timed_unlock_return(&(storage->access), INTERNAL_ERROR); 
+
+            log_request("(WORKER %d) [ %s  ]  %-21s : %s : %lu bytes\n", 
+                worker_no, "readNFiles", get_status_message(INTERNAL_ERROR), "", 0);
+
+            return INTERNAL_ERROR; 
+        }
+        strcpy(copy->path, file->path);
+        copy->checksum = file->checksum;
+
+        list_insert_tail(files_list, copy);
         iter = iter->next;
     }
 
-    unlock_return(&(storage->access), INTERNAL_ERROR);
+    timed_unlock_return(&(storage->access), INTERNAL_ERROR);
 
     how_many = list_length(files_list);
         
@@ -621,15 +1211,17 @@ read_n_files_handler(int worker_no, int client_fd, request_t *request, list_t *f
     // Start sending files to client
     while ( (how_many--) > 0) {
 
-        file_t *to_send = (file_t*)list_remove_head(files_list);
+        file_copy_t *to_send = (file_copy_t*)list_remove_head(files_list);
 
         // Sending current file to client
-        send_response(client_fd, SUCCESS, get_status_message(SUCCESS), 
-            strlen(to_send->path) + 1, to_send->path, to_send->size, to_send->contents);
-
+        if ( send_response_checksum(client_fd, SUCCESS, get_status_message(SUCCESS), strlen(to_send->path) + 1, 
+                to_send->path, to_send->size, to_send->contents, to_send->checksum) == 0 ) {
+            *bytes_read += to_send->size & ~BODY_COMPRESSED;
+        }
+        free_file_copy(to_send);
     }
 
-    log_info("(WORKER %d) [ %s ]  %-21s\n", 
+    log_request("(WORKER %d) [ %s ]  %-21s\n", 
         worker_no, "readNFiles", get_status_message(SUCCESS));
 
     return SUCCESS;
@@ -644,38 +1236,43 @@ remove_file_handler(int worker_no, int client_fd, request_t *request)
     int status = 0; // will be the final response status
 
     // Checking whether file exists
-    lock_return(&(storage->access), INTERNAL_ERROR);
+    timed_lock_return(&(storage->access), INTERNAL_ERROR);
 
     file_t *to_remove = storage_get_file(storage, request->file_path);
     if (to_remove == NULL) {
-        // File doesn't exists, log and return
-        unlock_return(&(storage->access), INTERNAL_ERROR);
+        // File doesn't exists or is in the disk tier, where it is not locked, log and return
+        status = storage_contains_file(storage, request->file_path) ? UNAUTHORIZED : NOT_FOUND;
+        timed_unlock_return(&(storage->access), INTERNAL_ERROR);
 
-        log_info("(WORKER %d) [ %s ]  %-21s : %s\n", 
-            worker_no, "removeFile", get_status_message(NOT_FOUND), request->file_path);
+        log_request("(WORKER %d) [ %s ]  %-21s : %s\n", 
+            worker_no, "removeFile", get_status_message(status), request->file_path);
 
-        return NOT_FOUND;
+        return status;
     }
 
     // Checking whether client has permission to remove file
     if ( (!CHK_FLAG(to_remove->flags, O_LOCK)) ||
             (CHK_FLAG(to_remove->flags, O_LOCK) && to_remove->locked_by != client_fd)) {
         
-        unlock_return(&(storage->access), INTERNAL_ERROR);
+        timed_unlock_return(&(storage->access), INTERNAL_ERROR);
 
-        log_info("(WORKER %d) [ %s ]  %-21s : %s\n", 
+        log_request("(WORKER %d) [ %s ]  %-21s : %s\n", 
             worker_no, "removeFile", get_status_message(UNAUTHORIZED), request->file_path);
         
         return UNAUTHORIZED;
     }
 
     // Removing file
+    uint64_t lsn = wal_log(WAL_REMOVE, request->file_path, NULL, 0);
     storage_remove_file(storage, request->file_path);
 
-    unlock_return(&(storage->access), INTERNAL_ERROR);
+    timed_unlock_return(&(storage->access), INTERNAL_ERROR);
+
+    // Waiting for the removal to be durable
+    if ( wal_commit(lsn) != 0 ) status = INTERNAL_ERROR;
 
 
-    log_info("(WORKER %d) [ %s ]  %-21s : %s\n", 
+    log_request("(WORKER %d) [ %s ]  %-21s : %s\n", 
         worker_no, "removeFile", get_status_message(status), request->file_path);
 
     return status;
@@ -689,14 +1286,14 @@ lock_file_handler(int worker_no, int client_fd, request_t *request)
     int status = 0; // will be the final response status
 
     // Checking whether file exists
-    lock_return(&(storage->access), INTERNAL_ERROR);
+    timed_lock_return(&(storage->access), INTERNAL_ERROR);
 
-    file_t *file = storage_get_file(storage, request->file_path);
+    file_t *file = storage_fetch_file(storage, request->file_path);
     if (file == NULL) {
         // File doesn't exists, log and return
-        unlock_return(&(storage->access), INTERNAL_ERROR);
+        timed_unlock_return(&(storage->access), INTERNAL_ERROR);
 
-        log_info("(WORKER %d) [  %s  ]  %-21s : %s\n", 
+        log_request("(WORKER %d) [  %s  ]  %-21s : %s\n", 
             worker_no, "lockFile", get_status_message(NOT_FOUND), request->file_path);
         
         return NOT_FOUND;
@@ -709,9 +1306,9 @@ lock_file_handler(int worker_no, int client_fd, request_t *request)
         file->locked_by = client_fd;
         storage_update_file(storage, file);
 
-        unlock_return(&(storage->access), INTERNAL_ERROR);
+        timed_unlock_return(&(storage->access), INTERNAL_ERROR);
 
-        log_info("(WORKER %d) [  %s  ]  %-21s : %s\n", 
+        log_request("(WORKER %d) [  %s  ]  %-21s : %s\n", 
             worker_no, "lockFile", get_status_message(SUCCESS), request->file_path);
         
         return SUCCESS;
@@ -720,18 +1317,24 @@ lock_file_handler(int worker_no, int client_fd, request_t *request)
 
         if (file->locked_by == client_fd) { // File is already locked by this client
 
-            unlock_return(&(storage->access), INTERNAL_ERROR);
+            timed_unlock_return(&(storage->access), INTERNAL_ERROR);
 
-            log_info("(WORKER %d) [  %s  ]  %-21s : %s\n", 
+            log_request("(WORKER %d) [  %s  ]  %-21s : %s\n", 
                 worker_no, "lockFile", get_status_message(SUCCESS), request->file_path);
             
             return SUCCESS;
         } else { // Otherwise adds client to list of client waiting for lock on this file
             
+            // Most files are never waited on, their queue is created on demand
+            if (file->waiting_on_lock == NULL) file->waiting_on_lock = list_create(NULL, free, NULL);
+
             int *tmp_fd = malloc(sizeof(int));
             *tmp_fd = client_fd;
-            if ( list_insert_tail(file->waiting_on_lock, tmp_fd) != 0 ) {
-                log_info("(WORKER %d) [  %s  ]  %-21s : %s\n", 
+            if ( file->waiting_on_lock == NULL || list_insert_tail(file->waiting_on_lock, tmp_fd) != 0 ) {
+                free(tmp_fd);
+                timed_unlock_return(&(storage->access), INTERNAL_ERROR);
+
+                log_request("(WORKER %d) [  %s  ]  %-21s : %s\n", 
                     worker_no, "lockFile", get_status_message(INTERNAL_ERROR), request->file_path);
             
                 return INTERNAL_ERROR;
@@ -740,16 +1343,16 @@ lock_file_handler(int worker_no, int client_fd, request_t *request)
             // Updating file with client added to list
             storage_update_file(storage, file);
 
-            unlock_return(&(storage->access), INTERNAL_ERROR);
+            timed_unlock_return(&(storage->access), INTERNAL_ERROR);
 
-            log_info("(WORKER %d) [  %s  ]  %-21s : %s\n", 
+            log_request("(WORKER %d) [  %s  ]  %-21s : %s\n", 
                             worker_no, "lockFile", get_status_message(AWAITING), request->file_path);
             
             return AWAITING; 
         } 
     }
 
-    log_info("(WORKER %d) [  %s  ]  %-21s : %s\n", 
+    log_request("(WORKER %d) [  %s  ]  %-21s : %s\n", 
                             worker_no, "lockFile", get_status_message(status), request->file_path);
 
     return status;
@@ -763,25 +1366,26 @@ unlock_file_handler(int worker_no, int client_fd, request_t *request)
     int status = 0; // will be the final response status
 
     // Checking whether file exists
-    lock_return(&(storage->access), INTERNAL_ERROR);
+    timed_lock_return(&(storage->access), INTERNAL_ERROR);
 
     file_t *file = storage_get_file(storage, request->file_path);
     if (file == NULL) {
-        // File doesn't exists, log and return
-        unlock_return(&(storage->access), INTERNAL_ERROR);
+        // File doesn't exists or is in the disk tier, where it is not locked, log and return
+        status = storage_contains_file(storage, request->file_path) ? BAD_REQUEST : NOT_FOUND;
+        timed_unlock_return(&(storage->access), INTERNAL_ERROR);
 
-        log_info("(WORKER %d) [ %s ]  %-21s : %s\n", 
-            worker_no, "unlockFile", get_status_message(NOT_FOUND), request->file_path);
+        log_request("(WORKER %d) [ %s ]  %-21s : %s\n", 
+            worker_no, "unlockFile", get_status_message(status), request->file_path);
         
-        return NOT_FOUND;
+        return status;
     }
 
     // Check whether file was previously locked
     if (!CHK_FLAG(file->flags, O_LOCK)) { 
         // File isn't locked, illegal request
-        unlock_return(&(storage->access), INTERNAL_ERROR);
+        timed_unlock_return(&(storage->access), INTERNAL_ERROR);
 
-        log_info("(WORKER %d) [ %s ]  %-21s : %s\n", 
+        log_request("(WORKER %d) [ %s ]  %-21s : %s\n", 
             worker_no, "unlockFile", get_status_message(BAD_REQUEST), request->file_path);
         
         return BAD_REQUEST;
@@ -795,24 +1399,40 @@ unlock_file_handler(int worker_no, int client_fd, request_t *request)
             
             storage_update_file(storage, file);
 
-            unlock_return(&(storage->access), INTERNAL_ERROR);
+            timed_unlock_return(&(storage->access), INTERNAL_ERROR);
 
-            log_info("(WORKER %d) [ %s ]  %-21s : %s\n", 
+            log_request("(WORKER %d) [ %s ]  %-21s : %s\n", 
                 worker_no, "unlockFile", get_status_message(SUCCESS), request->file_path);
             return SUCCESS;
         
         } else {
             // File was locked by someone else
-            unlock_return(&(storage->access), INTERNAL_ERROR);
+            timed_unlock_return(&(storage->access), INTERNAL_ERROR);
 
-            log_info("(WORKER %d) [ %s ]  %-21s : %s\n", 
+            log_request("(WORKER %d) [ %s ]  %-21s : %s\n", 
                 worker_no, "unlockFile", get_status_message(UNAUTHORIZED), request->file_path);
             return UNAUTHORIZED;
         }
     }
     
-    log_info("(WORKER %d) [ %s ]  %-21s : %s\n", 
+    log_request("(WORKER %d) [ %s ]  %-21s : %s\n", 
         worker_no, "unlockFile", get_status_message(status), request->file_path);
 
     return status;
-}
\ No newline at end of file
+}
+int
+stats_handler(int worker_no, int client_fd, request_t *request, char **stats, size_t *size)
+{
+    if ( stats_render(stats, size) != 0 ) {
+
+        log_request("(WORKER %d) [   %s    ]  %-21s\n", 
+            worker_no, "stats", get_status_message(INTERNAL_ERROR));
+
+        return INTERNAL_ERROR;
+    }
+
+    log_request("(WORKER %d) [   %s    ]  %-21s : %lu bytes\n", 
+        worker_no, "stats", get_status_message(SUCCESS), *size);
+
+    return SUCCESS;
+}
@@ -2,6 +2,7 @@
 #define WORKER_H
 
 #include "server_config.h"
+#include "metrics.h"
 
 /**
  * Worker arguments
@@ -11,6 +12,15 @@ typedef struct _worker_arg_t {
    int worker_id;
 } worker_arg_t;
 
+/**
+ * Client with a pending request, as queued in request_queue
+ */
+typedef struct _queued_client_t {
+   int client_fd;
+   /* When the request was queued, from metrics_now_us */
+   uint64_t enqueued_us;
+} queued_client_t;
+
 /**
  * Worker thread
  */
@@ -36,10 +46,13 @@ int
 append_to_file_handler(int worker_no, int client_fd, request_t *request, list_t *expelled_files);
 
 int
-read_file_handler(int worker_no, int client_fd, request_t *request, void** read_buffer, size_t *size);
+read_file_handler(int worker_no, int client_fd, request_t *request, void** read_buffer, size_t *size, uint32_t *checksum, bool *streamed);
 
 int
-read_n_files_handler(int worker_no, int client_fd, request_t *request, list_t *files_list);
+read_range_handler(int worker_no, int client_fd, request_t *request, void** read_buffer, size_t *size);
+
+int
+read_n_files_handler(int worker_no, int client_fd, request_t *request, list_t *files_list, size_t *bytes_read);
 
 int
 remove_file_handler(int worker_no, int client_fd, request_t *request);
@@ -50,4 +63,7 @@ lock_file_handler(int worker_no, int client_fd, request_t *request);
 int
 unlock_file_handler(int worker_no, int client_fd, request_t *request);
 
+int
+stats_handler(int worker_no, int client_fd, request_t *request, char **stats, size_t *size);
+
 #endif
\ No newline at end of file
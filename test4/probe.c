@@ -0,0 +1,294 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "utils/protocol.h"
+#include "utils/utilities.h"
+
+/**
+ * Sends requests the client never sends and checks the server answers them
+ * and keeps serving the connection
+ */
+
+static int failures = 0;
+
+static void
+expect(const char *what, response_t *response, response_code status)
+{
+    if (response == NULL) {
+        printf("%-45s : no response (%s)\n", what, strerror(errno));
+        failures++;
+        return;
+    }
+
+    bool ok = response->status == status;
+    printf("%-45s : %s, %s\n", what, response->status_phrase, ok ? "as expected" : "NOT AS EXPECTED");
+    if (!ok) failures++;
+    free_response(response);
+}
+
+/**
+ * Sends a request whose small body is streamed in a single frame
+ */
+static int
+send_streamed(long fd, request_code type, char *path, void *body, size_t body_size)
+{
+    if (send_request(fd, type, strlen(path) + 1, path, body_size | BODY_STREAMED, NULL) != 0) return -1;
+
+    body_stream_t stream;
+    stream_open(&stream, fd, body_size);
+    if (stream_send(&stream, body, body_size) != 0) return -1;
+    return stream_end(&stream);
+}
+
+/**
+ * Opens a connection that gives up on responses after a few seconds
+ */
+static long
+connect_to(const char *socket_path)
+{
+    long fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socket_path, sizeof(address.sun_path) - 1);
+    if (fd == -1 || connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        perror("connect");
+        return -1;
+    }
+
+    struct timeval timeout = { .tv_sec = 5, .tv_usec = 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    uint32_t capabilities = CAP_CHECKSUM | CAP_STREAMING;
+    send_request(fd, OPEN_CONNECTION, 0, NULL, sizeof(capabilities), &capabilities);
+    response_t *handshake = recv_response(fd);
+    if (handshake != NULL && handshake->body_size == sizeof(uint32_t)) set_capabilities(fd, *(uint32_t*)handshake->body);
+    expect("openConnection", handshake, SUCCESS);
+    return fd;
+}
+
+/**
+ * Receives the answer to a write, skipping the files it expelled
+ */
+static response_t*
+recv_write_response(long fd)
+{
+    response_t *response = recv_response(fd);
+    if (response == NULL || response->status != FILES_EXPELLED) return response;
+
+    int how_many = (response->body_size == sizeof(int)) ? *(int*)response->body : 0;
+    free_response(response);
+    while (how_many-- > 0) {
+        response_t *expelled = recv_response(fd);
+        if (expelled == NULL) return NULL;
+        free_response(expelled);
+    }
+    return recv_response(fd);
+}
+
+/**
+ * Requests other than writes with streamed bodies are refused, and the
+ * connection goes on
+ */
+static void
+check_streamed(const char *socket_path, char *path)
+{
+    long fd = connect_to(socket_path);
+    if (fd == -1) {
+        failures++;
+        return;
+    }
+
+    int flags = O_CREATE | O_LOCK;
+    send_streamed(fd, OPEN_FILE, path, &flags, sizeof(flags));
+    expect("openFile with a streamed body", recv_response(fd), BAD_REQUEST);
+
+    int how_many = 0;
+    send_streamed(fd, READ_N_FILES, "", &how_many, sizeof(how_many));
+    expect("readNFiles with a streamed body", recv_response(fd), BAD_REQUEST);
+
+    send_request(fd, OPEN_FILE, strlen(path) + 1, path, sizeof(flags), &flags);
+    expect("openFile after them", recv_response(fd), SUCCESS);
+
+    send_request(fd, CLOSE_CONNECTION, 0, NULL, 0, NULL);
+    close(fd);
+}
+
+/**
+ * A frame larger than the body leaves the server unable to find the next
+ * request, the connection is closed
+ */
+static void
+check_broken(const char *socket_path, char *path)
+{
+    long fd = connect_to(socket_path);
+    if (fd == -1) {
+        failures++;
+        return;
+    }
+
+    size_t frame_size = 200;
+    send_request(fd, WRITE_FILE, strlen(path) + 1, path, 100 | BODY_STREAMED, NULL);
+    writen(fd, &frame_size, sizeof(frame_size));
+
+    char byte;
+    bool closed = read(fd, &byte, 1) == 0;
+    printf("%-45s : %s\n", "writeFile with a frame larger than its body", closed ? "connection closed, as expected" : "NOT AS EXPECTED");
+    if (!closed) failures++;
+    close(fd);
+}
+
+/**
+ * Clients waiting for the lock of a file are answered when the file is
+ * removed or expelled
+ */
+static void
+check_waiters(const char *socket_path, char *path, size_t max_size)
+{
+    // Both files do not fit, chunk lists of deduplicated contents included
+    size_t small_size = 20000, big_size = max_size - 10000;
+    char *big = calloc(big_size, 1);
+    char *big_path = malloc(strlen(path) + 5);
+    long fd = connect_to(socket_path);
+    long waiting_fd = connect_to(socket_path);
+    if (big == NULL || big_path == NULL || fd == -1 || waiting_fd == -1) {
+        failures++;
+        return;
+    }
+    sprintf(big_path, "%s.big", path);
+
+    int flags = O_CREATE | O_LOCK;
+    send_request(fd, OPEN_FILE, strlen(path) + 1, path, sizeof(flags), &flags);
+    expect("openFile of the locked file", recv_response(fd), SUCCESS);
+    send_request(fd, WRITE_FILE, strlen(path) + 1, path, small_size, big);
+    expect("writeFile of the locked file", recv_write_response(fd), SUCCESS);
+
+    send_request(waiting_fd, LOCK_FILE, strlen(path) + 1, path, 0, NULL);
+    usleep(300000);
+
+    send_request(fd, REMOVE_FILE, strlen(path) + 1, path, 0, NULL);
+    expect("removeFile of the locked file", recv_response(fd), SUCCESS);
+    expect("lockFile waiting on the removed file", recv_response(waiting_fd), NOT_FOUND);
+
+    send_request(fd, OPEN_FILE, strlen(path) + 1, path, sizeof(flags), &flags);
+    expect("openFile of the locked file again", recv_response(fd), SUCCESS);
+    send_request(fd, WRITE_FILE, strlen(path) + 1, path, small_size, big);
+    expect("writeFile of the locked file again", recv_write_response(fd), SUCCESS);
+
+    send_request(waiting_fd, LOCK_FILE, strlen(path) + 1, path, 0, NULL);
+    usleep(300000);
+
+    send_request(fd, OPEN_FILE, strlen(big_path) + 1, big_path, sizeof(flags), &flags);
+    expect("openFile of a file expelling it", recv_response(fd), SUCCESS);
+    send_request(fd, WRITE_FILE, strlen(big_path) + 1, big_path, big_size, big);
+    expect("writeFile of a file expelling it", recv_write_response(fd), SUCCESS);
+    expect("lockFile waiting on the expelled file", recv_response(waiting_fd), NOT_FOUND);
+
+    send_request(waiting_fd, CLOSE_CONNECTION, 0, NULL, 0, NULL);
+    close(waiting_fd);
+    send_request(fd, CLOSE_CONNECTION, 0, NULL, 0, NULL);
+    close(fd);
+    free(big_path);
+    free(big);
+}
+
+/**
+ * Checks a readRange answer holds length bytes of contents from offset
+ */
+static void
+expect_range(const char *what, response_t *response, char *contents, size_t offset, size_t length)
+{
+    if (response == NULL) {
+        printf("%-45s : no response (%s)\n", what, strerror(errno));
+        failures++;
+        return;
+    }
+
+    bool ok = response->status == SUCCESS && response->body_size == length
+        && (length == 0 || memcmp(response->body, contents + offset, length) == 0);
+    printf("%-45s : %s, %lu bytes, %s\n", what, response->status_phrase, response->body_size, ok ? "as expected" : "NOT AS EXPECTED");
+    if (!ok) failures++;
+    free_response(response);
+}
+
+/**
+ * Ranges are cut at the end of the file, whichever way its contents are
+ * kept by the server
+ */
+static void
+check_range(const char *socket_path, char *path)
+{
+    // Text-like contents, they compress and split in several chunks
+    size_t size = 100000;
+    char *contents = malloc(size);
+    long fd = connect_to(socket_path);
+    if (contents == NULL || fd == -1) {
+        failures++;
+        return;
+    }
+    for (size_t i = 0, line = 0; i < size; line++) {
+        char text[64];
+        int length = snprintf(text, sizeof(text), "line %lu of the read file\n", line);
+        for (int j = 0; j < length && i < size; j++) contents[i++] = text[j];
+    }
+
+    int flags = O_CREATE | O_LOCK;
+    send_request(fd, OPEN_FILE, strlen(path) + 1, path, sizeof(flags), &flags);
+    expect("openFile of the read file", recv_response(fd), SUCCESS);
+    send_request(fd, WRITE_FILE, strlen(path) + 1, path, size, contents);
+    expect("writeFile of the read file", recv_write_response(fd), SUCCESS);
+
+    uint64_t range[2] = { 1000, 50000 };
+    send_request(fd, READ_RANGE, strlen(path) + 1, path, sizeof(range), range);
+    expect_range("readRange inside the file", recv_response(fd), contents, 1000, 50000);
+
+    range[0] = size - 100; range[1] = 1000;
+    send_request(fd, READ_RANGE, strlen(path) + 1, path, sizeof(range), range);
+    expect_range("readRange across the end", recv_response(fd), contents, size - 100, 100);
+
+    range[0] = size + 10; range[1] = 10;
+    send_request(fd, READ_RANGE, strlen(path) + 1, path, sizeof(range), range);
+    expect_range("readRange past the end", recv_response(fd), contents, size, 0);
+
+    range[0] = 10; range[1] = 0;
+    send_request(fd, READ_RANGE, strlen(path) + 1, path, sizeof(range), range);
+    expect_range("readRange of no bytes", recv_response(fd), contents, 10, 0);
+
+    range[0] = 0; range[1] = UINT64_MAX;
+    send_request(fd, READ_RANGE, strlen(path) + 1, path, sizeof(range), range);
+    expect_range("readRange of the whole file", recv_response(fd), contents, 0, size);
+
+    send_request(fd, CLOSE_CONNECTION, 0, NULL, 0, NULL);
+    close(fd);
+    free(contents);
+}
+
+int
+main(int argc, char *argv[])
+{
+    if (argc < 4) {
+        fprintf(stderr, "usage: %s socket_path streamed|broken|waiters|range file_path [max_size]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (strcmp(argv[2], "streamed") == 0) {
+        check_streamed(argv[1], argv[3]);
+    } else if (strcmp(argv[2], "broken") == 0) {
+        check_broken(argv[1], argv[3]);
+    } else if (strcmp(argv[2], "range") == 0) {
+        check_range(argv[1], argv[3]);
+    } else if (strcmp(argv[2], "waiters") == 0 && argc == 5) {
+        check_waiters(argv[1], argv[3], strtoul(argv[4], NULL, 10));
+    } else {
+        fprintf(stderr, "%s: unknown check %s\n", argv[0], argv[2]);
+        return EXIT_FAILURE;
+    }
+
+    return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
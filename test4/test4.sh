@@ -0,0 +1,135 @@
+#!/bin/bash
+
+RED="\033[1;31m"
+GREEN="\033[1;32m"
+YELLOW="\033[1;33m"
+BOLD="\033[;1m"
+RESET="\033[;0m"
+
+SERVER=./server
+CLIENT=./client
+PROBE=./probe
+
+SERVER_CONFIG=$(realpath ./test4_config.txt)
+SERVER_LOG=$(realpath ./server.log)
+
+N_WORKERS=2
+MAX_SIZE=1000000
+MAX_FILES=100
+SOCKET_PATH=/tmp/LSO_test4.sk
+STREAM_CHUNK_SIZE=4096
+
+echo ""
+echo -e "${BOLD}*************************${RESET}"
+echo -e "${BOLD}*    ${GREEN}STARTING TEST 4${BOLD}    *${RESET}"
+echo -e "${BOLD}*************************${RESET}"
+echo ""
+
+FAILED=0
+
+# Starts the server, the argument adds lines to the configuration
+start_server() {
+    echo -e "N_WORKERS=${N_WORKERS}\nMAX_SIZE=${MAX_SIZE}\nMAX_FILES=${MAX_FILES}\nSOCKET_PATH=${SOCKET_PATH}\nLOG_FILE=${SERVER_LOG}\nSTREAM_CHUNK_SIZE=${STREAM_CHUNK_SIZE}$1" > ${SERVER_CONFIG}
+    ${SERVER} ${SERVER_CONFIG} &
+    SERVER_PID=$!
+    sleep 1
+}
+
+stop_server() {
+    kill -SIGINT ${SERVER_PID}
+    wait ${SERVER_PID}
+    if [ $? -ne 0 ]; then FAILED=1; fi
+}
+
+# Reads the files back from the server and compares them with the originals
+check_restored() {
+    rm -rf restored
+    mkdir restored
+    ${CLIENT} -f ${SOCKET_PATH} -r $(echo $@ | tr ' ' ',') -d restored
+    for file in $@; do
+        if cmp -s ${file} restored/$(basename ${file}); then
+            printf "%-45s : %s\n" "$(basename ${file}) after the restart" "same contents, as expected"
+        else
+            printf "%-45s : %s\n" "$(basename ${file}) after the restart" "NOT AS EXPECTED"
+            FAILED=1
+        fi
+    done
+}
+
+echo -e "${YELLOW}[TEST 4]${BOLD} Starting server${RESET}"
+start_server
+echo ""
+
+echo -e "${YELLOW}[TEST 4]${BOLD} Testing:${RESET} requests other than writeFile with streamed bodies  -->  expecting them refused"
+${PROBE} ${SOCKET_PATH} streamed $(realpath data/small) || FAILED=1
+echo ""
+
+echo -e "${YELLOW}[TEST 4]${BOLD} Testing:${RESET} writeFile with a frame larger than its body  -->  expecting the connection closed"
+${PROBE} ${SOCKET_PATH} broken $(realpath data/small) || FAILED=1
+echo ""
+
+echo -e "${YELLOW}[TEST 4]${BOLD} Testing:${RESET} removing and expelling a file a client waits to lock  -->  expecting the client answered"
+${PROBE} ${SOCKET_PATH} waiters $(realpath data)/waited ${MAX_SIZE} || FAILED=1
+echo ""
+
+echo -e "${YELLOW}[TEST 4]${BOLD} Testing:${RESET} readRange of a file kept as it is  -->  expecting ranges cut at the end of the file"
+${PROBE} ${SOCKET_PATH} range $(realpath data)/ranged || FAILED=1
+echo ""
+
+echo ""
+echo -e "${YELLOW}[TEST 4]${BOLD} Shutting down server${RESET}"
+stop_server
+echo ""
+
+echo -e "${YELLOW}[TEST 4]${BOLD} Testing:${RESET} readRange of a compressed file  -->  expecting ranges cut at the end of the file"
+start_server "\nCOMPRESS_THRESHOLD=1024"
+${PROBE} ${SOCKET_PATH} range $(realpath data)/ranged || FAILED=1
+stop_server
+echo ""
+
+echo -e "${YELLOW}[TEST 4]${BOLD} Testing:${RESET} readRange of a file split in chunks  -->  expecting ranges cut at the end of the file"
+start_server "\nDEDUP=1"
+${PROBE} ${SOCKET_PATH} range $(realpath data)/ranged || FAILED=1
+stop_server
+echo ""
+
+# Files written before a restart
+head -c 300000 /dev/urandom > data/random
+RESTORED_FILES="$(realpath data/small) $(realpath data/random)"
+
+echo -e "${YELLOW}[TEST 4]${BOLD} Testing:${RESET} restarting the server with a storage file  -->  expecting files restored from the snapshot"
+rm -f storage.snap
+start_server "\nSTORAGE_FILE=$(realpath storage.snap)"
+${CLIENT} -f ${SOCKET_PATH} -W $(echo ${RESTORED_FILES} | tr ' ' ',')
+stop_server
+start_server "\nSTORAGE_FILE=$(realpath storage.snap)"
+check_restored ${RESTORED_FILES}
+stop_server
+echo ""
+
+echo -e "${YELLOW}[TEST 4]${BOLD} Testing:${RESET} killing the server with a write-ahead log  -->  expecting writes and removes replayed"
+rm -f storage.wal.*
+start_server "\nWAL_FILE=$(realpath storage.wal)\nWAL_SYNC=2"
+${CLIENT} -f ${SOCKET_PATH} -W $(echo ${RESTORED_FILES} | tr ' ' ',') -c $(realpath data/small)
+kill -9 ${SERVER_PID}
+wait ${SERVER_PID} 2> /dev/null
+start_server "\nWAL_FILE=$(realpath storage.wal)\nWAL_SYNC=2"
+check_restored $(realpath data/random)
+if [ -e restored/small ]; then
+    printf "%-45s : %s\n" "small after the restart" "NOT AS EXPECTED"
+    FAILED=1
+else
+    printf "%-45s : %s\n" "small after the restart" "removed, as expected"
+fi
+stop_server
+echo ""
+
+echo ""
+if [ ${FAILED} -eq 0 ]; then
+    echo -e "${BOLD}*     ${GREEN}TEST 4 PASSED${BOLD}     *${RESET}"
+else
+    echo -e "${BOLD}*     ${RED}TEST 4 FAILED${BOLD}     *${RESET}"
+fi
+echo ""
+
+exit ${FAILED}
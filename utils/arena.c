@@ -0,0 +1,63 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include "arena.h"
+
+#define ARENA_ALIGN     16
+
+arena_t*
+arena_create(size_t capacity)
+{
+    arena_t *arena = malloc(sizeof(arena_t));
+    if (arena == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    arena->block = malloc(capacity);
+    if (arena->block == NULL) {
+        free(arena);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    arena->capacity = capacity;
+    arena->used = 0;
+    return arena;
+}
+
+void
+arena_destroy(arena_t *arena)
+{
+    if (arena == NULL) return;
+
+    free(arena->block);
+    free(arena);
+}
+
+void*
+arena_alloc(arena_t *arena, size_t size)
+{
+    size_t offset = (arena->used + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (offset > arena->capacity || size > arena->capacity - offset) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    arena->used = offset + size;
+    return arena->block + offset;
+}
+
+void
+arena_reset(arena_t *arena)
+{
+    if (arena != NULL) arena->used = 0;
+}
+
+bool
+arena_owns(const arena_t *arena, const void *ptr)
+{
+    if (arena == NULL || ptr == NULL) return false;
+    return (uintptr_t)ptr >= (uintptr_t)arena->block && (uintptr_t)ptr < (uintptr_t)arena->block + arena->capacity;
+}
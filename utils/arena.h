@@ -0,0 +1,71 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define ARENA_DEFAULT_SIZE  (64 * 1024)
+
+/**
+ * A bump allocator over a single block. Allocations are never freed one
+ * by one, the whole arena is reset at once when none of them is used
+ * anymore. When the block is full allocations fail and callers fall back
+ * to the heap.
+ */
+typedef struct _arena_t {
+
+    char    *block;
+    size_t  capacity;
+    size_t  used;
+
+} arena_t;
+
+/**
+ * \brief Creates an arena of capacity bytes
+ *
+ * \param capacity: bytes available for allocations
+ *
+ * \return the arena on success, NULL on failure. Errno is set.
+ */
+arena_t*
+arena_create(size_t capacity);
+
+/**
+ * \brief Destroyes an arena, its allocations become invalid
+ *
+ * \param arena: arena to be destroyed (can be NULL)
+ */
+void
+arena_destroy(arena_t *arena);
+
+/**
+ * \brief Allocates size bytes aligned for any type, contents are undefined
+ *
+ * \param arena: arena where to allocate
+ * \param size: bytes to allocate
+ *
+ * \return the allocation on success, NULL if the arena is full. Errno is set.
+ */
+void*
+arena_alloc(arena_t *arena, size_t size);
+
+/**
+ * \brief Releases all allocations of an arena at once
+ *
+ * \param arena: arena to reset (can be NULL)
+ */
+void
+arena_reset(arena_t *arena);
+
+/**
+ * \brief Checks whether ptr was allocated from an arena
+ *
+ * \param arena: arena to check (can be NULL)
+ * \param ptr: pointer to check
+ *
+ * \return true if ptr is inside the arena, false otherwise
+ */
+bool
+arena_owns(const arena_t *arena, const void *ptr);
+
+#endif
@@ -0,0 +1,130 @@
+#include <stdlib.h>
+#include <errno.h>
+
+#include "bloom_filter.h"
+
+#define COUNTERS_PER_KEY    16
+#define N_HASHES            8
+#define COUNTER_MAX         UINT8_MAX
+
+/**
+ * Two independent hashes of key, the counters of a key are
+ * found by double hashing (h1 + i * h2)
+ */
+static void
+hash_key(const char *key, uint64_t *h1, uint64_t *h2)
+{
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for (const unsigned char *p = (const unsigned char*)key; *p != '\0'; p++) {
+        hash ^= *p;
+        hash *= 1099511628211ULL;
+    }
+    *h1 = hash;
+
+    // splitmix64 finalizer, odd so that it visits all counters
+    hash ^= hash >> 30;
+    hash *= 0xbf58476d1ce4e5b9ULL;
+    hash ^= hash >> 27;
+    hash *= 0x94d049bb133111ebULL;
+    hash ^= hash >> 31;
+    *h2 = hash | 1;
+}
+
+bloom_filter_t*
+bloom_filter_create(size_t expected_keys)
+{
+    bloom_filter_t *filter = calloc(1, sizeof(bloom_filter_t));
+    if (filter == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    size_t n_counters = 64;
+    while (n_counters < expected_keys * COUNTERS_PER_KEY) n_counters <<= 1;
+
+    filter->counters = calloc(n_counters, sizeof(uint8_t));
+    if (filter->counters == NULL) {
+        free(filter);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    filter->n_counters = n_counters;
+    filter->n_hashes = N_HASHES;
+    return filter;
+}
+
+void
+bloom_filter_destroy(bloom_filter_t *filter)
+{
+    if (filter == NULL) return;
+    free(filter->counters);
+    free(filter);
+}
+
+void
+bloom_filter_add(bloom_filter_t *filter, const char *key)
+{
+    uint64_t h1, h2;
+    hash_key(key, &h1, &h2);
+
+    for (int i = 0; i < filter->n_hashes; i++) {
+        uint8_t *counter = &filter->counters[(h1 + i * h2) & (filter->n_counters - 1)];
+        uint8_t value = __atomic_load_n(counter, __ATOMIC_RELAXED);
+
+        // Saturated counters are never incremented
+        while (value < COUNTER_MAX
+                && !__atomic_compare_exchange_n(counter, &value, value + 1, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    }
+}
+
+void
+bloom_filter_remove(bloom_filter_t *filter, const char *key)
+{
+    uint64_t h1, h2;
+    hash_key(key, &h1, &h2);
+
+    for (int i = 0; i < filter->n_hashes; i++) {
+        uint8_t *counter = &filter->counters[(h1 + i * h2) & (filter->n_counters - 1)];
+        uint8_t value = __atomic_load_n(counter, __ATOMIC_RELAXED);
+
+        // Saturated counters lost track of how many keys they count
+        while (value > 0 && value < COUNTER_MAX
+                && !__atomic_compare_exchange_n(counter, &value, value - 1, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    }
+}
+
+bool
+bloom_filter_may_contain(bloom_filter_t *filter, const char *key)
+{
+    uint64_t h1, h2;
+    hash_key(key, &h1, &h2);
+
+    __atomic_fetch_add(&filter->lookups, 1, __ATOMIC_RELAXED);
+
+    for (int i = 0; i < filter->n_hashes; i++) {
+        if (__atomic_load_n(&filter->counters[(h1 + i * h2) & (filter->n_counters - 1)], __ATOMIC_ACQUIRE) == 0) {
+            __atomic_fetch_add(&filter->negatives, 1, __ATOMIC_RELAXED);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void
+bloom_filter_false_positive(bloom_filter_t *filter)
+{
+    __atomic_fetch_add(&filter->false_positives, 1, __ATOMIC_RELAXED);
+}
+
+double
+bloom_filter_fp_rate(bloom_filter_t *filter)
+{
+    unsigned long negatives = __atomic_load_n(&filter->negatives, __ATOMIC_RELAXED);
+    unsigned long false_positives = __atomic_load_n(&filter->false_positives, __ATOMIC_RELAXED);
+
+    if (negatives + false_positives == 0) return 0;
+    return (double)false_positives / (double)(negatives + false_positives);
+}
@@ -0,0 +1,94 @@
+#ifndef BLOOM_FILTER_H
+#define BLOOM_FILTER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * A counting Bloom filter of strings. Counters are updated with atomic
+ * operations, so lookups can run concurrently with insertions and removals
+ * without any lock. A counter that reaches its maximum value sticks there,
+ * which can only cause false positives, never false negatives.
+ */
+typedef struct _bloom_filter_t {
+
+    /* Number of counters, a power of two */
+    size_t          n_counters;
+    /* Number of counters touched by each key */
+    int             n_hashes;
+    uint8_t         *counters;
+    /* Lookup counters, updated atomically */
+    unsigned long   lookups;
+    unsigned long   negatives;
+    unsigned long   false_positives;
+
+} bloom_filter_t;
+
+/**
+ * \brief Creates a new filter sized for about expected_keys keys
+ *
+ * \param expected_keys: number of keys expected to be in the filter at once
+ *
+ * \return the filter on success, NULL on failure. Errno is set.
+ */
+bloom_filter_t*
+bloom_filter_create(size_t expected_keys);
+
+/**
+ * \brief Destroyes a filter
+ *
+ * \param filter: filter to be destroyed
+ */
+void
+bloom_filter_destroy(bloom_filter_t *filter);
+
+/**
+ * \brief Adds a key to the filter, a key may be added more than once
+ *
+ * \param filter: filter where to add
+ * \param key: key to add
+ */
+void
+bloom_filter_add(bloom_filter_t *filter, const char *key);
+
+/**
+ * \brief Removes one occurrence of a key previously added to the filter
+ *
+ * \param filter: filter where the key is
+ * \param key: key to remove
+ */
+void
+bloom_filter_remove(bloom_filter_t *filter, const char *key);
+
+/**
+ * \brief Checks whether a key may be in the filter
+ *
+ * \param filter: filter where to look
+ * \param key: key to look for
+ *
+ * \return: false if the key is surely not in the filter, true otherwise.
+ */
+bool
+bloom_filter_may_contain(bloom_filter_t *filter, const char *key);
+
+/**
+ * \brief Records that a key the filter may contain was not found
+ *
+ * \param filter: filter that answered the lookup
+ */
+void
+bloom_filter_false_positive(bloom_filter_t *filter);
+
+/**
+ * \brief Gets the false positive rate observed so far, the fraction of
+ *        lookups for absent keys the filter did not rule out
+ *
+ * \param filter: filter to check
+ *
+ * \return: the false positive rate, 0 if there were no such lookups.
+ */
+double
+bloom_filter_fp_rate(bloom_filter_t *filter);
+
+#endif
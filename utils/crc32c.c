@@ -0,0 +1,96 @@
+#include <string.h>
+#include <pthread.h>
+
+#include "crc32c.h"
+
+#define CRC32C_POLY     0x82f63b78  /* Castagnoli polynomial, reflected */
+
+/* Checksum of a byte followed by 0 to 7 zero bytes, for slicing by 8 */
+static uint32_t table[8][256];
+static bool hardware;
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+
+static void
+crc32c_init()
+{
+    for (int i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) crc = (crc >> 1) ^ ((crc & 1) ? CRC32C_POLY : 0);
+        table[0][i] = crc;
+    }
+    for (int i = 0; i < 256; i++) {
+        for (int k = 1; k < 8; k++) table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xff];
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    hardware = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+/**
+ * Slicing by 8, words are read little endian as everything else on disk
+ * and on the wire
+ */
+static uint32_t
+crc32c_slice8(uint32_t crc, const uint8_t *p, size_t size)
+{
+    for (; size > 0 && ((uintptr_t)p & 7) != 0; size--) crc = table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+    for (; size >= 8; size -= 8, p += 8) {
+        uint32_t lo, hi;
+        memcpy(&lo, p, sizeof(lo));
+        memcpy(&hi, p + 4, sizeof(hi));
+        lo ^= crc;
+        crc = table[7][lo & 0xff] ^ table[6][(lo >> 8) & 0xff] ^ table[5][(lo >> 16) & 0xff] ^ table[4][lo >> 24]
+            ^ table[3][hi & 0xff] ^ table[2][(hi >> 8) & 0xff] ^ table[1][(hi >> 16) & 0xff] ^ table[0][hi >> 24];
+    }
+
+    for (; size > 0; size--) crc = table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t
+crc32c_sse42(uint32_t crc, const uint8_t *p, size_t size)
+{
+    for (; size > 0 && ((uintptr_t)p & 7) != 0; size--) crc = __builtin_ia32_crc32qi(crc, *p++);
+
+    uint64_t crc64 = crc;
+    for (; size >= 8; size -= 8, p += 8) {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        crc64 = __builtin_ia32_crc32di(crc64, word);
+    }
+    crc = (uint32_t)crc64;
+
+    for (; size > 0; size--) crc = __builtin_ia32_crc32qi(crc, *p++);
+    return crc;
+}
+#endif
+
+uint32_t
+crc32c(uint32_t crc, const void *data, size_t size)
+{
+    pthread_once(&init_once, crc32c_init);
+
+#if defined(__x86_64__)
+    if (hardware) return ~crc32c_sse42(~crc, (const uint8_t*)data, size);
+#endif
+    return ~crc32c_slice8(~crc, (const uint8_t*)data, size);
+}
+
+uint32_t
+crc32c_software(uint32_t crc, const void *data, size_t size)
+{
+    pthread_once(&init_once, crc32c_init);
+    return ~crc32c_slice8(~crc, (const uint8_t*)data, size);
+}
+
+bool
+crc32c_hardware()
+{
+    pthread_once(&init_once, crc32c_init);
+    return hardware;
+}
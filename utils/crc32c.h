@@ -0,0 +1,35 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * \brief Extends the CRC32C (Castagnoli) checksum crc with size bytes of data.
+ *        Checksums chain, crc32c(crc32c(0, a), b) is the checksum of a followed
+ *        by b. Runs on the SSE4.2 instruction when the processor has it and
+ *        slices by 8 bytes otherwise.
+ *
+ * \param crc: checksum of the data before, 0 to start
+ * \param data: data to checksum
+ * \param size: bytes of data
+ *
+ * \return the checksum
+ */
+uint32_t
+crc32c(uint32_t crc, const void *data, size_t size);
+
+/**
+ * \brief Computes the same checksum as crc32c, always in software
+ */
+uint32_t
+crc32c_software(uint32_t crc, const void *data, size_t size);
+
+/**
+ * \brief Whether crc32c runs on the SSE4.2 instruction
+ */
+bool
+crc32c_hardware();
+
+#endif
@@ -103,11 +103,11 @@ hash_map_insert(hash_map_t *hmap, void* key, void* value)
         } else {
             prev->next = entry;
         }
+        hmap->n_entries++;
     } else {
         entry->value = value;
     }
 
-    hmap->n_entries++;
     return 0;
 }
 
@@ -127,10 +127,8 @@ hash_map_remove(hash_map_t *hmap, void *key)
     hash_map_entry_t *entry = hmap->buckets[hashed_key], *prev = NULL;
 
     while (entry != NULL) {
-        if (hmap->key_cmp(entry->key, key)) {
-            prev = entry;
-            break;
-        }
+        if (hmap->key_cmp(entry->key, key)) break;
+        prev = entry;
         entry = entry->next;
     }
 
@@ -145,7 +143,6 @@ hash_map_remove(hash_map_t *hmap, void *key)
         prev->next = entry->next;
     }
 
-    hmap->buckets[hashed_key] = NULL;
     hmap->free_key(entry->key);
     hmap->free_value(entry->value);
     free(entry);
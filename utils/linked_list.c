@@ -6,6 +6,39 @@
 #include "linked_list.h"
 #include "utilities.h"
 
+/**
+ * Gets a node from the pool of list, or a new one
+ */
+static node_t*
+node_get(list_t *list)
+{
+    node_t *node = list->free_nodes;
+    if (node == NULL) {
+        node = malloc(sizeof(node_t));
+        if (node == NULL) errno = ENOMEM;
+        return node;
+    }
+
+    list->free_nodes = node->next;
+    list->n_free--;
+    return node;
+}
+
+/**
+ * Gives node back to the pool of list
+ */
+static void
+node_put(list_t *list, node_t *node)
+{
+    if (list->n_free >= LIST_POOL_MAX) {
+        free(node);
+        return;
+    }
+
+    node->next = list->free_nodes;
+    list->free_nodes = node;
+    list->n_free++;
+}
 
 list_t*
 list_create(bool cmp(void*, void*), void free_fun(void*), void print(void*, FILE*))
@@ -36,6 +69,11 @@ list_destroy(list_t *list)
         list->free_fun(tmp->data);
         free(tmp);
     }
+    while (list->free_nodes != NULL) {
+        tmp = list->free_nodes;
+        list->free_nodes = tmp->next;
+        free(tmp);
+    }
     list->length = 0;
     free(list);
 }
@@ -48,11 +86,8 @@ list_insert_tail(list_t *list, void* to_insert)
         return -1;
     }
 
-    node_t *new = calloc(1, sizeof(node_t));
-    if (new == NULL) {
-        errno = ENOMEM;
-        return -1;
-    }
+    node_t *new = node_get(list);
+    if (new == NULL) return -1;
 
     new->data = to_insert;
     new->next = NULL;
@@ -76,15 +111,13 @@ list_insert_head(list_t *list, void* to_insert)
         return -1;
     }
 
-    node_t *new = calloc(1, sizeof(node_t));
-    if (new == NULL) {
-        errno = ENOMEM;
-        return -1;
-    }
+    node_t *new = node_get(list);
+    if (new == NULL) return -1;
 
     new->data = to_insert;
     new->next = list->head;
     list->head = new;
+    if (list->length == 0) list->tail = new;
     list->length++;
     return 0;
 }
@@ -98,11 +131,8 @@ list_insert_at_index(list_t *list, void* to_insert, int index)
         return -1;
     }
 
-    node_t *new = calloc(1, sizeof(node_t));
-    if (new == NULL) {
-        errno = ENOMEM;
-        return -1;
-    }
+    node_t *new = node_get(list);
+    if (new == NULL) return -1;
 
     new->data = to_insert;
     new->next = NULL;
@@ -110,6 +140,7 @@ list_insert_at_index(list_t *list, void* to_insert, int index)
     if (index == 0) { // Head of the list
         new->next = list->head;
         list->head = new;
+        if (list->length == 0) list->tail = new;
         list->length++;
         return 0;
     }
@@ -153,7 +184,7 @@ list_remove_head(list_t *list)
         list->head = list->head->next;
     }
 
-    free(tmp);
+    node_put(list, tmp);
     list->length--;
     return to_return;
 }
@@ -182,7 +213,7 @@ list_remove_tail(list_t *list)
         list->tail = prev;
     }
 
-    free(tmp);
+    node_put(list, tmp);
     list->length--;
     return to_return;
 }
@@ -206,14 +237,13 @@ list_remove_element(list_t *list, void* elem)
 
     if (prev == NULL) {
         list->head = list->head->next;
-        list->free_fun(tmp->data);
-        free(tmp);
+        if (list->head == NULL) list->tail = NULL;
     } else {
         prev->next = curr->next;
         if (prev->next == NULL) list->tail = prev;
-        list->free_fun(tmp->data);
-        free(tmp);
     }
+    list->free_fun(tmp->data);
+    node_put(list, tmp);
 
     list->length--;
 
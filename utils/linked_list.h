@@ -13,13 +13,21 @@ typedef struct _node_t {
 } node_t;
 
 /**
- * The type of a linked list
+ * Most nodes kept by a list for reuse
+ */
+#define LIST_POOL_MAX   1024
+
+/**
+ * The type of a linked list, nodes of removed elements are kept for
+ * the next insertions, up to LIST_POOL_MAX
  */
 typedef struct _list_t {
 
     int     length;
     node_t  *head;
     node_t  *tail;
+    node_t  *free_nodes;
+    int     n_free;
     bool    (*cmp)(void*, void*);
     void    (*free_fun)(void*);
     void    (*print)(void*, FILE*);
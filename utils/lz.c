@@ -0,0 +1,234 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "lz.h"
+
+#define LZ_HASH_BITS    13
+#define LZ_RUN_MASK     15
+/* Every 2^LZ_SKIP_SHIFT bytes without a match the search steps one byte further */
+#define LZ_SKIP_SHIFT   6
+
+static inline uint32_t
+read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t
+read64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t
+hash(uint32_t sequence)
+{
+    return (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/**
+ * Bytes ip and ref have in common, up to end
+ */
+static size_t
+match_length(const uint8_t *ip, const uint8_t *ref, const uint8_t *end)
+{
+    const uint8_t *start = ip;
+
+    while (ip + sizeof(uint64_t) <= end) {
+        uint64_t diff = read64(ip) ^ read64(ref);
+        if (diff != 0) return ip - start + (__builtin_ctzll(diff) >> 3);
+        ip += sizeof(uint64_t);
+        ref += sizeof(uint64_t);
+    }
+    while (ip < end && *ip == *ref) {
+        ip++;
+        ref++;
+    }
+    return ip - start;
+}
+
+/**
+ * Writes the bytes of a length not fitting in the token
+ */
+static uint8_t*
+write_length(uint8_t *op, const uint8_t *oend, size_t length)
+{
+    while (length >= 255) {
+        if (op == oend) return NULL;
+        *op++ = 255;
+        length -= 255;
+    }
+    if (op == oend) return NULL;
+    *op++ = (uint8_t)length;
+    return op;
+}
+
+/**
+ * Writes a sequence, the last one has match_len 0 and no offset
+ */
+static uint8_t*
+write_sequence(uint8_t *op, const uint8_t *oend, const uint8_t *literals, size_t n_literals, size_t offset, size_t match_len)
+{
+    if (op == oend) return NULL;
+    uint8_t *token = op++;
+
+    size_t match_code = (match_len > 0) ? match_len - LZ_MIN_MATCH : 0;
+    *token = (uint8_t)(((n_literals < LZ_RUN_MASK) ? n_literals : LZ_RUN_MASK) << 4);
+    *token |= (uint8_t)((match_code < LZ_RUN_MASK) ? match_code : LZ_RUN_MASK);
+
+    if (n_literals >= LZ_RUN_MASK && (op = write_length(op, oend, n_literals - LZ_RUN_MASK)) == NULL) return NULL;
+    if ((size_t)(oend - op) < n_literals) return NULL;
+    memcpy(op, literals, n_literals);
+    op += n_literals;
+
+    if (match_len == 0) return op;
+
+    if (oend - op < 2) return NULL;
+    *op++ = (uint8_t)(offset & 0xff);
+    *op++ = (uint8_t)(offset >> 8);
+
+    if (match_code >= LZ_RUN_MASK && (op = write_length(op, oend, match_code - LZ_RUN_MASK)) == NULL) return NULL;
+    return op;
+}
+
+size_t
+lz_compress_bound(size_t size)
+{
+    return size + size / 255 + 16;
+}
+
+size_t
+lz_decompress_bound(size_t size)
+{
+    return (size > SIZE_MAX / 255) ? SIZE_MAX : size * 255;
+}
+
+size_t
+lz_compress(const void *src, size_t size, void *dst, size_t capacity)
+{
+    const uint8_t *in = (const uint8_t*)src, *ip = in, *anchor = in, *end = in + size;
+    uint8_t *op = (uint8_t*)dst, *oend = op + capacity;
+
+    // Positions of the last sequence of LZ_MIN_MATCH bytes with a given hash
+    uint32_t table[1 << LZ_HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    while (ip + LZ_MIN_MATCH <= end) {
+
+        uint32_t sequence = read32(ip);
+        uint32_t h = hash(sequence);
+        const uint8_t *ref = in + table[h];
+        table[h] = (uint32_t)(ip - in);
+
+        if (ref >= ip || ip - ref > LZ_MAX_OFFSET || read32(ref) != sequence) {
+            ip += 1 + ((ip - anchor) >> LZ_SKIP_SHIFT);
+            continue;
+        }
+
+        size_t match_len = LZ_MIN_MATCH + match_length(ip + LZ_MIN_MATCH, ref + LZ_MIN_MATCH, end);
+        op = write_sequence(op, oend, anchor, ip - anchor, ip - ref, match_len);
+        if (op == NULL) return 0;
+
+        ip += match_len;
+        anchor = ip;
+    }
+
+    op = write_sequence(op, oend, anchor, end - anchor, 0, 0);
+    return (op == NULL) ? 0 : op - (uint8_t*)dst;
+}
+
+/**
+ * Reads the bytes of a length not fitting in the token
+ */
+static const uint8_t*
+read_length(const uint8_t *ip, const uint8_t *iend, size_t *length)
+{
+    uint8_t byte;
+    do {
+        if (ip == iend) return NULL;
+        byte = *ip++;
+        *length += byte;
+    } while (byte == 255);
+    return ip;
+}
+
+/**
+ * Decodes the stream into raw_size bytes of dst. Decoding a prefix stops
+ * once dst is full, anywhere in the stream, instead of expecting the stream
+ * to end there.
+ */
+static int
+decode(const void *src, size_t size, void *dst, size_t raw_size, bool prefix)
+{
+    const uint8_t *ip = (const uint8_t*)src, *iend = ip + size;
+    uint8_t *op = (uint8_t*)dst, *oend = op + raw_size;
+
+    while (ip < iend) {
+
+        if (prefix && op == oend) return 0;
+
+        uint8_t token = *ip++;
+
+        size_t n_literals = token >> 4;
+        if (n_literals == LZ_RUN_MASK && (ip = read_length(ip, iend, &n_literals)) == NULL) goto _malformed;
+        if ((size_t)(iend - ip) < n_literals) goto _malformed;
+        if ((size_t)(oend - op) < n_literals) {
+            if (!prefix) goto _malformed;
+            memcpy(op, ip, oend - op);
+            return 0;
+        }
+        memcpy(op, ip, n_literals);
+        ip += n_literals;
+        op += n_literals;
+
+        // Last sequence
+        if (ip == iend) break;
+
+        if (iend - ip < 2) goto _malformed;
+        size_t offset = ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - (uint8_t*)dst)) goto _malformed;
+
+        size_t match_len = token & LZ_RUN_MASK;
+        if (match_len == LZ_RUN_MASK && (ip = read_length(ip, iend, &match_len)) == NULL) goto _malformed;
+        match_len += LZ_MIN_MATCH;
+        if ((size_t)(oend - op) < match_len) {
+            if (!prefix) goto _malformed;
+            match_len = oend - op;
+        }
+
+        // Overlapping matches repeat the last offset bytes
+        const uint8_t *ref = op - offset;
+        if (offset >= match_len) {
+            memcpy(op, ref, match_len);
+            op += match_len;
+        } else {
+            while (match_len--) *op++ = *ref++;
+        }
+    }
+
+    if (op != oend) goto _malformed;
+    return 0;
+
+_malformed:
+    errno = EILSEQ;
+    return -1;
+}
+
+int
+lz_decompress(const void *src, size_t size, void *dst, size_t raw_size)
+{
+    return decode(src, size, dst, raw_size, false);
+}
+
+int
+lz_decompress_prefix(const void *src, size_t size, void *dst, size_t prefix_size)
+{
+    return decode(src, size, dst, prefix_size, true);
+}
@@ -0,0 +1,80 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <stddef.h>
+
+/**
+ * A fast LZ77 codec in the style of LZ4. The compressed stream is a list of
+ * sequences, each a token byte with the number of literals in the high
+ * nibble and the match length minus LZ_MIN_MATCH in the low one, extended
+ * by bytes of 255 when they do not fit, followed by the literals and by the
+ * two bytes offset of the match. The last sequence has literals only.
+ * Streams do not record the size of the data, callers keep it.
+ */
+#define LZ_MIN_MATCH    4
+#define LZ_MAX_OFFSET   65535
+
+/**
+ * \brief Bytes of the largest stream compressing size bytes can produce
+ *
+ * \param size: bytes of data
+ *
+ * \return the bound
+ */
+size_t
+lz_compress_bound(size_t size);
+
+/**
+ * \brief Bytes of the largest data a stream of size bytes can decompress to,
+ *          a sequence yields at most 255 bytes for each of its own
+ *
+ * \param size: bytes of the stream
+ *
+ * \return the bound, SIZE_MAX if it does not fit in a size_t
+ */
+size_t
+lz_decompress_bound(size_t size);
+
+/**
+ * \brief Compresses size bytes of src into dst
+ *
+ * \param src: data to compress
+ * \param size: bytes of data
+ * \param dst: buffer for the stream
+ * \param capacity: bytes of dst, the stream is given up when it does not fit
+ *
+ * \return bytes of the stream on success, 0 if it does not fit in capacity
+ */
+size_t
+lz_compress(const void *src, size_t size, void *dst, size_t capacity);
+
+/**
+ * \brief Decompresses a stream of size bytes into exactly raw_size bytes
+ *
+ * \param src: stream to decompress
+ * \param size: bytes of the stream
+ * \param dst: buffer for the data
+ * \param raw_size: bytes of the data
+ *
+ * \return 0 on success, -1 if the stream is malformed or does not decompress
+ * to raw_size bytes. Errno is set.
+ */
+int
+lz_decompress(const void *src, size_t size, void *dst, size_t raw_size);
+
+/**
+ * \brief Decompresses only the first prefix_size bytes of a stream, without
+ *          decoding the sequences after them
+ *
+ * \param src: stream to decompress
+ * \param size: bytes of the stream
+ * \param dst: buffer for the data
+ * \param prefix_size: bytes of the data to decompress, at most its size
+ *
+ * \return 0 on success, -1 if the stream is malformed or holds less than
+ * prefix_size bytes. Errno is set.
+ */
+int
+lz_decompress_prefix(const void *src, size_t size, void *dst, size_t prefix_size);
+
+#endif
@@ -3,15 +3,18 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <unistd.h>
+#include <sys/select.h>
 
 #include "protocol.h"
 #include "utilities.h"
+#include "lz.h"
+#include "crc32c.h"
 
 /** 
  * Messages corresponding to a
  * certain response status
  */
-static char status_message[12][128] = {
+static char status_message[12][MAX_PATH] = {
     "Operation successfull",
     "Connection accepted",
     "Internal server error",
@@ -26,6 +29,26 @@ static char status_message[12][128] = {
     "No more connections"
 };
 
+/**
+ * Names of the requests, as they
+ * appear in the server log
+ */
+static const char *request_name[] = {
+    "openConn",
+    "closeConn",
+    "openFile",
+    "closeFile",
+    "writeFile",
+    "readFile",
+    "readNFiles",
+    "removeFile",
+    "lockFile",
+    "unlockFile",
+    "appendToFile",
+    "stats",
+    "readRange"
+};
+
 const char*
 get_status_message(response_code code)
 {
@@ -33,6 +56,109 @@ get_status_message(response_code code)
     return status_message[code];
 }
 
+const char*
+get_request_name(request_code code)
+{
+    if (code < OPEN_CONNECTION || code >= OPEN_CONNECTION + sizeof(request_name) / sizeof(request_name[0])) return NULL;
+    return request_name[code - OPEN_CONNECTION];
+}
+
+/**
+ * Capabilities of each connection, by file descriptor
+ */
+static uint32_t capabilities[FD_SETSIZE];
+
+int
+set_capabilities(long conn_fd, uint32_t caps)
+{
+    if (conn_fd < 0 || conn_fd >= FD_SETSIZE) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    capabilities[conn_fd] = caps;
+    return 0;
+}
+
+uint32_t
+get_capabilities(long conn_fd)
+{
+    return (conn_fd >= 0 && conn_fd < FD_SETSIZE) ? capabilities[conn_fd] : 0;
+}
+
+/**
+ * Compresses body_size bytes of body as a compressed body, kept only if it
+ * saves at least an eighth of them. Returns the compressed body, to be freed
+ * by the caller, NULL if it is not worth sending.
+ */
+static void*
+compress_body(const void *body, size_t body_size, size_t *wire_size)
+{
+    size_t capacity = body_size - body_size / 8 - COMPRESSED_BODY_HEADER;
+    char *wire_body = malloc(COMPRESSED_BODY_HEADER + capacity);
+    if (wire_body == NULL) return NULL;
+
+    size_t stream_size = lz_compress(body, body_size, wire_body + COMPRESSED_BODY_HEADER, capacity);
+    if (stream_size == 0) {
+        free(wire_body);
+        return NULL;
+    }
+
+    uint64_t raw_size = body_size;
+    memcpy(wire_body, &raw_size, COMPRESSED_BODY_HEADER);
+    *wire_size = COMPRESSED_BODY_HEADER + stream_size;
+    return wire_body;
+}
+
+/**
+ * Writes the size and the bytes of a message body, compressed if the
+ * connection negotiated it and it is worth it, followed by the checksum of
+ * its data if negotiated. Checksum is computed if NULL.
+ */
+static int
+write_body(long conn_fd, size_t body_size, void *body, const uint32_t *checksum)
+{
+    // Frames of streamed bodies follow, sent with stream_send
+    if (CHK_FLAG(body_size, BODY_STREAMED)) {
+        return (writen(conn_fd, (void*)&body_size, sizeof(size_t)) == -1) ? -1 : 0;
+    }
+
+    void *wire_body = NULL;
+    size_t wire_size = 0;
+
+    uint32_t crc = 0;
+    bool checked = CHK_FLAG(get_capabilities(conn_fd), CAP_CHECKSUM) && (body_size & ~BODY_COMPRESSED) != 0;
+    if (checked && checksum != NULL) {
+        crc = *checksum;
+    } else if (checked) {
+        // Compressed bodies would have to be decompressed first
+        if (CHK_FLAG(body_size, BODY_COMPRESSED)) {
+            errno = EINVAL;
+            return -1;
+        }
+        crc = crc32c(0, body, body_size);
+    }
+
+    if (!CHK_FLAG(body_size, BODY_COMPRESSED) && body_size >= WIRE_COMPRESS_MIN
+        && CHK_FLAG(get_capabilities(conn_fd), CAP_COMPRESSION)) {
+        wire_body = compress_body(body, body_size, &wire_size);
+    }
+    if (wire_body != NULL) {
+        body = wire_body;
+        body_size = wire_size | BODY_COMPRESSED;
+    }
+
+    int result = 0;
+    if (writen(conn_fd, (void*)&body_size, sizeof(size_t)) == -1) result = -1;
+
+    size_t size = body_size & ~BODY_COMPRESSED;
+    if (result == 0 && size != 0 && writen(conn_fd, body, size) == -1) result = -1;
+    if (result == 0 && checked && writen(conn_fd, (void*)&crc, sizeof(crc)) == -1) result = -1;
+
+    free(wire_body);
+    return result;
+}
+
 int
 send_request(long conn_fd, request_code type, size_t path_len, const char *resource_path, size_t body_size, void* body)
 {
@@ -44,93 +170,176 @@ send_request(long conn_fd, request_code type, size_t path_len, const char *resou
     int result = 0;
     
     // Writes type
-    if (write(conn_fd, (void*)&type, sizeof(response_code)) == -1) return -1;
+    if (writen(conn_fd, (void*)&type, sizeof(response_code)) == -1) return -1;
 
     // Writes file path length
-    if (write(conn_fd, (void*)&path_len, sizeof(size_t)) == -1) return -1;
+    if (writen(conn_fd, (void*)&path_len, sizeof(size_t)) == -1) return -1;
 
     // Writes file path
     if (path_len != 0) {
-        if (write(conn_fd, resource_path, sizeof(char) * path_len) == -1) return -1;
+        if (writen(conn_fd, (void*)resource_path, sizeof(char) * path_len) == -1) return -1;
     }
 
-    // Writes body size
-    if (write(conn_fd, (void*)&body_size, sizeof(size_t)) == -1) return -1;
+    // Writes body size and body
+    if (write_body(conn_fd, body_size, body, NULL) == -1) return -1;
 
-    // Writes body
-    if (body_size != 0) {
-        if (write(conn_fd, body, body_size) == -1) return -1;
+    return result;
+}
+
+/**
+ * Allocates size bytes of a message from arena, large bodies and
+ * allocations that do not fit go to the heap
+ */
+static void*
+message_alloc(arena_t *arena, size_t size)
+{
+    void *ptr = (arena != NULL && size <= arena->capacity / 4) ? arena_alloc(arena, size) : NULL;
+    if (ptr == NULL) {
+        ptr = malloc(size);
+        if (ptr == NULL) errno = ENOMEM;
     }
+    return ptr;
+}
 
-    return result;
+static void
+message_free(arena_t *arena, void *ptr)
+{
+    if (ptr != NULL && !arena_owns(arena, ptr)) free(ptr);
+}
+
+/**
+ * Reads the size and the bytes of a message body, decompressing it if it
+ * was sent compressed, and checks it against the checksum following it if
+ * the connection negotiated one. Streamed bodies are left on the socket.
+ */
+static int
+read_body(long conn_fd, arena_t *arena, size_t *body_size, void **body, bool *streamed)
+{
+    if (readn(conn_fd, (void*)body_size, sizeof(size_t)) == -1) return -1;
+
+    if (CHK_FLAG(*body_size, BODY_STREAMED)) {
+        CLR_FLAG(*body_size, BODY_STREAMED);
+        *streamed = true;
+        return 0;
+    }
+
+    size_t wire_size = *body_size & ~BODY_COMPRESSED;
+    if (wire_size == 0) {
+        *body_size = 0;
+        return 0;
+    }
+
+    void *wire_body = message_alloc(arena, wire_size);
+    if (wire_body == NULL) return -1;
+
+    if (readn(conn_fd, wire_body, wire_size) != wire_size) goto _read_error;
+
+    uint32_t crc = 0;
+    bool checked = CHK_FLAG(get_capabilities(conn_fd), CAP_CHECKSUM);
+    if (checked && readn(conn_fd, (void*)&crc, sizeof(crc)) != sizeof(crc)) goto _read_error;
+
+    if (!CHK_FLAG(*body_size, BODY_COMPRESSED)) {
+        if (checked && crc32c(0, wire_body, wire_size) != crc) {
+            errno = EBADMSG;
+            goto _read_error;
+        }
+        *body = wire_body;
+        return 0;
+    }
+
+    uint64_t raw_size = 0;
+    if (wire_size > COMPRESSED_BODY_HEADER) memcpy(&raw_size, wire_body, COMPRESSED_BODY_HEADER);
+    // Size comes from the peer, a stream this short could never decompress to more
+    if (raw_size == 0 || raw_size > SIZE_MAX / 2
+        || raw_size > lz_decompress_bound(wire_size - COMPRESSED_BODY_HEADER)) {
+        errno = EILSEQ;
+        goto _read_error;
+    }
+
+    void *raw_body = message_alloc(arena, raw_size);
+    if (raw_body == NULL) goto _read_error;
+
+    if (lz_decompress((char*)wire_body + COMPRESSED_BODY_HEADER, wire_size - COMPRESSED_BODY_HEADER, raw_body, raw_size) != 0) {
+        message_free(arena, raw_body);
+        goto _read_error;
+    }
+
+    if (checked && crc32c(0, raw_body, raw_size) != crc) {
+        message_free(arena, raw_body);
+        errno = EBADMSG;
+        goto _read_error;
+    }
+
+    message_free(arena, wire_body);
+    *body_size = raw_size;
+    *body = raw_body;
+    return 0;
+
+_read_error:
+    message_free(arena, wire_body);
+    *body_size = 0;
+    return -1;
 }
 
 request_t*
 recv_request(long conn_fd)
+{
+    return recv_request_arena(conn_fd, NULL);
+}
+
+request_t*
+recv_request_arena(long conn_fd, arena_t *arena)
 {   
     if (conn_fd < 0) {
         errno = EINVAL;
         return NULL;
     }
 
-    request_t *request;
-    request = (request_t*)calloc(1, sizeof(request_t));
-    if (request == NULL) {
-        errno = ENOMEM;
-        return NULL;
-    }
+    request_t *request = message_alloc(arena, sizeof(request_t));
+    if (request == NULL) return NULL;
+    memset(request, 0, sizeof(request_t));
+    request->arena = arena;
 
     // Reads type
-    if (read(conn_fd, (void*)&request->type, sizeof(response_code)) == -1) return NULL;
+    if (readn(conn_fd, (void*)&request->type, sizeof(response_code)) == -1) goto _recv_error;
     
     // Read file path length
-    if (read(conn_fd, (void*)&request->path_len, sizeof(size_t)) == -1) return NULL;
+    if (readn(conn_fd, (void*)&request->path_len, sizeof(size_t)) == -1) goto _recv_error;
     
     // Allocates space for file path
     if (request->path_len != 0) {
-        request->file_path = calloc(1, request->path_len);
-        if (request->file_path == NULL) {
-            free(request);
-            errno = ENOMEM;
-            return NULL;
-        }
+        request->file_path = message_alloc(arena, request->path_len);
+        if (request->file_path == NULL) goto _recv_error;
 
         // Reads file path
-        if (read(conn_fd, (void*)request->file_path, sizeof(char) * request->path_len) == -1) return NULL; 
+        if (readn(conn_fd, (void*)request->file_path, sizeof(char) * request->path_len) != request->path_len) goto _recv_error; 
     }
 
-    // Reads body size      
-    if (read(conn_fd, (void*)&request->body_size, sizeof(size_t)) == -1) return NULL;
-
-    // Allocates space for body
-    if (request->body_size != 0) {
-        request->body = calloc(1, request->body_size);
-        if (request->body == NULL) {
-            free(request);
-            errno = ENOMEM;
-            return NULL;
-        }
-
-        // Reads body
-        if (read(conn_fd, request->body, request->body_size) == -1) return NULL;
-    }
+    // Reads body size and body
+    if (read_body(conn_fd, arena, &request->body_size, &request->body, &request->streamed) == -1) goto _recv_error;
 
     return request;
+
+_recv_error:
+    free_request(request);
+    return NULL;
 }
 
 void
 free_request(request_t *request)
 {
     if (request != NULL) {
-        if (request->body) free(request->body);
-        if (request->file_path) free(request->file_path);
-        free(request);
+        message_free(request->arena, request->body);
+        message_free(request->arena, request->file_path);
+        message_free(request->arena, request);
     }
-    
 }
 
-int
-send_response(long conn_fd, response_code status, const char *status_phrase, size_t path_len, char *file_path, size_t body_size, void* body)
+/**
+ * Sends a response, checksum of its body is computed if NULL
+ */
+static int
+write_response(long conn_fd, response_code status, const char *status_phrase, size_t path_len, char *file_path, size_t body_size, void* body, const uint32_t *checksum)
 {
     if (conn_fd < 0) {
         errno = EINVAL;
@@ -138,81 +347,182 @@ send_response(long conn_fd, response_code status, const char *status_phrase, siz
     }
 
     int result = 0;
-    if (write(conn_fd, (void*)&status, sizeof(response_code)) == -1) return -1;
-    if (write(conn_fd, (void*)status_phrase, sizeof(char) * MAX_PATH) == -1) return -1;
+    if (writen(conn_fd, (void*)&status, sizeof(response_code)) == -1) return -1;
+    if (writen(conn_fd, (void*)status_phrase, sizeof(char) * MAX_PATH) == -1) return -1;
     
     // Writes file path length
-    if (write(conn_fd, (void*)&path_len, sizeof(size_t)) == -1) return -1;
+    if (writen(conn_fd, (void*)&path_len, sizeof(size_t)) == -1) return -1;
 
     // Writes file path
     if (path_len != 0) {
-        if (write(conn_fd, file_path, sizeof(char) * path_len) == -1) return -1;
+        if (writen(conn_fd, file_path, sizeof(char) * path_len) == -1) return -1;
     }
-    if (write(conn_fd, (void*)&body_size, sizeof(size_t)) == -1) return -1;
+    if (write_body(conn_fd, body_size, body, checksum) == -1) return -1;
 
-    if (body_size != 0) {
-        if (write(conn_fd, body, body_size) == -1) return -1;
-    }
     return result;
 }
 
+int
+send_response(long conn_fd, response_code status, const char *status_phrase, size_t path_len, char *file_path, size_t body_size, void* body)
+{
+    return write_response(conn_fd, status, status_phrase, path_len, file_path, body_size, body, NULL);
+}
+
+int
+send_response_checksum(long conn_fd, response_code status, const char *status_phrase, size_t path_len, char *file_path, size_t body_size, void* body, uint32_t checksum)
+{
+    return write_response(conn_fd, status, status_phrase, path_len, file_path, body_size, body, &checksum);
+}
+
 response_t*
 recv_response(long conn_fd)
+{
+    return recv_response_arena(conn_fd, NULL);
+}
+
+response_t*
+recv_response_arena(long conn_fd, arena_t *arena)
 {
     if (conn_fd < 0) {
         errno = EINVAL;
         return NULL;
     }
 
-    response_t *response;
-    response = (response_t*)calloc(1, sizeof(response_t));
-    if (response == NULL) {
-        errno = ENOMEM;
-        return NULL;
-    }
+    response_t *response = message_alloc(arena, sizeof(response_t));
+    if (response == NULL) return NULL;
+    memset(response, 0, sizeof(response_t));
+    response->arena = arena;
 
-
-    if (read(conn_fd, (void*)&response->status, sizeof(response_code)) == -1) return NULL;
-    if (read(conn_fd, (void*)response->status_phrase, sizeof(char) * MAX_PATH) == -1) return NULL;           
+    if (readn(conn_fd, (void*)&response->status, sizeof(response_code)) == -1) goto _recv_error;
+    if (readn(conn_fd, (void*)response->status_phrase, sizeof(char) * MAX_PATH) == -1) goto _recv_error;           
     
     // Read file path length
-    if (read(conn_fd, (void*)&response->path_len, sizeof(size_t)) == -1) return NULL;
+    if (readn(conn_fd, (void*)&response->path_len, sizeof(size_t)) == -1) goto _recv_error;
     
     // Allocates space for file path
     if (response->path_len != 0) {
-        response->file_path = calloc(1, response->path_len);
-        if (response->file_path == NULL) {
-            free(response);
-            errno = ENOMEM;
-            return NULL;
-        }
+        response->file_path = message_alloc(arena, response->path_len);
+        if (response->file_path == NULL) goto _recv_error;
 
         // Reads file path
-        if (read(conn_fd, (void*)response->file_path, sizeof(char) * response->path_len) == -1) return NULL; 
-    }
-    if (read(conn_fd, (void*)&response->body_size, sizeof(size_t)) == -1) return NULL;
-
-    if (response->body_size != 0) {
-        response->body = calloc(1, response->body_size);
-        if (response->body == NULL) {
-            free(response);
-            errno = ENOMEM;
-            return NULL;
-        }
-
-        if (read(conn_fd, response->body, response->body_size) == -1) return NULL;
+        if (readn(conn_fd, (void*)response->file_path, sizeof(char) * response->path_len) != response->path_len) goto _recv_error; 
     }
+    if (read_body(conn_fd, arena, &response->body_size, &response->body, &response->streamed) == -1) goto _recv_error;
 
     return response;
+
+_recv_error:
+    free_response(response);
+    return NULL;
 }
 
 void
 free_response(response_t *response)
 {
     if (response != NULL) {
-        if (response->body) free(response->body);
-        if (response->file_path) free(response->file_path);
-        free(response);
+        message_free(response->arena, response->body);
+        message_free(response->arena, response->file_path);
+        message_free(response->arena, response);
     }
 }
 
+void
+stream_open(body_stream_t *stream, long conn_fd, size_t body_size)
+{
+    stream->conn_fd = conn_fd;
+    stream->left = body_size;
+    stream->frame_left = 0;
+    stream->checksum = 0;
+}
+
+int
+stream_send(body_stream_t *stream, const void *data, size_t size)
+{
+    if (size > stream->left) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (size == 0) return 0;
+
+    if (writen(stream->conn_fd, (void*)&size, sizeof(size_t)) == -1) return -1;
+    if (writen(stream->conn_fd, (void*)data, size) == -1) return -1;
+
+    if (CHK_FLAG(get_capabilities(stream->conn_fd), CAP_CHECKSUM)) stream->checksum = crc32c(stream->checksum, data, size);
+    stream->left -= size;
+    return 0;
+}
+
+int
+stream_end(body_stream_t *stream)
+{
+    if (stream->left != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    size_t end = 0;
+    if (writen(stream->conn_fd, (void*)&end, sizeof(size_t)) == -1) return -1;
+    if (CHK_FLAG(get_capabilities(stream->conn_fd), CAP_CHECKSUM)
+        && writen(stream->conn_fd, (void*)&stream->checksum, sizeof(uint32_t)) == -1) return -1;
+    return 0;
+}
+
+int
+stream_abort(body_stream_t *stream)
+{
+    size_t abort = STREAM_ABORT;
+    stream->left = 0;
+    return (writen(stream->conn_fd, (void*)&abort, sizeof(size_t)) == -1) ? -1 : 0;
+}
+
+ssize_t
+stream_recv(body_stream_t *stream, void *buffer, size_t capacity)
+{
+    if (stream->frame_left == 0) {
+
+        size_t frame_size;
+        if (readn(stream->conn_fd, (void*)&frame_size, sizeof(size_t)) != sizeof(size_t)) return -1;
+
+        if (frame_size == STREAM_ABORT) {
+            stream->left = 0;
+            errno = ECANCELED;
+            return -1;
+        }
+
+        // Last frame has no bytes, the checksum of the body follows it
+        if (frame_size == 0) {
+            if (stream->left != 0) {
+                errno = EBADMSG;
+                return -1;
+            }
+
+            uint32_t crc;
+            if (CHK_FLAG(get_capabilities(stream->conn_fd), CAP_CHECKSUM)) {
+                if (readn(stream->conn_fd, (void*)&crc, sizeof(crc)) != sizeof(crc)) return -1;
+                if (crc != stream->checksum) {
+                    errno = EBADMSG;
+                    return -1;
+                }
+            }
+            return 0;
+        }
+
+        if (frame_size > stream->left) {
+            errno = EBADMSG;
+            return -1;
+        }
+        stream->frame_left = frame_size;
+    }
+
+    size_t size = (capacity < stream->frame_left) ? capacity : stream->frame_left;
+    if (size == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (readn(stream->conn_fd, buffer, size) != size) return -1;
+
+    if (CHK_FLAG(get_capabilities(stream->conn_fd), CAP_CHECKSUM)) stream->checksum = crc32c(stream->checksum, buffer, size);
+    stream->frame_left -= size;
+    stream->left -= size;
+    return size;
+}
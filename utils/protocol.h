@@ -1,7 +1,11 @@
 #ifndef PROTOCOL_H
 #define PROTOCOL_H
 
+#include <stdint.h>
+#include <sys/types.h>
+
 #include "utilities.h"
+#include "arena.h"
 
 
 /**
@@ -21,6 +25,8 @@ typedef enum {
     LOCK_FILE           = 108,
     UNLOCK_FILE         = 109,    
     APPEND_TO_FILE      = 110,
+    STATS               = 111,
+    READ_RANGE          = 112,
 
 } request_code;
 
@@ -45,6 +51,40 @@ typedef enum {
     
 } response_code;
 
+/**
+ * Capabilities a connection may negotiate at OPEN_CONNECTION. The client
+ * sends those it wants as the body of the request, the server answers with
+ * those it accepts. Peers that send no body get none.
+ */
+#define CAP_COMPRESSION     0x1     /* large bodies may cross the socket compressed */
+#define CAP_CHECKSUM        0x2     /* bodies are followed by the CRC32C of their data */
+#define CAP_STREAMING       0x4     /* large bodies may cross the socket in frames */
+
+/**
+ * Set in the body size on the wire when the body is compressed, as a
+ * COMPRESSED_BODY_HEADER with the size of the data followed by an LZ stream
+ * of it. Receivers hand the data back decompressed.
+ * Senders set it on body sizes they pass for bodies already in this form.
+ */
+#define BODY_COMPRESSED             ((size_t)1 << (sizeof(size_t) * 8 - 1))
+#define COMPRESSED_BODY_HEADER      sizeof(uint64_t)
+
+/**
+ * Set in the body size on the wire when the body follows in frames, each
+ * its size and its bytes, ended by a frame of no bytes and by the CRC32C of
+ * the whole body if the connection negotiated CAP_CHECKSUM. A frame of
+ * STREAM_ABORT bytes ends the body early, its sender gave up on it.
+ * Streamed bodies are never compressed, receivers get the size without the
+ * body and take the frames with stream_recv.
+ */
+#define BODY_STREAMED               ((size_t)1 << (sizeof(size_t) * 8 - 2))
+#define STREAM_ABORT                SIZE_MAX
+
+/**
+ * Smallest body worth compressing on connections that negotiated it
+ */
+#define WIRE_COMPRESS_MIN   1024
+
 /**
  * The type of a request
  */
@@ -60,6 +100,10 @@ typedef struct _request_t {
     size_t          body_size;
     /* Body of the request (Nullable field) */
     void*           body;
+    /* Body follows in frames, body_size bytes of them */
+    bool            streamed;
+    /* Arena the request was received in (Nullable field) */
+    arena_t         *arena;
 
 } request_t;
 
@@ -80,13 +124,53 @@ typedef struct _response_t {
     size_t          body_size;
     /* Body of the response (Nullable field) */
     void*           body;
+    /* Body follows in frames, body_size bytes of them */
+    bool            streamed;
+    /* Arena the response was received in (Nullable field) */
+    arena_t         *arena;
 
 } response_t;
 
+/**
+ * A body sent or received in frames
+ */
+typedef struct _body_stream_t {
+
+    /* Connection the body crosses */
+    long            conn_fd;
+    /* Bytes of the body not sent or received yet */
+    size_t          left;
+    /* Bytes of the frame being received not read yet */
+    size_t          frame_left;
+    /* CRC32C of the bytes sent or received so far */
+    uint32_t        checksum;
+
+} body_stream_t;
+
 
 const char*
 get_status_message(response_code code);
 
+/**
+ * Name of a request code, NULL if unknown
+ */
+const char*
+get_request_name(request_code code);
+
+
+/**
+ * Sets the capabilities negotiated on the connection of conn_fd, in effect
+ * for the messages sent and received from now on. Returns 0 on success, -1
+ * on failure, errno is set.
+ */
+int
+set_capabilities(long conn_fd, uint32_t capabilities);
+
+/**
+ * Capabilities negotiated on the connection of conn_fd, none if unknown
+ */
+uint32_t
+get_capabilities(long conn_fd);
 
 /**
  * Sends a request on socket associated with conn_fd, returns 0 on success,
@@ -97,11 +181,20 @@ send_request(long conn_fd, request_code type, size_t path_len, const char *resou
 
 /**
  * Receives a request on socket associated with conn_fd, return the request
- * on success, NULL on failure, errno is set.
+ * on success, NULL on failure, errno is set (EBADMSG if the body does not
+ * match its checksum).
  */
 request_t*
 recv_request(long conn_fd);
 
+/**
+ * Receives a request as recv_request, the request and its fields are
+ * allocated from arena when they fit, large bodies always come from the
+ * heap. The request must be freed before arena is reset.
+ */
+request_t*
+recv_request_arena(long conn_fd, arena_t *arena);
+
 /**
  * Deallocates a requests and all of its components
  */
@@ -122,6 +215,14 @@ new_response(response_code status, char *status_phrase, size_t body_size, void*
 int
 send_response(long conn_fd, response_code status, const char *status_phrase, size_t path_len, char *file_path, size_t body_size, void* body);
 
+/**
+ * Sends a response as send_response, with checksum as the CRC32C of the
+ * data of the body instead of computing it. Bodies passed compressed need
+ * it on connections that negotiated CAP_CHECKSUM.
+ */
+int
+send_response_checksum(long conn_fd, response_code status, const char *status_phrase, size_t path_len, char *file_path, size_t body_size, void* body, uint32_t checksum);
+
 /**
  * Receives a response on socket associated with conn_fd, return the response
  * on success, NULL on failure, errno is set.
@@ -129,10 +230,57 @@ send_response(long conn_fd, response_code status, const char *status_phrase, siz
 response_t*
 recv_response(long conn_fd);
 
+/**
+ * Receives a response as recv_response, allocating it from arena as
+ * recv_request_arena does.
+ */
+response_t*
+recv_response_arena(long conn_fd, arena_t *arena);
+
 /**
  * Deallocates a response and all of its components
  */
 void
 free_response(response_t *response);
 
+/**
+ * Starts a streamed body of body_size bytes on conn_fd, sent after a message
+ * with BODY_STREAMED set in its body size and no body, or received after
+ * one came with streamed set
+ */
+void
+stream_open(body_stream_t *stream, long conn_fd, size_t body_size);
+
+/**
+ * Sends size bytes of data as the next frame of stream, returns 0 on
+ * success, -1 on failure, errno is set (EINVAL if they exceed the body).
+ */
+int
+stream_send(body_stream_t *stream, const void *data, size_t size);
+
+/**
+ * Ends stream once all of its bytes were sent, returns 0 on success, -1 on
+ * failure, errno is set (EINVAL if bytes are missing).
+ */
+int
+stream_end(body_stream_t *stream);
+
+/**
+ * Ends stream before all of its bytes were sent, receivers get ECANCELED.
+ * Returns 0 on success, -1 on failure, errno is set.
+ */
+int
+stream_abort(body_stream_t *stream);
+
+/**
+ * Receives up to capacity bytes of stream into buffer, never more than what
+ * is left of the frame being received.
+ * Returns the bytes received, 0 once the body ended and matched its
+ * checksum, -1 on failure, errno is set (ECANCELED if the sender aborted the
+ * body, EBADMSG if frames do not add up to the body or it does not match
+ * its checksum).
+ */
+ssize_t
+stream_recv(body_stream_t *stream, void *buffer, size_t capacity);
+
 #endif
@@ -0,0 +1,19 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_DIGEST_SIZE  32
+
+/**
+ * \brief Computes the SHA-256 digest of size bytes of data
+ *
+ * \param data: data to hash
+ * \param size: bytes of data
+ * \param digest: where the SHA256_DIGEST_SIZE bytes of the digest are written
+ */
+void
+sha256(const void *data, size_t size, uint8_t digest[SHA256_DIGEST_SIZE]);
+
+#endif
@@ -92,6 +92,23 @@ mkdir_p(const char *path)
     return 0;
 }
  
+ssize_t  /* Read "n" bytes from a descriptor */
+readn(int fd, void *ptr, size_t n) {  
+   size_t   nleft;
+   ssize_t  nread;
+ 
+   nleft = n;
+   while (nleft > 0) {
+     if((nread = read(fd, ptr, nleft)) < 0) {
+        if (nleft == n) return -1; /* error, return -1 */
+        else break; /* error, return amount read so far */
+     } else if (nread == 0) break; /* EOF */
+     nleft -= nread;
+     ptr   += nread;
+   }
+   return(n - nleft); /* return >= 0 */
+}
+ 
 ssize_t  /* Write "n" bytes to a descriptor */
 writen(int fd, void *ptr, size_t n) {  
    size_t   nleft;